@@ -0,0 +1,394 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file
+ *
+ * Copying whole trees as one archive streamed to or from `tar` on the
+ * server.
+ *
+ * Over SFTP every file costs at least an open, a write and a close, each a
+ * round trip, so a tree of thousands of small files spends most of its time
+ * waiting on the network.  An archive is one stream however many files it
+ * holds.
+ */
+
+#ifndef SSH_ARCHIVE_HPP
+#define SSH_ARCHIVE_HPP
+
+#include <ssh/command.hpp>
+#include <ssh/detail/local_path.hpp> // local_name, utf8_name
+#include <ssh/detail/shell_quote.hpp>
+#include <ssh/detail/tar.hpp>
+#include <ssh/filesystem/path.hpp>
+#include <ssh/session.hpp>
+
+#include <boost/cstdint.hpp> // uintmax_t, uint64_t
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/function.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+#include <ctime>    // time_t
+#include <exception>
+#include <ios>      // ios_base
+#include <iterator> // istreambuf_iterator
+#include <string>
+#include <utility> // pair
+#include <vector>
+
+namespace ssh
+{
+namespace filesystem
+{
+
+struct archive_statistics
+{
+    archive_statistics() : files(0), directories(0), bytes(0), skipped(0)
+    {
+    }
+
+    boost::uintmax_t files;
+    boost::uintmax_t directories;
+
+    /**
+     * Bytes of file data, not counting the archive's own overhead.
+     */
+    boost::uintmax_t bytes;
+
+    /**
+     * Links, devices and anything else that isn't a file or directory,
+     * which are left out.
+     */
+    boost::uintmax_t skipped;
+};
+
+/**
+ * Told the local path of each file as it is finished with and the running
+ * total of file data copied.
+ *
+ * May throw to cancel the copy.
+ */
+typedef boost::function<void(const boost::filesystem::path&,
+                             boost::uintmax_t)> archive_progress;
+
+namespace archive_detail
+{
+
+inline boost::uint64_t archive_time(std::time_t time)
+{
+    return (time < 0) ? 0 : static_cast<boost::uint64_t>(time);
+}
+
+/**
+ * The archive name as a path relative to the root of the copy, without the
+ * `./` that `tar -C dir .` puts in front or any trailing `/`.
+ *
+ * @returns an empty string for the root itself.
+ * @throws if the name would land outside the root, which a well-behaved
+ *         `tar` never produces.
+ */
+inline std::string relative_name(const std::string& archive_name)
+{
+    std::string name = archive_name;
+    while (name.compare(0, 2, "./") == 0)
+        name.erase(0, 2);
+    while (!name.empty() && name[name.size() - 1] == '/')
+        name.erase(name.size() - 1);
+    if (name == ".")
+        name.clear();
+
+    bool escapes = !name.empty() && name[0] == '/';
+    std::string::size_type start = 0;
+    while (!escapes && start <= name.size() && !name.empty())
+    {
+        std::string::size_type end = name.find('/', start);
+        if (end == std::string::npos)
+            end = name.size();
+
+        escapes = name.compare(start, end - start, "..") == 0;
+        start = end + 1;
+    }
+
+    if (escapes)
+    {
+        BOOST_THROW_EXCEPTION(boost::system::system_error(
+            boost::system::errc::make_error_code(
+                boost::system::errc::bad_message),
+            "Archive entry outside the destination: " + archive_name));
+    }
+
+    return name;
+}
+
+/**
+ * Throw, with whatever the command said about it, if the command failed.
+ *
+ * Waits for the command to finish.
+ */
+inline void throw_if_failed(remote_command& command,
+                            const std::string& message)
+{
+    // Before the exit status, which throws away unread error output
+    std::string errors((std::istreambuf_iterator<char>(command.errors())),
+                       std::istreambuf_iterator<char>());
+
+    if (command.exit_status() != 0 || !command.exit_signal().empty())
+    {
+        while (!errors.empty() && errors[errors.size() - 1] == '\n')
+            errors.erase(errors.size() - 1);
+
+        BOOST_THROW_EXCEPTION(boost::system::system_error(
+            boost::system::errc::make_error_code(
+                boost::system::errc::io_error),
+            errors.empty() ? message : message + ": " + errors));
+    }
+}
+
+inline void archive_directory(::ssh::detail::tar::writer& archive,
+                              const boost::filesystem::path& directory,
+                              const std::string& archive_prefix,
+                              archive_statistics& statistics,
+                              archive_progress& progress)
+{
+    for (boost::filesystem::directory_iterator it(directory), end; it != end;
+         ++it)
+    {
+        const boost::filesystem::path& local = it->path();
+        std::string name =
+            archive_prefix + ::ssh::detail::utf8_name(local.filename());
+
+        // Not following links, so a link to a parent can't send us round
+        // in circles
+        boost::filesystem::file_status status = it->symlink_status();
+        if (boost::filesystem::is_directory(status))
+        {
+            archive.add_directory(
+                name, 0755,
+                archive_time(boost::filesystem::last_write_time(local)));
+            ++statistics.directories;
+
+            archive_directory(archive, local, name + "/", statistics,
+                              progress);
+        }
+        else if (boost::filesystem::is_regular_file(status))
+        {
+            ::ssh::detail::tar::entry file;
+            file.name = name;
+            file.size = boost::filesystem::file_size(local);
+            file.mtime =
+                archive_time(boost::filesystem::last_write_time(local));
+
+            boost::filesystem::ifstream data(
+                local, std::ios_base::in | std::ios_base::binary);
+            if (!data)
+            {
+                BOOST_THROW_EXCEPTION(boost::system::system_error(
+                    boost::system::errc::make_error_code(
+                        boost::system::errc::no_such_file_or_directory),
+                    "Failed to open " + local.string()));
+            }
+
+            archive.add_file(file, data);
+            ++statistics.files;
+            statistics.bytes += file.size;
+
+            if (progress)
+                progress(local, statistics.bytes);
+        }
+        else
+        {
+            ++statistics.skipped;
+        }
+    }
+}
+
+inline void extract_file(::ssh::detail::tar::reader& archive,
+                         const boost::filesystem::path& target)
+{
+    boost::filesystem::ofstream file(target, std::ios_base::out |
+                                                 std::ios_base::trunc |
+                                                 std::ios_base::binary);
+
+    char buffer[32 * 1024];
+    std::size_t count;
+    while (file && (count = archive.read(buffer, sizeof(buffer))) > 0)
+        file.write(buffer, static_cast<std::streamsize>(count));
+
+    file.close();
+    if (!file)
+    {
+        BOOST_THROW_EXCEPTION(boost::system::system_error(
+            boost::system::errc::make_error_code(
+                boost::system::errc::io_error),
+            "Failed to write " + target.string()));
+    }
+}
+}
+
+/**
+ * Whether the server can run `tar` for `upload_tree` and `download_tree`.
+ *
+ * Servers that give no shell access, or whose shell isn't a POSIX one, such
+ * as Windows servers, can't.  Use SFTP for those.
+ */
+inline bool can_exchange_archives(session& session)
+{
+    try
+    {
+        remote_command probe =
+            session.exec("command -v tar > /dev/null 2>&1");
+        return probe.exit_status() == 0 && probe.exit_signal().empty();
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+}
+
+/**
+ * Copy the contents of a local directory into a directory on the server,
+ * creating the directory if need be.
+ *
+ * The tree is archived as it is read and piped to `tar -x` on the server,
+ * so nothing is held in memory or written to a temporary file.  Files the
+ * server already has are replaced.  Modification times are kept; modes are
+ * the server's defaults.
+ *
+ * Only files and directories are copied.  Links aren't followed.
+ *
+ * If the copy fails part-way, whatever the server unpacked by then stays.
+ *
+ * @throws `boost::system::system_error` with the server's message if `tar`
+ *         fails, or whatever `progress` threw.
+ */
+inline archive_statistics
+upload_tree(session& session, const boost::filesystem::path& local_directory,
+            const path& remote_directory,
+            archive_progress progress = archive_progress())
+{
+    std::string target = ::ssh::detail::shell_quote(remote_directory.native());
+    remote_command tar =
+        session.exec("mkdir -p " + target + " && tar -x -f - -C " + target);
+
+    archive_statistics statistics;
+    try
+    {
+        ::ssh::detail::tar::writer archive(tar.io());
+        archive_detail::archive_directory(archive, local_directory,
+                                          std::string(), statistics,
+                                          progress);
+        archive.finish();
+    }
+    catch (...)
+    {
+        // Writing fails once tar has given up, and what it says is far
+        // more use than that
+        if (tar.io().bad())
+            archive_detail::throw_if_failed(
+                tar, "Unable to unpack on the server");
+        throw;
+    }
+
+    tar.close_input();
+    archive_detail::throw_if_failed(tar, "Unable to unpack on the server");
+
+    return statistics;
+}
+
+/**
+ * Copy the contents of a directory on the server into a local directory,
+ * creating the local directory if need be.
+ *
+ * The server's `tar -c` streams the tree, which is unpacked as it arrives.
+ * Local files are replaced.  Modification times are kept.
+ *
+ * Only files and directories are copied.  Links and anything else are
+ * skipped.
+ *
+ * @throws `boost::system::system_error` with the server's message if `tar`
+ *         fails, or whatever `progress` threw.
+ */
+inline archive_statistics
+download_tree(session& session, const path& remote_directory,
+              const boost::filesystem::path& local_directory,
+              archive_progress progress = archive_progress())
+{
+    std::string source = ::ssh::detail::shell_quote(remote_directory.native());
+    remote_command tar = session.exec("tar -c -f - -C " + source + " .");
+
+    boost::filesystem::create_directories(local_directory);
+
+    archive_statistics statistics;
+    std::vector<std::pair<boost::filesystem::path, std::time_t>> directories;
+
+    ::ssh::detail::tar::reader archive(tar.io());
+    ::ssh::detail::tar::entry entry;
+    while (archive.next(entry))
+    {
+        std::string name = archive_detail::relative_name(entry.name);
+        if (name.empty())
+            continue;
+
+        boost::filesystem::path target =
+            local_directory / ::ssh::detail::local_name(name);
+
+        if (entry.type == ::ssh::detail::tar::entry_type::directory)
+        {
+            boost::filesystem::create_directories(target);
+            directories.push_back(
+                std::make_pair(target, static_cast<std::time_t>(entry.mtime)));
+            ++statistics.directories;
+        }
+        else if (entry.type == ::ssh::detail::tar::entry_type::file)
+        {
+            archive_detail::extract_file(archive, target);
+            boost::filesystem::last_write_time(
+                target, static_cast<std::time_t>(entry.mtime));
+            ++statistics.files;
+            statistics.bytes += entry.size;
+
+            if (progress)
+                progress(target, statistics.bytes);
+        }
+        else
+        {
+            ++statistics.skipped;
+        }
+    }
+
+    archive_detail::throw_if_failed(tar, "Unable to archive on the server");
+
+    // Last, and deepest first, as adding to a directory changes its time.
+    // Not every filesystem lets a directory's time be set, which isn't
+    // worth failing the copy over.
+    for (std::vector<std::pair<boost::filesystem::path,
+                               std::time_t>>::reverse_iterator it =
+             directories.rbegin();
+         it != directories.rend(); ++it)
+    {
+        boost::system::error_code ignored;
+        boost::filesystem::last_write_time(it->first, it->second, ignored);
+    }
+
+    return statistics;
+}
+}
+} // namespace ssh::filesystem
+
+#endif
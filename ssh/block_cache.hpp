@@ -0,0 +1,268 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file
+ *
+ * Remote file blocks kept in memory.
+ *
+ * Shell property handlers and preview panes read the start of a file, then
+ * its end, then its start again, often through several streams one after
+ * the other.  Without a cache each of those reads is another trip to the
+ * server.
+ */
+
+#ifndef SSH_BLOCK_CACHE_HPP
+#define SSH_BLOCK_CACHE_HPP
+
+#include <boost/cstdint.hpp> // uint64_t, uintmax_t
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+#include <cstddef> // size_t
+#include <list>
+#include <map>
+#include <stdexcept> // invalid_argument
+#include <string>
+#include <utility> // make_pair
+#include <vector>
+
+namespace ssh
+{
+namespace filesystem
+{
+
+/**
+ * Identifies one block of one version of a remote file.
+ *
+ * The version is the file's size and modification time when it was opened,
+ * so a file changed on the server never gets blocks of its old contents.
+ */
+struct block_id
+{
+    block_id(const std::string& file, boost::uint64_t size,
+             boost::uint64_t modified, boost::uint64_t index)
+        : file(file), size(size), modified(modified), index(index)
+    {
+    }
+
+    std::string file;
+    boost::uint64_t size;
+    boost::uint64_t modified;
+    boost::uint64_t index;
+};
+
+inline bool operator<(const block_id& lhs, const block_id& rhs)
+{
+    if (lhs.file != rhs.file)
+        return lhs.file < rhs.file;
+    if (lhs.size != rhs.size)
+        return lhs.size < rhs.size;
+    if (lhs.modified != rhs.modified)
+        return lhs.modified < rhs.modified;
+    return lhs.index < rhs.index;
+}
+
+struct block_cache_statistics
+{
+    block_cache_statistics()
+        : hits(0), misses(0), read_ahead(0), evictions(0), bytes(0)
+    {
+    }
+
+    /** Blocks found in the cache. */
+    boost::uintmax_t hits;
+
+    /** Blocks that had to be fetched from the server. */
+    boost::uintmax_t misses;
+
+    /** Blocks fetched before they were asked for. */
+    boost::uintmax_t read_ahead;
+
+    /** Blocks dropped to stay within the memory budget. */
+    boost::uintmax_t evictions;
+
+    /** Memory used by the blocks currently held. */
+    std::size_t bytes;
+};
+
+/**
+ * Least-recently-used cache of remote file blocks within a memory budget.
+ *
+ * Safe to use from several threads at once.  Blocks are handed out as
+ * shared pointers, so a block evicted while someone is copying out of it
+ * stays alive until they are done.
+ */
+class block_cache : private boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<const std::vector<char>> block_pointer;
+
+    static const std::size_t default_budget = 8 * 1024 * 1024;
+    static const std::size_t default_block_size = 32 * 1024;
+
+    /**
+     * Blocks fetched at once, at most, when a file is being read in order.
+     */
+    static const std::size_t default_max_read_ahead = 32;
+
+    explicit block_cache(std::size_t budget = default_budget,
+                         std::size_t block_size = default_block_size,
+                         std::size_t max_read_ahead = default_max_read_ahead)
+        : m_budget(budget),
+          m_block_size(block_size),
+          m_max_read_ahead(max_read_ahead)
+    {
+        if (block_size == 0 || max_read_ahead == 0)
+        {
+            BOOST_THROW_EXCEPTION(std::invalid_argument(
+                "Block size and read-ahead must be at least one"));
+        }
+    }
+
+    std::size_t budget() const
+    {
+        return m_budget;
+    }
+
+    std::size_t block_size() const
+    {
+        return m_block_size;
+    }
+
+    std::size_t max_read_ahead() const
+    {
+        return m_max_read_ahead;
+    }
+
+    /**
+     * The block if it is cached, otherwise null.
+     *
+     * Counts as a use of the block for the purposes of eviction.
+     */
+    block_pointer find(const block_id& id)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        block_map::iterator entry = m_blocks.find(id);
+        if (entry == m_blocks.end())
+        {
+            ++m_statistics.misses;
+            return block_pointer();
+        }
+
+        ++m_statistics.hits;
+        m_recency.splice(m_recency.begin(), m_recency,
+                         entry->second.recency);
+        return entry->second.block;
+    }
+
+    /**
+     * Add a block, replacing any already held for the same id.
+     *
+     * @param read_ahead  Whether the block was fetched before it was asked
+     *                    for.
+     */
+    void insert(const block_id& id, block_pointer block, bool read_ahead)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        erase(m_blocks.find(id));
+
+        m_recency.push_front(id);
+        cache_entry entry = {block, m_recency.begin()};
+        m_blocks.insert(std::make_pair(id, entry));
+        m_statistics.bytes += block->size();
+
+        if (read_ahead)
+            ++m_statistics.read_ahead;
+
+        while (m_statistics.bytes > m_budget && !m_recency.empty())
+        {
+            erase(m_blocks.find(m_recency.back()));
+            ++m_statistics.evictions;
+        }
+    }
+
+    /**
+     * Drop every block of the file, whatever its version, and of any file
+     * beneath it if it is a directory.
+     */
+    void invalidate(const std::string& file)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        block_map::iterator entry =
+            m_blocks.lower_bound(block_id(file, 0, 0, 0));
+        while (entry != m_blocks.end() && entry->first.file == file)
+        {
+            erase(entry++);
+        }
+
+        // Files beneath a directory needn't sort next to it ("dir-x" comes
+        // between "dir" and "dir/x") so look for them separately
+        std::string prefix = file;
+        if (prefix.empty() || prefix[prefix.size() - 1] != '/')
+            prefix += '/';
+        entry = m_blocks.lower_bound(block_id(prefix, 0, 0, 0));
+        while (entry != m_blocks.end() &&
+               entry->first.file.compare(0, prefix.size(), prefix) == 0)
+        {
+            erase(entry++);
+        }
+    }
+
+    block_cache_statistics statistics() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_statistics;
+    }
+
+private:
+    typedef std::list<block_id> recency_list;
+
+    struct cache_entry
+    {
+        block_pointer block;
+        recency_list::iterator recency;
+    };
+
+    typedef std::map<block_id, cache_entry> block_map;
+
+    void erase(block_map::iterator entry)
+    {
+        if (entry == m_blocks.end())
+            return;
+
+        m_statistics.bytes -= entry->second.block->size();
+        m_recency.erase(entry->second.recency);
+        m_blocks.erase(entry);
+    }
+
+    const std::size_t m_budget;
+    const std::size_t m_block_size;
+    const std::size_t m_max_read_ahead;
+
+    mutable boost::mutex m_mutex;
+    block_map m_blocks;
+    recency_list m_recency; ///< Most recently used first
+    block_cache_statistics m_statistics;
+};
+}
+} // namespace ssh::filesystem
+
+#endif
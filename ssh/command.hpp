@@ -0,0 +1,273 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_COMMAND_HPP
+#define SSH_COMMAND_HPP
+
+#include <ssh/detail/command_state.hpp>
+#include <ssh/detail/session_state.hpp>
+
+#include <boost/iostreams/categories.hpp> // bidirectional_device_tag, ...
+#include <boost/iostreams/stream.hpp>
+#include <boost/move/move.hpp> // BOOST_RV_REF, BOOST_MOVABLE_BUT_NOT_COPYABLE
+#include <boost/noncopyable.hpp>
+
+#include <ios>    // streamsize, ios_base
+#include <istream>
+#include <memory> // auto_ptr
+#include <string>
+
+namespace ssh
+{
+
+class session;
+
+namespace detail
+{
+
+/**
+ * The command's input and output as one device.
+ *
+ * Closing the output side tells the command there is no more input.
+ */
+class command_device
+{
+public:
+    typedef char char_type;
+
+    struct category : boost::iostreams::bidirectional_device_tag,
+                      boost::iostreams::closable_tag,
+                      boost::iostreams::optimally_buffered_tag
+    {
+    };
+
+    explicit command_device(command_state& state) : m_state(&state)
+    {
+    }
+
+    // Bigger than the stream's default so that bulk data, such as an archive
+    // piped to `tar`, goes to the channel in packet-sized writes
+    std::streamsize optimal_buffer_size() const
+    {
+        return 32 * 1024;
+    }
+
+    std::streamsize read(char* buffer, std::streamsize size)
+    {
+        return m_state->read(0, buffer, size);
+    }
+
+    std::streamsize write(const char* data, std::streamsize size)
+    {
+        return m_state->write(data, size);
+    }
+
+    void close(std::ios_base::openmode which)
+    {
+        if (which == std::ios_base::out)
+            m_state->close_input();
+    }
+
+private:
+    command_state* m_state;
+};
+
+/**
+ * The command's error output.
+ */
+class command_error_source
+{
+public:
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+
+    explicit command_error_source(command_state& state) : m_state(&state)
+    {
+    }
+
+    std::streamsize read(char* buffer, std::streamsize size)
+    {
+        return m_state->read(1, buffer, size);
+    }
+
+private:
+    command_state* m_state;
+};
+}
+
+/**
+ * A command running on the server.
+ *
+ * Commands are non-copyable.  The command's channel is closed when the
+ * object is destroyed, whether or not the command has finished.
+ *
+ * Any number of commands can run at once on one session, alongside its
+ * SFTP connections, and each can be used from its own thread.
+ *
+ * As with local pipes, a command that writes a lot to one output while the
+ * caller is only reading the other stalls once the unread output fills
+ * the channel's window.  Read the error output as you go, or make the
+ * command redirect it, if it may be large.
+ */
+class remote_command : private boost::noncopyable
+{
+    BOOST_MOVABLE_BUT_NOT_COPYABLE(remote_command)
+
+public:
+    /**
+     * Move constructor.
+     */
+    remote_command(BOOST_RV_REF(remote_command) other)
+        : m_state(boost::move(other.m_state)),
+          m_io(boost::move(other.m_io)),
+          m_errors(boost::move(other.m_errors))
+    {
+    }
+
+    /**
+     * Move-assignment.
+     */
+    remote_command& operator=(BOOST_RV_REF(remote_command) other)
+    {
+        // Streams first as they refer to the state
+        m_errors = boost::move(other.m_errors);
+        m_io = boost::move(other.m_io);
+        m_state = boost::move(other.m_state);
+        return *this;
+    }
+
+    /**
+     * Stream writing to the command's input and reading its output.
+     */
+    std::iostream& io()
+    {
+        return *m_io;
+    }
+
+    /**
+     * Stream reading the command's error output.
+     */
+    std::istream& errors()
+    {
+        return *m_errors;
+    }
+
+    /**
+     * Send anything still buffered for the command's input and tell it there
+     * is no more to come.
+     *
+     * Commands that read their input to the end, such as `cat` or `tar x`,
+     * only finish once this is called.
+     */
+    void close_input()
+    {
+        send_buffered_input();
+        m_state->close_input();
+    }
+
+    /**
+     * Wait for the command to finish and return its exit status.
+     *
+     * Closes the command's input first.  Any output and error output not yet
+     * read is thrown away.
+     *
+     * A command killed by a signal has no exit status; this returns zero and
+     * `exit_signal` names the signal.
+     */
+    int exit_status()
+    {
+        finish();
+        return m_state->exit_status();
+    }
+
+    /**
+     * Wait for the command to finish and return the name of the signal that
+     * killed it, without the "SIG" prefix, or an empty string if it exited
+     * normally.
+     */
+    std::string exit_signal()
+    {
+        finish();
+        return m_state->exit_signal();
+    }
+
+    /// @cond INTERNAL
+    /**
+     * Defines the single permitted factory of `remote_command` instances.
+     * This class calls the private constructor on behalf of the factory.
+     * See http://stackoverflow.com/q/3217390/67013.
+     */
+    class factory_attorney
+    {
+    private:
+        friend class ssh::session;
+
+        remote_command operator()(::ssh::detail::session_state& session_state,
+                                  const std::string& command)
+        {
+            return remote_command(session_state, command);
+        }
+    };
+    /// @endcond
+
+private:
+    friend class factory_attorney;
+
+    typedef boost::iostreams::stream<detail::command_device> io_stream;
+    typedef boost::iostreams::stream<detail::command_error_source>
+        error_stream;
+
+    remote_command(::ssh::detail::session_state& session_state,
+                   const std::string& command)
+        : m_state(new detail::command_state(session_state, command)),
+          m_io(new io_stream(detail::command_device(*m_state))),
+          m_errors(new error_stream(detail::command_error_source(*m_state)))
+    {
+    }
+
+    // Not using the stream's flush(), which does nothing once the output has
+    // been read to the end and the stream's eofbit is set
+    void send_buffered_input()
+    {
+        if (m_io->is_open())
+            m_io->rdbuf()->pubsync();
+    }
+
+    void finish()
+    {
+        send_buffered_input();
+        m_state->finish();
+    }
+
+    // Held by pointer, like sftp_filesystem's state, so the streams' devices
+    // keep pointing at the right state when the command is moved.  Declared
+    // before the streams so they are destroyed first.
+    std::auto_ptr<detail::command_state> m_state;
+    std::auto_ptr<io_stream> m_io;
+    std::auto_ptr<error_stream> m_errors;
+};
+
+// Only needed for C++03 support with Boost move-emulation because C++11
+// std::swap does this type of swap already
+inline void swap(remote_command& lhs, remote_command& rhs)
+{
+    remote_command tmp(boost::move(lhs));
+    lhs = boost::move(rhs);
+    rhs = boost::move(tmp);
+}
+
+} // namespace ssh
+
+#endif
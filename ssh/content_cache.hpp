@@ -0,0 +1,589 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file
+ *
+ * Local copies of remote files that outlive the connection.
+ *
+ * Explorer and Office open the same remote file over and over: for a
+ * preview, for a thumbnail, then for each round of an edit.  The block
+ * cache only helps while the session lasts and only within its memory
+ * budget.  This cache keeps whole files on local disk, so reopening one
+ * costs a single stat to check the copy is still current.
+ *
+ * Swish's provider uses it, through `cached_copy`, for files opened only
+ * for reading.
+ */
+
+#ifndef SSH_CONTENT_CACHE_HPP
+#define SSH_CONTENT_CACHE_HPP
+
+#include <ssh/filesystem.hpp>      // sftp_filesystem, status
+#include <ssh/filesystem/path.hpp> // path
+#include <ssh/stream.hpp>          // ifstream
+
+#include <boost/cstdint.hpp> // uint64_t, uintmax_t
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/optional/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+#include <algorithm> // sort
+#include <ctime>     // time, time_t
+#include <iomanip>   // setfill, setw
+#include <istream>
+#include <iterator>  // istreambuf_iterator
+#include <sstream>   // ostringstream
+#include <stdexcept> // runtime_error
+#include <string>
+#include <utility> // make_pair, pair
+#include <vector>
+
+namespace ssh
+{
+namespace filesystem
+{
+
+struct content_cache_statistics
+{
+    content_cache_statistics() : hits(0), misses(0), evictions(0), bytes(0)
+    {
+    }
+
+    /** Files served from a local copy. */
+    boost::uintmax_t hits;
+
+    /** Files with no local copy of the version on the server. */
+    boost::uintmax_t misses;
+
+    /** Copies deleted to stay within the disk budget. */
+    boost::uintmax_t evictions;
+
+    /** Disk used by the copies held, as of the last time it was counted. */
+    boost::uintmax_t bytes;
+};
+
+/**
+ * A local copy from the cache, held open so that it can't be lost while it
+ * is read.
+ *
+ * The cache may delete the copy at any time to stay within budget, as may
+ * another process sharing the directory.  Windows won't delete a file that
+ * is open, and elsewhere a deleted file lives on until it is closed, so the
+ * stream reads the whole copy for as long as this object, or a copy of it,
+ * lasts.  The path may stop naming it sooner.
+ */
+class content_copy
+{
+public:
+    explicit content_copy(const boost::filesystem::path& file)
+        : m_file(file),
+          m_stream(boost::make_shared<boost::filesystem::ifstream>(
+              file, std::ios_base::in | std::ios_base::binary))
+    {
+    }
+
+    const boost::filesystem::path& file() const
+    {
+        return m_file;
+    }
+
+    std::istream& stream() const
+    {
+        return *m_stream;
+    }
+
+    bool is_open() const
+    {
+        return m_stream->is_open();
+    }
+
+private:
+    boost::filesystem::path m_file;
+    boost::shared_ptr<boost::filesystem::ifstream> m_stream;
+};
+
+/**
+ * Whole remote files kept in a local directory within a disk budget.
+ *
+ * A copy is identified by where the file came from (the connection as
+ * given by the caller, such as `user@host:port`, plus the remote path) and
+ * by the file's size and modification time.  A file changed on the server
+ * therefore never matches the copy of its old contents.
+ *
+ * Copies are named after a hash of where they came from, so beside each
+ * copy is a file holding the origin and path in full.  A copy is only used
+ * for the file named there, so two files whose names hash the same can't
+ * be mistaken for each other.
+ *
+ * Copies are written under a temporary name and renamed into place, so
+ * neither a crash part way through nor another process sharing the
+ * directory ever sees half a file.  Once over budget, the least recently
+ * used copies are deleted first.
+ */
+class content_cache : private boost::noncopyable
+{
+public:
+    static const boost::uintmax_t default_budget = 256 * 1024 * 1024;
+
+    explicit content_cache(const boost::filesystem::path& directory,
+                           boost::uintmax_t budget = default_budget)
+        : m_directory(directory), m_budget(budget)
+    {
+        boost::filesystem::create_directories(m_directory);
+
+        boost::mutex::scoped_lock lock(m_mutex);
+        evict(boost::filesystem::path());
+    }
+
+    const boost::filesystem::path& directory() const
+    {
+        return m_directory;
+    }
+
+    boost::uintmax_t budget() const
+    {
+        return m_budget;
+    }
+
+    /**
+     * The local copy of this version of the file, opened, if there is one.
+     *
+     * Counts as a use of the copy for the purposes of eviction.
+     */
+    boost::optional<content_copy>
+    find(const std::string& origin, const std::string& remote_file,
+         boost::uint64_t size, std::time_t modified)
+    {
+        // Opened under the lock so that our own eviction can't slip in
+        // between finding the copy and opening it
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        content_copy copy(
+            local_path(copy_name(origin, remote_file, size, modified)));
+        if (!copy.is_open() || !is_copy_of(copy.file(), origin, remote_file))
+        {
+            ++m_statistics.misses;
+            return boost::none;
+        }
+
+        boost::system::error_code ec;
+        boost::filesystem::last_write_time(copy.file(), std::time(NULL), ec);
+
+        ++m_statistics.hits;
+        return copy;
+    }
+
+    /**
+     * Keep `content` as the copy of this version of the file, and open it.
+     *
+     * Copies of other versions of the file are deleted.
+     *
+     * @throws std::runtime_error if `content` isn't `size` bytes long, which
+     *         happens when the file changes while being read.  Nothing is
+     *         kept in that case.
+     */
+    content_copy insert(const std::string& origin,
+                        const std::string& remote_file, boost::uint64_t size,
+                        std::time_t modified, std::istream& content)
+    {
+        std::string name = copy_name(origin, remote_file, size, modified);
+        boost::filesystem::path copy = local_path(name);
+        boost::filesystem::path partial = local_path(
+            name + partial_marker() +
+            boost::filesystem::unique_path().string());
+        boost::filesystem::path partial_origin = origin_file(partial);
+
+        try
+        {
+            {
+                boost::filesystem::ofstream file(
+                    partial_origin,
+                    std::ios_base::out | std::ios_base::binary);
+                std::string identity = origin_identity(origin, remote_file);
+                if (!file.write(identity.data(), identity.size()).flush())
+                {
+                    BOOST_THROW_EXCEPTION(std::runtime_error(
+                        "Unable to record origin in content cache"));
+                }
+            }
+
+            boost::uint64_t written = 0;
+            {
+                boost::filesystem::ofstream file(
+                    partial, std::ios_base::out | std::ios_base::binary);
+
+                std::vector<char> buffer(detail::DEFAULT_BUFFER_SIZE);
+                while (content.read(&buffer[0], buffer.size()) ||
+                       content.gcount() > 0)
+                {
+                    file.write(&buffer[0], content.gcount());
+                    written += content.gcount();
+                }
+
+                if (content.bad() || !file.flush())
+                {
+                    BOOST_THROW_EXCEPTION(std::runtime_error(
+                        "Unable to copy file into content cache"));
+                }
+            }
+
+            if (written != size)
+            {
+                BOOST_THROW_EXCEPTION(std::runtime_error(
+                    "File changed while being copied into content cache"));
+            }
+        }
+        catch (...)
+        {
+            boost::system::error_code ec;
+            boost::filesystem::remove(partial, ec);
+            boost::filesystem::remove(partial_origin, ec);
+            throw;
+        }
+
+        // Renamed and opened under the lock so that our own eviction can't
+        // delete the copy before we have it open
+        boost::mutex::scoped_lock lock(m_mutex);
+
+        // A copy of a different file whose name hashes the same gives way.
+        // Its origin is replaced before the copy so that a crash in between
+        // can only leave a copy that doesn't match its origin, which is
+        // never used.
+        if (boost::filesystem::exists(copy) &&
+            !is_copy_of(copy, origin, remote_file))
+        {
+            remove_copy(copy);
+        }
+
+        boost::system::error_code rename_error;
+        boost::filesystem::rename(partial_origin, origin_file(copy),
+                                  rename_error);
+        if (!rename_error)
+        {
+            boost::filesystem::rename(partial, copy, rename_error);
+        }
+
+        if (rename_error)
+        {
+            // Usually someone else kept the same version first and has it
+            // open, which is as good as ours
+            boost::system::error_code ec;
+            boost::filesystem::remove(partial, ec);
+            boost::filesystem::remove(partial_origin, ec);
+        }
+
+        content_copy kept(copy);
+        if (!kept.is_open() || !is_copy_of(copy, origin, remote_file))
+        {
+            BOOST_THROW_EXCEPTION(boost::filesystem::filesystem_error(
+                "Unable to keep file in content cache", partial, copy,
+                rename_error));
+        }
+
+        remove_versions(origin, remote_file, copy);
+        evict(copy);
+
+        return kept;
+    }
+
+    /**
+     * Delete every copy of the file, whatever its version.
+     */
+    void invalidate(const std::string& origin, const std::string& remote_file)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        remove_versions(origin, remote_file, boost::filesystem::path());
+    }
+
+    content_cache_statistics statistics() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_statistics;
+    }
+
+private:
+    static const char* partial_marker()
+    {
+        return ".partial-";
+    }
+
+    static const char* origin_suffix()
+    {
+        return ".origin";
+    }
+
+    /**
+     * The file beside a copy that says where the copy came from.
+     */
+    static boost::filesystem::path
+    origin_file(const boost::filesystem::path& copy)
+    {
+        return copy.string() + origin_suffix();
+    }
+
+    static bool is_origin_file(const boost::filesystem::path& file)
+    {
+        std::string name = file.filename().string();
+        std::string suffix = origin_suffix();
+        return name.size() >= suffix.size() &&
+               name.compare(name.size() - suffix.size(), suffix.size(),
+                            suffix) == 0;
+    }
+
+    static std::string origin_identity(const std::string& origin,
+                                       const std::string& remote_file)
+    {
+        return origin + '\0' + remote_file;
+    }
+
+    /**
+     * Whether the copy is of the given file, as opposed to another whose
+     * name hashes the same.
+     *
+     * A copy whose origin can't be read is of no file.
+     */
+    static bool is_copy_of(const boost::filesystem::path& copy,
+                           const std::string& origin,
+                           const std::string& remote_file)
+    {
+        boost::filesystem::ifstream file(
+            origin_file(copy), std::ios_base::in | std::ios_base::binary);
+        if (!file.is_open())
+            return false;
+
+        std::string identity((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+        return !file.bad() &&
+               identity == origin_identity(origin, remote_file);
+    }
+
+    /**
+     * Delete a copy and the record of its origin.
+     *
+     * @returns whether the copy was deleted.
+     */
+    static bool remove_copy(const boost::filesystem::path& copy)
+    {
+        boost::system::error_code ec;
+        bool removed = boost::filesystem::remove(copy, ec);
+        if (!ec)
+            boost::filesystem::remove(origin_file(copy), ec);
+
+        return removed;
+    }
+
+    /**
+     * Hash of where the file came from.
+     *
+     * 64-bit FNV-1a: stable across runs and platforms, which the standard
+     * library's hash needn't be.
+     */
+    static std::string origin_key(const std::string& origin,
+                                  const std::string& remote_file)
+    {
+        boost::uint64_t hash = 14695981039346656037ULL;
+        std::string identity = origin + '\0' + remote_file;
+        for (std::string::size_type i = 0; i < identity.size(); ++i)
+        {
+            hash ^= static_cast<unsigned char>(identity[i]);
+            hash *= 1099511628211ULL;
+        }
+
+        std::ostringstream key;
+        key << std::hex << std::setfill('0') << std::setw(16) << hash;
+        return key.str();
+    }
+
+    static std::string copy_name(const std::string& origin,
+                                 const std::string& remote_file,
+                                 boost::uint64_t size, std::time_t modified)
+    {
+        std::ostringstream name;
+        name << origin_key(origin, remote_file) << '-' << size << '-'
+             << static_cast<long long>(modified);
+        return name.str();
+    }
+
+    boost::filesystem::path local_path(const std::string& name) const
+    {
+        return m_directory / boost::filesystem::path(name);
+    }
+
+    /**
+     * Delete copies of other versions of the file than `keep`.
+     *
+     * Copies of other files whose names hash the same are left alone.
+     */
+    void remove_versions(const std::string& origin,
+                         const std::string& remote_file,
+                         const boost::filesystem::path& keep)
+    {
+        std::string prefix = origin_key(origin, remote_file) + '-';
+
+        std::vector<boost::filesystem::path> doomed;
+        for (boost::filesystem::directory_iterator it(m_directory), end;
+             it != end; ++it)
+        {
+            std::string name = it->path().filename().string();
+            if (name.compare(0, prefix.size(), prefix) == 0 &&
+                name.find(partial_marker()) == std::string::npos &&
+                !is_origin_file(it->path()) && it->path() != keep &&
+                is_copy_of(it->path(), origin, remote_file))
+            {
+                doomed.push_back(it->path());
+            }
+        }
+
+        for (std::size_t i = 0; i < doomed.size(); ++i)
+        {
+            remove_copy(doomed[i]);
+        }
+    }
+
+    /**
+     * Delete the least recently used copies until the rest fit the budget,
+     * sparing `keep`.
+     *
+     * Also recounts the disk used, which other processes sharing the
+     * directory may have changed.
+     */
+    void evict(const boost::filesystem::path& keep)
+    {
+        typedef std::pair<std::time_t, boost::filesystem::path> aged_copy;
+        std::vector<aged_copy> copies;
+        boost::uintmax_t bytes = 0;
+
+        std::vector<boost::filesystem::path> orphans;
+
+        for (boost::filesystem::directory_iterator it(m_directory), end;
+             it != end; ++it)
+        {
+            if (!boost::filesystem::is_regular_file(it->status()) ||
+                it->path().filename().string().find(partial_marker()) !=
+                    std::string::npos)
+            {
+                continue;
+            }
+
+            if (is_origin_file(it->path()))
+            {
+                // Left behind if a copy was deleted by something other
+                // than the cache
+                boost::filesystem::path copy = it->path().parent_path() /
+                                               it->path().stem();
+                if (!boost::filesystem::exists(copy))
+                    orphans.push_back(it->path());
+                continue;
+            }
+
+            boost::system::error_code ec;
+            boost::uintmax_t size =
+                boost::filesystem::file_size(it->path(), ec);
+            std::time_t used =
+                (ec) ? 0 : boost::filesystem::last_write_time(it->path(), ec);
+            if (ec)
+                continue; // Deleted by someone else
+
+            bytes += size;
+            copies.push_back(std::make_pair(used, it->path()));
+        }
+
+        for (std::size_t i = 0; i < orphans.size(); ++i)
+        {
+            boost::system::error_code ec;
+            boost::filesystem::remove(orphans[i], ec);
+        }
+
+        std::sort(copies.begin(), copies.end());
+
+        for (std::size_t i = 0; i < copies.size() && bytes > m_budget; ++i)
+        {
+            if (copies[i].second == keep)
+                continue;
+
+            boost::system::error_code ec;
+            boost::uintmax_t size =
+                boost::filesystem::file_size(copies[i].second, ec);
+            if (!ec && remove_copy(copies[i].second))
+            {
+                bytes -= size;
+                ++m_statistics.evictions;
+            }
+        }
+
+        m_statistics.bytes = bytes;
+    }
+
+    const boost::filesystem::path m_directory;
+    const boost::uintmax_t m_budget;
+
+    mutable boost::mutex m_mutex;
+    content_cache_statistics m_statistics;
+};
+
+/**
+ * Local copy of the remote file, downloading it only if the cache doesn't
+ * hold the version described by `remote_status`.
+ *
+ * For callers that have already stat'ed the file, for example to decide
+ * whether it is small enough to cache.
+ *
+ * @param origin  Identifies the server, for example `user@host:port`.
+ */
+inline content_copy cached_copy(content_cache& cache,
+                                sftp_filesystem& filesystem,
+                                const std::string& origin,
+                                const path& remote_file,
+                                const file_status& remote_status)
+{
+    boost::optional<content_copy> copy =
+        cache.find(origin, remote_file.string(), remote_status.file_size(),
+                   remote_status.last_write_time());
+    if (copy)
+        return *copy;
+
+    ifstream remote(filesystem, remote_file);
+    return cache.insert(origin, remote_file.string(),
+                        remote_status.file_size(),
+                        remote_status.last_write_time(), remote);
+}
+
+/**
+ * Local copy of the remote file, downloading it only if the cache doesn't
+ * hold the version currently on the server.
+ *
+ * Costs one stat when the cache has the file.
+ *
+ * @param origin  Identifies the server, for example `user@host:port`.
+ */
+inline content_copy cached_copy(content_cache& cache,
+                                sftp_filesystem& filesystem,
+                                const std::string& origin,
+                                const path& remote_file)
+{
+    return cached_copy(cache, filesystem, origin, remote_file,
+                       status(filesystem, remote_file));
+}
+}
+} // namespace ssh::filesystem
+
+#endif
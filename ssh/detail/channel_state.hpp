@@ -0,0 +1,299 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_CHANNEL_STATE_HPP
+#define SSH_DETAIL_CHANNEL_STATE_HPP
+
+#include <ssh/detail/libssh2/channel.hpp>
+#include <ssh/detail/session_state.hpp>
+#include <ssh/ssh_error.hpp> // last_error_code, SSH_DETAIL_THROW_API_*
+
+#include <boost/noncopyable.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <cstddef> // size_t
+#include <string>
+
+#include <libssh2.h> // LIBSSH2_CHANNEL, LIBSSH2_CHANNEL_*_DEFAULT
+
+namespace ssh
+{
+namespace detail
+{
+
+/**
+ * Switches a session to non-blocking mode for as long as the object lives.
+ *
+ * The session lock must be held for the whole of the object's life as the
+ * other users of the session expect it to block.
+ */
+class scoped_non_blocking : private boost::noncopyable
+{
+public:
+    explicit scoped_non_blocking(LIBSSH2_SESSION* session)
+        : m_session(session),
+          m_was_blocking(::libssh2_session_get_blocking(session))
+    {
+        ::libssh2_session_set_blocking(m_session, 0);
+    }
+
+    ~scoped_non_blocking() throw()
+    {
+        ::libssh2_session_set_blocking(m_session, m_was_blocking);
+    }
+
+private:
+    LIBSSH2_SESSION* m_session;
+    int m_was_blocking;
+};
+
+inline LIBSSH2_CHANNEL* do_channel_open(session_state& session,
+                                        const std::string& request,
+                                        const std::string& message)
+{
+    static const char channel_type[] = "session";
+
+    session_state::scoped_lock lock = session.aquire_lock();
+
+    LIBSSH2_CHANNEL* channel = libssh2::channel::open(
+        session.session_ptr(), channel_type, sizeof(channel_type) - 1,
+        LIBSSH2_CHANNEL_WINDOW_DEFAULT, LIBSSH2_CHANNEL_PACKET_DEFAULT, NULL,
+        0);
+
+    try
+    {
+        libssh2::channel::process_startup(
+            session.session_ptr(), channel, request.data(),
+            static_cast<unsigned int>(request.size()), message.data(),
+            static_cast<unsigned int>(message.size()));
+    }
+    catch (...)
+    {
+        ::libssh2_channel_free(channel);
+        throw;
+    }
+
+    return channel;
+}
+
+/**
+ * RAII object managing a session channel running a subsystem or command.
+ *
+ * Opens the channel and starts the process in a thread-safe manner, and
+ * closes the channel in a thread-safe manner when it goes out of scope.
+ */
+class channel_state : private boost::noncopyable
+{
+    //
+    // Intentionally not movable for the same reasons as sftp_channel_state.
+    //
+public:
+    typedef session_state::scoped_lock scoped_lock;
+
+    /**
+     * Open a channel and make a process-startup request on it.
+     *
+     * @param request  "subsystem", "exec" or "shell".
+     * @param message  Name of the subsystem or the command to execute.
+     */
+    channel_state(session_state& session, const std::string& request,
+                  const std::string& message)
+        : m_session(session),
+          m_channel(do_channel_open(session, request, message))
+    {
+    }
+
+    ~channel_state() throw()
+    {
+        session_state::scoped_lock lock = m_session.aquire_lock();
+
+        // Ignoring any errors because there's nothing we can do about them
+        boost::system::error_code ec;
+        libssh2::channel::close(m_session.session_ptr(), m_channel, ec);
+
+        ::libssh2_channel_free(m_channel);
+    }
+
+    scoped_lock aquire_lock()
+    {
+        return m_session.aquire_lock();
+    }
+
+    LIBSSH2_SESSION* session_ptr()
+    {
+        return m_session.session_ptr();
+    }
+
+    LIBSSH2_CHANNEL* channel_ptr()
+    {
+        return m_channel;
+    }
+
+    /**
+     * Read from one of the channel's streams, waiting until there is
+     * something to read.
+     *
+     * The session lock is released while waiting for the server so that a
+     * slow command doesn't stall everything else using the session.
+     *
+     * @returns 0 at the end of the stream.
+     */
+    ssize_t read(int stream_id, char* buffer, std::size_t size)
+    {
+        scoped_lock lock = aquire_lock();
+
+        ssize_t rc;
+        do
+        {
+            scoped_non_blocking non_blocking(session_ptr());
+            rc = ::libssh2_channel_read_ex(m_channel, stream_id, buffer,
+                                           size);
+        } while (wait_if_blocked(rc, lock, "libssh2_channel_read_ex"));
+
+        return rc;
+    }
+
+    /**
+     * Write some of the data to one of the channel's streams.
+     *
+     * Waits for the server to open its window without holding the session
+     * lock, like `read`.
+     *
+     * @returns the number of bytes written, which may be fewer than `size`.
+     */
+    ssize_t write(int stream_id, const char* data, std::size_t size)
+    {
+        scoped_lock lock = aquire_lock();
+
+        ssize_t rc;
+        do
+        {
+            scoped_non_blocking non_blocking(session_ptr());
+            rc = ::libssh2_channel_write_ex(m_channel, stream_id, data,
+                                            size);
+        } while (wait_if_blocked(rc, lock, "libssh2_channel_write_ex"));
+
+        return rc;
+    }
+
+    /**
+     * Close our end of the channel and wait for the server to close its end.
+     *
+     * Afterwards, everything the server sent about how the process ended,
+     * such as its exit status, has arrived.
+     */
+    void close_and_wait()
+    {
+        scoped_lock lock = aquire_lock();
+
+        int rc;
+        do
+        {
+            scoped_non_blocking non_blocking(session_ptr());
+            rc = ::libssh2_channel_close(m_channel);
+        } while (wait_if_blocked(rc, lock, "libssh2_channel_close"));
+
+        do
+        {
+            scoped_non_blocking non_blocking(session_ptr());
+            rc = ::libssh2_channel_wait_closed(m_channel);
+        } while (wait_if_blocked(rc, lock, "libssh2_channel_wait_closed"));
+    }
+
+private:
+    /**
+     * Deal with the result of a non-blocking call.
+     *
+     * Throws if the call failed and waits for the socket if the call would
+     * have blocked.
+     *
+     * The lock is only given up while waiting for incoming data.  If
+     * libssh2 is part-way through sending a packet, it has to finish that
+     * packet before anything else is sent on the session, so we wait with
+     * the lock held.
+     *
+     * @returns whether to make the call again.
+     */
+    bool wait_if_blocked(ssize_t rc, scoped_lock& lock,
+                         const char* api_function)
+    {
+        if (rc >= 0)
+            return false;
+
+        if (rc != LIBSSH2_ERROR_EAGAIN)
+        {
+            std::string e_msg;
+            boost::system::error_code ec =
+                ::ssh::detail::last_error_code(session_ptr(), e_msg);
+            SSH_DETAIL_THROW_API_ERROR_CODE(ec, e_msg, api_function);
+        }
+
+        int directions = ::libssh2_session_block_directions(session_ptr());
+        if (directions & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+        {
+            m_session.wait_for_socket(directions);
+        }
+        else
+        {
+            lock.unlock();
+            m_session.wait_for_socket(directions);
+            lock.lock();
+        }
+
+        return true;
+    }
+
+    session_state& m_session;
+    LIBSSH2_CHANNEL* m_channel;
+};
+
+/**
+ * Run a command on the server and wait for it to finish.
+ *
+ * Only suitable for commands whose output is small: the whole of it is
+ * collected in `output`.  Anything the command writes to stderr is thrown
+ * away.
+ *
+ * The session stays usable by other threads while the command runs.
+ *
+ * @returns the command's exit status.
+ */
+inline int run_command(session_state& session, const std::string& command,
+                       std::string& output)
+{
+    channel_state channel(session, "exec", command);
+
+    char buffer[4096];
+    for (;;)
+    {
+        ssize_t count = channel.read(0, buffer, sizeof(buffer));
+        if (count == 0)
+            break;
+
+        output.append(buffer, static_cast<std::size_t>(count));
+    }
+
+    // The exit status may arrive after the end of the output, so we have to
+    // wait for the server to close its end to be sure of having it
+    channel.close_and_wait();
+
+    channel_state::scoped_lock lock = channel.aquire_lock();
+    return ::libssh2_channel_get_exit_status(channel.channel_ptr());
+}
+}
+} // namespace ssh::detail
+
+#endif
@@ -0,0 +1,180 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_COMMAND_STATE_HPP
+#define SSH_DETAIL_COMMAND_STATE_HPP
+
+#include <ssh/detail/channel_state.hpp>
+#include <ssh/detail/libssh2/channel.hpp>
+#include <ssh/detail/session_state.hpp>
+
+#include <boost/noncopyable.hpp>
+
+#include <cassert> // assert
+#include <cstddef> // size_t
+#include <ios>     // streamsize
+#include <string>
+
+#include <libssh2.h> // LIBSSH2_CHANNEL_EXTENDED_DATA_IGNORE, libssh2_free
+
+namespace ssh
+{
+namespace detail
+{
+
+/**
+ * A command running on the server, and how it ended once it has.
+ *
+ * Every call into libssh2 is made under the session lock, so commands can
+ * run alongside each other and alongside SFTP on the same session.  The
+ * lock is not held while waiting for the command, so a slow command only
+ * holds up its own reader.
+ */
+class command_state : private boost::noncopyable
+{
+public:
+    command_state(session_state& session, const std::string& command)
+        : m_channel(session, "exec", command),
+          m_input_closed(false),
+          m_finished(false),
+          m_exit_status(0)
+    {
+    }
+
+    /**
+     * Read from the command's output (stream 0) or its error output
+     * (stream 1).
+     *
+     * @returns -1 at the end of the stream.
+     */
+    std::streamsize read(int stream_id, char* buffer, std::streamsize size)
+    {
+        ssize_t count = m_channel.read(stream_id, buffer,
+                                       static_cast<std::size_t>(size));
+
+        return (count == 0) ? -1 : static_cast<std::streamsize>(count);
+    }
+
+    /**
+     * Send all the data to the command's input.
+     */
+    std::streamsize write(const char* data, std::streamsize size)
+    {
+        // Looping for the same reason as sftp_output_device: the stream
+        // can't make sense of a short write
+        std::streamsize count = 0;
+        while (count < size)
+        {
+            count += m_channel.write(0, data + count,
+                                     static_cast<std::size_t>(size - count));
+        }
+
+        return count;
+    }
+
+    /**
+     * Tell the command there is no more input.
+     */
+    void close_input()
+    {
+        if (m_input_closed)
+            return;
+
+        channel_state::scoped_lock lock = m_channel.aquire_lock();
+
+        libssh2::channel::send_eof(m_channel.session_ptr(),
+                                   m_channel.channel_ptr());
+        m_input_closed = true;
+    }
+
+    /**
+     * Wait for the command to end, throwing away any output not yet read.
+     *
+     * The command can't end while it is blocked on output that nobody is
+     * reading, so the output has to be drained before the server will close
+     * the channel.
+     */
+    void finish()
+    {
+        if (m_finished)
+            return;
+
+        close_input();
+
+        {
+            channel_state::scoped_lock lock = m_channel.aquire_lock();
+
+            // Also drops error output already waiting
+            ::libssh2_channel_handle_extended_data2(
+                m_channel.channel_ptr(), LIBSSH2_CHANNEL_EXTENDED_DATA_IGNORE);
+        }
+
+        char buffer[4096];
+        while (read(0, buffer, sizeof(buffer)) > 0)
+        {
+        }
+
+        // The exit status may arrive after the end of the output, so we have
+        // to wait for the server to close its end to be sure of having it
+        m_channel.close_and_wait();
+
+        channel_state::scoped_lock lock = m_channel.aquire_lock();
+
+        m_exit_status = ::libssh2_channel_get_exit_status(
+            m_channel.channel_ptr());
+        m_exit_signal = fetch_exit_signal();
+        m_finished = true;
+    }
+
+    int exit_status() const
+    {
+        assert(m_finished);
+        return m_exit_status;
+    }
+
+    const std::string& exit_signal() const
+    {
+        assert(m_finished);
+        return m_exit_signal;
+    }
+
+private:
+    // Caller must hold the session lock
+    std::string fetch_exit_signal()
+    {
+        char* signal = NULL;
+        std::size_t signal_length = 0;
+
+        ::libssh2_channel_get_exit_signal(m_channel.channel_ptr(), &signal,
+                                          &signal_length, NULL, NULL, NULL,
+                                          NULL);
+        if (!signal)
+            return std::string();
+
+        std::string name(signal, signal_length);
+        ::libssh2_free(m_channel.session_ptr(), signal);
+        return name;
+    }
+
+    channel_state m_channel;
+    bool m_input_closed;
+    bool m_finished;
+    int m_exit_status;
+    std::string m_exit_signal;
+};
+}
+} // namespace ssh::detail
+
+#endif
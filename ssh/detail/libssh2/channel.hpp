@@ -0,0 +1,294 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_LIBSSH2_CHANNEL_HPP
+#define SSH_DETAIL_LIBSSH2_CHANNEL_HPP
+
+#include <ssh/ssh_error.hpp> // last_error_code, SSH_DETAIL_THROW_API_*
+
+#include <boost/optional/optional.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <string>
+
+#include <libssh2.h> // LIBSSH2_SESSION, LIBSSH2_CHANNEL, libssh2_channel_*
+
+// See ssh/detail/libssh2/libssh2.hpp for rules governing functions in this
+// namespace
+
+namespace ssh
+{
+namespace detail
+{
+namespace libssh2
+{
+namespace channel
+{
+
+/**
+ * Error-fetching wrapper around libssh2_channel_open_ex.
+ */
+inline LIBSSH2_CHANNEL*
+open(LIBSSH2_SESSION* session, const char* channel_type,
+     unsigned int channel_type_len, unsigned int window_size,
+     unsigned int packet_size, const char* message, unsigned int message_len,
+     boost::system::error_code& ec,
+     boost::optional<std::string&> e_msg = boost::optional<std::string&>())
+{
+    LIBSSH2_CHANNEL* channel =
+        ::libssh2_channel_open_ex(session, channel_type, channel_type_len,
+                                  window_size, packet_size, message,
+                                  message_len);
+    if (!channel)
+    {
+        ec = ssh::detail::last_error_code(session, e_msg);
+    }
+
+    return channel;
+}
+
+/**
+ * Exception wrapper around libssh2_channel_open_ex.
+ */
+inline LIBSSH2_CHANNEL* open(LIBSSH2_SESSION* session,
+                             const char* channel_type,
+                             unsigned int channel_type_len,
+                             unsigned int window_size,
+                             unsigned int packet_size, const char* message,
+                             unsigned int message_len)
+{
+    boost::system::error_code ec;
+    std::string e_msg;
+
+    LIBSSH2_CHANNEL* channel =
+        open(session, channel_type, channel_type_len, window_size,
+             packet_size, message, message_len, ec, e_msg);
+    if (ec)
+    {
+        SSH_DETAIL_THROW_API_ERROR_CODE(ec, e_msg, "libssh2_channel_open_ex");
+    }
+
+    return channel;
+}
+
+/**
+ * Error-fetching wrapper around libssh2_channel_process_startup.
+ */
+inline void process_startup(
+    LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel, const char* request,
+    unsigned int request_len, const char* message, unsigned int message_len,
+    boost::system::error_code& ec,
+    boost::optional<std::string&> e_msg = boost::optional<std::string&>())
+{
+    int rc = ::libssh2_channel_process_startup(channel, request, request_len,
+                                               message, message_len);
+    if (rc != 0)
+    {
+        ec = ssh::detail::last_error_code(session, e_msg);
+    }
+}
+
+/**
+ * Exception wrapper around libssh2_channel_process_startup.
+ */
+inline void process_startup(LIBSSH2_SESSION* session,
+                            LIBSSH2_CHANNEL* channel, const char* request,
+                            unsigned int request_len, const char* message,
+                            unsigned int message_len)
+{
+    boost::system::error_code ec;
+    std::string e_msg;
+
+    process_startup(session, channel, request, request_len, message,
+                    message_len, ec, e_msg);
+    if (ec)
+    {
+        SSH_DETAIL_THROW_API_ERROR_CODE(ec, e_msg,
+                                        "libssh2_channel_process_startup");
+    }
+}
+
+/**
+ * Error-fetching wrapper around libssh2_channel_read_ex.
+ */
+inline ssize_t
+read(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel, int stream_id,
+     char* buffer, size_t buffer_len, boost::system::error_code& ec,
+     boost::optional<std::string&> e_msg = boost::optional<std::string&>())
+{
+    ssize_t count =
+        ::libssh2_channel_read_ex(channel, stream_id, buffer, buffer_len);
+    if (count < 0)
+    {
+        ec = ssh::detail::last_error_code(session, e_msg);
+    }
+
+    return count;
+}
+
+/**
+ * Exception wrapper around libssh2_channel_read_ex.
+ */
+inline ssize_t read(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel,
+                    int stream_id, char* buffer, size_t buffer_len)
+{
+    boost::system::error_code ec;
+    std::string e_msg;
+
+    ssize_t count =
+        read(session, channel, stream_id, buffer, buffer_len, ec, e_msg);
+    if (ec)
+    {
+        SSH_DETAIL_THROW_API_ERROR_CODE(ec, e_msg, "libssh2_channel_read_ex");
+    }
+
+    return count;
+}
+
+/**
+ * Error-fetching wrapper around libssh2_channel_write_ex.
+ */
+inline ssize_t
+write(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel, int stream_id,
+      const char* data, size_t data_len, boost::system::error_code& ec,
+      boost::optional<std::string&> e_msg = boost::optional<std::string&>())
+{
+    ssize_t count =
+        ::libssh2_channel_write_ex(channel, stream_id, data, data_len);
+    if (count < 0)
+    {
+        ec = ssh::detail::last_error_code(session, e_msg);
+    }
+
+    return count;
+}
+
+/**
+ * Exception wrapper around libssh2_channel_write_ex.
+ */
+inline ssize_t write(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel,
+                     int stream_id, const char* data, size_t data_len)
+{
+    boost::system::error_code ec;
+    std::string e_msg;
+
+    ssize_t count =
+        write(session, channel, stream_id, data, data_len, ec, e_msg);
+    if (ec)
+    {
+        SSH_DETAIL_THROW_API_ERROR_CODE(ec, e_msg,
+                                        "libssh2_channel_write_ex");
+    }
+
+    return count;
+}
+
+/**
+ * Error-fetching wrapper around libssh2_channel_send_eof.
+ */
+inline void send_eof(
+    LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel,
+    boost::system::error_code& ec,
+    boost::optional<std::string&> e_msg = boost::optional<std::string&>())
+{
+    int rc = ::libssh2_channel_send_eof(channel);
+    if (rc != 0)
+    {
+        ec = ssh::detail::last_error_code(session, e_msg);
+    }
+}
+
+/**
+ * Exception wrapper around libssh2_channel_send_eof.
+ */
+inline void send_eof(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel)
+{
+    boost::system::error_code ec;
+    std::string e_msg;
+
+    send_eof(session, channel, ec, e_msg);
+    if (ec)
+    {
+        SSH_DETAIL_THROW_API_ERROR_CODE(ec, e_msg,
+                                        "libssh2_channel_send_eof");
+    }
+}
+
+/**
+ * Error-fetching wrapper around libssh2_channel_close.
+ */
+inline void
+close(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel,
+      boost::system::error_code& ec,
+      boost::optional<std::string&> e_msg = boost::optional<std::string&>())
+{
+    int rc = ::libssh2_channel_close(channel);
+    if (rc != 0)
+    {
+        ec = ssh::detail::last_error_code(session, e_msg);
+    }
+}
+
+/**
+ * Exception wrapper around libssh2_channel_close.
+ */
+inline void close(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel)
+{
+    boost::system::error_code ec;
+    std::string e_msg;
+
+    close(session, channel, ec, e_msg);
+    if (ec)
+    {
+        SSH_DETAIL_THROW_API_ERROR_CODE(ec, e_msg, "libssh2_channel_close");
+    }
+}
+
+/**
+ * Error-fetching wrapper around libssh2_channel_wait_closed.
+ */
+inline void wait_closed(
+    LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel,
+    boost::system::error_code& ec,
+    boost::optional<std::string&> e_msg = boost::optional<std::string&>())
+{
+    int rc = ::libssh2_channel_wait_closed(channel);
+    if (rc != 0)
+    {
+        ec = ssh::detail::last_error_code(session, e_msg);
+    }
+}
+
+/**
+ * Exception wrapper around libssh2_channel_wait_closed.
+ */
+inline void wait_closed(LIBSSH2_SESSION* session, LIBSSH2_CHANNEL* channel)
+{
+    boost::system::error_code ec;
+    std::string e_msg;
+
+    wait_closed(session, channel, ec, e_msg);
+    if (ec)
+    {
+        SSH_DETAIL_THROW_API_ERROR_CODE(ec, e_msg,
+                                        "libssh2_channel_wait_closed");
+    }
+}
+}
+}
+}
+} // namespace ssh::detail::libssh2::channel
+
+#endif
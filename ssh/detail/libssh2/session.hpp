@@ -134,6 +134,38 @@ inline void disconnect(LIBSSH2_SESSION* session, const char* description)
                                         "libssh2_session_disconnect");
     }
 }
+
+/**
+ * Error-fetching wrapper around libssh2_keepalive_send.
+ */
+inline void keepalive_send(
+    LIBSSH2_SESSION* session, int* seconds_to_next,
+    boost::system::error_code& ec,
+    boost::optional<std::string&> e_msg = boost::optional<std::string&>())
+{
+    int rc = ::libssh2_keepalive_send(session, seconds_to_next);
+
+    if (rc != 0)
+    {
+        ec = ssh::detail::last_error_code(session, e_msg);
+    }
+}
+
+/**
+ * Exception wrapper around libssh2_keepalive_send.
+ */
+inline void keepalive_send(LIBSSH2_SESSION* session, int* seconds_to_next)
+{
+    boost::system::error_code ec;
+    std::string message;
+
+    keepalive_send(session, seconds_to_next, ec, message);
+
+    if (ec)
+    {
+        SSH_DETAIL_THROW_API_ERROR_CODE(ec, message, "libssh2_keepalive_send");
+    }
+}
 }
 }
 }
@@ -529,6 +529,39 @@ inline ssize_t write(LIBSSH2_SESSION* session, LIBSSH2_SFTP* sftp,
     return count;
 }
 
+/**
+ * Error-fetching wrapper around libssh2_sftp_fsync.
+ */
+inline void
+fsync(LIBSSH2_SESSION* session, LIBSSH2_SFTP* sftp,
+      LIBSSH2_SFTP_HANDLE* file_handle, boost::system::error_code& ec,
+      boost::optional<std::string&> e_msg = boost::optional<std::string&>())
+{
+    int rc = ::libssh2_sftp_fsync(file_handle);
+    if (rc < 0)
+    {
+        ec = ::ssh::filesystem::detail::last_sftp_error_code(session, sftp,
+                                                             e_msg);
+    }
+}
+
+/**
+ * Exception wrapper around libssh2_sftp_fsync.
+ */
+inline void fsync(LIBSSH2_SESSION* session, LIBSSH2_SFTP* sftp,
+                  LIBSSH2_SFTP_HANDLE* file_handle)
+{
+    boost::system::error_code ec;
+    std::string message;
+
+    fsync(session, sftp, file_handle, ec, message);
+
+    if (ec)
+    {
+        SSH_DETAIL_THROW_API_ERROR_CODE(ec, message, "libssh2_sftp_fsync");
+    }
+}
+
 /**
  * Error-fetching wrapper around libssh2_sftp_readdir_ex.
  */
@@ -0,0 +1,48 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_LOCAL_PATH_HPP
+#define SSH_DETAIL_LOCAL_PATH_HPP
+
+#include <boost/filesystem/path.hpp>
+#include <boost/locale/encoding_utf.hpp> // utf_to_utf
+
+#include <string>
+
+namespace ssh
+{
+namespace detail
+{
+
+/**
+ * A local path as the server would name it: UTF-8 with `/` between the
+ * segments.
+ */
+inline std::string utf8_name(const boost::filesystem::path& name)
+{
+    return boost::locale::conv::utf_to_utf<char>(name.generic_wstring());
+}
+
+/**
+ * A name from the server as a local path.
+ */
+inline boost::filesystem::path local_name(const std::string& utf8_name)
+{
+    return boost::locale::conv::utf_to_utf<wchar_t>(utf8_name);
+}
+}
+} // namespace ssh::detail
+
+#endif
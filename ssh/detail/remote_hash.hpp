@@ -0,0 +1,213 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file
+ *
+ * The three ways we know of getting a server to hash a file: the
+ * `check-file` and `md5-hash` SFTP extensions, and running a hashing
+ * command such as `md5sum`.
+ */
+
+#ifndef SSH_DETAIL_REMOTE_HASH_HPP
+#define SSH_DETAIL_REMOTE_HASH_HPP
+
+#include <ssh/detail/sftp_protocol.hpp> // throw_bad_reply
+#include <ssh/detail/shell_quote.hpp>
+#include <ssh/detail/wire.hpp>
+
+#include <boost/cstdint.hpp> // uint64_t
+
+#include <cstddef> // size_t
+#include <sstream> // ostringstream
+#include <string>
+
+namespace ssh
+{
+namespace detail
+{
+
+struct hash_command_info
+{
+    const char* algorithm;
+    const char* command;
+    std::size_t hex_length;
+};
+
+/**
+ * Commands that print a hash of their input, by the name `check-file`
+ * gives the algorithm.
+ */
+inline const hash_command_info* find_hash_command(const std::string& algorithm)
+{
+    static const hash_command_info commands[] = {
+        {"md5", "md5sum", 32},       {"sha1", "sha1sum", 40},
+        {"sha224", "sha224sum", 56}, {"sha256", "sha256sum", 64},
+        {"sha384", "sha384sum", 96}, {"sha512", "sha512sum", 128}};
+
+    for (std::size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); ++i)
+    {
+        if (algorithm == commands[i].algorithm)
+            return &commands[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Lower-case hex, which is how hashing commands print hashes.
+ */
+inline std::string to_hex(const std::string& bytes)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    std::string hex;
+    hex.reserve(bytes.size() * 2);
+    for (std::size_t i = 0; i < bytes.size(); ++i)
+    {
+        unsigned char byte = static_cast<unsigned char>(bytes[i]);
+        hex += digits[byte >> 4];
+        hex += digits[byte & 0x0F];
+    }
+    return hex;
+}
+
+/**
+ * Arguments to a `check-file-name` request for a single hash of the range.
+ *
+ * @param length  Zero means to the end of the file.
+ */
+inline std::string check_file_arguments(const std::string& file,
+                                        const std::string& algorithm,
+                                        boost::uint64_t offset,
+                                        boost::uint64_t length)
+{
+    wire_writer arguments;
+    arguments.put_string(file)
+        .put_string(algorithm)
+        .put_uint64(offset)
+        .put_uint64(length)
+        .put_uint32(0); // Block size of zero means one hash for the lot
+    return arguments.buffer();
+}
+
+inline std::string hash_from_check_file_reply(const std::string& data,
+                                              const std::string& algorithm)
+{
+    wire_reader in(data);
+    if (in.get_string() != "check-file")
+        sftp_protocol::throw_bad_reply("Expected check-file reply");
+
+    if (in.get_string() != algorithm)
+        sftp_protocol::throw_bad_reply("check-file used the wrong algorithm");
+
+    if (in.empty())
+        sftp_protocol::throw_bad_reply("check-file reply has no hash");
+
+    return to_hex(data.substr(data.size() - in.remaining()));
+}
+
+/**
+ * Arguments to an `md5-hash` request.
+ *
+ * @param length  Zero means to the end of the file.
+ */
+inline std::string md5_hash_arguments(const std::string& file,
+                                      boost::uint64_t offset,
+                                      boost::uint64_t length)
+{
+    wire_writer arguments;
+    arguments.put_string(file)
+        .put_uint64(offset)
+        .put_uint64(length)
+        .put_string(""); // No quick-check hash: always hash the lot
+    return arguments.buffer();
+}
+
+inline std::string hash_from_md5_hash_reply(const std::string& data)
+{
+    wire_reader in(data);
+    if (in.get_string() != "md5-hash")
+        sftp_protocol::throw_bad_reply("Expected md5-hash reply");
+
+    std::string hash = in.get_string();
+    if (hash.empty())
+        sftp_protocol::throw_bad_reply("md5-hash reply has no hash");
+
+    return to_hex(hash);
+}
+
+/**
+ * Shell command printing the hash of the range of the file, or an empty
+ * string if we don't know a command for the algorithm.
+ *
+ * @param length  Zero means to the end of the file.
+ */
+inline std::string hash_command(const std::string& file,
+                                const std::string& algorithm,
+                                boost::uint64_t offset, boost::uint64_t length)
+{
+    const hash_command_info* info = find_hash_command(algorithm);
+    if (!info)
+        return std::string();
+
+    std::string quoted_file = shell_quote(file);
+
+    std::ostringstream command;
+    if (offset == 0 && length == 0)
+    {
+        command << info->command << " < " << quoted_file;
+    }
+    else
+    {
+        // Testing first as the exit status of the pipeline is only that of
+        // the hashing command, which would happily hash nothing
+        command << "test -r " << quoted_file << " && tail -c +" << offset + 1
+                << " " << quoted_file;
+        if (length != 0)
+            command << " | head -c " << length;
+        command << " | " << info->command;
+    }
+
+    return command.str();
+}
+
+/**
+ * The hash printed by a hashing command, or an empty string if it didn't
+ * print one.
+ */
+inline std::string hash_from_command_output(const std::string& output,
+                                            const std::string& algorithm)
+{
+    const hash_command_info* info = find_hash_command(algorithm);
+    if (!info || output.size() < info->hex_length)
+        return std::string();
+
+    std::string hash = output.substr(0, info->hex_length);
+    if (hash.find_first_not_of("0123456789abcdef") != std::string::npos)
+        return std::string();
+
+    if (output.size() > info->hex_length &&
+        output.find_first_of(" \t\n", info->hex_length) != info->hex_length)
+    {
+        return std::string();
+    }
+
+    return hash;
+}
+}
+} // namespace ssh::detail
+
+#endif
@@ -39,16 +39,24 @@
 
 #include <ssh/detail/libssh2/session.hpp> // init
 
+#include <boost/date_time/posix_time/posix_time_duration.hpp> // milliseconds
 #include <boost/noncopyable.hpp>
 #include <boost/optional/optional.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/system/system_error.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp> // sleep
 #include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
 
 #include <string>
 
-#include <libssh2.h> // LIBSSH2_SESSION
+#ifdef _WIN32
+#include <winsock2.h> // select
+#else
+#include <sys/select.h> // select
+#endif
+
+#include <libssh2.h> // LIBSSH2_SESSION, LIBSSH2_SESSION_BLOCK_*
 
 namespace ssh
 {
@@ -83,7 +91,8 @@ public:
     /**
      * Creates a session that is not (and never will be) connected to a host.
      */
-    session_state() : m_session(::ssh::detail::libssh2::session::init())
+    session_state()
+        : m_session(::ssh::detail::libssh2::session::init()), m_socket(-1)
     {
     }
 
@@ -91,7 +100,7 @@ public:
      * Creates a session connected to a host over the given socket.
      */
     session_state(int socket, const std::string& disconnection_message)
-        : m_session(libssh2::session::init())
+        : m_session(libssh2::session::init()), m_socket(socket)
     {
         // Session is 'alive' from this point onwards.  All paths must
         // eventually free it.
@@ -141,12 +150,53 @@ public:
         return m_session;
     }
 
+    /**
+     * Wait until the socket is ready in the directions that libssh2 was
+     * blocked on, or for a short while, whichever comes first.
+     *
+     * Call without the session lock.  Another thread may take what we are
+     * waiting for off the socket and hold it in the session for us, so
+     * callers must try again when this returns, whatever the socket did.
+     *
+     * @param directions  From `libssh2_session_block_directions`.
+     */
+    void wait_for_socket(int directions)
+    {
+        if (m_socket < 0)
+        {
+            boost::this_thread::sleep(
+                boost::posix_time::milliseconds(SOCKET_WAIT_MS));
+            return;
+        }
+
+        fd_set reads;
+        fd_set writes;
+        FD_ZERO(&reads);
+        FD_ZERO(&writes);
+        if (directions & LIBSSH2_SESSION_BLOCK_INBOUND)
+            FD_SET(m_socket, &reads);
+        if (directions & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+            FD_SET(m_socket, &writes);
+
+        timeval timeout = {0, SOCKET_WAIT_MS * 1000};
+
+        // Failure is treated the same as a timeout as the caller tries
+        // again anyway and libssh2 reports what's wrong with the socket
+        ::select(m_socket + 1, &reads, &writes, NULL, &timeout);
+    }
+
 private:
+
+    static const int SOCKET_WAIT_MS = 20;
+
     mutable boost::mutex m_mutex;
     ///< Coordinates multiple-threads using of non-thread-safe LIBSSH2_SESSION.
 
     LIBSSH2_SESSION* m_session;
 
+    int m_socket;
+    ///< Negative if the session was never connected to a host.
+
     // Overloading this to hold both the message and flag whether disconnection
     // is necessary.
     boost::optional<std::string> m_disconnection_message;
@@ -0,0 +1,410 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_SFTP_BATCH_HPP
+#define SSH_DETAIL_SFTP_BATCH_HPP
+
+#include <ssh/detail/sftp_protocol.hpp>
+#include <ssh/detail/wire.hpp>
+#include <ssh/sftp_extensions.hpp> // sftp_limits
+
+#include <boost/cstdint.hpp> // uint32_t, uint64_t
+#include <boost/system/error_code.hpp>
+
+#include <algorithm> // min
+#include <cstddef>   // size_t
+#include <map>
+#include <string>
+#include <vector>
+
+#include <libssh2_sftp.h> // LIBSSH2_SFTP_*
+
+namespace ssh
+{
+namespace detail
+{
+namespace sftp_protocol
+{
+
+/**
+ * One file to create on the server.
+ *
+ * Does not own the contents.
+ */
+struct upload_job
+{
+    upload_job(const std::string& path, const char* data, std::size_t size,
+               bool overwrite, bool durable = false)
+        : path(path),
+          data(data),
+          size(size),
+          overwrite(overwrite),
+          durable(durable)
+    {
+    }
+
+    std::string path;
+    const char* data;
+    std::size_t size;
+    bool overwrite;
+
+    /** Have the server fsync the file before it is closed. */
+    bool durable;
+};
+
+const std::size_t default_max_outstanding = 64;
+
+/**
+ * Largest WRITE we send.
+ *
+ * Every server must accept 32 KB.
+ */
+const std::size_t max_write_size = 32 * 1024;
+
+/**
+ * Largest READ or WRITE we send even if the server takes bigger ones.
+ */
+const std::size_t max_request_size = 256 * 1024;
+
+/**
+ * Room left in a packet for everything but the data in a READ reply or
+ * WRITE request.
+ */
+const std::size_t packet_overhead = 1024;
+
+/**
+ * How big to make data requests and how many to keep in flight.
+ */
+struct request_sizing
+{
+    request_sizing()
+        : request_size(max_write_size),
+          max_outstanding(default_max_outstanding),
+          max_bytes_in_flight(default_max_outstanding * max_write_size),
+          max_open_handles(0)
+    {
+    }
+
+    /** Most data in one READ or WRITE. */
+    std::size_t request_size;
+
+    /** Most requests of any kind waiting for a reply. */
+    std::size_t max_outstanding;
+
+    /** Most data asked for by READs waiting for a reply. */
+    std::size_t max_bytes_in_flight;
+
+    /** Most files open at once, or zero if there is no limit. */
+    std::size_t max_open_handles;
+};
+
+/**
+ * Sizing that suits a server with the given limits.
+ *
+ * Data requests are as big as the server allows, up to `max_request_size`,
+ * keeping the same amount of data in flight whatever the size.  Servers
+ * that don't report their limits get the 32 KB every server must accept.
+ */
+inline request_sizing sizing_for(const ::ssh::filesystem::sftp_limits& limits)
+{
+    request_sizing sizing;
+
+    if (limits.max_read_length > 0 && limits.max_write_length > 0)
+    {
+        boost::uint64_t size = (std::min)(
+            static_cast<boost::uint64_t>(max_request_size),
+            (std::min)(limits.max_read_length, limits.max_write_length));
+
+        if (limits.max_packet_length > packet_overhead)
+            size = (std::min)(size,
+                              limits.max_packet_length - packet_overhead);
+
+        sizing.request_size = static_cast<std::size_t>(size);
+    }
+
+    if (limits.max_open_handles > 0)
+    {
+        sizing.max_open_handles = static_cast<std::size_t>((std::min)(
+            limits.max_open_handles,
+            static_cast<boost::uint64_t>(default_max_outstanding)));
+    }
+
+    return sizing;
+}
+
+namespace batch_detail
+{
+
+enum upload_stage
+{
+    opening,
+    writing,
+    syncing,
+    closing
+};
+
+struct upload_progress
+{
+    upload_progress() : stage(opening), writes_due(0)
+    {
+    }
+
+    upload_stage stage;
+    std::string handle;
+    std::size_t writes_due;
+    boost::system::error_code error;
+};
+
+inline std::string open_request(const upload_job& job)
+{
+    boost::uint32_t flags =
+        open_flags::write | open_flags::create |
+        ((job.overwrite) ? open_flags::truncate : open_flags::exclusive);
+
+    // Same permissions as ssh::filesystem::ofstream creates files with
+    LIBSSH2_SFTP_ATTRIBUTES attributes = LIBSSH2_SFTP_ATTRIBUTES();
+    attributes.flags = LIBSSH2_SFTP_ATTR_PERMISSIONS;
+    attributes.permissions = LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR |
+                             LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH;
+
+    wire_writer body;
+    body.put_string(job.path).put_uint32(flags);
+    put_attributes(body, attributes);
+    return body.buffer();
+}
+
+inline std::string close_request(const std::string& handle)
+{
+    wire_writer body;
+    body.put_string(handle);
+    return body.buffer();
+}
+
+/**
+ * Send whatever request follows the file's last WRITE: an fsync if the job
+ * wants one and the writes went through, otherwise the CLOSE.
+ */
+template <typename Pipeline>
+boost::uint32_t
+send_after_writes(Pipeline& pipeline, const upload_job& job,
+                  upload_progress& file)
+{
+    if (job.durable && !file.error)
+    {
+        // Carries just the handle, the same as a CLOSE
+        file.stage = syncing;
+        return pipeline.send_extended("fsync@openssh.com",
+                                      close_request(file.handle));
+    }
+
+    file.stage = closing;
+    return pipeline.send(packet_type::close, close_request(file.handle));
+}
+}
+
+/**
+ * Create many small files, keeping their requests in flight together.
+ *
+ * Each file takes an OPEN, its WRITEs and a CLOSE, in that order, but the
+ * chains for different files are interleaved so that the time is bounded by
+ * bandwidth rather than by round trips.  New files are opened whenever
+ * fewer than `sizing.max_outstanding` requests are waiting and fewer than
+ * `sizing.max_open_handles` files are open.
+ *
+ * A durable job adds an fsync between its last WRITE and its CLOSE.  The
+ * fsyncs are pipelined like everything else, so many small durable files
+ * cost little more than the same files without.  A server that doesn't
+ * support `fsync@openssh.com` fails those jobs, though their data is
+ * written.
+ *
+ * Files are created with the same permissions as `ofstream` would give
+ * them.  A file whose job doesn't allow overwriting is opened exclusively,
+ * so it fails if the file already exists.
+ *
+ * @returns the outcome for each job, in the same order as the jobs.
+ * @throws if the channel fails or the server breaks the protocol.  The
+ *         pipeline can't be used again after that because it may still have
+ *         replies due.
+ */
+template <typename Pipeline>
+std::vector<boost::system::error_code>
+upload_files(Pipeline& pipeline, const std::vector<upload_job>& jobs,
+             const request_sizing& sizing = request_sizing())
+{
+    using namespace batch_detail;
+
+    std::vector<boost::system::error_code> results(jobs.size());
+    std::vector<upload_progress> progress(jobs.size());
+    std::map<boost::uint32_t, std::size_t> owners;
+
+    std::size_t next_job = 0;
+    std::size_t finished = 0;
+
+    while (finished < jobs.size())
+    {
+        while (next_job < jobs.size() &&
+               pipeline.outstanding() < sizing.max_outstanding &&
+               (sizing.max_open_handles == 0 ||
+                next_job - finished < sizing.max_open_handles))
+        {
+            owners[pipeline.send(packet_type::open,
+                                 open_request(jobs[next_job]))] = next_job;
+            ++next_job;
+        }
+
+        packet reply = pipeline.receive();
+
+        std::map<boost::uint32_t, std::size_t>::iterator owner =
+            owners.find(reply.id);
+        if (owner == owners.end())
+            throw_bad_reply("SFTP reply to unknown request");
+
+        std::size_t index = owner->second;
+        owners.erase(owner);
+
+        const upload_job& job = jobs[index];
+        upload_progress& file = progress[index];
+
+        switch (file.stage)
+        {
+        case opening:
+            file.handle = handle_from_reply(reply, results[index]);
+            if (results[index])
+            {
+                ++finished;
+                break;
+            }
+
+            file.stage = writing;
+            for (std::size_t offset = 0; offset < job.size;
+                 offset += sizing.request_size)
+            {
+                std::size_t count =
+                    (std::min)(sizing.request_size, job.size - offset);
+
+                wire_writer body;
+                body.put_string(file.handle)
+                    .put_uint64(offset)
+                    .put_string(job.data + offset, count);
+                owners[pipeline.send(packet_type::write, body.buffer())] =
+                    index;
+                ++file.writes_due;
+            }
+
+            if (file.writes_due == 0)
+                owners[send_after_writes(pipeline, job, file)] = index;
+            break;
+
+        case writing:
+            {
+                boost::system::error_code ec = status_error(reply);
+                if (ec && !file.error)
+                    file.error = ec;
+
+                // Closing even after a failed write so we don't leak the
+                // handle
+                if (--file.writes_due == 0)
+                    owners[send_after_writes(pipeline, job, file)] = index;
+            }
+            break;
+
+        case syncing:
+            file.error = status_error(reply);
+            file.stage = closing;
+            owners[pipeline.send(packet_type::close,
+                                 close_request(file.handle))] = index;
+            break;
+
+        case closing:
+            {
+                boost::system::error_code ec = status_error(reply);
+                results[index] = (file.error) ? file.error : ec;
+                ++finished;
+            }
+            break;
+        }
+    }
+
+    return results;
+}
+
+/**
+ * A request the server answers with nothing but a status, such as MKDIR,
+ * RMDIR, REMOVE or SETSTAT.
+ */
+struct status_request
+{
+    status_request(boost::uint8_t type, const std::string& body)
+        : type(type), body(body)
+    {
+    }
+
+    boost::uint8_t type;
+    std::string body;
+};
+
+/**
+ * Carry out requests that don't depend on each other, keeping up to
+ * `sizing.max_outstanding` in flight at once.
+ *
+ * The server may act on them in any order, so requests that must happen
+ * in turn, such as creating a directory and then its subdirectory, belong
+ * in separate calls.
+ *
+ * @returns the outcome of each request, in the same order as `requests`.
+ * @throws if the channel fails or the server breaks the protocol.  The
+ *         pipeline can't be used again after that because it may still have
+ *         replies due.
+ */
+template <typename Pipeline>
+std::vector<boost::system::error_code>
+run_requests(Pipeline& pipeline, const std::vector<status_request>& requests,
+             const request_sizing& sizing = request_sizing())
+{
+    std::vector<boost::system::error_code> results(requests.size());
+    std::map<boost::uint32_t, std::size_t> owners;
+
+    std::size_t next = 0;
+    std::size_t finished = 0;
+
+    while (finished < requests.size())
+    {
+        while (next < requests.size() &&
+               pipeline.outstanding() < sizing.max_outstanding)
+        {
+            owners[pipeline.send(requests[next].type, requests[next].body)] =
+                next;
+            ++next;
+        }
+
+        packet reply = pipeline.receive();
+
+        std::map<boost::uint32_t, std::size_t>::iterator owner =
+            owners.find(reply.id);
+        if (owner == owners.end())
+            throw_bad_reply("SFTP reply to unknown request");
+
+        results[owner->second] = status_error(reply);
+        owners.erase(owner);
+        ++finished;
+    }
+
+    return results;
+}
+}
+}
+} // namespace ssh::detail::sftp_protocol
+
+#endif
@@ -39,8 +39,13 @@
 
 #include <ssh/detail/libssh2/sftp.hpp> // init
 #include <ssh/detail/session_state.hpp>
+#include <ssh/detail/sftp_protocol.hpp> // protocol_channel
+#include <ssh/block_cache.hpp>
 
+#include <boost/exception_ptr.hpp> // current_exception, rethrow_exception
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <libssh2_sftp.h> // LIBSSH2_SFTP
 
@@ -106,14 +111,124 @@ public:
         return m_sftp;
     }
 
-private:
+    /**
+     * Second SFTP channel, on which we send raw requests, opened the first
+     * time it is needed.
+     *
+     * A channel marked broken is replaced by a fresh one.  The broken one
+     * lives on until the last user to hold it lets go.
+     *
+     * If the first attempt to open the channel fails, for example because
+     * the server only allows one channel per session, later calls fail the
+     * same way without asking the server again.
+     *
+     * Use it through `protocol_use` rather than directly.
+     */
+    boost::shared_ptr<sftp_protocol::protocol_channel> protocol()
+    {
+        boost::mutex::scoped_lock lock(m_protocol_guard);
+
+        if (m_protocol_failure)
+            boost::rethrow_exception(m_protocol_failure);
+
+        if (!m_protocol || m_protocol->is_broken())
+        {
+            try
+            {
+                m_protocol.reset(
+                    new sftp_protocol::protocol_channel(session_ref()));
+            }
+            catch (...)
+            {
+                if (!m_protocol)
+                    m_protocol_failure = boost::current_exception();
+                throw;
+            }
+        }
+
+        return m_protocol;
+    }
+
+    /**
+     * Cache of remote file blocks, or null if reads aren't cached.
+     */
+    boost::shared_ptr<::ssh::filesystem::block_cache> block_cache() const
+    {
+        boost::mutex::scoped_lock lock(m_block_cache_guard);
+        return m_block_cache;
+    }
+
+    void block_cache(boost::shared_ptr<::ssh::filesystem::block_cache> cache)
+    {
+        boost::mutex::scoped_lock lock(m_block_cache_guard);
+        m_block_cache = cache;
+    }
+
+    /**
+     * The session the channel runs on, for opening other channels beside
+     * it.
+     */
     session_state& session_ref()
     {
         return m_session;
     }
 
+private:
+
     session_state& m_session;
     LIBSSH2_SFTP* m_sftp;
+    boost::mutex m_protocol_guard;
+    boost::shared_ptr<sftp_protocol::protocol_channel> m_protocol;
+    boost::exception_ptr m_protocol_failure;
+    mutable boost::mutex m_block_cache_guard;
+    boost::shared_ptr<::ssh::filesystem::block_cache> m_block_cache;
+};
+
+/**
+ * Sole use of the raw SFTP channel for as long as this object lives.
+ *
+ * Keeps its own reference to the channel, so the channel can't be
+ * destroyed while this is using it or waiting for its turn.  If the
+ * channel was marked broken while we waited, we move on to its
+ * replacement.
+ */
+class protocol_use : private boost::noncopyable
+{
+public:
+    explicit protocol_use(sftp_channel_state& sftp)
+    {
+        while (true)
+        {
+            m_channel = sftp.protocol();
+
+            sftp_protocol::protocol_channel::use_lock lock =
+                m_channel->aquire_use_lock();
+            if (!m_channel->is_broken())
+            {
+                m_lock.swap(lock);
+                return;
+            }
+        }
+    }
+
+    sftp_protocol::protocol_channel& channel()
+    {
+        return *m_channel;
+    }
+
+    /**
+     * Mark the channel broken after a failure that may have left replies
+     * due on it, so that the next user gets a fresh one.
+     */
+    void discard()
+    {
+        m_channel->mark_broken();
+    }
+
+private:
+    // Declared first so the lock is released before the reference
+    boost::shared_ptr<sftp_protocol::protocol_channel> m_channel;
+    sftp_protocol::protocol_channel::use_lock m_lock;
 };
 }
 } // namespace ssh::detail
@@ -0,0 +1,324 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_SFTP_COPY_HPP
+#define SSH_DETAIL_SFTP_COPY_HPP
+
+#include <ssh/detail/sftp_batch.hpp> // request_sizing
+#include <ssh/detail/sftp_protocol.hpp>
+#include <ssh/detail/wire.hpp>
+
+#include <boost/cstdint.hpp> // uint32_t, uint64_t
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+#include <algorithm> // min
+#include <cstddef>   // size_t
+#include <map>
+#include <string>
+#include <utility> // make_pair
+
+#include <libssh2_sftp.h> // LIBSSH2_SFTP_*, LIBSSH2_FX_EOF
+
+namespace ssh
+{
+namespace detail
+{
+namespace sftp_protocol
+{
+
+namespace copy_detail
+{
+
+inline std::string handle_request(const std::string& handle)
+{
+    wire_writer body;
+    body.put_string(handle);
+    return body.buffer();
+}
+
+/**
+ * Open a file, returning its handle.
+ */
+template <typename Pipeline>
+std::string open_file(Pipeline& pipeline, const std::string& path,
+                      boost::uint32_t flags,
+                      const LIBSSH2_SFTP_ATTRIBUTES& attributes,
+                      boost::system::error_code& ec)
+{
+    wire_writer body;
+    body.put_string(path).put_uint32(flags);
+    put_attributes(body, attributes);
+
+    return handle_from_reply(
+        pipeline.transact(packet_type::open, body.buffer()), ec);
+}
+
+template <typename Pipeline>
+LIBSSH2_SFTP_ATTRIBUTES fstat(Pipeline& pipeline, const std::string& handle,
+                              boost::system::error_code& ec)
+{
+    packet reply =
+        pipeline.transact(packet_type::fstat, handle_request(handle));
+    if (reply.type == packet_type::attrs)
+    {
+        wire_reader in(reply.payload);
+        return get_attributes(in);
+    }
+
+    ec = status_error(reply);
+    if (!ec)
+        throw_bad_reply("SFTP fstat succeeded without attributes");
+
+    return LIBSSH2_SFTP_ATTRIBUTES();
+}
+
+template <typename Pipeline>
+boost::system::error_code close_file(Pipeline& pipeline,
+                                     const std::string& handle)
+{
+    return status_error(
+        pipeline.transact(packet_type::close, handle_request(handle)));
+}
+
+/**
+ * Have the server copy everything from one open file to another.
+ */
+template <typename Pipeline>
+boost::system::error_code copy_data(Pipeline& pipeline,
+                                    const std::string& source,
+                                    const std::string& target)
+{
+    wire_writer arguments;
+    arguments.put_string(source)
+        .put_uint64(0)
+        .put_uint64(0) // Zero length means up to the end of the file
+        .put_string(target)
+        .put_uint64(0);
+
+    return status_error(pipeline.transact(
+        packet_type::extended, extended_body("copy-data", arguments.buffer())));
+}
+
+struct transfer
+{
+    transfer(bool is_read, boost::uint64_t offset, boost::uint32_t length)
+        : is_read(is_read), offset(offset), length(length)
+    {
+    }
+
+    bool is_read;
+    boost::uint64_t offset;
+    boost::uint32_t length;
+};
+
+/**
+ * Read from one open file and write what arrives to the other, with many
+ * requests in flight at once.
+ *
+ * Copies the first `size` bytes, or fewer if the file turns out to be
+ * shorter by the time we read it.
+ */
+template <typename Pipeline>
+boost::system::error_code
+stream_data(Pipeline& pipeline, const std::string& source,
+            const std::string& target, boost::uint64_t size,
+            const request_sizing& sizing)
+{
+    std::map<boost::uint32_t, transfer> transfers;
+    boost::system::error_code error;
+    boost::uint64_t next_read = 0;
+    std::size_t bytes_in_flight = 0;
+    bool end_of_file = false;
+
+    for (;;)
+    {
+        while (!error && !end_of_file && next_read < size &&
+               pipeline.outstanding() < sizing.max_outstanding &&
+               bytes_in_flight < sizing.max_bytes_in_flight)
+        {
+            boost::uint32_t count = static_cast<boost::uint32_t>(
+                (std::min)(static_cast<boost::uint64_t>(sizing.request_size),
+                           size - next_read));
+
+            wire_writer body;
+            body.put_string(source).put_uint64(next_read).put_uint32(count);
+            transfers.insert(std::make_pair(
+                pipeline.send(packet_type::read, body.buffer()),
+                transfer(true, next_read, count)));
+
+            next_read += count;
+            bytes_in_flight += count;
+        }
+
+        if (pipeline.outstanding() == 0)
+            break;
+
+        packet reply = pipeline.receive();
+
+        std::map<boost::uint32_t, transfer>::iterator pos =
+            transfers.find(reply.id);
+        if (pos == transfers.end())
+            throw_bad_reply("SFTP reply to unknown request");
+
+        transfer done = pos->second;
+        transfers.erase(pos);
+
+        if (done.is_read)
+            bytes_in_flight -= done.length;
+
+        if (!done.is_read)
+        {
+            boost::system::error_code ec = status_error(reply);
+            if (ec && !error)
+                error = ec;
+        }
+        else if (reply.type == packet_type::data)
+        {
+            wire_reader in(reply.payload);
+            std::string data = in.get_string();
+            if (data.empty() || data.size() > done.length)
+                throw_bad_reply("SFTP read returned an impossible amount");
+
+            if (!error)
+            {
+                wire_writer body;
+                body.put_string(target).put_uint64(done.offset).put_string(
+                    data);
+                transfers.insert(std::make_pair(
+                    pipeline.send(packet_type::write, body.buffer()),
+                    transfer(false, done.offset, 0)));
+
+                // Servers may return less than we asked for without being
+                // at the end of the file
+                if (data.size() < done.length)
+                {
+                    boost::uint64_t rest = done.offset + data.size();
+                    boost::uint32_t rest_length = static_cast<boost::uint32_t>(
+                        done.length - data.size());
+
+                    wire_writer again;
+                    again.put_string(source).put_uint64(rest).put_uint32(
+                        rest_length);
+                    transfers.insert(std::make_pair(
+                        pipeline.send(packet_type::read, again.buffer()),
+                        transfer(true, rest, rest_length)));
+                    bytes_in_flight += rest_length;
+                }
+            }
+        }
+        else
+        {
+            boost::system::error_code ec = status_error(reply);
+            if (ec.value() == LIBSSH2_FX_EOF)
+                end_of_file = true; // Shrunk since we asked its size
+            else if (!ec)
+                throw_bad_reply("SFTP read succeeded without data");
+            else if (!error)
+                error = ec;
+        }
+    }
+
+    return error;
+}
+}
+
+/**
+ * Copy a file to a new file on the same server without the data leaving
+ * the server, if possible.
+ *
+ * If the server supports the `copy-data` extension, it copies the data
+ * itself.  Otherwise the data is read and written back over the channel,
+ * never touching the local disk, in requests sized by `sizing`.  The new
+ * file gets the permissions of the old one.
+ *
+ * @throws boost::system::system_error if the source can't be read or the
+ *         target can't be created, including because it already exists.
+ *         If that happens after the target was created, it is left
+ *         incomplete.
+ * @throws if the channel fails or the server breaks the protocol.  The
+ *         pipeline can't be used again after that because it may still have
+ *         replies due.
+ */
+template <typename Pipeline>
+void copy_file(Pipeline& pipeline, const std::string& from,
+               const std::string& to,
+               const request_sizing& sizing = request_sizing())
+{
+    using namespace copy_detail;
+
+    boost::system::error_code ec;
+    std::string source = open_file(pipeline, from, open_flags::read,
+                                   LIBSSH2_SFTP_ATTRIBUTES(), ec);
+    if (ec)
+        BOOST_THROW_EXCEPTION(boost::system::system_error(ec, from));
+
+    LIBSSH2_SFTP_ATTRIBUTES source_attributes = fstat(pipeline, source, ec);
+    if (ec)
+    {
+        close_file(pipeline, source);
+        BOOST_THROW_EXCEPTION(boost::system::system_error(ec, from));
+    }
+
+    LIBSSH2_SFTP_ATTRIBUTES attributes = LIBSSH2_SFTP_ATTRIBUTES();
+    if (source_attributes.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)
+    {
+        attributes.flags = LIBSSH2_SFTP_ATTR_PERMISSIONS;
+        attributes.permissions =
+            source_attributes.permissions & ~LIBSSH2_SFTP_S_IFMT;
+    }
+
+    std::string target = open_file(
+        pipeline, to,
+        open_flags::write | open_flags::create | open_flags::exclusive,
+        attributes, ec);
+    if (ec)
+    {
+        close_file(pipeline, source);
+        BOOST_THROW_EXCEPTION(boost::system::system_error(ec, to));
+    }
+
+    if (pipeline.extensions().count("copy-data"))
+    {
+        ec = copy_data(pipeline, source, target);
+    }
+    else if (source_attributes.flags & LIBSSH2_SFTP_ATTR_SIZE)
+    {
+        ec = stream_data(pipeline, source, target, source_attributes.filesize,
+                         sizing);
+    }
+    else
+    {
+        ec = boost::system::error_code(
+            LIBSSH2_FX_OP_UNSUPPORTED,
+            ::ssh::filesystem::sftp_error_category());
+    }
+
+    // Closing both even after a failure so we don't leak the handles
+    boost::system::error_code source_closed = close_file(pipeline, source);
+    boost::system::error_code target_closed = close_file(pipeline, target);
+
+    if (!ec)
+        ec = (target_closed) ? target_closed : source_closed;
+
+    if (ec)
+        BOOST_THROW_EXCEPTION(boost::system::system_error(ec, to));
+}
+}
+}
+} // namespace ssh::detail::sftp_protocol
+
+#endif
@@ -0,0 +1,631 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_SFTP_PROTOCOL_HPP
+#define SSH_DETAIL_SFTP_PROTOCOL_HPP
+
+#include <ssh/detail/channel_state.hpp>
+#include <ssh/detail/wire.hpp>
+#include <ssh/sftp_error.hpp>      // sftp_error_category
+#include <ssh/sftp_extensions.hpp> // sftp_limits
+
+#include <boost/cstdint.hpp> // uint8_t, uint32_t
+#include <boost/noncopyable.hpp>
+#include <boost/optional/optional.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+#include <cstddef> // size_t
+#include <map>
+#include <stdexcept> // logic_error
+#include <string>
+
+#include <libssh2_sftp.h> // LIBSSH2_SFTP_ATTRIBUTES, LIBSSH2_FX_OK
+
+namespace ssh
+{
+namespace detail
+{
+
+/**
+ * The SFTP protocol, version 3 (draft-ietf-secsh-filexfer-02), spoken
+ * directly rather than through libssh2.
+ *
+ * libssh2 only lets us have one request outstanding per operation and
+ * doesn't let us send extended requests.  Speaking the protocol ourselves,
+ * on a channel of our own, lets us do both.
+ */
+namespace sftp_protocol
+{
+
+const boost::uint32_t protocol_version = 3;
+
+/**
+ * Refuse anything bigger to stop a broken server making us allocate wildly.
+ *
+ * OpenSSH never sends packets over 256 KB.
+ */
+const boost::uint32_t max_packet_size = 4 * 1024 * 1024;
+
+namespace packet_type
+{
+enum value
+{
+    init = 1,
+    version = 2,
+    open = 3,
+    close = 4,
+    read = 5,
+    write = 6,
+    lstat = 7,
+    fstat = 8,
+    setstat = 9,
+    fsetstat = 10,
+    opendir = 11,
+    readdir = 12,
+    remove = 13,
+    mkdir = 14,
+    rmdir = 15,
+    realpath = 16,
+    stat = 17,
+    rename = 18,
+    readlink = 19,
+    symlink = 20,
+
+    status = 101,
+    handle = 102,
+    data = 103,
+    name = 104,
+    attrs = 105,
+
+    extended = 200,
+    extended_reply = 201
+};
+}
+
+namespace open_flags
+{
+enum value
+{
+    read = 0x01,
+    write = 0x02,
+    append = 0x04,
+    create = 0x08,
+    truncate = 0x10,
+    exclusive = 0x20
+};
+}
+
+/**
+ * A reply, or a request as seen by a server.
+ *
+ * The payload follows the request id.
+ */
+struct packet
+{
+    packet() : type(0), id(0)
+    {
+    }
+
+    packet(boost::uint8_t type, boost::uint32_t id, const std::string& payload)
+        : type(type), id(id), payload(payload)
+    {
+    }
+
+    boost::uint8_t type;
+    boost::uint32_t id;
+    std::string payload;
+};
+
+/**
+ * Bytes to send for a request.
+ */
+inline std::string frame(boost::uint8_t type, boost::uint32_t id,
+                         const std::string& body)
+{
+    wire_writer out;
+    out.put_uint32(static_cast<boost::uint32_t>(1 + 4 + body.size()))
+        .put_uint8(type)
+        .put_uint32(id)
+        .put_raw(body.data(), body.size());
+    return out.buffer();
+}
+
+/**
+ * Encode attributes as the protocol does, only including the fields whose
+ * flags are set.
+ */
+inline void put_attributes(wire_writer& out,
+                           const LIBSSH2_SFTP_ATTRIBUTES& attributes)
+{
+    boost::uint32_t flags = static_cast<boost::uint32_t>(
+        attributes.flags &
+        (LIBSSH2_SFTP_ATTR_SIZE | LIBSSH2_SFTP_ATTR_UIDGID |
+         LIBSSH2_SFTP_ATTR_PERMISSIONS | LIBSSH2_SFTP_ATTR_ACMODTIME));
+    out.put_uint32(flags);
+
+    if (flags & LIBSSH2_SFTP_ATTR_SIZE)
+        out.put_uint64(attributes.filesize);
+
+    if (flags & LIBSSH2_SFTP_ATTR_UIDGID)
+    {
+        out.put_uint32(static_cast<boost::uint32_t>(attributes.uid))
+            .put_uint32(static_cast<boost::uint32_t>(attributes.gid));
+    }
+
+    if (flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)
+        out.put_uint32(static_cast<boost::uint32_t>(attributes.permissions));
+
+    if (flags & LIBSSH2_SFTP_ATTR_ACMODTIME)
+    {
+        out.put_uint32(static_cast<boost::uint32_t>(attributes.atime))
+            .put_uint32(static_cast<boost::uint32_t>(attributes.mtime));
+    }
+}
+
+inline LIBSSH2_SFTP_ATTRIBUTES get_attributes(wire_reader& in)
+{
+    LIBSSH2_SFTP_ATTRIBUTES attributes = LIBSSH2_SFTP_ATTRIBUTES();
+    boost::uint32_t flags = in.get_uint32();
+
+    if (flags & LIBSSH2_SFTP_ATTR_SIZE)
+        attributes.filesize = in.get_uint64();
+
+    if (flags & LIBSSH2_SFTP_ATTR_UIDGID)
+    {
+        attributes.uid = in.get_uint32();
+        attributes.gid = in.get_uint32();
+    }
+
+    if (flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)
+        attributes.permissions = in.get_uint32();
+
+    if (flags & LIBSSH2_SFTP_ATTR_ACMODTIME)
+    {
+        attributes.atime = in.get_uint32();
+        attributes.mtime = in.get_uint32();
+    }
+
+    if (flags & LIBSSH2_SFTP_ATTR_EXTENDED)
+    {
+        // We don't understand any, but must step over them
+        boost::uint32_t count = in.get_uint32();
+        for (boost::uint32_t i = 0; i < count; ++i)
+        {
+            in.get_string();
+            in.get_string();
+        }
+    }
+
+    attributes.flags = flags & ~LIBSSH2_SFTP_ATTR_EXTENDED;
+    return attributes;
+}
+
+inline void throw_bad_reply(const char* description)
+{
+    BOOST_THROW_EXCEPTION(boost::system::system_error(
+        boost::system::errc::make_error_code(boost::system::errc::bad_message),
+        description));
+}
+
+/**
+ * The error reported by a status reply, if any.
+ *
+ * @param message  Set to the server's description of the error.
+ */
+inline boost::system::error_code status_error(const packet& reply,
+                                              std::string& message)
+{
+    if (reply.type != packet_type::status)
+        throw_bad_reply("Expected SFTP status reply");
+
+    wire_reader in(reply.payload);
+    boost::uint32_t code = in.get_uint32();
+
+    // Some old servers leave out the message and language tag
+    if (!in.empty())
+        message = in.get_string();
+
+    if (code == LIBSSH2_FX_OK)
+        return boost::system::error_code();
+    else
+        return boost::system::error_code(
+            static_cast<int>(code), ::ssh::filesystem::sftp_error_category());
+}
+
+inline boost::system::error_code status_error(const packet& reply)
+{
+    std::string message;
+    return status_error(reply, message);
+}
+
+/**
+ * Throw the error in a status reply, if it reports one.
+ */
+inline void check_status(const packet& reply)
+{
+    std::string message;
+    boost::system::error_code ec = status_error(reply, message);
+    if (ec)
+        BOOST_THROW_EXCEPTION(boost::system::system_error(ec, message));
+}
+
+/**
+ * The handle from a reply to OPEN or OPENDIR.
+ *
+ * @param ec  Set if the server replied with an error instead.
+ */
+inline std::string handle_from_reply(const packet& reply,
+                                     boost::system::error_code& ec)
+{
+    if (reply.type == packet_type::handle)
+    {
+        wire_reader in(reply.payload);
+        return in.get_string();
+    }
+    else
+    {
+        ec = status_error(reply);
+        if (!ec)
+            throw_bad_reply("SFTP open succeeded without a handle");
+        return std::string();
+    }
+}
+
+/**
+ * Body of an extended request: the extension's name, then its arguments,
+ * already encoded as the extension defines.
+ */
+inline std::string extended_body(const std::string& name,
+                                 const std::string& arguments)
+{
+    wire_writer out;
+    out.put_string(name).put_raw(arguments.data(), arguments.size());
+    return out.buffer();
+}
+
+/**
+ * The data from the reply to an extended request.
+ *
+ * Extensions that have nothing to return answer with a status instead, in
+ * which case this returns an empty string if the status is a success.
+ *
+ * @throws boost::system::system_error if the server reported an error,
+ *         including not supporting the extension.
+ */
+inline std::string extended_reply_data(const packet& reply)
+{
+    if (reply.type == packet_type::extended_reply)
+        return reply.payload;
+
+    check_status(reply);
+    return std::string();
+}
+
+/**
+ * Carries packets over a channel running the SFTP subsystem.
+ */
+class channel_transport : private boost::noncopyable
+{
+public:
+    explicit channel_transport(channel_state& channel) : m_channel(channel)
+    {
+    }
+
+    void write(const char* data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            channel_state::scoped_lock lock = m_channel.aquire_lock();
+
+            ssize_t count = libssh2::channel::write(
+                m_channel.session_ptr(), m_channel.channel_ptr(), 0, data,
+                size);
+
+            data += count;
+            size -= static_cast<std::size_t>(count);
+        }
+    }
+
+    void read(char* buffer, std::size_t size)
+    {
+        while (size > 0)
+        {
+            channel_state::scoped_lock lock = m_channel.aquire_lock();
+
+            ssize_t count = libssh2::channel::read(
+                m_channel.session_ptr(), m_channel.channel_ptr(), 0, buffer,
+                size);
+            if (count == 0)
+            {
+                BOOST_THROW_EXCEPTION(boost::system::system_error(
+                    boost::system::errc::make_error_code(
+                        boost::system::errc::connection_reset),
+                    "SFTP server closed the channel"));
+            }
+
+            buffer += count;
+            size -= static_cast<std::size_t>(count);
+        }
+    }
+
+private:
+    channel_state& m_channel;
+};
+
+/**
+ * SFTP client that can have many requests outstanding at once.
+ *
+ * Requests are tagged with an id and the replies come back tagged with the
+ * same id, not necessarily in order.  The caller matches them up.
+ *
+ * The transport must provide `write(const char*, size_t)` and
+ * `read(char*, size_t)`, both of which transfer exactly the number of bytes
+ * given or throw.
+ *
+ * Not thread-safe: the caller must make sure only one thread uses it at a
+ * time.
+ */
+template <typename Transport>
+class request_pipeline : private boost::noncopyable
+{
+public:
+    typedef std::map<std::string, std::string> extension_map;
+
+    /**
+     * Start the protocol, learning the server's version and extensions.
+     */
+    explicit request_pipeline(Transport& transport)
+        : m_transport(transport), m_next_id(0), m_outstanding(0)
+    {
+        wire_writer init;
+        init.put_uint32(1 + 4).put_uint8(packet_type::init).put_uint32(
+            protocol_version);
+        m_transport.write(init.buffer().data(), init.buffer().size());
+
+        std::string version = read_packet();
+        wire_reader in(version);
+        if (in.get_uint8() != packet_type::version)
+            throw_bad_reply("Expected SFTP version");
+
+        m_version = in.get_uint32();
+        while (!in.empty())
+        {
+            std::string name = in.get_string();
+            m_extensions[name] = in.get_string();
+        }
+    }
+
+    boost::uint32_t version() const
+    {
+        return m_version;
+    }
+
+    /**
+     * Extensions announced by the server, mapped to their version data.
+     */
+    const extension_map& extensions() const
+    {
+        return m_extensions;
+    }
+
+    bool supports(const std::string& extension,
+                  const std::string& version) const
+    {
+        extension_map::const_iterator pos = m_extensions.find(extension);
+        return pos != m_extensions.end() && pos->second == version;
+    }
+
+    /**
+     * Send a request without waiting for its reply.
+     *
+     * @returns id that the reply will carry.
+     */
+    boost::uint32_t send(boost::uint8_t type, const std::string& body)
+    {
+        boost::uint32_t id = m_next_id++;
+
+        std::string request = frame(type, id, body);
+        m_transport.write(request.data(), request.size());
+        ++m_outstanding;
+
+        return id;
+    }
+
+    /**
+     * Send an extended request without waiting for its reply.
+     *
+     * @returns id that the reply will carry.
+     */
+    boost::uint32_t send_extended(const std::string& name,
+                                  const std::string& arguments)
+    {
+        return send(packet_type::extended, extended_body(name, arguments));
+    }
+
+    /**
+     * Wait for the next reply to arrive, whichever request it answers.
+     */
+    packet receive()
+    {
+        if (m_outstanding == 0)
+        {
+            BOOST_THROW_EXCEPTION(
+                std::logic_error("No SFTP requests outstanding"));
+        }
+
+        std::string bytes = read_packet();
+        wire_reader in(bytes);
+
+        packet reply;
+        reply.type = in.get_uint8();
+        reply.id = in.get_uint32();
+        reply.payload = bytes.substr(bytes.size() - in.remaining());
+        --m_outstanding;
+
+        return reply;
+    }
+
+    /**
+     * Send a request and wait for its reply.
+     *
+     * Only allowed when nothing else is outstanding.
+     */
+    packet transact(boost::uint8_t type, const std::string& body)
+    {
+        if (m_outstanding > 0)
+        {
+            BOOST_THROW_EXCEPTION(std::logic_error(
+                "Can't wait for a single SFTP reply while others are due"));
+        }
+
+        boost::uint32_t id = send(type, body);
+        packet reply = receive();
+        if (reply.id != id)
+            throw_bad_reply("SFTP reply to unknown request");
+
+        return reply;
+    }
+
+    /**
+     * Send an extended request and wait for the data it returns.
+     *
+     * Only allowed when nothing else is outstanding.
+     */
+    std::string transact_extended(const std::string& name,
+                                  const std::string& arguments)
+    {
+        return extended_reply_data(
+            transact(packet_type::extended, extended_body(name, arguments)));
+    }
+
+    std::size_t outstanding() const
+    {
+        return m_outstanding;
+    }
+
+    /**
+     * Sizes the server accepts, asked for the first time they're wanted.
+     *
+     * All zero if the server can't say.  Only allowed when nothing else is
+     * outstanding.
+     */
+    const ::ssh::filesystem::sftp_limits& limits()
+    {
+        if (!m_limits)
+        {
+            ::ssh::filesystem::sftp_limits limits;
+            if (supports("limits@openssh.com", "1"))
+            {
+                std::string data =
+                    transact_extended("limits@openssh.com", std::string());
+                wire_reader in(data);
+                limits.max_packet_length = in.get_uint64();
+                limits.max_read_length = in.get_uint64();
+                limits.max_write_length = in.get_uint64();
+                limits.max_open_handles = in.get_uint64();
+            }
+
+            m_limits = limits;
+        }
+
+        return *m_limits;
+    }
+
+private:
+    std::string read_packet()
+    {
+        char length_bytes[4];
+        m_transport.read(length_bytes, sizeof(length_bytes));
+
+        boost::uint32_t length = load_uint32(length_bytes);
+        if (length == 0 || length > max_packet_size)
+            throw_bad_reply("SFTP packet has an impossible length");
+
+        std::string bytes(length, '\0');
+        m_transport.read(&bytes[0], bytes.size());
+        return bytes;
+    }
+
+    Transport& m_transport;
+    boost::uint32_t m_version;
+    extension_map m_extensions;
+    boost::uint32_t m_next_id;
+    std::size_t m_outstanding;
+    boost::optional< ::ssh::filesystem::sftp_limits> m_limits;
+};
+
+/**
+ * A second SFTP channel on a session, which we speak the protocol on
+ * ourselves.
+ *
+ * Each user must hold the lock from `aquire_use_lock` for as long as it
+ * has requests outstanding so that replies go to whoever is waiting for
+ * them.
+ *
+ * A user that fails part way through a request marks the channel broken,
+ * as replies may still be due on it.  The channel stays alive for anyone
+ * still holding it but nobody should send anything more on it.
+ */
+class protocol_channel : private boost::noncopyable
+{
+public:
+    typedef boost::mutex::scoped_lock use_lock;
+
+    explicit protocol_channel(session_state& session)
+        : m_broken(false),
+          m_channel(session, "subsystem", "sftp"),
+          m_transport(m_channel),
+          m_pipeline(m_transport)
+    {
+    }
+
+    use_lock aquire_use_lock()
+    {
+        return use_lock(m_in_use);
+    }
+
+    void mark_broken()
+    {
+        boost::mutex::scoped_lock lock(m_broken_guard);
+        m_broken = true;
+    }
+
+    bool is_broken() const
+    {
+        boost::mutex::scoped_lock lock(m_broken_guard);
+        return m_broken;
+    }
+
+    request_pipeline<channel_transport>& pipeline()
+    {
+        return m_pipeline;
+    }
+
+private:
+    boost::mutex m_in_use;
+    mutable boost::mutex m_broken_guard;
+    bool m_broken;
+    channel_state m_channel;
+    channel_transport m_transport;
+    request_pipeline<channel_transport> m_pipeline;
+};
+}
+}
+} // namespace ssh::detail::sftp_protocol
+
+#endif
@@ -0,0 +1,270 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_SFTP_WALK_HPP
+#define SSH_DETAIL_SFTP_WALK_HPP
+
+#include <ssh/detail/sftp_batch.hpp> // request_sizing
+#include <ssh/detail/sftp_protocol.hpp>
+#include <ssh/detail/wire.hpp>
+
+#include <boost/cstdint.hpp> // uint32_t
+#include <boost/system/error_code.hpp>
+
+#include <cstddef> // size_t
+#include <deque>
+#include <map>
+#include <string>
+#include <utility> // pair
+#include <vector>
+
+#include <libssh2_sftp.h> // LIBSSH2_SFTP_*
+
+namespace ssh
+{
+namespace detail
+{
+namespace sftp_protocol
+{
+
+/**
+ * Something found below the root of a walk.
+ */
+struct tree_entry
+{
+    /**
+     * Path relative to the root, with `/` between the segments.
+     */
+    std::string name;
+
+    /**
+     * As the server listed them, so links are not followed.
+     */
+    LIBSSH2_SFTP_ATTRIBUTES attributes;
+};
+
+struct tree_listing
+{
+    std::vector<tree_entry> entries;
+
+    /**
+     * Directories that couldn't be opened or read, by relative name.  The
+     * root is the empty name.
+     *
+     * Entries read from a directory before it failed are kept.
+     */
+    std::vector<std::pair<std::string, boost::system::error_code>> failures;
+};
+
+inline bool is_directory_entry(const LIBSSH2_SFTP_ATTRIBUTES& attributes)
+{
+    return (attributes.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) &&
+           (attributes.permissions & LIBSSH2_SFTP_S_IFMT) ==
+               LIBSSH2_SFTP_S_IFDIR;
+}
+
+inline bool is_file_entry(const LIBSSH2_SFTP_ATTRIBUTES& attributes)
+{
+    return (attributes.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) &&
+           (attributes.permissions & LIBSSH2_SFTP_S_IFMT) ==
+               LIBSSH2_SFTP_S_IFREG;
+}
+
+namespace walk_detail
+{
+
+enum walk_stage
+{
+    opening,
+    reading,
+    closing
+};
+
+struct directory_progress
+{
+    directory_progress() : stage(opening)
+    {
+    }
+
+    explicit directory_progress(const std::string& name)
+        : name(name), stage(opening)
+    {
+    }
+
+    std::string name;
+    walk_stage stage;
+    std::string handle;
+};
+
+inline std::string path_request(const std::string& path)
+{
+    wire_writer body;
+    body.put_string(path);
+    return body.buffer();
+}
+
+inline std::string child_name(const std::string& parent,
+                              const std::string& filename)
+{
+    return (parent.empty()) ? filename : parent + "/" + filename;
+}
+
+inline std::string full_path(const std::string& root,
+                             const std::string& name)
+{
+    if (name.empty())
+        return root;
+    else if (!root.empty() && root[root.size() - 1] == '/')
+        return root + name;
+    else
+        return root + "/" + name;
+}
+}
+
+/**
+ * List everything below a directory on the server, however deep.
+ *
+ * Rather than listing one directory after another, each subdirectory is
+ * opened as soon as its parent's listing names it, so many directories are
+ * read at once and a deep tree costs about as many round trips as it has
+ * levels rather than one for every directory.  New directories are opened
+ * whenever fewer than `sizing.max_outstanding` requests are waiting and
+ * fewer than `sizing.max_open_handles` directories are open.
+ *
+ * Links are listed but not followed.
+ *
+ * @returns every entry, in no particular order, and the directories that
+ *          couldn't be read.  A root that can't be opened is reported as a
+ *          failure of the empty name rather than thrown.
+ * @throws if the channel fails or the server breaks the protocol.  The
+ *         pipeline can't be used again after that because it may still have
+ *         replies due.
+ */
+template <typename Pipeline>
+tree_listing walk_tree(Pipeline& pipeline, const std::string& root,
+                       const request_sizing& sizing = request_sizing())
+{
+    using namespace walk_detail;
+
+    tree_listing listing;
+
+    std::deque<std::string> waiting(1, std::string());
+    std::map<boost::uint32_t, directory_progress> owners;
+    std::size_t open = 0;
+
+    while (!waiting.empty() || !owners.empty())
+    {
+        while (!waiting.empty() &&
+               pipeline.outstanding() < sizing.max_outstanding &&
+               (sizing.max_open_handles == 0 ||
+                open < sizing.max_open_handles))
+        {
+            const std::string& name = waiting.front();
+            owners[pipeline.send(packet_type::opendir,
+                                 path_request(full_path(root, name)))] =
+                directory_progress(name);
+            waiting.pop_front();
+            ++open;
+        }
+
+        packet reply = pipeline.receive();
+
+        std::map<boost::uint32_t, directory_progress>::iterator owner =
+            owners.find(reply.id);
+        if (owner == owners.end())
+            throw_bad_reply("SFTP reply to unknown request");
+
+        directory_progress directory = owner->second;
+        owners.erase(owner);
+
+        switch (directory.stage)
+        {
+        case opening:
+            {
+                boost::system::error_code ec;
+                directory.handle = handle_from_reply(reply, ec);
+                if (ec)
+                {
+                    listing.failures.push_back(
+                        std::make_pair(directory.name, ec));
+                    --open;
+                    break;
+                }
+
+                directory.stage = reading;
+                owners[pipeline.send(packet_type::readdir,
+                                     path_request(directory.handle))] =
+                    directory;
+            }
+            break;
+
+        case reading:
+            if (reply.type == packet_type::name)
+            {
+                wire_reader in(reply.payload);
+                boost::uint32_t count = in.get_uint32();
+                for (boost::uint32_t i = 0; i < count; ++i)
+                {
+                    std::string filename = in.get_string();
+                    in.get_string(); // long name, meant for people
+                    LIBSSH2_SFTP_ATTRIBUTES attributes = get_attributes(in);
+
+                    if (filename == "." || filename == "..")
+                        continue;
+
+                    tree_entry entry;
+                    entry.name = child_name(directory.name, filename);
+                    entry.attributes = attributes;
+                    listing.entries.push_back(entry);
+
+                    if (is_directory_entry(attributes))
+                        waiting.push_back(entry.name);
+                }
+
+                owners[pipeline.send(packet_type::readdir,
+                                     path_request(directory.handle))] =
+                    directory;
+            }
+            else
+            {
+                boost::system::error_code ec = status_error(reply);
+                if (ec && ec.value() != LIBSSH2_FX_EOF)
+                {
+                    listing.failures.push_back(
+                        std::make_pair(directory.name, ec));
+                }
+
+                directory.stage = closing;
+                owners[pipeline.send(packet_type::close,
+                                     path_request(directory.handle))] =
+                    directory;
+            }
+            break;
+
+        case closing:
+            // Nothing we could do about a failure now that the listing is
+            // complete
+            --open;
+            break;
+        }
+    }
+
+    return listing;
+}
+}
+}
+} // namespace ssh::detail::sftp_protocol
+
+#endif
@@ -0,0 +1,46 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_SHELL_QUOTE_HPP
+#define SSH_DETAIL_SHELL_QUOTE_HPP
+
+#include <cstddef> // size_t
+#include <string>
+
+namespace ssh
+{
+namespace detail
+{
+
+/**
+ * Quote a string so a POSIX shell takes it literally.
+ */
+inline std::string shell_quote(const std::string& text)
+{
+    std::string quoted = "'";
+    for (std::size_t i = 0; i < text.size(); ++i)
+    {
+        if (text[i] == '\'')
+            quoted += "'\\''";
+        else
+            quoted += text[i];
+    }
+    quoted += "'";
+    return quoted;
+}
+}
+} // namespace ssh::detail
+
+#endif
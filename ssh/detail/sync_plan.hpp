@@ -0,0 +1,248 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_SYNC_PLAN_HPP
+#define SSH_DETAIL_SYNC_PLAN_HPP
+
+#include <boost/cstdint.hpp> // uint64_t
+#include <boost/function.hpp>
+
+#include <algorithm> // count, stable_sort
+#include <cstddef>   // size_t
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace ssh
+{
+namespace detail
+{
+
+/**
+ * What a sync knows about one thing in a tree.
+ */
+struct sync_item
+{
+    enum item_type
+    {
+        file,
+        directory,
+
+        /** Links, devices and anything else, which are never copied. */
+        other
+    };
+
+    sync_item() : type(file), size(0), mtime(0)
+    {
+    }
+
+    sync_item(item_type type, boost::uint64_t size, boost::uint64_t mtime)
+        : type(type), size(size), mtime(mtime)
+    {
+    }
+
+    item_type type;
+    boost::uint64_t size;
+
+    /** Seconds since the epoch, the finest that SFTP version 3 has. */
+    boost::uint64_t mtime;
+};
+
+/**
+ * A tree by path relative to its root, with `/` between the segments.
+ *
+ * Being ordered, a directory comes before everything in it.
+ */
+typedef std::map<std::string, sync_item> sync_tree;
+
+/**
+ * What it takes to make the remote tree match the local one, in the order
+ * it has to be done: removals, then new directories, then uploads and
+ * times.
+ */
+struct sync_plan
+{
+    sync_plan() : unchanged(0)
+    {
+    }
+
+    /**
+     * Files, links and anything else that isn't a directory.
+     */
+    std::vector<std::string> remove_files;
+
+    /**
+     * Deepest first, so each is empty by the time it is removed.
+     */
+    std::vector<std::string> remove_directories;
+
+    /**
+     * Parents first.
+     */
+    std::vector<std::string> create_directories;
+
+    /**
+     * Files the server is missing or has a different version of.
+     */
+    std::vector<std::string> uploads;
+
+    /**
+     * Files the server has the same contents of but with a different
+     * modification time.
+     */
+    std::vector<std::string> touches;
+
+    /**
+     * Files left alone because the server's copy already matches.
+     */
+    std::size_t unchanged;
+};
+
+/**
+ * Told the name of a file that is the same size in both trees but has a
+ * different time.  Returns whether the contents are the same anyway.
+ */
+typedef boost::function<bool(const std::string&)> contents_comparison;
+
+namespace sync_detail
+{
+
+inline std::size_t depth(const std::string& name)
+{
+    return static_cast<std::size_t>(std::count(name.begin(), name.end(), '/'));
+}
+
+inline bool deeper(const std::string& lhs, const std::string& rhs)
+{
+    return depth(lhs) > depth(rhs);
+}
+
+/**
+ * Whether the name is inside any of the directories.
+ */
+inline bool is_below(const std::string& name,
+                     const std::set<std::string>& directories)
+{
+    std::string::size_type slash = name.rfind('/');
+    while (slash != std::string::npos)
+    {
+        if (directories.count(name.substr(0, slash)))
+            return true;
+
+        slash = name.rfind('/', slash - 1);
+        if (slash == 0)
+            break;
+    }
+
+    return false;
+}
+
+inline bool same_type(sync_item::item_type lhs, sync_item::item_type rhs)
+{
+    return lhs == rhs && lhs != sync_item::other;
+}
+}
+
+/**
+ * The fewest changes that make `remote` hold everything in `local`.
+ *
+ * A file is uploaded if the server doesn't have it or has it with a
+ * different size or time.  Where only the time differs and `same_contents`
+ * says the contents match, the file's time is set instead.  Without
+ * `same_contents`, any difference in time means an upload.
+ *
+ * Anything on the server in the way of a local file or directory, such as
+ * a directory where the local tree has a file, is removed whatever
+ * `remove_extraneous` says.  Other things on the server that aren't in the
+ * local tree are only removed if `remove_extraneous` is set.
+ *
+ * Local links and anything else that isn't a file or directory should be
+ * left out of `local`; they aren't copied.
+ */
+inline sync_plan
+plan_sync(const sync_tree& local, const sync_tree& remote,
+          bool remove_extraneous,
+          contents_comparison same_contents = contents_comparison())
+{
+    using namespace sync_detail;
+
+    sync_plan plan;
+
+    // Remote directories going, along with all they hold
+    std::set<std::string> removed_directories;
+
+    for (sync_tree::const_iterator it = remote.begin(); it != remote.end();
+         ++it)
+    {
+        sync_tree::const_iterator mine = local.find(it->first);
+
+        bool remove;
+        if (is_below(it->first, removed_directories))
+            remove = true;
+        else if (mine == local.end())
+            remove = remove_extraneous;
+        else
+            remove = !same_type(mine->second.type, it->second.type);
+
+        if (!remove)
+            continue;
+
+        if (it->second.type == sync_item::directory)
+        {
+            removed_directories.insert(it->first);
+            plan.remove_directories.push_back(it->first);
+        }
+        else
+        {
+            plan.remove_files.push_back(it->first);
+        }
+    }
+
+    std::stable_sort(plan.remove_directories.begin(),
+                     plan.remove_directories.end(), &deeper);
+
+    for (sync_tree::const_iterator it = local.begin(); it != local.end();
+         ++it)
+    {
+        sync_tree::const_iterator theirs = remote.find(it->first);
+        bool present = theirs != remote.end() &&
+                       same_type(theirs->second.type, it->second.type) &&
+                       !is_below(it->first, removed_directories);
+
+        if (it->second.type == sync_item::directory)
+        {
+            if (!present)
+                plan.create_directories.push_back(it->first);
+        }
+        else if (it->second.type == sync_item::file)
+        {
+            if (!present || theirs->second.size != it->second.size)
+                plan.uploads.push_back(it->first);
+            else if (theirs->second.mtime == it->second.mtime)
+                ++plan.unchanged;
+            else if (same_contents && same_contents(it->first))
+                plan.touches.push_back(it->first);
+            else
+                plan.uploads.push_back(it->first);
+        }
+    }
+
+    return plan;
+}
+}
+} // namespace ssh::detail
+
+#endif
@@ -0,0 +1,600 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file
+ *
+ * Just enough of the tar format to stream trees of files and directories
+ * to and from the `tar` command on a server.
+ *
+ * We write POSIX ustar, with GNU long-name entries for names ustar can't
+ * hold.  We read that, plain GNU archives and the pax headers that BSD tar
+ * writes.
+ */
+
+#ifndef SSH_DETAIL_TAR_HPP
+#define SSH_DETAIL_TAR_HPP
+
+#include <boost/cstdint.hpp> // uint64_t
+#include <boost/lexical_cast.hpp>
+#include <boost/system/error_code.hpp> // errc
+#include <boost/system/system_error.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+#include <algorithm> // copy, fill, min
+#include <cstddef>   // size_t
+#include <cstring>   // memcpy
+#include <istream>
+#include <ostream>
+#include <stdexcept> // runtime_error
+#include <string>
+
+namespace ssh
+{
+namespace detail
+{
+namespace tar
+{
+
+const std::size_t block_size = 512;
+
+namespace entry_type
+{
+const char file = '0';
+const char hard_link = '1';
+const char symlink = '2';
+const char directory = '5';
+const char pax_header = 'x';
+const char pax_global_header = 'g';
+const char gnu_long_name = 'L';
+const char gnu_long_link = 'K';
+}
+
+/**
+ * One file or directory in an archive.
+ */
+struct entry
+{
+    entry() : type(entry_type::file), mode(0644), size(0), mtime(0)
+    {
+    }
+
+    /** Path relative to the archive root, '/'-separated. */
+    std::string name;
+    char type;
+    unsigned long mode;
+    boost::uint64_t size;
+
+    /** Seconds since the Unix epoch. */
+    boost::uint64_t mtime;
+};
+
+namespace tar_detail
+{
+
+// Offsets and widths of the header fields we use
+const std::size_t name_offset = 0;
+const std::size_t name_width = 100;
+const std::size_t mode_offset = 100;
+const std::size_t uid_offset = 108;
+const std::size_t gid_offset = 116;
+const std::size_t id_width = 8;
+const std::size_t size_offset = 124;
+const std::size_t size_width = 12;
+const std::size_t mtime_offset = 136;
+const std::size_t mtime_width = 12;
+const std::size_t checksum_offset = 148;
+const std::size_t checksum_width = 8;
+const std::size_t type_offset = 156;
+const std::size_t magic_offset = 257;
+const std::size_t prefix_offset = 345;
+const std::size_t prefix_width = 155;
+
+inline void throw_bad_archive(const char* description)
+{
+    BOOST_THROW_EXCEPTION(boost::system::system_error(
+        boost::system::errc::make_error_code(boost::system::errc::bad_message),
+        description));
+}
+
+inline std::size_t padding_for(boost::uint64_t size)
+{
+    return static_cast<std::size_t>((block_size - size % block_size) %
+                                    block_size);
+}
+
+/**
+ * Write a number as zero-padded octal, or in GNU base-256 if it is too big
+ * for octal to fit the field.
+ */
+inline void put_number(char* field, std::size_t width, boost::uint64_t value)
+{
+    boost::uint64_t octal_limit = 1;
+    for (std::size_t i = 0; i < width - 1; ++i)
+    {
+        octal_limit *= 8;
+    }
+
+    if (value < octal_limit)
+    {
+        field[width - 1] = '\0';
+        for (std::size_t i = width - 1; i > 0; --i)
+        {
+            field[i - 1] = static_cast<char>('0' + (value & 7));
+            value >>= 3;
+        }
+    }
+    else
+    {
+        for (std::size_t i = width; i > 0; --i)
+        {
+            field[i - 1] = static_cast<char>(value & 0xFF);
+            value >>= 8;
+        }
+        field[0] = static_cast<char>(0x80);
+    }
+}
+
+inline boost::uint64_t get_number(const char* field, std::size_t width)
+{
+    boost::uint64_t value = 0;
+
+    if (static_cast<unsigned char>(field[0]) & 0x80)
+    {
+        for (std::size_t i = 1; i < width; ++i)
+        {
+            value = (value << 8) | static_cast<unsigned char>(field[i]);
+        }
+        return value;
+    }
+
+    std::size_t i = 0;
+    while (i < width && field[i] == ' ')
+    {
+        ++i;
+    }
+
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; ++i)
+    {
+        value = (value << 3) | static_cast<boost::uint64_t>(field[i] - '0');
+    }
+
+    return value;
+}
+
+/**
+ * Sum of the header's bytes, counting the checksum field as spaces.
+ */
+inline unsigned long checksum(const char* header)
+{
+    unsigned long sum = 0;
+    for (std::size_t i = 0; i < block_size; ++i)
+    {
+        if (i >= checksum_offset && i < checksum_offset + checksum_width)
+            sum += ' ';
+        else
+            sum += static_cast<unsigned char>(header[i]);
+    }
+    return sum;
+}
+
+inline std::string field_string(const char* field, std::size_t width)
+{
+    const char* end = std::find(field, field + width, '\0');
+    return std::string(field, end);
+}
+
+inline std::string header_block(const std::string& name, const entry& e,
+                                const std::string& prefix, const char* magic)
+{
+    char header[block_size];
+    std::fill(header, header + block_size, '\0');
+
+    std::copy(name.begin(), name.end(), header + name_offset);
+    put_number(header + mode_offset, id_width, e.mode & 07777);
+    put_number(header + uid_offset, id_width, 0);
+    put_number(header + gid_offset, id_width, 0);
+    put_number(header + size_offset, size_width, e.size);
+    put_number(header + mtime_offset, mtime_width, e.mtime);
+    header[type_offset] = e.type;
+    std::memcpy(header + magic_offset, magic, 8);
+    std::copy(prefix.begin(), prefix.end(), header + prefix_offset);
+
+    // Six octal digits, a NUL and a space, as historical tars wrote it
+    put_number(header + checksum_offset, checksum_width - 1,
+               checksum(header));
+    header[checksum_offset + checksum_width - 1] = ' ';
+
+    return std::string(header, block_size);
+}
+
+/**
+ * Split a name into a ustar prefix and name, if it can be.
+ */
+inline bool split_name(const std::string& name, std::string& prefix,
+                       std::string& rest)
+{
+    if (name.size() <= name_width)
+    {
+        prefix.clear();
+        rest = name;
+        return true;
+    }
+
+    // The name part can't be empty, so a directory's trailing slash is no
+    // use
+    std::string::size_type slash = name.find('/', name.size() - name_width - 1);
+    if (slash == std::string::npos || slash == 0 || slash > prefix_width ||
+        slash + 1 == name.size())
+        return false;
+
+    prefix = name.substr(0, slash);
+    rest = name.substr(slash + 1);
+    return true;
+}
+
+/**
+ * Value of `key` in a pax extended header, if it sets it.
+ *
+ * Records are "<length> <key>=<value>\n".
+ */
+inline bool pax_value(const std::string& records, const std::string& key,
+                      std::string& value)
+{
+    std::string::size_type position = 0;
+    bool found = false;
+    while (position < records.size())
+    {
+        std::string::size_type space = records.find(' ', position);
+        if (space == std::string::npos)
+            throw_bad_archive("pax record has no length");
+
+        std::size_t length = 0;
+        try
+        {
+            length = boost::lexical_cast<std::size_t>(
+                records.substr(position, space - position));
+        }
+        catch (const boost::bad_lexical_cast&)
+        {
+            throw_bad_archive("pax record length is not a number");
+        }
+
+        if (length == 0 || position + length > records.size())
+            throw_bad_archive("pax record overruns the header");
+
+        std::string record = records.substr(space + 1,
+                                            position + length - space - 2);
+        std::string::size_type equals = record.find('=');
+        if (equals != std::string::npos && record.substr(0, equals) == key)
+        {
+            // Later records win
+            value = record.substr(equals + 1);
+            found = true;
+        }
+
+        position += length;
+    }
+
+    return found;
+}
+}
+
+/**
+ * Writes an archive to a stream.
+ *
+ * Directories must be added before anything inside them.  The archive isn't
+ * complete until `finish` is called.
+ */
+class writer
+{
+public:
+    explicit writer(std::ostream& out) : m_out(out)
+    {
+    }
+
+    void add_directory(const std::string& name, unsigned long mode,
+                       boost::uint64_t mtime)
+    {
+        entry e;
+        e.name = name + "/";
+        e.type = entry_type::directory;
+        e.mode = mode;
+        e.mtime = mtime;
+        put_header(e);
+    }
+
+    /**
+     * Add a file, copying exactly `e.size` bytes of it from `data`.
+     *
+     * @throws if `data` ends early, in which case the archive is left
+     *         unusable.
+     */
+    void add_file(const entry& e, std::istream& data)
+    {
+        put_header(e);
+
+        char buffer[32 * 1024];
+        boost::uint64_t remaining = e.size;
+        while (remaining > 0)
+        {
+            std::streamsize wanted = static_cast<std::streamsize>(
+                (std::min)(remaining,
+                           static_cast<boost::uint64_t>(sizeof(buffer))));
+            data.read(buffer, wanted);
+            if (data.gcount() != wanted)
+            {
+                BOOST_THROW_EXCEPTION(std::runtime_error(
+                    e.name + " got shorter while it was being archived"));
+            }
+
+            write(buffer, wanted);
+            remaining -= static_cast<boost::uint64_t>(wanted);
+        }
+
+        pad(e.size);
+    }
+
+    /**
+     * Mark the end of the archive with two empty blocks.
+     */
+    void finish()
+    {
+        char zeros[2 * block_size];
+        std::fill(zeros, zeros + sizeof(zeros), '\0');
+        write(zeros, sizeof(zeros));
+        m_out.flush();
+    }
+
+private:
+    void put_header(const entry& e)
+    {
+        static const char ustar_magic[] = "ustar\0" "00";
+        static const char gnu_magic[] = "ustar  ";
+
+        std::string prefix;
+        std::string name;
+        if (!tar_detail::split_name(e.name, prefix, name))
+        {
+            entry long_name;
+            long_name.type = entry_type::gnu_long_name;
+            long_name.mode = 0;
+            long_name.size = e.name.size() + 1;
+            std::string header = tar_detail::header_block(
+                "././@LongLink", long_name, std::string(), gnu_magic);
+            write(header.data(), header.size());
+            write(e.name.c_str(), e.name.size() + 1);
+            pad(long_name.size);
+
+            prefix.clear();
+            name = e.name.substr(0, tar_detail::name_width);
+        }
+
+        std::string header =
+            tar_detail::header_block(name, e, prefix, ustar_magic);
+        write(header.data(), header.size());
+    }
+
+    void pad(boost::uint64_t size)
+    {
+        char zeros[block_size];
+        std::fill(zeros, zeros + block_size, '\0');
+        write(zeros, tar_detail::padding_for(size));
+    }
+
+    void write(const char* data, std::size_t size)
+    {
+        if (!m_out.write(data, static_cast<std::streamsize>(size)))
+            BOOST_THROW_EXCEPTION(std::runtime_error("Unable to write archive"));
+    }
+
+    std::ostream& m_out;
+};
+
+/**
+ * Reads an archive from a stream, one entry at a time.
+ */
+class reader
+{
+public:
+    explicit reader(std::istream& in)
+        : m_in(in), m_remaining(0), m_padding(0)
+    {
+    }
+
+    /**
+     * Move to the next entry, skipping any of the current entry's data
+     * that hasn't been read.
+     *
+     * @returns false at the end of the archive.
+     */
+    bool next(entry& e)
+    {
+        skip(m_remaining + m_padding);
+        m_remaining = 0;
+        m_padding = 0;
+
+        std::string long_name;
+        bool has_long_name = false;
+        std::string pax_records;
+
+        for (;;)
+        {
+            char header[block_size];
+            m_in.read(header, block_size);
+            if (m_in.gcount() == 0)
+                return false; // Some tars leave out the end blocks
+            if (static_cast<std::size_t>(m_in.gcount()) != block_size)
+                tar_detail::throw_bad_archive("archive ends mid-header");
+
+            if (std::find_if(header, header + block_size, not_nul) ==
+                header + block_size)
+                return false;
+
+            if (tar_detail::get_number(header + tar_detail::checksum_offset,
+                                       tar_detail::checksum_width) !=
+                tar_detail::checksum(header))
+                tar_detail::throw_bad_archive("header checksum is wrong");
+
+            entry current;
+            current.type = header[tar_detail::type_offset];
+            current.mode = static_cast<unsigned long>(tar_detail::get_number(
+                header + tar_detail::mode_offset, tar_detail::id_width));
+            current.size = tar_detail::get_number(
+                header + tar_detail::size_offset, tar_detail::size_width);
+            current.mtime = tar_detail::get_number(
+                header + tar_detail::mtime_offset, tar_detail::mtime_width);
+            current.name = tar_detail::field_string(
+                header + tar_detail::name_offset, tar_detail::name_width);
+
+            std::string prefix = tar_detail::field_string(
+                header + tar_detail::prefix_offset, tar_detail::prefix_width);
+            if (std::string(header + tar_detail::magic_offset, 6) ==
+                    std::string("ustar\0", 6) &&
+                !prefix.empty())
+            {
+                current.name = prefix + "/" + current.name;
+            }
+
+            if (current.type == entry_type::gnu_long_name)
+            {
+                long_name = read_whole(current.size);
+                long_name = long_name.substr(0, long_name.find('\0'));
+                has_long_name = true;
+                continue;
+            }
+
+            if (current.type == entry_type::pax_header)
+            {
+                pax_records = read_whole(current.size);
+                continue;
+            }
+
+            if (current.type == entry_type::pax_global_header ||
+                current.type == entry_type::gnu_long_link)
+            {
+                read_whole(current.size);
+                continue;
+            }
+
+            if (has_long_name)
+                current.name = long_name;
+
+            std::string value;
+            if (tar_detail::pax_value(pax_records, "path", value))
+                current.name = value;
+            if (tar_detail::pax_value(pax_records, "size", value))
+                current.size = parse_pax_number(value);
+            if (tar_detail::pax_value(pax_records, "mtime", value))
+            {
+                // May have a fraction, which we don't need
+                current.mtime = parse_pax_number(value.substr(
+                    0, value.find('.')));
+            }
+
+            if (current.type == '\0')
+                current.type = entry_type::file;
+
+            // Only files have data whatever the size field says
+            if (current.type == entry_type::directory ||
+                current.type == entry_type::symlink ||
+                current.type == entry_type::hard_link)
+            {
+                current.size = 0;
+            }
+
+            m_remaining = current.size;
+            m_padding = tar_detail::padding_for(current.size);
+
+            e = current;
+            return true;
+        }
+    }
+
+    /**
+     * Read up to `size` bytes of the current entry's data.
+     *
+     * @returns the number read, which is zero once the data is used up.
+     */
+    std::size_t read(char* buffer, std::size_t size)
+    {
+        std::size_t wanted = static_cast<std::size_t>(
+            (std::min)(static_cast<boost::uint64_t>(size), m_remaining));
+        if (wanted == 0)
+            return 0;
+
+        m_in.read(buffer, static_cast<std::streamsize>(wanted));
+        if (static_cast<std::size_t>(m_in.gcount()) != wanted)
+            tar_detail::throw_bad_archive("archive ends mid-file");
+
+        m_remaining -= wanted;
+        return wanted;
+    }
+
+private:
+    static bool not_nul(char c)
+    {
+        return c != '\0';
+    }
+
+    static boost::uint64_t parse_pax_number(const std::string& value)
+    {
+        try
+        {
+            return boost::lexical_cast<boost::uint64_t>(value);
+        }
+        catch (const boost::bad_lexical_cast&)
+        {
+            tar_detail::throw_bad_archive("pax number is not a number");
+            return 0;
+        }
+    }
+
+    std::string read_whole(boost::uint64_t size)
+    {
+        std::string data(static_cast<std::size_t>(size), '\0');
+        if (size > 0)
+        {
+            m_in.read(&data[0], static_cast<std::streamsize>(size));
+            if (static_cast<boost::uint64_t>(m_in.gcount()) != size)
+                tar_detail::throw_bad_archive("archive ends mid-header");
+        }
+        skip(tar_detail::padding_for(size));
+        return data;
+    }
+
+    void skip(boost::uint64_t size)
+    {
+        char buffer[4096];
+        while (size > 0)
+        {
+            std::streamsize count = static_cast<std::streamsize>(
+                (std::min)(size, static_cast<boost::uint64_t>(sizeof(buffer))));
+            m_in.read(buffer, count);
+            if (m_in.gcount() != count)
+                tar_detail::throw_bad_archive("archive ends mid-file");
+            size -= static_cast<boost::uint64_t>(count);
+        }
+    }
+
+    std::istream& m_in;
+    boost::uint64_t m_remaining;
+    std::size_t m_padding;
+};
+}
+}
+} // namespace ssh::detail::tar
+
+#endif
@@ -0,0 +1,211 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_WIRE_HPP
+#define SSH_DETAIL_WIRE_HPP
+
+#include <boost/cstdint.hpp> // uint8_t, uint32_t, uint64_t
+#include <boost/system/error_code.hpp> // errc
+#include <boost/system/system_error.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+#include <cstddef> // size_t
+#include <string>
+
+namespace ssh
+{
+namespace detail
+{
+
+/**
+ * Store a 32-bit value in network byte order.
+ *
+ * `out` must have room for 4 bytes.
+ */
+inline void store_uint32(char* out, boost::uint32_t value)
+{
+    out[0] = static_cast<char>((value >> 24) & 0xFF);
+    out[1] = static_cast<char>((value >> 16) & 0xFF);
+    out[2] = static_cast<char>((value >> 8) & 0xFF);
+    out[3] = static_cast<char>(value & 0xFF);
+}
+
+/**
+ * Load a 32-bit value stored in network byte order.
+ */
+inline boost::uint32_t load_uint32(const char* in)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+    return (static_cast<boost::uint32_t>(bytes[0]) << 24) |
+           (static_cast<boost::uint32_t>(bytes[1]) << 16) |
+           (static_cast<boost::uint32_t>(bytes[2]) << 8) |
+           static_cast<boost::uint32_t>(bytes[3]);
+}
+
+/**
+ * Builds a message out of values in SSH wire format (RFC 4251 section 5).
+ *
+ * All integers are big-endian and strings are length-prefixed, which is also
+ * the encoding used by the SFTP protocol.
+ */
+class wire_writer
+{
+public:
+    wire_writer& put_uint8(boost::uint8_t value)
+    {
+        m_buffer.push_back(static_cast<char>(value));
+        return *this;
+    }
+
+    wire_writer& put_bool(bool value)
+    {
+        return put_uint8((value) ? 1 : 0);
+    }
+
+    wire_writer& put_uint32(boost::uint32_t value)
+    {
+        char bytes[4];
+        store_uint32(bytes, value);
+        m_buffer.append(bytes, sizeof(bytes));
+        return *this;
+    }
+
+    wire_writer& put_uint64(boost::uint64_t value)
+    {
+        put_uint32(static_cast<boost::uint32_t>(value >> 32));
+        return put_uint32(static_cast<boost::uint32_t>(value & 0xFFFFFFFF));
+    }
+
+    wire_writer& put_string(const char* data, std::size_t size)
+    {
+        put_uint32(static_cast<boost::uint32_t>(size));
+        m_buffer.append(data, size);
+        return *this;
+    }
+
+    wire_writer& put_string(const std::string& value)
+    {
+        return put_string(value.data(), value.size());
+    }
+
+    /**
+     * Append bytes without a length prefix.
+     */
+    wire_writer& put_raw(const char* data, std::size_t size)
+    {
+        m_buffer.append(data, size);
+        return *this;
+    }
+
+    const std::string& buffer() const
+    {
+        return m_buffer;
+    }
+
+    std::string& buffer()
+    {
+        return m_buffer;
+    }
+
+private:
+    std::string m_buffer;
+};
+
+/**
+ * Takes values out of a message in SSH wire format.
+ *
+ * Reading past the end of the message throws a `system_error` with
+ * `errc::bad_message` rather than reading garbage, so a truncated or
+ * malicious message can't take us out of bounds.
+ *
+ * The reader does not copy the message; it must outlive the reader.
+ */
+class wire_reader
+{
+public:
+    wire_reader(const char* data, std::size_t size)
+        : m_data(data), m_size(size), m_position(0)
+    {
+    }
+
+    explicit wire_reader(const std::string& message)
+        : m_data(message.data()), m_size(message.size()), m_position(0)
+    {
+    }
+
+    boost::uint8_t get_uint8()
+    {
+        require(1);
+        return static_cast<boost::uint8_t>(m_data[m_position++]);
+    }
+
+    bool get_bool()
+    {
+        return get_uint8() != 0;
+    }
+
+    boost::uint32_t get_uint32()
+    {
+        require(4);
+        boost::uint32_t value = load_uint32(m_data + m_position);
+        m_position += 4;
+        return value;
+    }
+
+    boost::uint64_t get_uint64()
+    {
+        boost::uint64_t high = get_uint32();
+        return (high << 32) | get_uint32();
+    }
+
+    std::string get_string()
+    {
+        boost::uint32_t size = get_uint32();
+        require(size);
+        std::string value(m_data + m_position, size);
+        m_position += size;
+        return value;
+    }
+
+    std::size_t remaining() const
+    {
+        return m_size - m_position;
+    }
+
+    bool empty() const
+    {
+        return remaining() == 0;
+    }
+
+private:
+    void require(std::size_t size) const
+    {
+        if (size > remaining())
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::bad_message),
+                "Message truncated"));
+        }
+    }
+
+    const char* m_data;
+    std::size_t m_size;
+    std::size_t m_position;
+};
+}
+} // namespace ssh::detail
+
+#endif
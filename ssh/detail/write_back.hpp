@@ -0,0 +1,189 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_DETAIL_WRITE_BACK_HPP
+#define SSH_DETAIL_WRITE_BACK_HPP
+
+#include <boost/cstdint.hpp> // uint64_t
+
+#include <algorithm> // copy, min, max
+#include <cstddef>   // size_t
+#include <map>
+#include <string>
+
+namespace ssh
+{
+namespace detail
+{
+
+/**
+ * Data written to a file but not yet sent to the server.
+ *
+ * Held as ranges that never overlap or touch: each write is merged with any
+ * ranges it overlaps or abuts, so a run of small writes becomes one large
+ * request when flushed.
+ */
+class dirty_ranges
+{
+public:
+    dirty_ranges() : m_bytes(0)
+    {
+    }
+
+    bool empty() const
+    {
+        return m_ranges.empty();
+    }
+
+    /**
+     * Total size of the dirty data.
+     */
+    std::size_t bytes() const
+    {
+        return m_bytes;
+    }
+
+    /**
+     * Offset just past the last dirty byte, or 0 if nothing is dirty.
+     */
+    boost::uint64_t end() const
+    {
+        if (m_ranges.empty())
+            return 0;
+
+        range_map::const_iterator last = m_ranges.end();
+        --last;
+        return range_end(last);
+    }
+
+    void write(boost::uint64_t offset, const char* data, std::size_t size)
+    {
+        if (size == 0)
+            return;
+
+        boost::uint64_t start = offset;
+        boost::uint64_t finish = offset + size;
+
+        // The first range that might overlap or touch the new one is the one
+        // before the first to start after it
+        range_map::iterator first = m_ranges.upper_bound(offset);
+        if (first != m_ranges.begin())
+        {
+            range_map::iterator previous = first;
+            --previous;
+            if (range_end(previous) >= offset)
+                first = previous;
+        }
+
+        range_map::iterator last = first;
+        while (last != m_ranges.end() && last->first <= finish)
+        {
+            start = (std::min)(start, last->first);
+            finish = (std::max)(finish, range_end(last));
+            ++last;
+        }
+
+        std::string merged(static_cast<std::size_t>(finish - start), '\0');
+        for (range_map::iterator it = first; it != last; ++it)
+        {
+            std::copy(it->second.begin(), it->second.end(),
+                      merged.begin() +
+                          static_cast<std::size_t>(it->first - start));
+            m_bytes -= it->second.size();
+        }
+        std::copy(data, data + size,
+                  merged.begin() + static_cast<std::size_t>(offset - start));
+
+        m_ranges.erase(first, last);
+        m_bytes += merged.size();
+        m_ranges[start].swap(merged);
+    }
+
+    /**
+     * Whether `[offset, offset + size)` is entirely dirty, in which case
+     * `overlay` fills all of it.
+     */
+    bool covers(boost::uint64_t offset, std::size_t size) const
+    {
+        range_map::const_iterator range = m_ranges.upper_bound(offset);
+        if (range == m_ranges.begin())
+            return false;
+
+        --range;
+        return range_end(range) >= offset + size;
+    }
+
+    /**
+     * Copy any dirty data in `[offset, offset + size)` over the buffer
+     * holding that part of the file.
+     */
+    void overlay(boost::uint64_t offset, char* buffer, std::size_t size) const
+    {
+        boost::uint64_t finish = offset + size;
+
+        range_map::const_iterator range = m_ranges.upper_bound(offset);
+        if (range != m_ranges.begin())
+            --range;
+
+        for (; range != m_ranges.end() && range->first < finish; ++range)
+        {
+            boost::uint64_t from = (std::max)(offset, range->first);
+            boost::uint64_t to = (std::min)(finish, range_end(range));
+            if (from >= to)
+                continue;
+
+            std::string::const_iterator source =
+                range->second.begin() +
+                static_cast<std::size_t>(from - range->first);
+            std::copy(source, source + static_cast<std::size_t>(to - from),
+                      buffer + static_cast<std::size_t>(from - offset));
+        }
+    }
+
+    /**
+     * Hand each range to `write(offset, data, size)` in file order.
+     *
+     * A range is forgotten only once it has been written, so if the writer
+     * throws, what it didn't get to stays dirty and is tried again by the
+     * next flush.
+     */
+    template <typename Writer>
+    void flush(Writer write)
+    {
+        while (!m_ranges.empty())
+        {
+            range_map::iterator range = m_ranges.begin();
+            write(range->first, range->second.data(), range->second.size());
+
+            m_bytes -= range->second.size();
+            m_ranges.erase(range);
+        }
+    }
+
+private:
+    typedef std::map<boost::uint64_t, std::string> range_map;
+
+    static boost::uint64_t range_end(range_map::const_iterator range)
+    {
+        return range->first + range->second.size();
+    }
+
+    range_map m_ranges;
+    std::size_t m_bytes;
+};
+}
+} // namespace ssh::detail
+
+#endif
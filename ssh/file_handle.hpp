@@ -0,0 +1,181 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file
+ *
+ * Random access to a remote file.
+ *
+ * The stream devices only offer the `read`, `write` and `seek` triple and
+ * every seek throws away the read-ahead that libssh2 keeps for the handle.
+ * A file handle instead takes the position with each request and only moves
+ * the underlying handle when the request doesn't carry on from where the
+ * last one finished, so runs of sequential requests keep their read-ahead.
+ */
+
+#ifndef SSH_FILE_HANDLE_HPP
+#define SSH_FILE_HANDLE_HPP
+
+#include <ssh/detail/file_handle_state.hpp>
+#include <ssh/filesystem.hpp>
+#include <ssh/filesystem/path.hpp>
+#include <ssh/stream.hpp> // open_file, openmode, read_at, write_at
+
+#include <boost/cstdint.hpp> // uint64_t
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <cstddef> // size_t
+#include <ios>     // ios_base
+#include <vector>
+
+#include <libssh2_sftp.h>
+
+namespace ssh
+{
+namespace filesystem
+{
+
+/**
+ * A region of memory to read into.
+ */
+struct mutable_buffer
+{
+    mutable_buffer(char* data, std::size_t size) : data(data), size(size)
+    {
+    }
+
+    char* data;
+    std::size_t size;
+};
+
+/**
+ * A region of memory to write from.
+ */
+struct const_buffer
+{
+    const_buffer(const char* data, std::size_t size) : data(data), size(size)
+    {
+    }
+
+    const char* data;
+    std::size_t size;
+};
+
+/**
+ * Remote file opened for positional reads and writes.
+ *
+ * Safe to share between threads: each request is carried out whole before
+ * the next starts.
+ *
+ * The handle is separate from any stream open on the same file, so using
+ * one never disturbs the other's position or read-ahead.
+ */
+class sftp_file_handle
+{
+public:
+    sftp_file_handle(sftp_filesystem& channel, const path& open_path,
+                     openmode::value opening_mode = openmode::in)
+        : m_open_path(open_path),
+          m_handle(
+              detail::open_file(channel.sftp_ref(), m_open_path, opening_mode)),
+          m_sftp(&channel.sftp_ref()),
+          m_mutex(new boost::mutex())
+    {
+    }
+
+    /**
+     * Read up to `size` bytes starting at `offset`.
+     *
+     * @returns the number of bytes read, which is less than `size` only if
+     *          the end of the file was reached.
+     */
+    std::size_t read_at(boost::uint64_t offset, char* buffer,
+                        std::size_t size)
+    {
+        boost::mutex::scoped_lock lock(*m_mutex);
+
+        return detail::read_at(*m_handle, m_open_path, offset, buffer, size);
+    }
+
+    /**
+     * Write all of `data` starting at `offset`.
+     */
+    void write_at(boost::uint64_t offset, const char* data, std::size_t size)
+    {
+        boost::mutex::scoped_lock lock(*m_mutex);
+
+        detail::write_at(*m_handle, m_open_path, offset, data,
+                         static_cast<std::streamsize>(size));
+        detail::invalidate_cached_blocks(*m_sftp, m_open_path);
+    }
+
+    /**
+     * Read consecutive bytes starting at `offset` into each buffer in turn.
+     *
+     * @returns the total number of bytes read, which is less than the total
+     *          size of the buffers only if the end of the file was reached.
+     */
+    std::size_t readv_at(boost::uint64_t offset,
+                         const std::vector<mutable_buffer>& buffers)
+    {
+        boost::mutex::scoped_lock lock(*m_mutex);
+
+        std::size_t total = 0;
+        for (std::size_t i = 0; i < buffers.size(); ++i)
+        {
+            std::size_t count =
+                detail::read_at(*m_handle, m_open_path, offset + total,
+                                buffers[i].data, buffers[i].size);
+            total += count;
+
+            if (count < buffers[i].size)
+                break; // EOF
+        }
+
+        return total;
+    }
+
+    /**
+     * Write each buffer in turn to consecutive bytes starting at `offset`.
+     */
+    void writev_at(boost::uint64_t offset,
+                   const std::vector<const_buffer>& buffers)
+    {
+        boost::mutex::scoped_lock lock(*m_mutex);
+
+        boost::uint64_t position = offset;
+        for (std::size_t i = 0; i < buffers.size(); ++i)
+        {
+            detail::write_at(*m_handle, m_open_path, position, buffers[i].data,
+                             static_cast<std::streamsize>(buffers[i].size));
+            position += buffers[i].size;
+        }
+
+        detail::invalidate_cached_blocks(*m_sftp, m_open_path);
+    }
+
+private:
+    path m_open_path;
+    boost::shared_ptr<::ssh::detail::file_handle_state> m_handle;
+    ::ssh::detail::sftp_channel_state* m_sftp;
+
+    // Shared by copies, which use the same handle
+    boost::shared_ptr<boost::mutex> m_mutex;
+};
+}
+} // namespace ssh::filesystem
+
+#endif
@@ -16,15 +16,22 @@
 #ifndef SSH_FILESYSTEM_HPP
 #define SSH_FILESYSTEM_HPP
 
+#include <ssh/block_cache.hpp>
 #include <ssh/detail/file_handle_state.hpp>
+#include <ssh/detail/sftp_batch.hpp> // upload_files
 #include <ssh/detail/sftp_channel_state.hpp>
+#include <ssh/detail/sftp_copy.hpp> // copy_file
+#include <ssh/detail/sftp_walk.hpp> // walk_tree
 #include <ssh/detail/libssh2/sftp.hpp>
+#include <ssh/detail/remote_hash.hpp>
 #include <ssh/filesystem/path.hpp>
+#include <ssh/sftp_extensions.hpp>
 
 #include <boost/cstdint.hpp>                      // uint64_t, uintmax_t
 #include <boost/detail/bitmask.hpp>               // BOOST_BITMASK
 #include <boost/detail/scoped_enum_emulation.hpp> // BOOST_SCOPED_ENUM*
 #include <boost/exception/info.hpp>               // errinfo_api_function
+#include <boost/filesystem/path.hpp>
 #include <boost/iterator/iterator_facade.hpp>     // iterator_facade
 #include <boost/operators.hpp>
 #include <boost/optional/optional.hpp>
@@ -42,6 +49,7 @@
 #include <exception> // bad_alloc
 #include <stdexcept> // invalid_argument
 #include <string>
+#include <utility> // pair
 #include <vector>
 
 #include <libssh2_sftp.h>
@@ -610,6 +618,17 @@ BOOST_SCOPED_ENUM_END
 
 inline BOOST_SCOPED_ENUM(path_status)
     check_status(sftp_filesystem& filesystem, const path& path);
+
+/**
+ * Drop the file's blocks from its filesystem's cache, if there is one.
+ */
+inline void invalidate_cached_blocks(::ssh::detail::sftp_channel_state& sftp,
+                                     const path& file)
+{
+    boost::shared_ptr<block_cache> cache = sftp.block_cache();
+    if (cache)
+        cache->invalidate(file.string());
+}
 }
 
 BOOST_SCOPED_ENUM_START(overwrite_behaviour){
@@ -640,9 +659,98 @@ BOOST_SCOPED_ENUM_START(overwrite_behaviour){
     atomic_overwrite};
 BOOST_SCOPED_ENUM_END
 
+/**
+ * A small file to create on the server with `upload_batch`.
+ */
+struct batch_upload
+{
+    batch_upload(const path& target, const std::string& contents,
+                 bool overwrite, bool durable = false)
+        : target(target),
+          contents(contents),
+          overwrite(overwrite),
+          durable(durable)
+    {
+    }
+
+    path target;
+    std::string contents;
+
+    /**
+     * Replace any existing file.  If `false`, the upload fails instead.
+     */
+    bool overwrite;
+
+    /**
+     * Have the server commit the file to disk before closing it.
+     *
+     * Fails the upload if the server doesn't offer `fsync@openssh.com`.
+     */
+    bool durable;
+};
+
+/**
+ * Part of a file: `length` bytes from `offset`.
+ *
+ * A length of zero means to the end of the file, so the default range is
+ * the whole file.
+ */
+struct byte_range
+{
+    byte_range() : offset(0), length(0)
+    {
+    }
+
+    byte_range(boost::uint64_t offset, boost::uint64_t length)
+        : offset(offset), length(length)
+    {
+    }
+
+    boost::uint64_t offset;
+    boost::uint64_t length;
+};
+
+/**
+ * Size of the filesystem holding a path, in bytes.
+ *
+ * As in Boost.Filesystem, `available` is what an unprivileged user can
+ * still use, which may be less than `free`.
+ */
+struct space_info
+{
+    boost::uintmax_t capacity;
+    boost::uintmax_t free;
+    boost::uintmax_t available;
+};
+
+/**
+ * Something found below the directory given to `list_tree`.
+ */
+struct tree_item
+{
+    tree_item(const path& relative_path, const file_attributes& attributes)
+        : relative_path(relative_path), attributes(attributes)
+    {
+    }
+
+    /**
+     * Path from the directory listed, which isn't included.
+     */
+    path relative_path;
+
+    /**
+     * As the server listed them, so links are not followed.
+     */
+    file_attributes attributes;
+};
+
 class sftp_input_device;
 class sftp_output_device;
 class sftp_io_device;
+class sftp_file_handle;
+
+struct sync_policy;
+struct sync_statistics;
 
 /**
  * Connection to the filesystem on a remote server via an SSH/SFTP connection.
@@ -740,6 +848,77 @@ public:
                                LIBSSH2_SFTP_REALPATH);
     }
 
+    /**
+     * Keep blocks read from remote files in the given cache, or stop caching
+     * if it is null.
+     *
+     * Files are cached by path and by their size and modification time when
+     * opened, so each stream opened on a cached filesystem costs an extra
+     * trip to the server to find those out.  Changes made through this
+     * filesystem drop the affected blocks.
+     *
+     * Only streams opened after the call are affected.
+     */
+    void use_block_cache(boost::shared_ptr<block_cache> cache)
+    {
+        sftp_ref().block_cache(cache);
+    }
+
+    boost::shared_ptr<block_cache> cache() const
+    {
+        return m_sftp->block_cache();
+    }
+
+    /**
+     * Extensions the server announced when the SFTP protocol started.
+     *
+     * The first call opens the channel that extended requests are sent
+     * on.  If the server won't let us open it, there is no way to use any
+     * extension, so there are none.
+     */
+    sftp_extensions extensions()
+    {
+        namespace protocol = ::ssh::detail::sftp_protocol;
+
+        try
+        {
+            ::ssh::detail::protocol_use use(sftp_ref());
+            protocol::protocol_channel& channel = use.channel();
+
+            return sftp_extensions(channel.pipeline().extensions());
+        }
+        catch (const boost::system::system_error&)
+        {
+            return sftp_extensions();
+        }
+    }
+
+    /**
+     * Sizes the server accepts in a single request and how many files it
+     * lets us have open at once.
+     *
+     * Each is zero if the server doesn't say, which it can only do if it
+     * has the `limits@openssh.com` extension.  Transfers that go over the
+     * extension channel size their requests to suit.
+     */
+    sftp_limits limits()
+    {
+        namespace protocol = ::ssh::detail::sftp_protocol;
+
+        ::ssh::detail::protocol_use use(sftp_ref());
+        protocol::protocol_channel& channel = use.channel();
+
+        try
+        {
+            return channel.pipeline().limits();
+        }
+        catch (...)
+        {
+            use.discard();
+            throw;
+        }
+    }
+
     /// @cond INTERNAL
     /**
      * Defines the single permitted factory of `sftp_filesystem` instances.
@@ -769,11 +948,14 @@ private:
     friend class sftp_input_device;
     friend class sftp_output_device;
     friend class sftp_io_device;
+    friend class sftp_file_handle;
 
     friend bool create_directory(sftp_filesystem& fs,
                                  const path& new_directory);
     friend void create_symlink(sftp_filesystem& fs, const path& link,
                                const path& target);
+    friend void create_hard_link(sftp_filesystem& fs, const path& link,
+                                 const path& target);
     friend file_status status(sftp_filesystem& fs, const path& target);
     friend void permissions(sftp_filesystem& fs, const path& file,
                             perms new_permissions);
@@ -782,6 +964,20 @@ private:
                        BOOST_SCOPED_ENUM(overwrite_behaviour) overwrite_hint);
     friend bool remove(sftp_filesystem& fs, const path& target);
     friend boost::uintmax_t remove_all(sftp_filesystem& fs, const path& target);
+    friend std::vector<boost::system::error_code>
+    upload_batch(sftp_filesystem& fs, const std::vector<batch_upload>& files);
+    friend void copy_file(sftp_filesystem& fs, const path& from,
+                          const path& to);
+    friend std::string remote_hash(sftp_filesystem& fs, const path& file,
+                                   const std::string& algorithm,
+                                   const byte_range& range);
+    friend space_info space(sftp_filesystem& fs, const path& p);
+    friend std::vector<tree_item> list_tree(sftp_filesystem& fs,
+                                            const path& directory);
+    friend sync_statistics sync(const boost::filesystem::path& local_directory,
+                                sftp_filesystem& fs,
+                                const path& remote_directory,
+                                const sync_policy& policy);
 
     bool create_directory(const path& new_directory)
     {
@@ -846,6 +1042,22 @@ private:
             link_string.size(), target_string.data(), target_string.size());
     }
 
+    void create_hard_link(const path& link, const path& target)
+    {
+        if (!extensions().hardlink())
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                LIBSSH2_FX_OP_UNSUPPORTED,
+                ::ssh::filesystem::sftp_error_category(), link.string()));
+        }
+
+        ::ssh::detail::wire_writer arguments;
+        arguments.put_string(target.native()).put_string(link.native());
+        extended_request("hardlink@openssh.com", arguments.buffer());
+
+        detail::invalidate_cached_blocks(sftp_ref(), link);
+    }
+
     file_status status(const path& target)
     {
         std::string file_path = target.native();
@@ -943,6 +1155,19 @@ private:
                 std::invalid_argument("Unrecognised overwrite behaviour"));
         }
 
+        // Version 3 servers ignore the flags, but OpenSSH has an extension
+        // that replaces the destination atomically, as POSIX rename does
+        if (flags != 0 && extensions().posix_rename())
+        {
+            ::ssh::detail::wire_writer arguments;
+            arguments.put_string(source_string).put_string(destination_string);
+            extended_request("posix-rename@openssh.com", arguments.buffer());
+
+            detail::invalidate_cached_blocks(sftp_ref(), source);
+            detail::invalidate_cached_blocks(sftp_ref(), destination);
+            return;
+        }
+
         ::ssh::detail::sftp_channel_state::scoped_lock lock =
             sftp_ref().aquire_lock();
 
@@ -950,6 +1175,9 @@ private:
             sftp_ref().session_ptr(), sftp_ref().sftp_ptr(),
             source_string.data(), source_string.size(),
             destination_string.data(), destination_string.size(), flags);
+
+        detail::invalidate_cached_blocks(sftp_ref(), source);
+        detail::invalidate_cached_blocks(sftp_ref(), destination);
     }
 
     bool remove(const path& target)
@@ -1059,6 +1287,8 @@ private:
             }
         }
 
+        detail::invalidate_cached_blocks(sftp_ref(), target);
+
         return true;
     }
 
@@ -1085,6 +1315,290 @@ private:
                                        &target_path_buffer[0] + len);
     }
 
+    std::vector<boost::system::error_code>
+    upload_batch(const std::vector<batch_upload>& files)
+    {
+        namespace protocol = ::ssh::detail::sftp_protocol;
+
+        std::vector<protocol::upload_job> jobs;
+        jobs.reserve(files.size());
+        for (std::vector<batch_upload>::const_iterator it = files.begin();
+             it != files.end(); ++it)
+        {
+            jobs.push_back(protocol::upload_job(it->target.native(),
+                                                it->contents.data(),
+                                                it->contents.size(),
+                                                it->overwrite, it->durable));
+        }
+
+        ::ssh::detail::protocol_use use(sftp_ref());
+        protocol::protocol_channel& channel = use.channel();
+
+        for (std::vector<batch_upload>::const_iterator it = files.begin();
+             it != files.end(); ++it)
+        {
+            detail::invalidate_cached_blocks(sftp_ref(), it->target);
+        }
+
+        try
+        {
+            return protocol::upload_files(
+                channel.pipeline(), jobs,
+                protocol::sizing_for(channel.pipeline().limits()));
+        }
+        catch (...)
+        {
+            // Replies may still be due on the channel so it's no good to
+            // anyone else
+            use.discard();
+            throw;
+        }
+    }
+
+    void copy_file(const path& from, const path& to)
+    {
+        namespace protocol = ::ssh::detail::sftp_protocol;
+
+        ::ssh::detail::protocol_use use(sftp_ref());
+        protocol::protocol_channel& channel = use.channel();
+
+        detail::invalidate_cached_blocks(sftp_ref(), to);
+
+        try
+        {
+            protocol::copy_file(
+                channel.pipeline(), from.native(), to.native(),
+                protocol::sizing_for(channel.pipeline().limits()));
+        }
+        catch (const boost::system::system_error& e)
+        {
+            // The copy closes its handles before reporting what the server
+            // refused, so the channel is still in step
+            if (e.code().category() ==
+                ::ssh::filesystem::sftp_error_category())
+                throw;
+
+            use.discard();
+            throw;
+        }
+        catch (...)
+        {
+            use.discard();
+            throw;
+        }
+    }
+
+    std::string remote_hash(const path& file, const std::string& algorithm,
+                            const byte_range& range)
+    {
+        sftp_extensions supported = extensions();
+
+        // Servers that announce an extension may still refuse the request,
+        // for example because they don't do the algorithm we asked for
+        try
+        {
+            if (supported.check_file())
+            {
+                return ::ssh::detail::hash_from_check_file_reply(
+                    extended_request("check-file-name",
+                                     ::ssh::detail::check_file_arguments(
+                                         file.native(), algorithm,
+                                         range.offset, range.length)),
+                    algorithm);
+            }
+        }
+        catch (const boost::system::system_error& e)
+        {
+            if (e.code() != boost::system::error_code(
+                                LIBSSH2_FX_OP_UNSUPPORTED,
+                                ::ssh::filesystem::sftp_error_category()))
+                throw;
+        }
+
+        try
+        {
+            if (algorithm == "md5" && supported.md5_hash())
+            {
+                return ::ssh::detail::hash_from_md5_hash_reply(
+                    extended_request("md5-hash",
+                                     ::ssh::detail::md5_hash_arguments(
+                                         file.native(), range.offset,
+                                         range.length)));
+            }
+        }
+        catch (const boost::system::system_error& e)
+        {
+            if (e.code() != boost::system::error_code(
+                                LIBSSH2_FX_OP_UNSUPPORTED,
+                                ::ssh::filesystem::sftp_error_category()))
+                throw;
+        }
+
+        std::string command = ::ssh::detail::hash_command(
+            file.native(), algorithm, range.offset, range.length);
+        if (command.empty())
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::function_not_supported),
+                "No way to hash with " + algorithm + " on this server"));
+        }
+
+        std::string output;
+        int exit_status = ::ssh::detail::run_command(
+            sftp_ref().session_ref(), command, output);
+        std::string hash =
+            ::ssh::detail::hash_from_command_output(output, algorithm);
+        if (exit_status != 0 || hash.empty())
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::io_error),
+                "Unable to hash " + file.string() + " on the server"));
+        }
+
+        return hash;
+    }
+
+    space_info space(const path& p)
+    {
+        if (!extensions().statvfs())
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                LIBSSH2_FX_OP_UNSUPPORTED,
+                ::ssh::filesystem::sftp_error_category(), p.string()));
+        }
+
+        ::ssh::detail::wire_writer arguments;
+        arguments.put_string(p.native());
+        std::string data =
+            extended_request("statvfs@openssh.com", arguments.buffer());
+
+        // The reply is struct statvfs, each field as a uint64 in order
+        ::ssh::detail::wire_reader in(data);
+        in.get_uint64(); // f_bsize
+        boost::uint64_t fragment_size = in.get_uint64();
+        boost::uint64_t blocks = in.get_uint64();
+        boost::uint64_t free_blocks = in.get_uint64();
+        boost::uint64_t available_blocks = in.get_uint64();
+
+        space_info info;
+        info.capacity = blocks * fragment_size;
+        info.free = free_blocks * fragment_size;
+        info.available = available_blocks * fragment_size;
+        return info;
+    }
+
+    std::vector<tree_item> list_tree(const path& directory)
+    {
+        namespace protocol = ::ssh::detail::sftp_protocol;
+
+        protocol::tree_listing listing = walk_tree(directory);
+
+        if (!listing.failures.empty())
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                listing.failures.front().second,
+                (directory / listing.failures.front().first).string()));
+        }
+
+        std::vector<tree_item> items;
+        items.reserve(listing.entries.size());
+        for (std::vector<protocol::tree_entry>::const_iterator it =
+                 listing.entries.begin();
+             it != listing.entries.end(); ++it)
+        {
+            items.push_back(
+                tree_item(it->name, file_attributes(it->attributes)));
+        }
+
+        return items;
+    }
+
+    /**
+     * Everything below `root`, with many directories listed at once.
+     */
+    ::ssh::detail::sftp_protocol::tree_listing walk_tree(const path& root)
+    {
+        namespace protocol = ::ssh::detail::sftp_protocol;
+
+        ::ssh::detail::protocol_use use(sftp_ref());
+        protocol::protocol_channel& channel = use.channel();
+
+        try
+        {
+            return protocol::walk_tree(
+                channel.pipeline(), root.native(),
+                protocol::sizing_for(channel.pipeline().limits()));
+        }
+        catch (...)
+        {
+            use.discard();
+            throw;
+        }
+    }
+
+    /**
+     * Carry out requests that don't depend on each other, many at once.
+     */
+    std::vector<boost::system::error_code> run_requests(
+        const std::vector<::ssh::detail::sftp_protocol::status_request>&
+            requests)
+    {
+        namespace protocol = ::ssh::detail::sftp_protocol;
+
+        ::ssh::detail::protocol_use use(sftp_ref());
+        protocol::protocol_channel& channel = use.channel();
+
+        try
+        {
+            return protocol::run_requests(
+                channel.pipeline(), requests,
+                protocol::sizing_for(channel.pipeline().limits()));
+        }
+        catch (...)
+        {
+            use.discard();
+            throw;
+        }
+    }
+
+    /**
+     * Send an extended request and wait for the data it returns.
+     *
+     * @param arguments  The request's arguments, encoded as the extension
+     *                   defines.
+     */
+    std::string extended_request(const std::string& name,
+                                 const std::string& arguments)
+    {
+        namespace protocol = ::ssh::detail::sftp_protocol;
+
+        ::ssh::detail::protocol_use use(sftp_ref());
+        protocol::protocol_channel& channel = use.channel();
+
+        try
+        {
+            return channel.pipeline().transact_extended(name, arguments);
+        }
+        catch (const boost::system::system_error& e)
+        {
+            // The server answered, just not with success, so the channel is
+            // still in step
+            if (e.code().category() ==
+                ::ssh::filesystem::sftp_error_category())
+                throw;
+
+            use.discard();
+            throw;
+        }
+        catch (...)
+        {
+            use.discard();
+            throw;
+        }
+    }
+
     ::ssh::detail::sftp_channel_state& sftp_ref()
     {
         return *m_sftp;
@@ -1148,6 +1662,28 @@ inline void create_symlink(sftp_filesystem& fs, const path& link,
     return fs.create_symlink(link, target);
 }
 
+/**
+ * Create a hard link: a second name for an existing file.
+ *
+ * Both names refer to the same contents, so a change made through one is
+ * seen through the other.  Needs the `hardlink@openssh.com` SFTP
+ * extension, which OpenSSH has.
+ *
+ * @param link     Path to the new link on the remote filesystem. Must not
+ *                 already exist.
+ * @param target   Path of the file to be linked to.  Unlike with
+ *                 `create_symlink`, servers take these in the right order.
+ *
+ * @throws `boost::system::system_error` if the server doesn't have the
+ *         extension or refuses the link, for example because the target
+ *         is on another filesystem or `link` already exists.
+ */
+inline void create_hard_link(sftp_filesystem& fs, const path& link,
+                             const path& target)
+{
+    fs.create_hard_link(link, target);
+}
+
 /**
  * Change one path to a file with another.
  *
@@ -1169,7 +1705,9 @@ inline void create_symlink(sftp_filesystem& fs, const path& link,
  *     suggestions that the server is free to disregard (most SFTP servers
  *     disregard these flags).  If it does so and `destination` is already a
  *     path to a file, this function will throw an unspecified
- *     `boost::system::system_error`.
+ *     `boost::system::system_error`.  Servers with the
+ *     `posix-rename@openssh.com` extension, such as OpenSSH, replace
+ *     `destination` atomically for either of the other flags.
  *
  * @throws `boost::system::system_error` if `destination` is already a
  *         path to a file before this function is called and either
@@ -1243,6 +1781,101 @@ inline boost::uintmax_t remove_all(sftp_filesystem& fs, const path& target)
     return fs.remove_all(target);
 }
 
+/**
+ * Create many small files at once.
+ *
+ * Rather than creating the files one after another, waiting for the server
+ * to finish each step, the requests for all the files are interleaved, with
+ * many in flight at once.  For small files, this is many times faster than
+ * writing each through an `ofstream`.
+ *
+ * The contents of every file is held in memory, so this is only suitable for
+ * files small enough that it doesn't matter.
+ *
+ * Durable files are synced in the same interleaved way, so making a batch
+ * durable costs far less than syncing each file as an `ofstream` closes.
+ *
+ * @returns the outcome of each upload, in the same order as `files`.  A file
+ *          that failed doesn't stop the others.
+ * @throws `boost::system::system_error` if the connection itself fails.
+ *         Files may have been created even so.
+ */
+inline std::vector<boost::system::error_code>
+upload_batch(sftp_filesystem& fs, const std::vector<batch_upload>& files)
+{
+    return fs.upload_batch(files);
+}
+
+/**
+ * Copy a file to a new file on the same server.
+ *
+ * The data never comes to this machine: the server copies it itself if it
+ * supports the `copy-data` extension, and otherwise the data is streamed
+ * back to the server as it arrives, with many reads and writes in flight.
+ * The new file gets the permissions of the original.
+ *
+ * @throws `boost::system::system_error` if `to` already exists or either
+ *         file can't be opened or written.  A partly-written `to` is left
+ *         behind.
+ */
+inline void copy_file(sftp_filesystem& fs, const path& from, const path& to)
+{
+    fs.copy_file(from, to);
+}
+
+/**
+ * Hash of part or all of a file, worked out by the server.
+ *
+ * Only the hash crosses the network, so this is a cheap way to find out if
+ * a file on the server is the same as a local one.  Uses the `check-file`
+ * or `md5-hash` SFTP extension if the server has one that can do it, and
+ * otherwise runs a hashing command such as `md5sum` on the server.
+ *
+ * @param algorithm  Name of the hash algorithm as `check-file` gives it:
+ *                   `md5`, `sha1`, `sha224`, `sha256`, `sha384` or
+ *                   `sha512`.
+ *
+ * @returns the hash in lower-case hex, as hashing commands print it.
+ * @throws `boost::system::system_error` if the file can't be read or the
+ *         server has no way to hash it.
+ */
+inline std::string remote_hash(sftp_filesystem& fs, const path& file,
+                               const std::string& algorithm,
+                               const byte_range& range = byte_range())
+{
+    return fs.remote_hash(file, algorithm, range);
+}
+
+/**
+ * Size and free space of the server filesystem holding `p`.
+ *
+ * Needs the `statvfs@openssh.com` SFTP extension, which OpenSSH has.
+ *
+ * @throws `boost::system::system_error` if the server doesn't have the
+ *         extension or can't find `p`.
+ */
+inline space_info space(sftp_filesystem& fs, const path& p)
+{
+    return fs.space(p);
+}
+
+/**
+ * Everything below a directory on the server, however deep.
+ *
+ * The directories are listed many at a time, so this takes about one
+ * round trip for each level of the tree rather than one for each
+ * directory.  The items come in no particular order.  Links are listed
+ * but not followed.
+ *
+ * @throws `boost::system::system_error` if `directory`, or any directory
+ *         below it, can't be listed.
+ */
+inline std::vector<tree_item> list_tree(sftp_filesystem& fs,
+                                        const path& directory)
+{
+    return fs.list_tree(directory);
+}
+
 namespace detail
 {
 
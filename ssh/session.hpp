@@ -38,6 +38,7 @@
 #define SSH_SESSION_HPP
 
 #include <ssh/agent.hpp>
+#include <ssh/command.hpp> // remote_command
 #include <ssh/detail/libssh2/session.hpp>  // ssh::detail::libssh2::session
 #include <ssh/detail/libssh2/userauth.hpp> // ssh::detail::libssh2::userauth
 #include <ssh/host_key.hpp>
@@ -593,6 +594,54 @@ public:
             passphrase.c_str());
     }
 
+    /**
+     * Configure keepalive messages sent to the server over this session.
+     *
+     * Keepalives stop idle connections being dropped by firewalls and NAT
+     * devices that expire mappings without traffic.  Configuring them does
+     * not send anything by itself; the caller must call `send_keepalive`
+     * periodically, typically from a maintenance thread.
+     *
+     * @param want_reply
+     *     Whether the server should be asked to reply to each keepalive.
+     *     Asking for a reply keeps traffic flowing in both directions.
+     * @param interval_seconds
+     *     Minimum number of seconds without other traffic between keepalives.
+     *     Zero disables keepalives.
+     */
+    void keepalive_config(bool want_reply, unsigned int interval_seconds)
+    {
+        detail::session_state::scoped_lock lock = session_ref().aquire_lock();
+
+        ::libssh2_keepalive_config(session_ref().session_ptr(),
+                                   (want_reply) ? 1 : 0, interval_seconds);
+    }
+
+    /**
+     * Send a keepalive message if one is due.
+     *
+     * Nothing is sent if there has been traffic more recently than the
+     * interval given to `keepalive_config`, so this is cheap to call often.
+     *
+     * @returns
+     *     Number of seconds until the next keepalive is due.
+     *
+     * @throws `boost::system::system_error`
+     *     if the keepalive could not be sent, which usually means the
+     *     connection is broken.
+     */
+    unsigned int send_keepalive()
+    {
+        int seconds_to_next = 0;
+
+        detail::session_state::scoped_lock lock = session_ref().aquire_lock();
+
+        detail::libssh2::session::keepalive_send(session_ref().session_ptr(),
+                                                 &seconds_to_next);
+
+        return (seconds_to_next > 0) ? seconds_to_next : 0;
+    }
+
     /**
      * Connect to any agent running on the system and return object to
      * authenticate using its identities.
@@ -616,6 +665,24 @@ public:
         return filesystem::sftp_filesystem::factory_attorney()(session_ref());
     }
 
+    /**
+     * Run a command on the server.
+     *
+     * The command is run by the user's shell, so it may be a pipeline or use
+     * redirection.  Many commands can run at once over one session.
+     *
+     * @warning As with `connect_to_filesystem`, the caller must make sure the
+     *          command is destroyed before the session is disconnected.
+     *
+     * @throws `boost::system::system_error` if the server refuses to open a
+     *         channel or to run the command.  A command that runs but fails
+     *         reports that through its exit status instead.
+     */
+    remote_command exec(const std::string& command)
+    {
+        return remote_command::factory_attorney()(session_ref(), command);
+    }
+
 private:
     detail::session_state& session_ref()
     {
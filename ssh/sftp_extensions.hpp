@@ -0,0 +1,168 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file
+ *
+ * What an SFTP server can do beyond version 3 of the protocol.
+ *
+ * Servers list their extensions in their reply to our first packet.  The
+ * ones we know how to use let us do on the server what we would otherwise
+ * do with several round trips or by moving the data over the network:
+ * replace a file atomically, copy or hash a file, find free space.
+ */
+
+#ifndef SSH_SFTP_EXTENSIONS_HPP
+#define SSH_SFTP_EXTENSIONS_HPP
+
+#include <boost/cstdint.hpp> // uint64_t
+
+#include <map>
+#include <string>
+
+namespace ssh
+{
+namespace filesystem
+{
+
+/**
+ * Sizes the server will accept, as reported by `limits@openssh.com`.
+ *
+ * Each is zero if the server doesn't say.
+ */
+struct sftp_limits
+{
+    sftp_limits()
+        : max_packet_length(0),
+          max_read_length(0),
+          max_write_length(0),
+          max_open_handles(0)
+    {
+    }
+
+    /** Largest packet the server accepts, including its length field. */
+    boost::uint64_t max_packet_length;
+
+    /** Most data a single READ returns. */
+    boost::uint64_t max_read_length;
+
+    /** Most data a single WRITE may carry. */
+    boost::uint64_t max_write_length;
+
+    /** Most files and directories open at once on one channel. */
+    boost::uint64_t max_open_handles;
+};
+
+/**
+ * Extensions a server announced, with helpers for the ones we use.
+ *
+ * The OpenSSH extensions are versioned and we only claim support for the
+ * versions whose requests we know how to build.  The filexfer draft
+ * extensions (`copy-data`, `check-file`) carry no meaningful version.
+ */
+class sftp_extensions
+{
+public:
+    typedef std::map<std::string, std::string> extension_map;
+
+    sftp_extensions()
+    {
+    }
+
+    explicit sftp_extensions(const extension_map& announced)
+        : m_announced(announced)
+    {
+    }
+
+    /**
+     * Every extension the server announced, mapped to its version data.
+     */
+    const extension_map& announced() const
+    {
+        return m_announced;
+    }
+
+    /**
+     * Whether the server announced the extension, whatever its version.
+     */
+    bool has(const std::string& name) const
+    {
+        return m_announced.find(name) != m_announced.end();
+    }
+
+    /**
+     * Whether the server announced this version of the extension.
+     */
+    bool has(const std::string& name, const std::string& version) const
+    {
+        extension_map::const_iterator pos = m_announced.find(name);
+        return pos != m_announced.end() && pos->second == version;
+    }
+
+    /** Rename that replaces an existing target atomically. */
+    bool posix_rename() const
+    {
+        return has("posix-rename@openssh.com", "1");
+    }
+
+    /** Free space and other figures about a filesystem. */
+    bool statvfs() const
+    {
+        return has("statvfs@openssh.com", "2");
+    }
+
+    /** Hard links. */
+    bool hardlink() const
+    {
+        return has("hardlink@openssh.com", "1");
+    }
+
+    /** Flushing an open file to disk. */
+    bool fsync() const
+    {
+        return has("fsync@openssh.com", "1");
+    }
+
+    /** Copying between open files without the data leaving the server. */
+    bool copy_data() const
+    {
+        return has("copy-data");
+    }
+
+    /** Hashing files on the server. */
+    bool check_file() const
+    {
+        return has("check-file");
+    }
+
+    /** MD5 hashes of files on the server. */
+    bool md5_hash() const
+    {
+        return has("md5-hash");
+    }
+
+    /** The server's packet and request size limits. */
+    bool limits() const
+    {
+        return has("limits@openssh.com", "1");
+    }
+
+private:
+    extension_map m_announced;
+};
+}
+} // namespace ssh::filesystem
+
+#endif
@@ -37,22 +37,31 @@
 #ifndef SSH_STREAM_HPP
 #define SSH_STREAM_HPP
 
+#include <ssh/block_cache.hpp>
 #include <ssh/detail/file_handle_state.hpp>
+#include <ssh/detail/write_back.hpp>
 #include <ssh/detail/session_state.hpp>
 #include <ssh/detail/libssh2/sftp.hpp>
 #include <ssh/session.hpp>
 #include <ssh/filesystem.hpp>
 
+#include <boost/cstdint.hpp> // uint64_t
 #include <boost/filesystem/path.hpp>
 #include <boost/iostreams/categories.hpp> // seekable, input_seekable,
                                           // output_seekable
 #include <boost/iostreams/stream.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ref.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
 
+#include <algorithm> // copy, fill, min, max
 #include <cassert>   // assert
+#include <cstddef>   // size_t
 #include <stdexcept> // invalid_argument, logic_error
 #include <string>
+#include <vector>
 
 #include <libssh2_sftp.h>
 
@@ -129,7 +138,29 @@ struct openmode
         /**
          * Fail if the file already exists.
          */
-        noreplace = 0x80
+        noreplace = 0x80,
+
+        /**
+         * Others may change the file while it is open.
+         *
+         * Normally a stream asks the server for the file's size only the
+         * first time it seeks from the end, then keeps track of the size
+         * itself.  A shared stream asks every time, and doesn't use the
+         * filesystem's block cache.
+         *
+         * Not sent to the server: SFTP has no way to say this.
+         */
+        shared = 0x100,
+
+        /**
+         * Written data reaches the server's disk before the file is closed.
+         *
+         * Closing the stream asks the server to fsync the file, using the
+         * `fsync@openssh.com` extension, and fails if the server can't.
+         * Files closed only by destroying the stream are synced too, but
+         * any failure goes unreported.
+         */
+        durable = 0x200
     };
 };
 
@@ -331,9 +362,86 @@ open_output_file(::ssh::detail::sftp_channel_state& sftp, const path& open_path,
                                           opening_mode | openmode::out));
 }
 
+inline LIBSSH2_SFTP_ATTRIBUTES fstat(::ssh::detail::file_handle_state& handle,
+                                     const path& open_path)
+{
+    LIBSSH2_SFTP_ATTRIBUTES attributes = LIBSSH2_SFTP_ATTRIBUTES();
+
+    try
+    {
+        ::ssh::detail::file_handle_state::scoped_lock lock =
+            handle.aquire_lock();
+
+        ::ssh::detail::libssh2::sftp::fstat(
+            handle.session_ptr(), handle.sftp_ptr(), handle.file_handle(),
+            &attributes, LIBSSH2_SFTP_STAT);
+    }
+    catch (boost::exception& e)
+    {
+        e << boost::errinfo_file_name(open_path.string());
+        throw;
+    }
+
+    return attributes;
+}
+
+/**
+ * Size of an open file, fetched from the server when first needed and then
+ * kept up to date by the device's own writes.
+ *
+ * Consumers find the length of a stream by seeking to its end, often many
+ * times over, and each fetch is a round trip.  A file the device truncated
+ * when opening is known to be empty without asking.
+ */
+class tracked_size : private boost::noncopyable
+{
+public:
+    explicit tracked_size(openmode::value opening_mode)
+        : m_shared((opening_mode & openmode::shared) != 0),
+          m_known((openmode_to_libssh2_flags(opening_mode) &
+                   LIBSSH2_FXF_TRUNC) != 0),
+          m_size(0)
+    {
+    }
+
+    boost::uint64_t get(::ssh::detail::file_handle_state& handle,
+                        const path& open_path)
+    {
+        if (!m_known || m_shared)
+        {
+            m_size = fstat(handle, open_path).filesize; // MUST ACCESS SERVER
+            m_known = true;
+        }
+
+        return m_size;
+    }
+
+    /**
+     * Account for the device having written up to `end`.
+     */
+    void extend(boost::uint64_t end)
+    {
+        m_size = (std::max)(m_size, end);
+    }
+
+    /**
+     * Ask the server again next time.
+     */
+    void refresh()
+    {
+        m_known = false;
+    }
+
+private:
+    const bool m_shared;
+    bool m_known;
+    boost::uint64_t m_size;
+};
+
 inline boost::iostreams::stream_offset
 seek(::ssh::detail::file_handle_state& handle, const path& open_path,
-     boost::iostreams::stream_offset off, std::ios_base::seekdir way)
+     boost::iostreams::stream_offset off, std::ios_base::seekdir way,
+     tracked_size& size)
 {
     boost::iostreams::stream_offset new_position = 0;
 
@@ -350,26 +458,11 @@ seek(::ssh::detail::file_handle_state& handle, const path& open_path,
         break;
     }
 
-    case std::ios_base::end: // MUST ACCESS SERVER
+    case std::ios_base::end:
     {
-        LIBSSH2_SFTP_ATTRIBUTES attributes = LIBSSH2_SFTP_ATTRIBUTES();
-
-        try
-        {
-            ::ssh::detail::file_handle_state::scoped_lock lock =
-                handle.aquire_lock();
-
-            ::ssh::detail::libssh2::sftp::fstat(
-                handle.session_ptr(), handle.sftp_ptr(), handle.file_handle(),
-                &attributes, LIBSSH2_SFTP_STAT);
-        }
-        catch (boost::exception& e)
-        {
-            e << boost::errinfo_file_name(open_path.string());
-            throw;
-        }
-
-        new_position = attributes.filesize + off;
+        new_position = static_cast<boost::iostreams::stream_offset>(
+                           size.get(handle, open_path)) +
+                       off;
         break;
     }
 
@@ -460,19 +553,570 @@ inline std::streamsize write(::ssh::detail::file_handle_state& handle,
     }
 }
 
+/**
+ * Read data from the given position in the file.
+ *
+ * Reads less than requested only at the end of the file.  As with
+ * `write_at`, the handle is only moved if it isn't already at `offset`.
+ */
+inline std::size_t read_at(::ssh::detail::file_handle_state& handle,
+                           const path& open_path, boost::uint64_t offset,
+                           char* buffer, std::size_t buffer_size)
+{
+    if (libssh2_sftp_tell64(handle.file_handle()) != offset)
+    {
+        libssh2_sftp_seek64(handle.file_handle(), offset);
+    }
+
+    return static_cast<std::size_t>(read(
+        handle, open_path, buffer, static_cast<std::streamsize>(buffer_size)));
+}
+
+/**
+ * Write data at the given position in the file.
+ *
+ * The handle is only moved if it isn't already at `offset`, so runs of
+ * consecutive writes don't pay for a seek each.
+ */
+inline std::streamsize write_at(::ssh::detail::file_handle_state& handle,
+                                const path& open_path, boost::uint64_t offset,
+                                const char* data, std::streamsize data_size)
+{
+    if (libssh2_sftp_tell64(handle.file_handle()) != offset)
+    {
+        libssh2_sftp_seek64(handle.file_handle(), offset);
+    }
+
+    return write(handle, open_path, data, data_size);
+}
+
+/**
+ * Have the server commit the file's data to disk.
+ */
+inline void fsync(::ssh::detail::file_handle_state& handle,
+                  const path& open_path)
+{
+    try
+    {
+        ::ssh::detail::file_handle_state::scoped_lock lock =
+            handle.aquire_lock();
+
+        ::ssh::detail::libssh2::sftp::fsync(
+            handle.session_ptr(), handle.sftp_ptr(), handle.file_handle());
+    }
+    catch (boost::exception& e)
+    {
+        e << boost::errinfo_file_name(open_path.string());
+        throw;
+    }
+}
+
 const std::streamsize DEFAULT_BUFFER_SIZE = 1024 * 32;
 
+/**
+ * Position and block-cached reads for a device on a filesystem with a
+ * block cache.
+ *
+ * The file's size and modification time are fetched the first time they
+ * are needed, which a file that is only written may never do.  They
+ * identify the version of the file whose blocks are cached and answer
+ * seeks from the end without going back to the server.  Reads beyond the
+ * size the file had when fetched find the end of the file.
+ *
+ * Once anything is written through the device its reads bypass the cache,
+ * and every write drops the file's cached blocks, so nobody reads data
+ * older than the write.
+ */
+class cached_file : private boost::noncopyable
+{
+public:
+    cached_file(boost::shared_ptr<block_cache> cache,
+                boost::shared_ptr<::ssh::detail::file_handle_state> handle,
+                const path& open_path)
+        : m_cache(cache),
+          m_handle(handle),
+          m_open_path(open_path),
+          m_name(open_path.string()),
+          m_position(0),
+          m_size(0),
+          m_opened_size(0),
+          m_modified(0),
+          m_have_attributes(false),
+          m_caching(true),
+          m_fetched_any(false),
+          m_last_block(0),
+          m_read_ahead(1)
+    {
+    }
+
+    std::streamsize read(char* buffer, std::streamsize buffer_size)
+    {
+        if (!m_caching)
+        {
+            std::size_t count =
+                detail::read_at(*m_handle, m_open_path, m_position, buffer,
+                                static_cast<std::size_t>(buffer_size));
+            m_position += count;
+            return static_cast<std::streamsize>(count);
+        }
+
+        fetch_attributes();
+
+        const std::size_t block_size = m_cache->block_size();
+
+        std::streamsize count = 0;
+        while (count < buffer_size && m_position < m_opened_size)
+        {
+            boost::uint64_t index = m_position / block_size;
+            block_cache::block_pointer block = fetch(index);
+
+            std::size_t offset =
+                static_cast<std::size_t>(m_position - index * block_size);
+            if (offset >= block->size())
+                break; // File was shorter than it said when opened
+
+            std::size_t available = (std::min)(
+                block->size() - offset,
+                static_cast<std::size_t>(buffer_size - count));
+            std::copy(block->begin() + offset,
+                      block->begin() + offset + available, buffer + count);
+
+            count += available;
+            m_position += available;
+        }
+
+        return count;
+    }
+
+    std::size_t read_at(boost::uint64_t offset, char* buffer,
+                        std::size_t buffer_size)
+    {
+        m_position = offset;
+        return static_cast<std::size_t>(
+            read(buffer, static_cast<std::streamsize>(buffer_size)));
+    }
+
+    std::streamsize write(const char* data, std::streamsize data_size)
+    {
+        m_caching = false;
+
+        std::streamsize count = detail::write_at(*m_handle, m_open_path,
+                                                 m_position, data, data_size);
+        m_cache->invalidate(m_name);
+
+        m_position += count;
+        m_size = (std::max)(m_size, m_position);
+
+        return count;
+    }
+
+    std::streamsize write_at(boost::uint64_t offset, const char* data,
+                             std::streamsize data_size)
+    {
+        m_position = offset;
+        return write(data, data_size);
+    }
+
+    boost::iostreams::stream_offset seek(boost::iostreams::stream_offset off,
+                                         std::ios_base::seekdir way)
+    {
+        boost::iostreams::stream_offset new_position = 0;
+
+        switch (way)
+        {
+        case std::ios_base::beg:
+            new_position = off;
+            break;
+
+        case std::ios_base::cur:
+            new_position =
+                static_cast<boost::iostreams::stream_offset>(m_position) + off;
+            break;
+
+        case std::ios_base::end:
+            fetch_attributes();
+            new_position =
+                static_cast<boost::iostreams::stream_offset>(m_size) + off;
+            break;
+
+        default:
+            BOOST_THROW_EXCEPTION(
+                std::invalid_argument("Unknown seek direction"));
+        }
+
+        if (new_position < 0)
+        {
+            BOOST_THROW_EXCEPTION(
+                std::logic_error("Cannot seek before start of file"));
+        }
+
+        m_position = new_position;
+
+        return new_position;
+    }
+
+    /**
+     * Size of the file when its attributes were fetched, extended by writes
+     * through this device.
+     */
+    boost::uint64_t size()
+    {
+        fetch_attributes();
+        return m_size;
+    }
+
+    /**
+     * Fetch the file's size and modification time again, the next time
+     * they are needed.
+     *
+     * If they have changed, reads use blocks of the new version.
+     */
+    void refresh()
+    {
+        m_have_attributes = false;
+    }
+
+private:
+    void fetch_attributes()
+    {
+        if (m_have_attributes)
+            return;
+
+        LIBSSH2_SFTP_ATTRIBUTES attributes = fstat(*m_handle, m_open_path);
+        // Anything already written through this device is included
+        m_opened_size = m_size = attributes.filesize;
+        m_modified = attributes.mtime;
+        m_have_attributes = true;
+    }
+
+    block_id id(boost::uint64_t index) const
+    {
+        return block_id(m_name, m_opened_size, m_modified, index);
+    }
+
+    block_cache::block_pointer fetch(boost::uint64_t index)
+    {
+        bool sequential = m_fetched_any && index == m_last_block + 1;
+        if (!sequential && index != m_last_block)
+            m_read_ahead = 1;
+        m_last_block = index;
+        m_fetched_any = true;
+
+        block_cache::block_pointer block = m_cache->find(id(index));
+        if (block)
+            return block;
+
+        // Reading in order: fetch blocks before they are asked for, more
+        // each time the pattern holds.  libssh2 pipelines the requests for
+        // a large read so this costs little more than one block.
+        std::size_t blocks = 1;
+        if (sequential)
+        {
+            m_read_ahead =
+                (std::min)(m_read_ahead * 2, m_cache->max_read_ahead());
+            blocks = m_read_ahead;
+        }
+
+        const std::size_t block_size = m_cache->block_size();
+        boost::uint64_t start = index * block_size;
+        std::size_t wanted = static_cast<std::size_t>((std::min)(
+            static_cast<boost::uint64_t>(blocks * block_size),
+            m_opened_size - start));
+
+        std::vector<char> data(wanted);
+        std::size_t got =
+            detail::read_at(*m_handle, m_open_path, start, &data[0],
+                            data.size());
+
+        block_cache::block_pointer first =
+            slice(data, 0, (std::min)(block_size, got));
+        m_cache->insert(id(index), first, false);
+
+        for (std::size_t offset = block_size, i = 1; offset < got;
+             offset += block_size, ++i)
+        {
+            m_cache->insert(
+                id(index + i),
+                slice(data, offset, (std::min)(block_size, got - offset)),
+                true);
+        }
+
+        return first;
+    }
+
+    static block_cache::block_pointer
+    slice(const std::vector<char>& data, std::size_t offset,
+          std::size_t size)
+    {
+        return boost::make_shared<const std::vector<char>>(
+            data.begin() + offset, data.begin() + offset + size);
+    }
+
+    boost::shared_ptr<block_cache> m_cache;
+    boost::shared_ptr<::ssh::detail::file_handle_state> m_handle;
+    path m_open_path;
+    std::string m_name;
+
+    boost::uint64_t m_position;
+    boost::uint64_t m_size;
+    boost::uint64_t m_opened_size;
+    boost::uint64_t m_modified;
+    bool m_have_attributes;
+    bool m_caching;
+
+    bool m_fetched_any;
+    boost::uint64_t m_last_block;
+    std::size_t m_read_ahead;
+};
+
+/**
+ * Cached view of the file if its filesystem caches blocks, otherwise null.
+ *
+ * Files opened `shared` are never cached: someone else may change them
+ * under our feet.
+ */
+inline boost::shared_ptr<cached_file>
+open_cached_file(::ssh::detail::sftp_channel_state& sftp,
+                 boost::shared_ptr<::ssh::detail::file_handle_state> handle,
+                 const path& open_path, openmode::value opening_mode)
+{
+    boost::shared_ptr<block_cache> cache = sftp.block_cache();
+    if (!cache || (opening_mode & openmode::shared))
+        return boost::shared_ptr<cached_file>();
+
+    return boost::make_shared<cached_file>(cache, handle, open_path);
+}
+
+/**
+ * Writes held back and sent to the server together.
+ *
+ * Editing a file through a stream tends to mean many small writes, each
+ * after a seek: updating a header, then appending, then updating the header
+ * again.  Sent as they come, every one is a separate blocking request.
+ * Instead they are kept as dirty ranges, merged where they overlap or meet,
+ * and sent in file order when the file is flushed or closed, or once they
+ * reach the memory threshold.  Reads of the file see the held-back data
+ * without it having to be sent first.
+ *
+ * Errors sending the data surface from whichever of `write`, `flush` or
+ * `close` sends it.  Data that failed to send stays dirty and is sent again
+ * by the next flush.  Anything still dirty when the file is destroyed is
+ * sent then, but errors there have nowhere to go, so callers that care
+ * must flush or close first, as with any buffered stream.  With a threshold
+ * of zero nothing is held back past the write that made it.
+ */
+class write_back_file : private boost::noncopyable
+{
+public:
+    static const std::size_t default_threshold = 1024 * 1024;
+
+    write_back_file(::ssh::detail::sftp_channel_state& sftp,
+                    const path& open_path, openmode::value opening_mode,
+                    std::size_t threshold = default_threshold)
+        : m_sftp(&sftp),
+          m_handle(open_file(sftp, open_path, opening_mode)),
+          m_open_path(open_path),
+          m_cached(open_cached_file(sftp, m_handle, open_path, opening_mode)),
+          m_size(opening_mode),
+          m_threshold(threshold),
+          m_durable((opening_mode & openmode::durable) != 0),
+          m_position(0)
+    {
+    }
+
+    ~write_back_file()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    std::streamsize read(char* buffer, std::streamsize buffer_size)
+    {
+        std::size_t size = static_cast<std::size_t>(buffer_size);
+
+        if (m_dirty.covers(m_position, size))
+        {
+            m_dirty.overlay(m_position, buffer, size);
+            m_position += size;
+            return buffer_size;
+        }
+
+        std::size_t count = (m_cached)
+                                ? m_cached->read_at(m_position, buffer, size)
+                                : read_at(*m_handle, m_open_path, m_position,
+                                          buffer, size);
+
+        // Held-back writes may reach past the end of the file on the server.
+        // Anything between them and that end is a hole, which reads as zeros.
+        boost::uint64_t end = (std::max)(
+            m_position + count, (std::min)(m_position + size, m_dirty.end()));
+        std::size_t extended = static_cast<std::size_t>(end - m_position);
+        std::fill(buffer + count, buffer + extended, '\0');
+
+        m_dirty.overlay(m_position, buffer, extended);
+        m_position = end;
+
+        return static_cast<std::streamsize>(extended);
+    }
+
+    std::streamsize write(const char* data, std::streamsize data_size)
+    {
+        m_dirty.write(m_position, data, static_cast<std::size_t>(data_size));
+        m_position += data_size;
+
+        if (m_dirty.bytes() >= m_threshold)
+            flush();
+
+        return data_size;
+    }
+
+    std::streamsize write_at(boost::uint64_t offset, const char* data,
+                             std::streamsize data_size)
+    {
+        m_position = offset;
+        return write(data, data_size);
+    }
+
+    boost::iostreams::stream_offset seek(boost::iostreams::stream_offset off,
+                                         std::ios_base::seekdir way)
+    {
+        boost::iostreams::stream_offset new_position = 0;
+
+        switch (way)
+        {
+        case std::ios_base::beg:
+            new_position = off;
+            break;
+
+        case std::ios_base::cur:
+            new_position =
+                static_cast<boost::iostreams::stream_offset>(m_position) + off;
+            break;
+
+        case std::ios_base::end:
+            new_position =
+                static_cast<boost::iostreams::stream_offset>(size()) + off;
+            break;
+
+        default:
+            BOOST_THROW_EXCEPTION(
+                std::invalid_argument("Unknown seek direction"));
+        }
+
+        if (new_position < 0)
+        {
+            BOOST_THROW_EXCEPTION(
+                std::logic_error("Cannot seek before start of file"));
+        }
+
+        m_position = new_position;
+
+        return new_position;
+    }
+
+    /**
+     * Send the held-back writes to the server.
+     */
+    void flush()
+    {
+        if (m_dirty.empty())
+            return;
+
+        m_dirty.flush(backing_writer(*this));
+        invalidate_cached_blocks(*m_sftp, m_open_path);
+    }
+
+    /**
+     * Send the held-back writes and, if the file was opened `durable`,
+     * have the server commit them to disk.
+     */
+    void close()
+    {
+        flush();
+
+        if (m_durable)
+            fsync(*m_handle, m_open_path);
+    }
+
+    /**
+     * Forget what is known about the file's size on the server.
+     */
+    void refresh()
+    {
+        if (m_cached)
+            m_cached->refresh();
+        else
+            m_size.refresh();
+    }
+
+private:
+    class backing_writer
+    {
+    public:
+        explicit backing_writer(write_back_file& file) : m_file(&file)
+        {
+        }
+
+        void operator()(boost::uint64_t offset, const char* data,
+                        std::size_t size) const
+        {
+            std::streamsize data_size = static_cast<std::streamsize>(size);
+            if (m_file->m_cached)
+            {
+                m_file->m_cached->write_at(offset, data, data_size);
+            }
+            else
+            {
+                detail::write_at(*m_file->m_handle, m_file->m_open_path,
+                                 offset, data, data_size);
+                m_file->m_size.extend(offset + size);
+            }
+        }
+
+    private:
+        write_back_file* m_file;
+    };
+
+    boost::uint64_t size()
+    {
+        boost::uint64_t stored = (m_cached)
+                                     ? m_cached->size()
+                                     : m_size.get(*m_handle, m_open_path);
+
+        return (std::max)(stored, m_dirty.end());
+    }
+
+    ::ssh::detail::sftp_channel_state* m_sftp;
+    boost::shared_ptr<::ssh::detail::file_handle_state> m_handle;
+    path m_open_path;
+    boost::shared_ptr<cached_file> m_cached;
+    tracked_size m_size;
+    const std::size_t m_threshold;
+    const bool m_durable;
+
+    boost::uint64_t m_position;
+    ::ssh::detail::dirty_ranges m_dirty;
+};
+
 struct input_device_category : boost::iostreams::input_seekable,
                                boost::iostreams::optimally_buffered_tag
 {
 };
 
 struct output_device_category : boost::iostreams::output_seekable,
+                                boost::iostreams::closable_tag,
                                 boost::iostreams::optimally_buffered_tag
 {
 };
 
 struct io_device_category : boost::iostreams::seekable,
+                            boost::iostreams::flushable_tag,
+                            boost::iostreams::closable_tag,
                             boost::iostreams::optimally_buffered_tag
 {
 };
@@ -542,7 +1186,11 @@ public:
                       openmode::value opening_mode = openmode::in)
         : m_open_path(open_path),
           m_handle(detail::open_input_file(channel.sftp_ref(), m_open_path,
-                                           opening_mode))
+                                           opening_mode)),
+          m_cached(detail::open_cached_file(channel.sftp_ref(), m_handle,
+                                            m_open_path, opening_mode)),
+          m_size(boost::make_shared<detail::tracked_size>(
+              opening_mode | openmode::in))
     {
     }
 
@@ -551,7 +1199,12 @@ public:
         : m_open_path(open_path),
           m_handle(
               detail::open_input_file(channel.sftp_ref(), m_open_path,
-                                      detail::translate_flags(opening_mode)))
+                                      detail::translate_flags(opening_mode))),
+          m_cached(detail::open_cached_file(
+              channel.sftp_ref(), m_handle, m_open_path,
+              detail::translate_flags(opening_mode))),
+          m_size(boost::make_shared<detail::tracked_size>(
+              detail::translate_flags(opening_mode) | openmode::in))
     {
     }
 
@@ -562,18 +1215,38 @@ public:
 
     std::streamsize read(char* buffer, std::streamsize buffer_size)
     {
+        if (m_cached)
+            return m_cached->read(buffer, buffer_size);
+
         return detail::read(*m_handle, m_open_path, buffer, buffer_size);
     }
 
     boost::iostreams::stream_offset seek(boost::iostreams::stream_offset off,
                                          std::ios_base::seekdir way)
     {
-        return detail::seek(*m_handle, m_open_path, off, way);
+        if (m_cached)
+            return m_cached->seek(off, way);
+
+        return detail::seek(*m_handle, m_open_path, off, way, *m_size);
+    }
+
+    /**
+     * Ask the server for the file's size the next time it is needed,
+     * rather than trusting the size fetched when it was last asked.
+     */
+    void refresh()
+    {
+        if (m_cached)
+            m_cached->refresh();
+        else
+            m_size->refresh();
     }
 
 private:
     path m_open_path;
     boost::shared_ptr<ssh::detail::file_handle_state> m_handle;
+    boost::shared_ptr<detail::cached_file> m_cached;
+    boost::shared_ptr<detail::tracked_size> m_size;
 };
 
 /**
@@ -595,8 +1268,14 @@ public:
                        openmode::value opening_mode = openmode::out)
         : m_open_path(open_path),
           m_handle(detail::open_output_file(channel.sftp_ref(), m_open_path,
-                                            opening_mode))
+                                            opening_mode)),
+          m_sftp(&channel.sftp_ref()),
+          m_size(boost::make_shared<detail::tracked_size>(
+              opening_mode | openmode::out)),
+          m_durable((opening_mode & openmode::durable) != 0)
     {
+        // Opening may have truncated the file
+        detail::invalidate_cached_blocks(*m_sftp, m_open_path);
     }
 
     sftp_output_device(sftp_filesystem& channel, const path& open_path,
@@ -604,8 +1283,13 @@ public:
         : m_open_path(open_path),
           m_handle(
               detail::open_output_file(channel.sftp_ref(), m_open_path,
-                                       detail::translate_flags(opening_mode)))
+                                       detail::translate_flags(opening_mode))),
+          m_sftp(&channel.sftp_ref()),
+          m_size(boost::make_shared<detail::tracked_size>(
+              detail::translate_flags(opening_mode) | openmode::out)),
+          m_durable(false)
     {
+        detail::invalidate_cached_blocks(*m_sftp, m_open_path);
     }
 
     std::streamsize optimal_buffer_size() const
@@ -615,18 +1299,65 @@ public:
 
     std::streamsize write(const char* data, std::streamsize data_size)
     {
-        return detail::write(*m_handle, m_open_path, data, data_size);
+        std::streamsize count =
+            detail::write(*m_handle, m_open_path, data, data_size);
+        detail::invalidate_cached_blocks(*m_sftp, m_open_path);
+        m_size->extend(libssh2_sftp_tell64(m_handle->file_handle()));
+        return count;
+    }
+
+    /**
+     * Write data directly to the file at the given position.
+     *
+     * Bypasses any stream buffer so the data goes straight from the caller's
+     * memory to the SFTP channel.  A stream wrapping this device must be
+     * flushed before mixing its output with calls to this method.
+     *
+     * Subsequent writes through the device carry on from the end of this one.
+     */
+    std::streamsize write_at(boost::uint64_t offset, const char* data,
+                             std::streamsize data_size)
+    {
+        std::streamsize count = detail::write_at(*m_handle, m_open_path,
+                                                 offset, data, data_size);
+        detail::invalidate_cached_blocks(*m_sftp, m_open_path);
+        m_size->extend(offset + count);
+        return count;
     }
 
     boost::iostreams::stream_offset seek(boost::iostreams::stream_offset off,
                                          std::ios_base::seekdir way)
     {
-        return detail::seek(*m_handle, m_open_path, off, way);
+        return detail::seek(*m_handle, m_open_path, off, way, *m_size);
+    }
+
+    /**
+     * Have the server commit the data to disk if the file was opened
+     * `durable`.
+     *
+     * The handle itself stays open until the last copy of the device goes.
+     */
+    void close()
+    {
+        if (m_durable)
+            detail::fsync(*m_handle, m_open_path);
+    }
+
+    /**
+     * Ask the server for the file's size the next time it is needed,
+     * rather than trusting the size kept since it was last asked.
+     */
+    void refresh()
+    {
+        m_size->refresh();
     }
 
 private:
     path m_open_path;
     boost::shared_ptr<::ssh::detail::file_handle_state> m_handle;
+    ::ssh::detail::sftp_channel_state* m_sftp;
+    boost::shared_ptr<detail::tracked_size> m_size;
+    bool m_durable;
 };
 
 /**
@@ -646,18 +1377,40 @@ class sftp_io_device
 public:
     sftp_io_device(sftp_filesystem& channel, const path& open_path,
                    openmode::value opening_mode = openmode::in | openmode::out)
-        : m_open_path(open_path),
-          m_handle(
-              detail::open_file(channel.sftp_ref(), m_open_path, opening_mode))
+        : m_file(boost::make_shared<detail::write_back_file>(
+              boost::ref(channel.sftp_ref()), open_path, opening_mode))
     {
+        // Opening may have truncated the file
+        detail::invalidate_cached_blocks(channel.sftp_ref(), open_path);
     }
 
     sftp_io_device(sftp_filesystem& channel, const path& open_path,
                    std::ios_base::openmode opening_mode)
-        : m_open_path(open_path),
-          m_handle(detail::open_file(channel.sftp_ref(), m_open_path,
-                                     detail::translate_flags(opening_mode)))
+        : m_file(boost::make_shared<detail::write_back_file>(
+              boost::ref(channel.sftp_ref()), open_path,
+              detail::translate_flags(opening_mode)))
+    {
+        detail::invalidate_cached_blocks(channel.sftp_ref(), open_path);
+    }
+
+    /**
+     * @param write_back_threshold  Bytes of writes held back before they
+     *                              are sent without waiting for a flush.
+     *                              Writes still held back when the device
+     *                              is destroyed without being flushed or
+     *                              closed can fail unnoticed, so owners
+     *                              that might not flush should pass zero,
+     *                              which sends every write as it is made
+     *                              and reports its failure from `write`.
+     */
+    sftp_io_device(sftp_filesystem& channel, const path& open_path,
+                   std::ios_base::openmode opening_mode,
+                   std::size_t write_back_threshold)
+        : m_file(boost::make_shared<detail::write_back_file>(
+              boost::ref(channel.sftp_ref()), open_path,
+              detail::translate_flags(opening_mode), write_back_threshold))
     {
+        detail::invalidate_cached_blocks(channel.sftp_ref(), open_path);
     }
 
     std::streamsize optimal_buffer_size() const
@@ -667,23 +1420,71 @@ public:
 
     std::streamsize read(char* buffer, std::streamsize buffer_size)
     {
-        return detail::read(*m_handle, m_open_path, buffer, buffer_size);
+        return m_file->read(buffer, buffer_size);
     }
 
+    /**
+     * Held back and sent with neighbouring writes when the device is
+     * flushed or closed, or when enough is waiting.
+     */
     std::streamsize write(const char* data, std::streamsize data_size)
     {
-        return detail::write(*m_handle, m_open_path, data, data_size);
+        return m_file->write(data, data_size);
+    }
+
+    /**
+     * Write data to the file at the given position.
+     *
+     * Bypasses any stream buffer.  A stream wrapping this device must be
+     * flushed before mixing its output with calls to this method.
+     *
+     * Subsequent writes through the device carry on from the end of this one.
+     */
+    std::streamsize write_at(boost::uint64_t offset, const char* data,
+                             std::streamsize data_size)
+    {
+        return m_file->write_at(offset, data, data_size);
     }
 
     boost::iostreams::stream_offset seek(boost::iostreams::stream_offset off,
                                          std::ios_base::seekdir way)
     {
-        return detail::seek(*m_handle, m_open_path, off, way);
+        return m_file->seek(off, way);
+    }
+
+    /**
+     * Send held-back writes to the server.
+     *
+     * A failure sets the stream's badbit, or throws if the stream is set to
+     * throw.
+     */
+    bool flush()
+    {
+        m_file->flush();
+        return true;
+    }
+
+    /**
+     * Send held-back writes to the server and, if the file was opened
+     * `durable`, have the server commit them to disk.
+     */
+    void close()
+    {
+        m_file->close();
+    }
+
+    /**
+     * Ask the server for the file's size the next time it is needed,
+     * rather than trusting the size kept since it was last asked.
+     */
+    void refresh()
+    {
+        m_file->refresh();
     }
 
 private:
-    path m_open_path;
-    boost::shared_ptr<::ssh::detail::file_handle_state> m_handle;
+    // Shared by copies of the device, which Boost.IOStreams makes freely
+    boost::shared_ptr<detail::write_back_file> m_file;
 };
 
 /**
@@ -0,0 +1,661 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file
+ *
+ * Making a directory on the server match a local one, sending only what
+ * has changed.
+ *
+ * Copying the same tree again and again, as happens with build output,
+ * mostly resends files the server already has.  Comparing sizes and times
+ * first costs one listing of each tree, and the remote listing reads many
+ * directories at once.
+ */
+
+#ifndef SSH_SYNC_HPP
+#define SSH_SYNC_HPP
+
+#include <ssh/detail/local_path.hpp> // local_name, utf8_name
+#include <ssh/detail/sftp_batch.hpp> // status_request
+#include <ssh/detail/sftp_protocol.hpp>
+#include <ssh/detail/sftp_walk.hpp> // tree_listing
+#include <ssh/detail/sync_plan.hpp>
+#include <ssh/detail/wire.hpp>
+#include <ssh/filesystem.hpp>
+#include <ssh/filesystem/path.hpp>
+#include <ssh/stream.hpp> // ofstream
+#include <ssh/transfer.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp> // uint64_t, uintmax_t
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/function.hpp>
+#include <boost/ref.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+#include <cstddef> // size_t
+#include <ctime>   // time_t
+#include <ios>     // ios_base
+#include <iterator> // istreambuf_iterator
+#include <string>
+#include <utility> // pair
+#include <vector>
+
+#include <libssh2_sftp.h> // LIBSSH2_SFTP_*
+
+namespace ssh
+{
+namespace filesystem
+{
+
+/**
+ * Told the local path of each file as it is finished with and the running
+ * total of file data uploaded.
+ *
+ * May throw to cancel the sync.
+ */
+typedef boost::function<void(const boost::filesystem::path&,
+                             boost::uintmax_t)> sync_progress;
+
+struct sync_policy
+{
+    sync_policy()
+        : remove_extraneous(false), hash_algorithm("md5"), dry_run(false)
+    {
+    }
+
+    /**
+     * Remove whatever is on the server but not in the local tree.
+     */
+    bool remove_extraneous;
+
+    /**
+     * Hash of a local file in lower-case hex, as `remote_hash` gives it.
+     *
+     * If set, files that are the same size in both trees but have different
+     * times are compared by hash, and only have their time set if the hashes
+     * match.  Without it, a different time means an upload.
+     */
+    boost::function<std::string(const boost::filesystem::path&)> local_hash;
+
+    /**
+     * Algorithm that `local_hash` uses, named as `remote_hash` takes it.
+     */
+    std::string hash_algorithm;
+
+    /**
+     * Work out what needs doing and count it, but change nothing.
+     */
+    bool dry_run;
+
+    sync_progress progress;
+};
+
+struct sync_statistics
+{
+    sync_statistics()
+        : uploaded(0), bytes_uploaded(0), directories_created(0), removed(0),
+          times_updated(0), unchanged(0)
+    {
+    }
+
+    boost::uintmax_t uploaded;
+    boost::uintmax_t bytes_uploaded;
+    boost::uintmax_t directories_created;
+
+    /**
+     * Files and directories removed from the server.
+     */
+    boost::uintmax_t removed;
+
+    /**
+     * Files whose contents matched, so only their time was set.
+     */
+    boost::uintmax_t times_updated;
+
+    boost::uintmax_t unchanged;
+
+    /**
+     * Remote paths that couldn't be listed, created, removed or uploaded,
+     * and why.
+     */
+    std::vector<std::pair<path, boost::system::error_code>> failures;
+};
+
+namespace sync_detail
+{
+
+/**
+ * Files bigger than this are streamed on their own rather than read into
+ * memory to go in a batch.
+ */
+const boost::uintmax_t batch_file_limit = 1024 * 1024;
+
+/**
+ * Most file data read into memory for one batch.
+ */
+const std::size_t batch_byte_limit = 8 * 1024 * 1024;
+
+inline boost::uint64_t sync_time(std::time_t time)
+{
+    return (time < 0) ? 0 : static_cast<boost::uint64_t>(time);
+}
+
+/**
+ * Add the files and directories below `directory` to the tree.  Links
+ * aren't followed and anything else is left out.
+ */
+inline void add_local_items(::ssh::detail::sync_tree& tree,
+                            const boost::filesystem::path& directory,
+                            const std::string& prefix)
+{
+    using ::ssh::detail::sync_item;
+
+    for (boost::filesystem::directory_iterator it(directory), end; it != end;
+         ++it)
+    {
+        const boost::filesystem::path& local = it->path();
+        std::string name = prefix + ::ssh::detail::utf8_name(local.filename());
+
+        boost::filesystem::file_status status = it->symlink_status();
+        if (boost::filesystem::is_directory(status))
+        {
+            tree[name] = sync_item(sync_item::directory, 0, 0);
+            add_local_items(tree, local, name + "/");
+        }
+        else if (boost::filesystem::is_regular_file(status))
+        {
+            tree[name] = sync_item(
+                sync_item::file, boost::filesystem::file_size(local),
+                sync_time(boost::filesystem::last_write_time(local)));
+        }
+    }
+}
+
+inline ::ssh::detail::sync_tree
+remote_items(const ::ssh::detail::sftp_protocol::tree_listing& listing)
+{
+    using ::ssh::detail::sync_item;
+    namespace protocol = ::ssh::detail::sftp_protocol;
+
+    ::ssh::detail::sync_tree tree;
+    for (std::vector<protocol::tree_entry>::const_iterator it =
+             listing.entries.begin();
+         it != listing.entries.end(); ++it)
+    {
+        const LIBSSH2_SFTP_ATTRIBUTES& attributes = it->attributes;
+
+        sync_item item;
+        if (protocol::is_directory_entry(attributes))
+            item.type = sync_item::directory;
+        else if (protocol::is_file_entry(attributes))
+            item.type = sync_item::file;
+        else
+            item.type = sync_item::other;
+
+        if (attributes.flags & LIBSSH2_SFTP_ATTR_SIZE)
+            item.size = attributes.filesize;
+        if (attributes.flags & LIBSSH2_SFTP_ATTR_ACMODTIME)
+            item.mtime = attributes.mtime;
+
+        tree[it->name] = item;
+    }
+
+    return tree;
+}
+
+inline path remote_path(const path& root, const std::string& name)
+{
+    return root / path(name);
+}
+
+inline boost::filesystem::path local_path(const boost::filesystem::path& root,
+                                          const std::string& name)
+{
+    return root / ::ssh::detail::local_name(name);
+}
+
+/**
+ * Whether a file the same size in both trees has the same contents, going
+ * by its hash.  A file that can't be hashed on the server counts as
+ * different.
+ */
+inline bool same_hash(sftp_filesystem& fs,
+                      const boost::filesystem::path& local_root,
+                      const path& remote_root, const sync_policy& policy,
+                      const std::string& name)
+{
+    try
+    {
+        return policy.local_hash(local_path(local_root, name)) ==
+               remote_hash(fs, remote_path(remote_root, name),
+                           policy.hash_algorithm);
+    }
+    catch (const boost::system::system_error&)
+    {
+        return false;
+    }
+}
+
+inline ::ssh::detail::sftp_protocol::status_request
+path_request(boost::uint8_t type, const path& target)
+{
+    ::ssh::detail::wire_writer body;
+    body.put_string(target.native());
+    return ::ssh::detail::sftp_protocol::status_request(type, body.buffer());
+}
+
+inline ::ssh::detail::sftp_protocol::status_request
+mkdir_request(const path& directory)
+{
+    namespace protocol = ::ssh::detail::sftp_protocol;
+
+    // Same permissions as create_directory gives
+    LIBSSH2_SFTP_ATTRIBUTES attributes = LIBSSH2_SFTP_ATTRIBUTES();
+    attributes.flags = LIBSSH2_SFTP_ATTR_PERMISSIONS;
+    attributes.permissions = 0755;
+
+    ::ssh::detail::wire_writer body;
+    body.put_string(directory.native());
+    protocol::put_attributes(body, attributes);
+    return protocol::status_request(protocol::packet_type::mkdir,
+                                    body.buffer());
+}
+
+inline ::ssh::detail::sftp_protocol::status_request
+set_time_request(const path& file, boost::uint64_t mtime)
+{
+    namespace protocol = ::ssh::detail::sftp_protocol;
+
+    LIBSSH2_SFTP_ATTRIBUTES attributes = LIBSSH2_SFTP_ATTRIBUTES();
+    attributes.flags = LIBSSH2_SFTP_ATTR_ACMODTIME;
+    attributes.atime = static_cast<unsigned long>(mtime);
+    attributes.mtime = static_cast<unsigned long>(mtime);
+
+    ::ssh::detail::wire_writer body;
+    body.put_string(file.native());
+    protocol::put_attributes(body, attributes);
+    return protocol::status_request(protocol::packet_type::setstat,
+                                    body.buffer());
+}
+
+/**
+ * Record each failure among `results` against the name it was for.
+ *
+ * @returns how many succeeded.
+ */
+inline boost::uintmax_t
+count_results(const std::vector<boost::system::error_code>& results,
+              const std::vector<std::string>& names, const path& remote_root,
+              sync_statistics& statistics)
+{
+    boost::uintmax_t succeeded = 0;
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        if (results[i])
+        {
+            statistics.failures.push_back(
+                std::make_pair(remote_path(remote_root, names[i]), results[i]));
+        }
+        else
+        {
+            ++succeeded;
+        }
+    }
+
+    return succeeded;
+}
+
+/**
+ * Split names into runs of the same depth, keeping their order.
+ */
+inline std::vector<std::vector<std::string>>
+by_depth(const std::vector<std::string>& names)
+{
+    std::vector<std::vector<std::string>> levels;
+    for (std::vector<std::string>::const_iterator it = names.begin();
+         it != names.end(); ++it)
+    {
+        if (levels.empty() || ::ssh::detail::sync_detail::depth(*it) !=
+                                  ::ssh::detail::sync_detail::depth(
+                                      levels.back().front()))
+        {
+            levels.push_back(std::vector<std::string>());
+        }
+
+        levels.back().push_back(*it);
+    }
+
+    return levels;
+}
+
+inline std::string read_local_file(const boost::filesystem::path& file)
+{
+    boost::filesystem::ifstream data(
+        file, std::ios_base::in | std::ios_base::binary);
+    if (!data)
+    {
+        BOOST_THROW_EXCEPTION(boost::system::system_error(
+            boost::system::errc::make_error_code(
+                boost::system::errc::no_such_file_or_directory),
+            "Failed to open " + file.string()));
+    }
+
+    return std::string((std::istreambuf_iterator<char>(data)),
+                       std::istreambuf_iterator<char>());
+}
+
+inline void report_streamed(const sync_progress& progress,
+                            const boost::filesystem::path& file,
+                            boost::uintmax_t done_before,
+                            boost::uintmax_t so_far)
+{
+    progress(file, done_before + so_far);
+}
+}
+
+/**
+ * Make a directory on the server hold the same files as a local directory,
+ * sending only what differs.
+ *
+ * Both trees are listed first; the remote one with many directories read at
+ * once.  A file is uploaded if the server doesn't have it or has it with a
+ * different size or modification time, and uploaded files are given the
+ * local file's time so that the next sync finds them unchanged.  With a
+ * `local_hash` in the policy, files that differ only in time are compared by
+ * hash and just have their time set if they match.
+ *
+ * The changes are made in stages, each with many requests in flight:
+ * removals, then new directories a level at a time, then uploads, then
+ * times.  Small files are uploaded together in batches and large ones are
+ * streamed one at a time.  Nothing asks before replacing a file on the
+ * server.
+ *
+ * Anything on the server in the way of a local file or directory is
+ * removed.  Whatever else the server has that the local tree doesn't is
+ * only removed if the policy says to.  Local links and anything else that
+ * isn't a file or directory are left out.
+ *
+ * `remote_directory` is created if it doesn't exist, but its parent must.
+ * Remote directories that can't be listed are reported as failures, and
+ * local files that belong in them are uploaded whether they are needed or
+ * not.
+ *
+ * @returns what was done.  Things that failed don't stop the rest and are
+ *          listed in the statistics.
+ * @throws `boost::system::system_error` if `remote_directory` can't be
+ *         listed or created, a local file can't be read or the connection
+ *         fails, or whatever `progress` threw.
+ */
+inline sync_statistics sync(const boost::filesystem::path& local_directory,
+                            sftp_filesystem& fs, const path& remote_directory,
+                            const sync_policy& policy)
+{
+    using namespace sync_detail;
+    namespace protocol = ::ssh::detail::sftp_protocol;
+
+    sync_statistics statistics;
+
+    ::ssh::detail::sync_tree local;
+    add_local_items(local, local_directory, std::string());
+
+    bool root_missing = false;
+    protocol::tree_listing listing = fs.walk_tree(remote_directory);
+    for (std::vector<std::pair<std::string, boost::system::error_code>>::
+             const_iterator it = listing.failures.begin();
+         it != listing.failures.end(); ++it)
+    {
+        if (!it->first.empty())
+        {
+            statistics.failures.push_back(std::make_pair(
+                remote_path(remote_directory, it->first), it->second));
+        }
+        else if (it->second.value() == LIBSSH2_FX_NO_SUCH_FILE)
+        {
+            root_missing = true;
+        }
+        else
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                it->second, "Unable to list " + remote_directory.string()));
+        }
+    }
+
+    ::ssh::detail::contents_comparison same_contents;
+    if (policy.local_hash && !root_missing)
+    {
+        same_contents = boost::bind(
+            &same_hash, boost::ref(fs), boost::cref(local_directory),
+            boost::cref(remote_directory), boost::cref(policy), _1);
+    }
+
+    ::ssh::detail::sync_plan plan =
+        ::ssh::detail::plan_sync(local, remote_items(listing),
+                                 policy.remove_extraneous, same_contents);
+
+    statistics.unchanged = plan.unchanged;
+
+    if (policy.dry_run)
+    {
+        statistics.uploaded = plan.uploads.size();
+        for (std::vector<std::string>::const_iterator it =
+                 plan.uploads.begin();
+             it != plan.uploads.end(); ++it)
+        {
+            statistics.bytes_uploaded += local[*it].size;
+        }
+        statistics.directories_created = plan.create_directories.size();
+        statistics.removed =
+            plan.remove_files.size() + plan.remove_directories.size();
+        statistics.times_updated = plan.touches.size();
+        return statistics;
+    }
+
+    if (root_missing)
+        create_directory(fs, remote_directory);
+
+    // Removals first, so nothing is in the way of what replaces them
+
+    std::vector<protocol::status_request> requests;
+    for (std::vector<std::string>::const_iterator it =
+             plan.remove_files.begin();
+         it != plan.remove_files.end(); ++it)
+    {
+        path target = remote_path(remote_directory, *it);
+        ::ssh::filesystem::detail::invalidate_cached_blocks(fs.sftp_ref(),
+                                                           target);
+        requests.push_back(
+            path_request(protocol::packet_type::remove, target));
+    }
+    statistics.removed += count_results(fs.run_requests(requests),
+                                        plan.remove_files, remote_directory,
+                                        statistics);
+
+    std::vector<std::vector<std::string>> levels =
+        by_depth(plan.remove_directories);
+    for (std::size_t level = 0; level < levels.size(); ++level)
+    {
+        requests.clear();
+        for (std::vector<std::string>::const_iterator it =
+                 levels[level].begin();
+             it != levels[level].end(); ++it)
+        {
+            requests.push_back(path_request(
+                protocol::packet_type::rmdir,
+                remote_path(remote_directory, *it)));
+        }
+        statistics.removed += count_results(fs.run_requests(requests),
+                                            levels[level], remote_directory,
+                                            statistics);
+    }
+
+    // A level at a time, as a directory must exist before its children
+
+    levels = by_depth(plan.create_directories);
+    for (std::size_t level = 0; level < levels.size(); ++level)
+    {
+        requests.clear();
+        for (std::vector<std::string>::const_iterator it =
+                 levels[level].begin();
+             it != levels[level].end(); ++it)
+        {
+            requests.push_back(
+                mkdir_request(remote_path(remote_directory, *it)));
+        }
+        statistics.directories_created +=
+            count_results(fs.run_requests(requests), levels[level],
+                          remote_directory, statistics);
+    }
+
+    // Only files that made it to the server get their time set
+    std::vector<std::string> timed(plan.touches);
+
+    std::vector<std::string> batch_names;
+    std::vector<batch_upload> batch;
+    std::size_t batch_bytes = 0;
+    boost::scoped_ptr<transfer_engine> engine;
+
+    for (std::size_t i = 0; i <= plan.uploads.size(); ++i)
+    {
+        bool last = i == plan.uploads.size();
+        boost::uintmax_t size = (last) ? 0 : local[plan.uploads[i]].size;
+
+        if (!batch.empty() &&
+            (last || batch_bytes + size > batch_byte_limit))
+        {
+            std::vector<boost::system::error_code> results =
+                upload_batch(fs, batch);
+            for (std::size_t j = 0; j < results.size(); ++j)
+            {
+                if (results[j])
+                {
+                    statistics.failures.push_back(
+                        std::make_pair(batch[j].target, results[j]));
+                    continue;
+                }
+
+                ++statistics.uploaded;
+                statistics.bytes_uploaded += batch[j].contents.size();
+                timed.push_back(batch_names[j]);
+
+                if (policy.progress)
+                {
+                    policy.progress(
+                        local_path(local_directory, batch_names[j]),
+                        statistics.bytes_uploaded);
+                }
+            }
+
+            batch.clear();
+            batch_names.clear();
+            batch_bytes = 0;
+        }
+
+        if (last)
+            break;
+
+        const std::string& name = plan.uploads[i];
+        boost::filesystem::path source = local_path(local_directory, name);
+        path target = remote_path(remote_directory, name);
+
+        if (size <= batch_file_limit)
+        {
+            batch.push_back(
+                batch_upload(target, read_local_file(source), true));
+            batch_names.push_back(name);
+            batch_bytes += static_cast<std::size_t>(size);
+            continue;
+        }
+
+        if (!engine)
+            engine.reset(new transfer_engine());
+
+        try
+        {
+            ofstream remote(fs, target, std::ios_base::out |
+                                            std::ios_base::trunc |
+                                            std::ios_base::binary);
+            file_source data(source);
+            stream_sink sink(remote);
+
+            transfer_engine::progress_callback streamed;
+            if (policy.progress)
+            {
+                streamed = boost::bind(&report_streamed,
+                                       boost::cref(policy.progress), source,
+                                       statistics.bytes_uploaded, _1);
+            }
+
+            transfer_statistics sent = engine->transfer(data, sink, streamed);
+            remote.close();
+
+            ++statistics.uploaded;
+            statistics.bytes_uploaded += sent.bytes;
+            timed.push_back(name);
+        }
+        catch (const boost::system::system_error& e)
+        {
+            // The server refusing one file needn't stop the rest
+            if (e.code().category() != sftp_error_category())
+                throw;
+
+            statistics.failures.push_back(std::make_pair(target, e.code()));
+        }
+    }
+
+    requests.clear();
+    for (std::vector<std::string>::const_iterator it = timed.begin();
+         it != timed.end(); ++it)
+    {
+        requests.push_back(set_time_request(
+            remote_path(remote_directory, *it), local[*it].mtime));
+    }
+    std::vector<boost::system::error_code> results = fs.run_requests(requests);
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        if (results[i])
+        {
+            statistics.failures.push_back(std::make_pair(
+                remote_path(remote_directory, timed[i]), results[i]));
+        }
+        else if (i < plan.touches.size())
+        {
+            ++statistics.times_updated;
+        }
+    }
+
+    return statistics;
+}
+
+/**
+ * Make a directory on the server hold the same files as a local directory,
+ * uploading what differs by size or time and removing nothing that is only
+ * on the server.
+ */
+inline sync_statistics sync(const boost::filesystem::path& local_directory,
+                            sftp_filesystem& fs, const path& remote_directory)
+{
+    return sync(local_directory, fs, remote_directory, sync_policy());
+}
+}
+} // namespace ssh::filesystem
+
+#endif
@@ -0,0 +1,850 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SSH_TRANSFER_HPP
+#define SSH_TRANSFER_HPP
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/exception_ptr.hpp> // current_exception, rethrow_exception
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp> // file_size
+#include <boost/filesystem/path.hpp>
+#include <boost/function.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+#include <algorithm> // copy, max, min
+#include <cstddef>   // size_t
+#include <deque>
+#include <istream>
+#include <ostream>
+#include <stdexcept> // invalid_argument
+#include <string>
+#include <utility> // pair
+#include <vector>
+
+namespace ssh
+{
+namespace filesystem
+{
+
+/**
+ * Where a transfer reads its data from.
+ *
+ * Read from a thread of the transfer's own, not the one that started the
+ * transfer, unless the transfer is started with
+ * `transfer_engine::transfer_reading_here`.
+ */
+class transfer_source
+{
+public:
+    virtual ~transfer_source()
+    {
+    }
+
+    /**
+     * Read up to `size` bytes.
+     *
+     * @returns the number of bytes read, which is only 0 at the end of the
+     *          data.
+     */
+    virtual std::size_t read(char* buffer, std::size_t size) = 0;
+
+    /**
+     * The next `size` bytes of the source, or fewer, if the source can hand
+     * them over where they are in memory.
+     *
+     * The engine then writes them straight to the sink rather than copying
+     * them through its buffers, and never calls `read`.  The data need only
+     * stay valid until the next call, and a size of 0 means the end of the
+     * data.  Sources that have to be read return a null pointer.
+     */
+    virtual std::pair<const char*, std::size_t>
+    contiguous_data(std::size_t /*size*/)
+    {
+        return std::pair<const char*, std::size_t>(NULL, 0);
+    }
+
+    /**
+     * Called on the reading thread before the first read.
+     *
+     * For sources that need to set up per-thread state.
+     */
+    virtual void reading_started()
+    {
+    }
+
+    /**
+     * Called on the reading thread after the last read, even if it failed.
+     */
+    virtual void reading_finished()
+    {
+    }
+};
+
+/**
+ * Where a transfer writes its data to.
+ *
+ * Written from the thread that started the transfer, unless the transfer
+ * is started with `transfer_engine::transfer_reading_here`.
+ */
+class transfer_sink
+{
+public:
+    virtual ~transfer_sink()
+    {
+    }
+
+    /**
+     * Write all of `data` or throw.
+     */
+    virtual void write(const char* data, std::size_t size) = 0;
+
+    /**
+     * Called once everything has been written.
+     */
+    virtual void finish()
+    {
+    }
+};
+
+/**
+ * Source reading from memory the caller keeps alive.
+ */
+class memory_source : public transfer_source
+{
+public:
+    memory_source(const char* data, std::size_t size)
+        : m_data(data), m_remaining(size)
+    {
+    }
+
+    explicit memory_source(const std::string& data)
+        : m_data(data.data()), m_remaining(data.size())
+    {
+    }
+
+    virtual std::size_t read(char* buffer, std::size_t size)
+    {
+        std::size_t count = (std::min)(size, m_remaining);
+        std::copy(m_data, m_data + count, buffer);
+        m_data += count;
+        m_remaining -= count;
+        return count;
+    }
+
+private:
+    const char* m_data;
+    std::size_t m_remaining;
+};
+
+/**
+ * Source reading from any standard stream.
+ */
+class stream_source : public transfer_source
+{
+public:
+    explicit stream_source(std::istream& stream) : m_stream(stream)
+    {
+    }
+
+    virtual std::size_t read(char* buffer, std::size_t size)
+    {
+        m_stream.read(buffer, size);
+        if (m_stream.bad())
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::io_error),
+                "Failed to read transfer source"));
+        }
+
+        return static_cast<std::size_t>(m_stream.gcount());
+    }
+
+private:
+    std::istream& m_stream;
+};
+
+/**
+ * Source reading a local file.
+ */
+class file_source : public transfer_source
+{
+public:
+    explicit file_source(const boost::filesystem::path& file)
+        : m_file(file, std::ios_base::in | std::ios_base::binary),
+          m_reader(m_file)
+    {
+        if (!m_file)
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::no_such_file_or_directory),
+                "Failed to open " + file.string()));
+        }
+    }
+
+    virtual std::size_t read(char* buffer, std::size_t size)
+    {
+        return m_reader.read(buffer, size);
+    }
+
+private:
+    boost::filesystem::ifstream m_file;
+    stream_source m_reader;
+};
+
+/**
+ * Source memory-mapping a local file.
+ *
+ * The engine uploads straight from the mapping so the file's data is never
+ * copied on its way to the sink.
+ *
+ * Only a window of the file is mapped at a time, moving along as the file
+ * is read, so a large file takes neither a large part of the address space
+ * nor more than the window's worth of memory.
+ */
+class mapped_file_source : public transfer_source
+{
+public:
+    static const std::size_t DEFAULT_WINDOW_SIZE = 4 * 1024 * 1024;
+
+    /**
+     * @param window_size  How much of the file to map at once.  Rounded up
+     *                     to a whole number of pages.
+     */
+    explicit mapped_file_source(const boost::filesystem::path& file,
+                                std::size_t window_size = DEFAULT_WINDOW_SIZE)
+        : m_size(boost::filesystem::file_size(file)),
+          m_position(0),
+          m_window_offset(0)
+    {
+        std::size_t page =
+            boost::interprocess::mapped_region::get_page_size();
+        m_window_size = ((std::max)(window_size, std::size_t(1)) + page - 1) /
+                        page * page;
+
+        // Empty files can't be mapped
+        if (m_size > 0)
+        {
+            boost::interprocess::file_mapping mapping(
+                file.string().c_str(), boost::interprocess::read_only);
+            m_mapping.swap(mapping);
+        }
+    }
+
+    virtual std::size_t read(char* buffer, std::size_t size)
+    {
+        std::pair<const char*, std::size_t> data = contiguous_data(size);
+        std::copy(data.first, data.first + data.second, buffer);
+        return data.second;
+    }
+
+    virtual std::pair<const char*, std::size_t>
+    contiguous_data(std::size_t size)
+    {
+        if (m_position >= m_size)
+        {
+            return std::pair<const char*, std::size_t>(window_data(), 0);
+        }
+
+        if (m_position < m_window_offset ||
+            m_position >= m_window_offset + m_window.get_size())
+        {
+            map_window();
+        }
+
+        std::size_t offset =
+            static_cast<std::size_t>(m_position - m_window_offset);
+        std::size_t count =
+            (std::min)(size, m_window.get_size() - offset);
+        m_position += count;
+
+        return std::make_pair(window_data() + offset, count);
+    }
+
+private:
+    /**
+     * Map the window holding the current position.
+     */
+    void map_window()
+    {
+        boost::uintmax_t offset = m_position / m_window_size * m_window_size;
+        std::size_t size = static_cast<std::size_t>(
+            (std::min)(static_cast<boost::uintmax_t>(m_window_size),
+                       m_size - offset));
+
+        // Unmapping the old window first so the two are never mapped at once
+        boost::interprocess::mapped_region().swap(m_window);
+
+        boost::interprocess::mapped_region window(
+            m_mapping, boost::interprocess::read_only,
+            static_cast<boost::interprocess::offset_t>(offset), size);
+        window.advise(boost::interprocess::mapped_region::advice_sequential);
+
+        m_window.swap(window);
+        m_window_offset = offset;
+    }
+
+    const char* window_data() const
+    {
+        return static_cast<const char*>(m_window.get_address());
+    }
+
+    boost::interprocess::file_mapping m_mapping;
+    boost::interprocess::mapped_region m_window;
+    std::size_t m_window_size;
+    boost::uintmax_t m_size;
+    boost::uintmax_t m_position;
+    boost::uintmax_t m_window_offset;
+};
+
+/**
+ * Sink writing to any standard stream, such as an `ssh::filesystem::ofstream`.
+ */
+class stream_sink : public transfer_sink
+{
+public:
+    explicit stream_sink(std::ostream& stream) : m_stream(stream)
+    {
+    }
+
+    virtual void write(const char* data, std::size_t size)
+    {
+        m_stream.write(data, size);
+        check();
+    }
+
+    virtual void finish()
+    {
+        m_stream.flush();
+        check();
+    }
+
+private:
+    void check()
+    {
+        if (!m_stream)
+        {
+            BOOST_THROW_EXCEPTION(boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::io_error),
+                "Failed to write transfer sink"));
+        }
+    }
+
+    std::ostream& m_stream;
+};
+
+/**
+ * Sink writing to an SFTP file device at increasing positions.
+ *
+ * Works with `sftp_output_device` and `sftp_io_device`.  Data is written
+ * with the device's `write_at`, which skips the stream buffer, so what the
+ * engine hands over goes to the channel without another copy.
+ */
+template <typename Device>
+class device_sink : public transfer_sink
+{
+public:
+    explicit device_sink(Device& device, boost::uint64_t offset = 0)
+        : m_device(device), m_offset(offset)
+    {
+    }
+
+    virtual void write(const char* data, std::size_t size)
+    {
+        m_device.write_at(m_offset, data, size);
+        m_offset += size;
+    }
+
+private:
+    Device& m_device;
+    boost::uint64_t m_offset;
+};
+
+/**
+ * What held a transfer back.
+ */
+enum transfer_bottleneck
+{
+    /** Neither end spent long waiting for the other. */
+    no_bottleneck,
+
+    /** The sink often had nothing to write: reading is the limit. */
+    source_bound,
+
+    /** Every buffer was often waiting to be written: the sink is the
+        limit, which for an upload means the network. */
+    sink_bound
+};
+
+struct transfer_statistics
+{
+    transfer_statistics() : bytes(0)
+    {
+    }
+
+    boost::uintmax_t bytes;
+    boost::posix_time::time_duration elapsed;
+
+    /**
+     * Time the writer spent waiting for the reader to fill a buffer.
+     */
+    boost::posix_time::time_duration waiting_for_source;
+
+    /**
+     * Time the reader spent waiting for the writer to free a buffer.
+     */
+    boost::posix_time::time_duration waiting_for_sink;
+
+    double bytes_per_second() const
+    {
+        boost::int64_t microseconds = elapsed.total_microseconds();
+        if (microseconds <= 0)
+            return 0.0;
+
+        return static_cast<double>(bytes) * 1000000.0 / microseconds;
+    }
+
+    /**
+     * The end that held the transfer back, if either did for more than a
+     * tenth of the time.
+     */
+    transfer_bottleneck bottleneck() const
+    {
+        boost::posix_time::time_duration threshold = elapsed / 10;
+
+        if (waiting_for_source > waiting_for_sink &&
+            waiting_for_source > threshold)
+            return source_bound;
+        else if (waiting_for_sink > waiting_for_source &&
+                 waiting_for_sink > threshold)
+            return sink_bound;
+        else
+            return no_bottleneck;
+    }
+};
+
+/**
+ * Copies from a source to a sink with reading and writing overlapped.
+ *
+ * A thread reads from the source into a ring of buffers while the calling
+ * thread writes the filled buffers to the sink, so the local disk and the
+ * network are both kept busy rather than taking turns.
+ *
+ * The buffers are allocated once and reused by every transfer the engine
+ * runs.  One engine runs one transfer at a time.
+ */
+class transfer_engine : private boost::noncopyable
+{
+public:
+    /**
+     * Told the running total after each buffer is written.
+     *
+     * May throw to cancel the transfer.
+     */
+    typedef boost::function<void(boost::uintmax_t)> progress_callback;
+
+    static const std::size_t default_buffer_count = 4;
+    static const std::size_t default_buffer_size = 32 * 1024;
+
+    explicit transfer_engine(std::size_t buffer_count = default_buffer_count,
+                             std::size_t buffer_size = default_buffer_size)
+        : m_buffers(buffer_count, std::vector<char>(buffer_size)),
+          m_filled(buffer_count, 0)
+    {
+        if (buffer_count < 2 || buffer_size == 0)
+        {
+            BOOST_THROW_EXCEPTION(std::invalid_argument(
+                "Transfer needs at least two non-empty buffers"));
+        }
+    }
+
+    /**
+     * Copy everything from `source` to `sink`.
+     *
+     * @throws whatever the source, the sink or the progress callback threw,
+     *         once the reading thread has stopped.
+     */
+    transfer_statistics transfer(transfer_source& source, transfer_sink& sink,
+                                 progress_callback progress =
+                                     progress_callback())
+    {
+        reset();
+
+        boost::posix_time::ptime start =
+            boost::posix_time::microsec_clock::universal_time();
+
+        if (write_contiguous(source, sink, progress))
+        {
+            sink.finish();
+
+            m_statistics.elapsed =
+                boost::posix_time::microsec_clock::universal_time() - start;
+            return m_statistics;
+        }
+
+        boost::thread reader(boost::bind(&transfer_engine::run_reader, this,
+                                         boost::ref(source)));
+
+        try
+        {
+            write_all(sink, progress);
+        }
+        catch (...)
+        {
+            stop();
+            reader.join();
+            throw;
+        }
+
+        reader.join();
+
+        sink.finish();
+
+        m_statistics.elapsed =
+            boost::posix_time::microsec_clock::universal_time() - start;
+        return m_statistics;
+    }
+
+    /**
+     * Copy everything from `source` to `sink`, the other way round to
+     * `transfer`: the source is read on the calling thread and the sink
+     * written on a thread of the engine's.
+     *
+     * For sources that can only be used from the thread that made them,
+     * such as COM objects belonging to the caller's apartment, where a
+     * call from another thread would have to wait for the caller to pump
+     * messages.  The source's hooks and the progress callback run on the
+     * calling thread, progress being reported between reads.
+     *
+     * @throws whatever the source, the sink or the progress callback threw,
+     *         once the writing thread has stopped.
+     */
+    transfer_statistics
+    transfer_reading_here(transfer_source& source, transfer_sink& sink,
+                          progress_callback progress = progress_callback())
+    {
+        reset();
+
+        boost::posix_time::ptime start =
+            boost::posix_time::microsec_clock::universal_time();
+
+        // Nothing to read, so nothing gained from another thread
+        if (write_contiguous(source, sink, progress))
+        {
+            sink.finish();
+
+            m_statistics.elapsed =
+                boost::posix_time::microsec_clock::universal_time() - start;
+            return m_statistics;
+        }
+
+        boost::thread writer(boost::bind(&transfer_engine::run_writer, this,
+                                         boost::ref(sink)));
+
+        try
+        {
+            source.reading_started();
+
+            try
+            {
+                read_all(source, progress);
+            }
+            catch (...)
+            {
+                source.reading_finished();
+                throw;
+            }
+
+            source.reading_finished();
+        }
+        catch (...)
+        {
+            stop();
+            writer.join();
+            throw;
+        }
+
+        writer.join();
+
+        if (m_sink_error)
+            boost::rethrow_exception(m_sink_error);
+
+        if (progress)
+            progress(m_statistics.bytes);
+
+        m_statistics.elapsed =
+            boost::posix_time::microsec_clock::universal_time() - start;
+        return m_statistics;
+    }
+
+private:
+    void reset()
+    {
+        m_free.clear();
+        m_full.clear();
+        for (std::size_t i = 0; i < m_buffers.size(); ++i)
+            m_free.push_back(i);
+
+        m_source_finished = false;
+        m_stopped = false;
+        m_source_error = boost::exception_ptr();
+        m_sink_error = boost::exception_ptr();
+        m_statistics = transfer_statistics();
+    }
+
+    void stop()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stopped = true;
+        m_changed.notify_all();
+    }
+
+    void run_reader(transfer_source& source)
+    {
+        try
+        {
+            source.reading_started();
+
+            try
+            {
+                progress_callback no_progress;
+                read_all(source, no_progress);
+            }
+            catch (...)
+            {
+                source.reading_finished();
+                throw;
+            }
+
+            source.reading_finished();
+        }
+        catch (...)
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_source_error = boost::current_exception();
+            m_source_finished = true;
+            m_changed.notify_all();
+        }
+    }
+
+    void run_writer(transfer_sink& sink)
+    {
+        try
+        {
+            progress_callback no_progress;
+            write_all(sink, no_progress);
+
+            boost::mutex::scoped_lock lock(m_mutex);
+            if (m_stopped)
+                return;
+        }
+        catch (...)
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_sink_error = boost::current_exception();
+            m_stopped = true;
+            m_changed.notify_all();
+            return;
+        }
+
+        try
+        {
+            sink.finish();
+        }
+        catch (...)
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_sink_error = boost::current_exception();
+        }
+    }
+
+    /**
+     * @param progress  Told how much has been written after each read, if
+     *                  it has changed.  Only for reading on the calling
+     *                  thread.
+     */
+    void read_all(transfer_source& source, progress_callback& progress)
+    {
+        boost::uintmax_t reported = 0;
+
+        while (true)
+        {
+            std::size_t slot;
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+
+                boost::posix_time::ptime wait_start =
+                    boost::posix_time::microsec_clock::universal_time();
+                while (m_free.empty() && !m_stopped)
+                    m_changed.wait(lock);
+                m_statistics.waiting_for_sink +=
+                    boost::posix_time::microsec_clock::universal_time() -
+                    wait_start;
+
+                if (m_stopped)
+                    return;
+
+                slot = m_free.front();
+                m_free.pop_front();
+            }
+
+            // Filling the whole buffer where the source allows, so that the
+            // sink gets writes of a useful size
+            std::vector<char>& buffer = m_buffers[slot];
+            std::size_t filled = 0;
+            while (filled < buffer.size())
+            {
+                std::size_t count =
+                    source.read(&buffer[filled], buffer.size() - filled);
+                if (count == 0)
+                    break;
+                filled += count;
+            }
+            m_filled[slot] = filled;
+
+            boost::uintmax_t written;
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+
+                if (filled > 0)
+                    m_full.push_back(slot);
+                else
+                    m_free.push_back(slot);
+
+                if (filled < buffer.size())
+                    m_source_finished = true;
+
+                m_changed.notify_all();
+
+                if (m_source_finished)
+                    return;
+
+                written = m_statistics.bytes;
+            }
+
+            if (progress && written > reported)
+            {
+                progress(written);
+                reported = written;
+            }
+        }
+    }
+
+    /**
+     * Write the source to the sink straight from the source's memory.
+     *
+     * @returns false, having taken nothing from the source, if the source
+     *          has to be read instead.
+     */
+    bool write_contiguous(transfer_source& source, transfer_sink& sink,
+                          progress_callback& progress)
+    {
+        // Slices the size of a buffer so progress and cancellation are as
+        // responsive as for sources that are read
+        std::size_t slice_size = m_buffers.front().size();
+
+        std::pair<const char*, std::size_t> slice =
+            source.contiguous_data(slice_size);
+        if (!slice.first)
+            return false;
+
+        while (slice.second > 0)
+        {
+            sink.write(slice.first, slice.second);
+            m_statistics.bytes += slice.second;
+
+            if (progress)
+                progress(m_statistics.bytes);
+
+            slice = source.contiguous_data(slice_size);
+        }
+
+        return true;
+    }
+
+    void write_all(transfer_sink& sink, progress_callback& progress)
+    {
+        while (true)
+        {
+            std::size_t slot;
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+
+                boost::posix_time::ptime wait_start =
+                    boost::posix_time::microsec_clock::universal_time();
+                while (m_full.empty() && !m_source_finished && !m_stopped)
+                    m_changed.wait(lock);
+                m_statistics.waiting_for_source +=
+                    boost::posix_time::microsec_clock::universal_time() -
+                    wait_start;
+
+                if (m_source_error)
+                    boost::rethrow_exception(m_source_error);
+
+                // Only the reader stops a writer, having failed itself
+                if (m_stopped)
+                    return;
+
+                if (m_full.empty())
+                    return;
+
+                slot = m_full.front();
+                m_full.pop_front();
+            }
+
+            sink.write(&m_buffers[slot][0], m_filled[slot]);
+
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+                m_statistics.bytes += m_filled[slot];
+                m_free.push_back(slot);
+                m_changed.notify_all();
+            }
+
+            if (progress)
+                progress(m_statistics.bytes);
+        }
+    }
+
+    std::vector<std::vector<char>> m_buffers;
+    std::vector<std::size_t> m_filled;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_changed;
+    std::deque<std::size_t> m_free;
+    std::deque<std::size_t> m_full;
+    bool m_source_finished;
+    bool m_stopped;
+    boost::exception_ptr m_source_error;
+    boost::exception_ptr m_sink_error;
+    transfer_statistics m_statistics;
+};
+}
+} // namespace ssh::filesystem
+
+#endif
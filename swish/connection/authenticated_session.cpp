@@ -38,6 +38,7 @@
 
 #include "swish/utils.hpp" // WideStringToUtf8String
 
+#include <ssh/block_cache.hpp>
 #include <ssh/knownhost.hpp> // openssh_knownhost_collection
 #include <ssh/session.hpp>
 #include <ssh/filesystem.hpp> // sftp_filesystem
@@ -51,6 +52,7 @@
 #include <boost/filesystem/fstream.hpp> // ofstream
 #include <boost/foreach.hpp> // BOOST_FOREACH
 #include <boost/function.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/move/move.hpp>
 #include <boost/optional/optional.hpp>
 #include <boost/system/error_code.hpp> // errc
@@ -74,6 +76,7 @@ using ssh::host_key;
 using ssh::knownhost_search_result;
 using ssh::openssh_knownhost_collection;
 using ssh::session;
+using ssh::filesystem::block_cache;
 using ssh::filesystem::sftp_filesystem;
 
 using comet::bstr_t;
@@ -83,6 +86,7 @@ using comet::com_ptr;
 using boost::filesystem::path;
 using boost::filesystem::ofstream;
 using boost::function;
+using boost::make_shared;
 using boost::move;
 using boost::mutex;
 using boost::optional;
@@ -489,7 +493,12 @@ authenticated_session::authenticated_session(
     com_ptr<ISftpConsumer> consumer)
     :
 m_session(create_and_authenticate(host, port, user, consumer)),
-m_filesystem(m_session.get_session().connect_to_filesystem()) {}
+m_filesystem(m_session.get_session().connect_to_filesystem())
+{
+    // Explorer's property handlers and previews read the same few parts of
+    // a file repeatedly, through a fresh stream each time
+    m_filesystem.use_block_cache(make_shared<block_cache>());
+}
 
 authenticated_session::authenticated_session(
     BOOST_RV_REF(authenticated_session) other)
@@ -518,6 +527,16 @@ bool authenticated_session::is_dead()
    return m_session.is_dead();
 }
 
+void authenticated_session::keepalive_config(unsigned int interval_seconds)
+{
+    m_session.keepalive_config(interval_seconds);
+}
+
+unsigned int authenticated_session::send_keepalive()
+{
+    return m_session.send_keepalive();
+}
+
 void swap(authenticated_session& lhs, authenticated_session& rhs)
 {
     boost::swap(lhs.m_session, rhs.m_session);
@@ -118,6 +118,18 @@ public:
 
     bool is_dead();
 
+    /**
+     * Enable keepalives at the given interval, or disable them if zero.
+     */
+    void keepalive_config(unsigned int interval_seconds);
+
+    /**
+     * Send a keepalive to the server if one is due.
+     *
+     * @returns  Seconds until the next keepalive is due.
+     */
+    unsigned int send_keepalive();
+
     // This class really represents an SFTP channel rather than an
     // authenticated session.  Clients only use the session accessors
     // below to report errors and this will be replaced by the wrapper
@@ -142,7 +142,45 @@ bool running_session::is_dead()
     if (rc < 0)
         BOOST_THROW_EXCEPTION(
             system_error(::WSAGetLastError(), get_system_category()));
-    return rc != 0;
+    else if (rc == 0)
+        return false; // Silent socket; nothing to suggest it is broken
+
+    // The socket is readable, which happens both when the connection has
+    // been closed and when the server sent us something we haven't read yet
+    // (such as the reply to a keepalive).  Peeking tells the two apart
+    // without consuming data that libssh2 is expecting to read later: a
+    // closed connection has nothing to peek.
+    char next_byte;
+    rc = ::recv(m_socket->native(), &next_byte, 1, MSG_PEEK);
+    if (rc > 0)
+        return false;
+    else if (rc == 0)
+        return true; // Server closed the connection
+
+    // Another thread may have read the pending bytes between the select
+    // and the peek, leaving nothing to read yet.  Only a real socket error
+    // means the connection is gone.
+    switch (::WSAGetLastError())
+    {
+    case WSAEWOULDBLOCK:
+    case WSAEINTR:
+    case WSAEINPROGRESS:
+        return false;
+    default:
+        return true;
+    }
+}
+
+void running_session::keepalive_config(unsigned int interval_seconds)
+{
+    // Asking for a reply means traffic flows in both directions, which is
+    // what NAT devices need to see to keep a mapping alive
+    m_session.keepalive_config(true, interval_seconds);
+}
+
+unsigned int running_session::send_keepalive()
+{
+    return m_session.send_keepalive();
 }
 
 void swap(running_session& lhs, running_session& rhs)
@@ -82,17 +82,35 @@ public:
     /**
      * Has the connection broken since we connected?
      *
-     * This only gives the correct answer as long as we're not expecting data
-     * to arrive on the socket. select()ing a silent socket should return 0. 
-     * If it doesn't, it indicates that the connection is broken.
+     * select()ing a silent socket returns 0, which means the connection is
+     * apparently healthy.  If the socket is readable, the server has either
+     * closed the connection or sent data we haven't processed yet, such as
+     * a keepalive reply.  We distinguish these by peeking at the socket,
+     * which returns 0 only if the socket is closed.  Neither check touches
+     * the SSH session so this is cheap and safe to call while another thread
+     * is using the session.
      *
-     * XXX: we could double-check this by reading from the socket.  It would return
-     *      0 if the socket is closed.
+     * A connection that has silently gone away, such as one whose NAT
+     * mapping expired, looks healthy until something is sent over it.
+     * `send_keepalive` provides that traffic.
      *
      * @see http://www.libssh2.org/mail/libssh2-devel-archive-2010-07/0050.shtml
      */
     bool is_dead();
 
+    /**
+     * Enable keepalives at the given interval, or disable them if zero.
+     */
+    void keepalive_config(unsigned int interval_seconds);
+
+    /**
+     * Send a keepalive to the server if one is due.
+     *
+     * @returns  Seconds until the next keepalive is due.
+     * @throws   `boost::system::system_error` if sending failed.
+     */
+    unsigned int send_keepalive();
+
     ssh::session& get_session();
 
     friend void swap(running_session& lhs, running_session& rhs);
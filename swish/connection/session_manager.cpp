@@ -29,22 +29,22 @@
 #include "swish/connection/session_pool.hpp"
 
 #include <boost/bind.hpp>
-#include <boost/date_time/posix_time/posix_time_duration.hpp> // seconds
+#include <boost/cstdint.hpp> // uint64_t
 #include <boost/function.hpp>
-#include <boost/range/adaptor/transformed.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/once.hpp> // call_once
-#include <boost/uuid/random_generator.hpp>
 
+#include <cassert> // assert
+#include <deque>
 #include <map>
 #include <memory> // auto_ptr
 #include <list>
+#include <utility> // make_pair
 #include <vector>
 
 using comet::com_ptr;
 
-using boost::adaptors::transformed;
 using boost::bind;
 using boost::call_once;
 using boost::condition_variable;
@@ -52,12 +52,12 @@ using boost::function;
 using boost::mutex;
 using boost::noncopyable;
 using boost::once_flag;
-using boost::posix_time::seconds;
-using boost::uuids::random_generator;
-using boost::uuids::uuid;
+using boost::uint64_t;
 
 using std::auto_ptr;
+using std::deque;
 using std::list;
+using std::make_pair;
 using std::map;
 using std::string;
 using std::vector;
@@ -65,48 +65,6 @@ using std::vector;
 namespace swish {
 namespace connection {
 
-namespace {
-
-class task_registration
-{
-public:
-    // We tag the registration with a UUID because it, and its copies, must
-    // be uniquely identifiable.  The task name is not enough as many tasks
-    // make share a name.  We can't just use the object address, though,
-    // because copies must be equal.
-    task_registration(
-        const string& task_name, const connection_spec& specification)
-        : m_tag(random_generator()()), m_task_name(task_name),
-          m_specification(specification) {}
-
-    // Copies take same tag
-
-    bool operator==(const task_registration& other) const
-    {
-        return m_tag == other.m_tag;
-    }
-
-    string name() const
-    {
-        return m_task_name;
-    }
-
-    // So that unregistering doesn't have to search all unrelated connection's
-    // tasks to find the matching task ID
-    connection_spec specification() const
-    {
-        return m_specification;
-    }
-
-private:
-    uuid m_tag;
-    string m_task_name;
-    connection_spec m_specification;
-};
-
-
-}
-
 // Hides the implementation details from the session_manager.hpp file.
 class session_reservation_impl : private boost::noncopyable
 {
@@ -135,63 +93,255 @@ private:
 
 namespace {
 
+struct pending_task
+{
+    pending_task(uint64_t id, const string& name) : id(id), name(name) {}
+
+    // Task names needn't be unique so each reservation also gets an id
+    uint64_t id;
+    string name;
+};
+
+/**
+ * Someone waiting for a connection's reservations to drain.
+ *
+ * Receives the names of the pending tasks each time they change, so that
+ * every change is reported even if several happen before the waiter gets
+ * a chance to run.
+ */
+struct drain_observer
+{
+    deque<vector<string> > changes;
+};
+
 // Purpose: to maintain the book of reservations in an orderly
 // fashion.  This means cleaning out entries for old connection_specs that
 // don't have any more tasks
+//
+// Reservations happen on every provider request so this is kept cheap:
+// ids come from a counter and the ticket for a reservation points straight
+// at its entry so releasing it doesn't search for it.
 class reservations_ledger
 {
-    typedef map<connection_spec, list<task_registration>> reservations_mapping;
+    struct connection_entry
+    {
+        list<pending_task> tasks;
+        list<drain_observer*> observers;
+    };
+
+    typedef map<connection_spec, connection_entry> reservations_mapping;
 
 public:
 
-    void new_reservation(
-        const connection_spec& specification, const task_registration& task)
+    /**
+     * Identifies a reservation in the ledger.
+     *
+     * The iterators stay valid until the reservation is released because
+     * a connection's entry is only removed once it has no tasks.
+     */
+    class ticket
     {
-        m_reservations[specification].push_back(task);
+    public:
+
+        connection_spec specification() const
+        {
+            return m_connection->first;
+        }
+
+    private:
+        friend class reservations_ledger;
+
+        ticket(
+            reservations_mapping::iterator connection,
+            list<pending_task>::iterator task)
+            : m_connection(connection), m_task(task), m_id(task->id) {}
+
+        reservations_mapping::iterator m_connection;
+        list<pending_task>::iterator m_task;
+        uint64_t m_id;
+    };
+
+    reservations_ledger() : m_next_id(0) {}
+
+    ticket new_reservation(
+        const connection_spec& specification, const string& task_name)
+    {
+        reservations_mapping::iterator connection =
+            m_reservations.insert(
+                make_pair(specification, connection_entry())).first;
+
+        list<pending_task>& tasks = connection->second.tasks;
+        tasks.push_back(pending_task(++m_next_id, task_name));
+
+        notify_observers(connection->second);
+
+        return ticket(connection, --tasks.end());
     }
 
-    vector<task_registration> reservations_for_connection(
-        const connection_spec& specification) const
+    void unreserve(const ticket& reservation)
+    {
+        connection_entry& entry = reservation.m_connection->second;
+
+        assert(reservation.m_task->id == reservation.m_id);
+        entry.tasks.erase(reservation.m_task);
+
+        notify_observers(entry);
+        erase_if_unused(reservation.m_connection);
+    }
+
+    vector<string> task_names(const connection_spec& specification) const
     {
         reservations_mapping::const_iterator pos =
             m_reservations.find(specification);
 
         if (pos == m_reservations.end())
         {
-            return vector<task_registration>();
+            return vector<string>();
         }
         else
         {
-            return vector<task_registration>(
-                pos->second.begin(), pos->second.end());
+            return task_names(pos->second);
         }
     }
 
-    void unreserve(const task_registration& task)
+    void add_observer(
+        const connection_spec& specification, drain_observer& observer)
     {
-        list<task_registration>& connection_registrations =
-            m_reservations[task.specification()];
+        m_reservations.insert(make_pair(specification, connection_entry()))
+            .first->second.observers.push_back(&observer);
+    }
+
+    void remove_observer(
+        const connection_spec& specification, drain_observer& observer)
+    {
+        reservations_mapping::iterator pos =
+            m_reservations.find(specification);
+        if (pos != m_reservations.end())
+        {
+            pos->second.observers.remove(&observer);
+            erase_if_unused(pos);
+        }
+    }
+
+private:
+
+    static vector<string> task_names(const connection_entry& entry)
+    {
+        vector<string> names;
+        names.reserve(entry.tasks.size());
+        for (list<pending_task>::const_iterator it = entry.tasks.begin();
+             it != entry.tasks.end(); ++it)
+        {
+            names.push_back(it->name);
+        }
+        return names;
+    }
+
+    // Only costs anything while someone is waiting to disconnect
+    static void notify_observers(connection_entry& entry)
+    {
+        if (entry.observers.empty())
+            return;
+
+        vector<string> names = task_names(entry);
+        for (list<drain_observer*>::iterator it = entry.observers.begin();
+             it != entry.observers.end(); ++it)
+        {
+            (*it)->changes.push_back(names);
+        }
+    }
 
-        connection_registrations.remove(task);
+public:
 
-        // To stop us building up a map full of empty lists for connections
-        // no longer in use, we remove the connection entry once it has
-        // no more tasks
-        if (connection_registrations.empty())
+    /**
+     * Report the current tasks to anyone waiting on the connection again,
+     * even though they haven't changed.
+     */
+    void renotify(const connection_spec& specification)
+    {
+        reservations_mapping::iterator pos =
+            m_reservations.find(specification);
+        if (pos != m_reservations.end())
         {
-            m_reservations.erase(m_reservations.find(task.specification()));
+            notify_observers(pos->second);
         }
     }
 
 private:
 
+    // To stop us building up a map full of empty lists for connections
+    // no longer in use, we remove the connection entry once it has
+    // no more tasks
+    void erase_if_unused(reservations_mapping::iterator pos)
+    {
+        if (pos->second.tasks.empty() && pos->second.observers.empty())
+        {
+            m_reservations.erase(pos);
+        }
+    }
+
     reservations_mapping m_reservations;
+    uint64_t m_next_id;
 };
 
-string extract_task_name(const task_registration& task)
+/**
+ * Keeps an observer registered with the ledger for as long as it exists.
+ *
+ * The ledger must only be touched while holding the reservations lock, so
+ * this must be created and destroyed with the lock held.
+ */
+class scoped_drain_observer : private noncopyable
 {
-    return task.name();
-}
+public:
+
+    scoped_drain_observer(
+        reservations_ledger& ledger, const connection_spec& specification)
+        : m_ledger(ledger), m_specification(specification)
+    {
+        m_ledger.add_observer(m_specification, m_observer);
+    }
+
+    ~scoped_drain_observer()
+    {
+        m_ledger.remove_observer(m_specification, m_observer);
+    }
+
+    deque<vector<string> >& changes()
+    {
+        return m_observer.changes;
+    }
+
+private:
+
+    reservations_ledger& m_ledger;
+    connection_spec m_specification;
+    drain_observer m_observer;
+};
+
+/**
+ * Releases a held lock for as long as it exists, taking it again after.
+ *
+ * Retaking it on the way out, even when unwinding, matters because the
+ * caller's other guards expect to be destroyed with the lock held.
+ */
+class scoped_unlock : private noncopyable
+{
+public:
+
+    explicit scoped_unlock(mutex::scoped_lock& lock) : m_lock(lock)
+    {
+        m_lock.unlock();
+    }
+
+    ~scoped_unlock()
+    {
+        m_lock.lock();
+    }
+
+private:
+
+    mutex::scoped_lock& m_lock;
+};
 
 // Hides the implementation details from the session_manager.hpp file.
 class session_manager_impl
@@ -205,27 +355,30 @@ public:
 
     session_reservation reserve_session(
         connection_spec specification, com_ptr<ISftpConsumer> consumer,
-        const std::string& task_name)
+        const std::string& task_name, unsigned int lane)
     {
-        task_registration task_id(task_name, specification);
-
         // Locking just before getting the session from the pool to make sure
         // another thread can't disconnect it just as we are about to become
         // first and only reservation (if there were other reservations 
         // already, it couldn't get disconnected regardless)
         mutex::scoped_lock lock(m_reservations_guard);
 
-        authenticated_session& session =
-            session_pool().pooled_session(specification, consumer);
+        // Counted as in use as the pool hands it over, so that the pool's
+        // maintenance thread can't close it before we have it
+        authenticated_session& session = session_pool().pooled_session_in_use(
+            specification, consumer, lane);
 
-        m_reservations.new_reservation(specification, task_id);
+        reservations_ledger::ticket ticket =
+            m_reservations.new_reservation(specification, task_name);
 
         m_reservations_changed.notify_all();
 
         return session_reservation(
             new session_reservation_impl(
                 session,
-                bind(&session_manager_impl::unreserve_session, this, task_id)));
+                bind(
+                    &session_manager_impl::unreserve_session, this, ticket,
+                    lane)));
     }
 
     void disconnect_session(
@@ -250,6 +403,15 @@ public:
         }
     }
 
+    void recheck_disconnection(const connection_spec& specification)
+    {
+        mutex::scoped_lock lock(m_reservations_guard);
+
+        m_reservations.renotify(specification);
+
+        m_reservations_changed.notify_all();
+    }
+
 private:
 
     bool wait_for_remaining_uses(
@@ -257,64 +419,76 @@ private:
         session_manager::progress_callback notification_sink,
         mutex::scoped_lock& lock)
     {
+        // Registering while holding the lock means no change to the
+        // reservations can slip past between reading them here and waiting
+        // for changes below
+        scoped_drain_observer observer(m_reservations, specification);
+
+        vector<string> pending = m_reservations.task_names(specification);
+
         while (true)
         {
-            vector<task_registration> reservations = 
-                m_reservations.reservations_for_connection(specification);
-
-            if (reservations.empty())
+            // The callback may run UI that needs another thread, such as
+            // the one running a dialog, which might itself be waiting for
+            // this lock to call `recheck_disconnection`.  The observer
+            // records any change made meanwhile so we can't miss it.
+            bool carry_on;
             {
-                // We notify the callback that tasks have completed so it can
-                // shut down any progress UI.
+                scoped_unlock unlocked(lock);
+
+                // We notify the callback when tasks have completed so it
+                // can shut down any progress UI.
                 // Ideally, we would use a separate no-argument overload for
                 // this, but that requires some way to overload
                 // boost::functions. Basically, we need full type erasure
-                notification_sink(vector<string>());
-                return true;
+                carry_on = notification_sink(pending);
             }
+
             // The callback controls whether we continue waiting or whether
             // we abort so that the user's UI isn't blocked
-            else if (notification_sink(
-                reservations | transformed(extract_task_name)))
+            if (!carry_on)
             {
-                // It is important to use a timed wait because we need to
-                // respond to cancellation promptly.
-                // If we used a regular wait we would only consult the user
-                // callback, and notice that the user had cancelled, when the
-                // number of tasks waiting changed.  This may be infrequent.
-                // For a single long-running task, that would be the same as
-                // preventing the user cancelling at all.
-
-                // It is important that we wait using a lock on the same mutex
-                // as the thread changing the reservations.  If there is only
-                // one reservation and it goes away because its task completes
-                // on another thread, that thread must not be able to try
-                // and notify us of the change between where we check for
-                // empty reservations (above) and where we wait for empty
-                // reservations (below).  If that could happen, the wait would
-                // have missed the final notification of end-of-reservations.
-                // (see http://stackoverflow.com/a/6924160/67013).
-                //
-                // It's not a fatal problem, because the wait uses a
-                // timeout, but we should still avoid it.
-
-                m_reservations_changed.timed_wait(
-                    lock, boost::posix_time::seconds(3));
+                return false;
             }
-            else
+            else if (pending.empty() && observer.changes().empty())
             {
-                return false;
+                // Nothing reserved the session while we were reporting that
+                // it was free, and nothing can now until we disconnect it
+                return true;
+            }
+
+            // It is important that we wait using a lock on the same mutex
+            // as the thread changing the reservations.  That thread
+            // records the change for us and notifies us while holding it
+            // so we can't miss the notification, however quickly it comes.
+            //
+            // The user cancelling doesn't change the reservations so
+            // whoever learns of it must call `recheck_disconnection` to
+            // wake us and have us ask the callback again.
+            while (observer.changes().empty())
+            {
+                m_reservations_changed.wait(lock);
             }
+
+            pending = observer.changes().front();
+            observer.changes().pop_front();
         }
     }
 
     // Used by session_registration to unregister the session when that
     // ticket object goes out of scope
-    void unreserve_session(const task_registration& task_id)
+    void unreserve_session(
+        const reservations_ledger::ticket& ticket, unsigned int lane)
     {
         mutex::scoped_lock lock(m_reservations_guard);
 
-        m_reservations.unreserve(task_id);
+        connection_spec specification = ticket.specification();
+
+        m_reservations.unreserve(ticket);
+
+        session_pool().end_use(specification, lane);
+
+        m_reservations_changed.notify_all();
     }
 
     session_manager_impl() {};
@@ -381,10 +555,10 @@ authenticated_session& session_reservation::session()
 
 session_reservation session_manager::reserve_session(
     const connection_spec& specification, com_ptr<ISftpConsumer> consumer,
-    const string& task_name)
+    const string& task_name, unsigned int lane)
 {
     return session_manager_impl::get().reserve_session(
-        specification, consumer, task_name);
+        specification, consumer, task_name, lane);
 }
 
 bool session_manager::has_session(const connection_spec& specification)
@@ -399,4 +573,10 @@ void session_manager::disconnect_session(
         specification, notification_sink);
 }
 
+void session_manager::recheck_disconnection(
+    const connection_spec& specification)
+{
+    session_manager_impl::get().recheck_disconnection(specification);
+}
+
 }}
\ No newline at end of file
@@ -114,11 +114,17 @@ public:
      * its createes after the reservation is destroyed as call to 
      * `disconnect_session` will disconnect and destroy the session.  Any 
      * subsequent uses of those references would cause a crash.
+     *
+     * @param lane  Which of the pool's sessions for the connection to use.
+     *              Tasks that run alongside each other, such as the workers
+     *              of a parallel copy, can each take a lane of their own
+     *              so that they don't queue for one session.  Disconnecting
+     *              the connection disconnects every lane.
      */
     session_reservation reserve_session(
         const connection_spec& specification,
         comet::com_ptr<ISftpConsumer> consumer,
-        const std::string& task_name);
+        const std::string& task_name, unsigned int lane=0);
 
     /**
      * Is a connection with the given specification already connected?
@@ -142,6 +148,17 @@ public:
     void disconnect_session(
         const connection_spec& specification,
         progress_callback notification_sink);
+
+    /**
+     * Make a `disconnect_session` call waiting on tasks consult its
+     * `notification_sink` again.
+     *
+     * The waiting call only asks its sink whether to carry on when the
+     * pending tasks change.  Call this when the sink's answer changes for
+     * some other reason, such as the user cancelling, so that the waiting
+     * call notices straight away.  Does nothing if no call is waiting.
+     */
+    void recheck_disconnection(const connection_spec& specification);
 };
 
 }}
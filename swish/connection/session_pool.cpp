@@ -27,42 +27,198 @@
 
 #include "session_pool.hpp"
 
-// Using ptr_map because move-aware map isn't usable with C++03
-#include <boost/ptr_container/ptr_map.hpp>
-//#include <boost/container/map.hpp> // move-aware map
+#include <boost/date_time/posix_time/posix_time_types.hpp> // microsec_clock
+#include <boost/move/move.hpp> // boost::move
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/once.hpp> // call_once
+#include <boost/thread/thread.hpp>
 
+#include <algorithm> // min
+#include <exception>
+#include <limits> // numeric_limits
+#include <map>
 #include <memory> // auto_ptr
+#include <utility> // pair
+#include <vector>
 
 using swish::provider::sftp_provider;
 
 using comet::com_ptr;
 
 using boost::call_once;
-using boost::container::map;
+using boost::condition_variable;
 using boost::mutex;
 using boost::once_flag;
+using boost::posix_time::microsec_clock;
+using boost::posix_time::pos_infin;
+using boost::posix_time::ptime;
+using boost::posix_time::seconds;
+using boost::posix_time::time_duration;
+using boost::shared_ptr;
+using boost::thread;
 
 using std::auto_ptr;
+using std::make_pair;
+using std::map;
+using std::min;
+using std::numeric_limits;
+using std::pair;
+using std::vector;
 
 
 namespace swish {
 namespace connection {
 
+session_maintenance_policy::session_maintenance_policy()
+    : check_interval(seconds(15)), keepalive_interval(seconds(60)),
+      idle_limit(pos_infin), lane_idle_limit(seconds(60)) {}
+
+pooled_session_statistics::pooled_session_statistics(
+    const connection_spec& specification, unsigned int lane)
+    : specification(specification), lane(lane), idle_time(seconds(0)),
+      users(0), alive(true) {}
+
 namespace {
 
+ptime now()
+{
+    return microsec_clock::universal_time();
+}
+
+/**
+ * A session in the pool along with the bookkeeping that the maintenance
+ * thread uses to decide what to do with it.
+ *
+ * Everything except the session itself is protected by the pool's lock.
+ * The session has its own lock, so the maintenance thread talks to it
+ * without holding the pool's.
+ */
+class pool_entry : private boost::noncopyable
+{
+public:
+
+    pool_entry(BOOST_RV_REF(authenticated_session) session, unsigned int users)
+        : m_session(boost::move(session)), m_connected_at(now()),
+          m_last_activity(m_connected_at), m_users(users), m_alive(true) {}
+
+    authenticated_session& session()
+    {
+        return m_session;
+    }
+
+    void begin_use()
+    {
+        ++m_users;
+        m_last_activity = now();
+    }
+
+    void end_use()
+    {
+        if (m_users > 0)
+            --m_users;
+        m_last_activity = now();
+    }
+
+    unsigned int users() const
+    {
+        return m_users;
+    }
+
+    void alive(bool is_alive)
+    {
+        m_alive = is_alive;
+    }
+
+    /**
+     * Should the maintenance thread close this session?
+     *
+     * Sessions in use are never closed, even if dead, because a task holds
+     * a reference to them.  The task will fail and, when it releases the
+     * session, the next check removes it.
+     */
+    bool evictable(const ptime& time, const time_duration& idle_limit) const
+    {
+        return m_users == 0 && (!m_alive || idle_time(time) > idle_limit);
+    }
+
+    pooled_session_statistics statistics(
+        const connection_spec& specification, unsigned int lane,
+        const ptime& time) const
+    {
+        pooled_session_statistics stats(specification, lane);
+        stats.connected_at = m_connected_at;
+        stats.last_activity = m_last_activity;
+        stats.idle_time = idle_time(time);
+        stats.users = m_users;
+        stats.alive = m_alive;
+        return stats;
+    }
+
+private:
+
+    time_duration idle_time(const ptime& time) const
+    {
+        return (m_users > 0) ? seconds(0) : time - m_last_activity;
+    }
+
+    authenticated_session m_session;
+    ptime m_connected_at;
+    ptime m_last_activity;
+    unsigned int m_users;
+    bool m_alive;
+};
+
+unsigned int keepalive_seconds(const time_duration& interval)
+{
+    if (interval.is_special() || interval.is_negative())
+        return 0;
+    else
+        return static_cast<unsigned int>(interval.total_seconds());
+}
+
+/**
+ * Check the session is still alive, sending it a keepalive if one is due.
+ *
+ * Must not be called with the pool lock held as it may have to wait for
+ * the session's lock while a task uses it.
+ */
+bool check_session(authenticated_session& session, unsigned int keepalive)
+{
+    try
+    {
+        if (session.is_dead())
+            return false;
+
+        session.keepalive_config(keepalive);
+        if (keepalive > 0)
+        {
+            session.send_keepalive();
+        }
+
+        return true;
+    }
+    catch (const std::exception&)
+    {
+        // Failing to send a keepalive means the transport is gone
+        return false;
+    }
+}
+
 /**
  * Hides the implementation details from the session_pool.hpp file.
  */
 class session_pool_impl
 {
-    // Using ptr_map because move-aware map isn't usable with C++03
-    // (http://bit.ly/1jP9BDL, https://svn.boost.org/trac/boost/ticket/6618)
-    typedef boost::ptr_map<connection_spec, authenticated_session>
-        pool_mapping;
-    //typedef boost::container::map<connection_spec, authenticated_session>
-    //    pool_mapping;
+    // A connection's lanes sort together, main session first
+    typedef pair<connection_spec, unsigned int> pool_key;
+
+    // Entries are shared so that the maintenance thread can check a session
+    // without holding the pool lock, and so that a session removed from the
+    // pool is not destroyed (i.e. disconnected) while the lock is held
+    typedef map<pool_key, shared_ptr<pool_entry> > pool_mapping;
 
 public:
 
@@ -74,58 +230,299 @@ public:
 
     static void destroy()
     {
+        if (m_instance.get())
+        {
+            m_instance->stop_maintenance();
+        }
+
         m_instance.reset();
     }
 
+    /**
+     * Never joins the maintenance thread, as this may run from a static
+     * destructor under the loader lock, and a thread can't finish while
+     * another holds that lock.
+     *
+     * The module stops the thread before it can be unloaded, so the thread
+     * only gets this far at process exit, by which time Windows has already
+     * ended it.
+     */
+    ~session_pool_impl()
+    {
+        if (m_maintenance_thread.joinable())
+        {
+            m_maintenance_thread.detach();
+        }
+    }
+
+    /**
+     * End the maintenance thread and wait for it to finish.
+     *
+     * The next session handed out starts it again.
+     */
+    void stop_maintenance()
+    {
+        thread stopping;
+
+        {
+            mutex::scoped_lock lock(m_session_pool_guard);
+
+            ++m_maintenance_generation;
+            stopping.swap(m_maintenance_thread);
+        }
+
+        m_maintenance_wakeup.notify_all();
+
+        if (stopping.joinable())
+        {
+            stopping.join();
+        }
+    }
+
+    /**
+     * @param in_use  Record a task using the session before letting go of
+     *                the lock, so that maintenance can't close it first.
+     */
     authenticated_session& pooled_session(
-        connection_spec specification, com_ptr<ISftpConsumer> consumer)
+        connection_spec specification, com_ptr<ISftpConsumer> consumer,
+        bool in_use, unsigned int lane)
     {
         mutex::scoped_lock lock(m_session_pool_guard);
 
-        pool_mapping::iterator session = m_sessions.find(specification);
+        start_maintenance_if_stopped();
+
+        pool_key key(specification, lane);
+        pool_mapping::iterator session = m_sessions.find(key);
 
         if (session != m_sessions.end())
         {
             // Dead sessions are replaced in the pool so that we always serve
             // something usable
 
-            if (session->second->is_dead())
+            if (session->second->session().is_dead())
             {
-                m_sessions.replace(
-                    session,
-                    new authenticated_session(
-                        specification.create_session(consumer)));
+                // Tasks still registered against the dead session carry
+                // over so their releases balance
+                session->second.reset(
+                    new pool_entry(
+                        specification.create_session(consumer),
+                        session->second->users()));
             }
         }
         else
         {
             session = m_sessions.insert(
-                specification,
-                new authenticated_session(
-                    specification.create_session(consumer))).first;
+                make_pair(
+                    key,
+                    shared_ptr<pool_entry>(
+                        new pool_entry(
+                            specification.create_session(consumer), 0))))
+                .first;
+        }
+
+        if (in_use)
+        {
+            session->second->begin_use();
         }
 
-        return *(session->second);
+        return session->second->session();
     }
 
     bool has_session(const connection_spec& specification) const
     {
         mutex::scoped_lock lock(m_session_pool_guard);
 
-        return m_sessions.find(specification) != m_sessions.end();
+        return m_sessions.find(pool_key(specification, 0)) != m_sessions.end();
     }
 
     void remove_session(const connection_spec& specification)
+    {
+        vector<shared_ptr<pool_entry> > removed;
+
+        {
+            mutex::scoped_lock lock(m_session_pool_guard);
+
+            pool_mapping::iterator first =
+                m_sessions.lower_bound(pool_key(specification, 0));
+            pool_mapping::iterator last = m_sessions.upper_bound(
+                pool_key(specification, numeric_limits<unsigned int>::max()));
+
+            for (pool_mapping::iterator it = first; it != last; ++it)
+            {
+                removed.push_back(it->second);
+            }
+            m_sessions.erase(first, last);
+        }
+
+        // Sessions disconnect here, outside the lock
+    }
+
+    void begin_use(const connection_spec& specification, unsigned int lane)
     {
         mutex::scoped_lock lock(m_session_pool_guard);
 
-        m_sessions.erase(specification);
+        pool_mapping::iterator pos =
+            m_sessions.find(pool_key(specification, lane));
+        if (pos != m_sessions.end())
+        {
+            pos->second->begin_use();
+        }
+    }
+
+    void end_use(const connection_spec& specification, unsigned int lane)
+    {
+        mutex::scoped_lock lock(m_session_pool_guard);
+
+        pool_mapping::iterator pos =
+            m_sessions.find(pool_key(specification, lane));
+        if (pos != m_sessions.end())
+        {
+            pos->second->end_use();
+        }
     }
 
+    void configure_maintenance(const session_maintenance_policy& policy)
+    {
+        {
+            mutex::scoped_lock lock(m_session_pool_guard);
+            m_policy = policy;
+        }
+
+        // Wake the thread so a shorter check interval applies immediately
+        m_maintenance_wakeup.notify_all();
+    }
+
+    session_maintenance_policy maintenance_policy() const
+    {
+        mutex::scoped_lock lock(m_session_pool_guard);
+
+        return m_policy;
+    }
+
+    void perform_maintenance()
+    {
+        vector<pair<pool_key, shared_ptr<pool_entry> > > entries;
+        vector<bool> in_use;
+        session_maintenance_policy policy;
+
+        {
+            mutex::scoped_lock lock(m_session_pool_guard);
+
+            entries.assign(m_sessions.begin(), m_sessions.end());
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                in_use.push_back(entries[i].second->users() > 0);
+            }
+            policy = m_policy;
+        }
+
+        unsigned int keepalive = keepalive_seconds(policy.keepalive_interval);
+
+        // Sessions in use are left alone: their traffic keeps them alive,
+        // they can't be evicted anyway, and a check would queue behind the
+        // task for the session's lock
+        vector<bool> alive;
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            alive.push_back(
+                in_use[i] ||
+                check_session(entries[i].second->session(), keepalive));
+        }
+
+        {
+            mutex::scoped_lock lock(m_session_pool_guard);
+
+            ptime time = now();
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                pool_entry& entry = *entries[i].second;
+                entry.alive(alive[i]);
+
+                time_duration idle_limit = (entries[i].first.second == 0) ?
+                    policy.idle_limit :
+                    min(policy.idle_limit, policy.lane_idle_limit);
+
+                pool_mapping::iterator pos = m_sessions.find(entries[i].first);
+
+                // The entry may have been replaced or removed, or picked up
+                // by a task, since the snapshot
+                if (pos != m_sessions.end() &&
+                    pos->second == entries[i].second &&
+                    entry.evictable(time, idle_limit))
+                {
+                    m_sessions.erase(pos);
+                }
+            }
+        }
+
+        // Evicted sessions disconnect here, when the snapshot goes, outside
+        // the lock
+    }
+
+    vector<pooled_session_statistics> statistics() const
+    {
+        mutex::scoped_lock lock(m_session_pool_guard);
+
+        ptime time = now();
+
+        vector<pooled_session_statistics> stats;
+        for (pool_mapping::const_iterator it = m_sessions.begin();
+             it != m_sessions.end(); ++it)
+        {
+            stats.push_back(
+                it->second->statistics(
+                    it->first.first, it->first.second, time));
+        }
+
+        return stats;
+    }
 
 private:
 
-    session_pool_impl() {};
+    session_pool_impl() : m_maintenance_generation(0) {}
+
+    /**
+     * Must be called with the pool lock held.
+     */
+    void start_maintenance_if_stopped()
+    {
+        if (!m_maintenance_thread.joinable())
+        {
+            thread started(
+                &session_pool_impl::maintenance_loop, this,
+                m_maintenance_generation);
+            m_maintenance_thread.swap(started);
+        }
+    }
+
+    /**
+     * @param generation  The thread runs until `stop_maintenance` moves the
+     *                    generation on.  A flag wouldn't do because a new
+     *                    thread might start, and clear it, before this one
+     *                    wakes up to see it.
+     */
+    void maintenance_loop(unsigned int generation)
+    {
+        mutex::scoped_lock lock(m_session_pool_guard);
+
+        while (generation == m_maintenance_generation)
+        {
+            m_maintenance_wakeup.timed_wait(lock, m_policy.check_interval);
+            if (generation != m_maintenance_generation)
+                break;
+
+            lock.unlock();
+            try
+            {
+                perform_maintenance();
+            }
+            catch (const std::exception&)
+            {
+                // Maintenance is best-effort; the thread must keep going
+            }
+            lock.lock();
+        }
+    }
 
     static void do_init()
     {
@@ -136,7 +533,11 @@ private:
     static auto_ptr<session_pool_impl> m_instance;
 
     mutable mutex m_session_pool_guard;
+    condition_variable m_maintenance_wakeup;
+    session_maintenance_policy m_policy;
+    unsigned int m_maintenance_generation;
     pool_mapping m_sessions;
+    thread m_maintenance_thread;
 };
 
 
@@ -149,7 +550,21 @@ auto_ptr<session_pool_impl> session_pool_impl::m_instance;
 authenticated_session& session_pool::pooled_session(
     const connection_spec& specification, com_ptr<ISftpConsumer> consumer)
 {
-    return session_pool_impl::get().pooled_session(specification, consumer);
+    return session_pool_impl::get().pooled_session(
+        specification, consumer, false, 0);
+}
+
+authenticated_session& session_pool::pooled_session_in_use(
+    const connection_spec& specification, com_ptr<ISftpConsumer> consumer,
+    unsigned int lane)
+{
+    return session_pool_impl::get().pooled_session(
+        specification, consumer, true, lane);
+}
+
+void session_pool::stop_maintenance()
+{
+    return session_pool_impl::get().stop_maintenance();
 }
 
 void session_pool::destroy()
@@ -167,4 +582,37 @@ void session_pool::remove_session(const connection_spec& specification)
     return session_pool_impl::get().remove_session(specification);
 }
 
+void session_pool::begin_use(
+    const connection_spec& specification, unsigned int lane)
+{
+    return session_pool_impl::get().begin_use(specification, lane);
+}
+
+void session_pool::end_use(
+    const connection_spec& specification, unsigned int lane)
+{
+    return session_pool_impl::get().end_use(specification, lane);
+}
+
+void session_pool::configure_maintenance(
+    const session_maintenance_policy& policy)
+{
+    return session_pool_impl::get().configure_maintenance(policy);
+}
+
+session_maintenance_policy session_pool::maintenance_policy() const
+{
+    return session_pool_impl::get().maintenance_policy();
+}
+
+void session_pool::perform_maintenance()
+{
+    return session_pool_impl::get().perform_maintenance();
+}
+
+vector<pooled_session_statistics> session_pool::statistics() const
+{
+    return session_pool_impl::get().statistics();
+}
+
 }} // namespace swish::connection
@@ -35,15 +35,103 @@
 
 #include <comet/ptr.h> // com_ptr
 
+#include <boost/date_time/posix_time/posix_time_types.hpp> // ptime
+
 #include <string>
+#include <vector>
 
 namespace swish {
 namespace connection {
 
+/**
+ * How the pool's maintenance thread looks after sessions between uses.
+ */
+struct session_maintenance_policy
+{
+    /**
+     * Default policy: check every 15 seconds, send keepalives after 60
+     * seconds of silence, never close a connection's main session just for
+     * being idle and close its other lanes after a minute unused.
+     */
+    session_maintenance_policy();
+
+    /**
+     * How often the maintenance thread wakes up to check the sessions.
+     */
+    boost::posix_time::time_duration check_interval;
+
+    /**
+     * Silence after which a keepalive is sent.  Zero disables keepalives.
+     */
+    boost::posix_time::time_duration keepalive_interval;
+
+    /**
+     * How long a session may sit unused before it is closed to free its
+     * slot on the server.  `pos_infin` means idle sessions are never closed.
+     */
+    boost::posix_time::time_duration idle_limit;
+
+    /**
+     * How long a session in any lane but the main one may sit unused
+     * before it is closed, if sooner than `idle_limit`.
+     *
+     * Those sessions are only wanted while tasks run side by side, and the
+     * next such task opens them again.
+     */
+    boost::posix_time::time_duration lane_idle_limit;
+};
+
+/**
+ * Snapshot of the state of one session in the pool.
+ */
+struct pooled_session_statistics
+{
+    pooled_session_statistics(
+        const connection_spec& specification, unsigned int lane);
+
+    connection_spec specification;
+
+    /**
+     * Which of the connection's sessions this is.  See `session_pool`.
+     */
+    unsigned int lane;
+
+    /**
+     * When the session was connected (UTC).
+     */
+    boost::posix_time::ptime connected_at;
+
+    /**
+     * When the session was last handed out or released by a user (UTC).
+     */
+    boost::posix_time::ptime last_activity;
+
+    /**
+     * How long the session has been unused.  Zero while in use.
+     */
+    boost::posix_time::time_duration idle_time;
+
+    /**
+     * Number of tasks currently using the session.
+     */
+    unsigned int users;
+
+    /**
+     * Whether the last maintenance check found the connection alive.
+     */
+    bool alive;
+};
+
 /**
  * Per-process pool of sessions.
  *
  * All instances of this class share the same pool of sessions.
+ *
+ * The pool can hold several sessions to the same server, told apart by
+ * lane.  Lane 0 is the connection's main session, used by everything
+ * unless asked otherwise.  The other lanes are separate connections, for
+ * tasks such as parallel copies whose transfers would otherwise queue
+ * behind each other on one session.
  */
 class session_pool
 {
@@ -63,6 +151,17 @@ public:
     authenticated_session& pooled_session(
         const connection_spec& specification,
         comet::com_ptr<ISftpConsumer> consumer);
+
+    /**
+     * Returns a running SFTP session, as `pooled_session` does, and
+     * records that a task has started using it.
+     *
+     * Both happen under the pool's lock so the maintenance thread can't
+     * close the session between them.  Balance with `end_use`.
+     */
+    authenticated_session& pooled_session_in_use(
+        const connection_spec& specification,
+        comet::com_ptr<ISftpConsumer> consumer, unsigned int lane=0);
     
     /**
      * Is a connection with the given specification in the pool?
@@ -74,12 +173,61 @@ public:
     bool has_session(const connection_spec& specification) const;
 
     /**
-     * Remove the specified session from the pool.
+     * Remove the specified session, in every lane, from the pool.
      */
     void remove_session(const connection_spec& specification);
 
     /**
-     * Destroy the singleton pool.
+     * Record that a task has started using the specified session.
+     *
+     * The maintenance thread never closes a session that is in use, however
+     * long it has been idle or however dead it looks.
+     */
+    void begin_use(
+        const connection_spec& specification, unsigned int lane=0);
+
+    /**
+     * Record that a task has finished using the specified session.
+     *
+     * The session's idle time is measured from the last such call.
+     */
+    void end_use(const connection_spec& specification, unsigned int lane=0);
+
+    /**
+     * Change how the maintenance thread treats sessions.
+     *
+     * The new policy takes effect from the next maintenance check.
+     */
+    void configure_maintenance(const session_maintenance_policy& policy);
+
+    session_maintenance_policy maintenance_policy() const;
+
+    /**
+     * Run the checks the maintenance thread runs, immediately.
+     *
+     * Sends any keepalives that are due and closes unused sessions that are
+     * dead or have exceeded the idle limit, so that the next request gets a
+     * fresh connection straight away instead of hanging on a stale one.
+     */
+    void perform_maintenance();
+
+    /**
+     * Activity statistics for every session in the pool.
+     */
+    std::vector<pooled_session_statistics> statistics() const;
+
+    /**
+     * Stop the maintenance thread and wait for it to end.
+     *
+     * Call this before the module can be unloaded.  The pool never stops
+     * the thread from a static destructor because joining it under the
+     * loader lock would deadlock.  The next session handed out starts the
+     * thread again.
+     */
+    void stop_maintenance();
+
+    /**
+     * Destroy the singleton pool, stopping its maintenance thread first.
      */
     void destroy();
 };
@@ -0,0 +1,324 @@
+/**
+    @file
+
+    Plan copying trees of many small files as one archive.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <swish@lammy.co.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#include "ArchiveCopyPlan.hpp"
+
+#include "swish/drop_target/DestinationSnapshot.hpp"
+#include "swish/drop_target/DropActionCallback.hpp"
+#include "swish/drop_target/Progress.hpp"
+#include "swish/provider/sftp_provider.hpp" // sftp_provider
+#include "swish/remote_folder/remote_pidl.hpp" // create_remote_itemid
+#include "swish/remote_folder/swish_pidl.hpp" // absolute_path_from_swish_pidl
+#include "swish/trace.hpp" // trace
+
+#include <ssh/archive.hpp> // archive_statistics
+#include <ssh/filesystem/path.hpp>
+
+#include <boost/bind.hpp> // bind
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/filesystem/operations.hpp>
+#include <boost/foreach.hpp> // BOOST_FOREACH
+#include <boost/ref.hpp> // ref
+#include <boost/shared_ptr.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/throw_exception.hpp>  // BOOST_THROW_EXCEPTION
+
+#include <comet/datetime.h> // datetime_t
+#include <comet/error.h> // com_error
+
+#include <exception>
+#include <memory> // auto_ptr
+#include <vector>
+
+#include <ShlObj.h> // SHGetPathFromIDListW, SHChangeNotify
+
+using swish::provider::sftp_provider;
+using swish::remote_folder::absolute_path_from_swish_pidl;
+using swish::remote_folder::create_remote_itemid;
+using swish::shell_folder::data_object::PidlFormat;
+using swish::tracing::trace;
+
+using washer::shell::pidl::apidl_t;
+using washer::shell::pidl::cpidl_t;
+
+using ssh::filesystem::archive_statistics;
+using ssh::filesystem::path;
+
+using comet::com_error;
+using comet::datetime_t;
+
+using boost::bind;
+using boost::shared_ptr;
+using boost::system::error_code;
+using boost::system::system_error;
+using boost::uintmax_t;
+
+using std::auto_ptr;
+using std::exception;
+using std::size_t;
+using std::vector;
+
+namespace swish {
+namespace drop_target {
+
+namespace {
+
+    /**
+     * The folders on a local disk that the items are, or nothing if any of
+     * them isn't one.
+     *
+     * Items in virtual folders, such as the inside of a zip file, have no
+     * path for `tar` to be fed from.
+     */
+    vector<boost::filesystem::path> local_folders(const PidlFormat& format)
+    {
+        vector<boost::filesystem::path> folders;
+        for (unsigned int i = 0; i < format.pidl_count(); ++i)
+        {
+            wchar_t buffer[MAX_PATH];
+            if (!::SHGetPathFromIDListW(format.file(i).get(), buffer))
+                return vector<boost::filesystem::path>();
+
+            boost::filesystem::path folder(buffer);
+            if (!boost::filesystem::is_directory(folder))
+                return vector<boost::filesystem::path>();
+
+            folders.push_back(folder);
+        }
+
+        return folders;
+    }
+
+    struct tree_totals
+    {
+        tree_totals() : files(0), bytes(0) {}
+
+        uintmax_t files;
+        uintmax_t bytes;
+    };
+
+    /**
+     * Count the files that the archives will hold, the same ones
+     * `upload_tree` will send.
+     *
+     * Returns false if any part of the trees can't be read.  The drop then
+     * goes file by file, which reports each item it can't copy rather than
+     * failing the lot.
+     */
+    bool count_files(
+        const vector<boost::filesystem::path>& folders, Progress& progress,
+        tree_totals& totals)
+    {
+        BOOST_FOREACH(const boost::filesystem::path& folder, folders)
+        {
+            progress.line_path(1, folder.wstring());
+
+            error_code error;
+            boost::filesystem::recursive_directory_iterator it(folder, error);
+            boost::filesystem::recursive_directory_iterator end;
+            for (; !error && it != end; it.increment(error))
+            {
+                if (progress.user_cancelled())
+                    BOOST_THROW_EXCEPTION(com_error(E_ABORT));
+
+                boost::filesystem::file_status status =
+                    it->symlink_status(error);
+                if (!error && boost::filesystem::is_regular_file(status))
+                {
+                    ++totals.files;
+                    totals.bytes +=
+                        boost::filesystem::file_size(it->path(), error);
+                }
+            }
+
+            if (error)
+            {
+                trace("Couldn't count files in %s (%s)")
+                    % folder % error.message();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    path target_for_folder(
+        const apidl_t& destination_root,
+        const boost::filesystem::path& folder)
+    {
+        return absolute_path_from_swish_pidl(destination_root) /
+            path(folder.filename().wstring());
+    }
+
+    void report_progress(
+        Progress& progress, uintmax_t done_before, uintmax_t total,
+        const boost::filesystem::path& file, uintmax_t so_far)
+    {
+        if (progress.user_cancelled())
+            BOOST_THROW_EXCEPTION(com_error(E_ABORT));
+
+        progress.line_path(1, file.wstring());
+        progress.update(done_before + so_far, total);
+    }
+
+    /**
+     * Show the new folder in any Explorer window open on its parent.
+     *
+     * The folders inside it are found when it is opened.
+     */
+    void notify_shell_of_new_folder(
+        const apidl_t& destination_root, const boost::filesystem::path& folder)
+    {
+        try
+        {
+            cpidl_t item = create_remote_itemid(
+                folder.filename().wstring(), true, false, L"", L"", 0, 0, 0,
+                0, datetime_t::now(), datetime_t::now());
+
+            ::SHChangeNotify(
+                SHCNE_MKDIR, SHCNF_IDLIST | SHCNF_FLUSHNOWAIT,
+                (destination_root + item).get(), NULL);
+        }
+        catch (const exception& e)
+        {
+            // The folder was copied even if the shell wasn't told
+            trace("Failed to notify shell of new folder %s") % e.what();
+        }
+    }
+
+    bool is_not_supported(const system_error& e)
+    {
+        return e.code() == boost::system::errc::function_not_supported;
+    }
+
+}
+
+/**
+ * Create plan to copy the items, as archives if they suit it.
+ *
+ * @param duplicates      What the file-by-file copy does with files that
+ *                        are the same as one already uploaded.
+ * @param file_threshold  Fewest files, over all the folders, worth sending
+ *                        as archives.
+ */
+ArchiveCopyPlan::ArchiveCopyPlan(
+    const PidlFormat& source_format, const apidl_t& destination_root,
+    ParallelPlan::provider_factory extra_providers,
+    duplicate_policy::value duplicates, size_t file_threshold)
+    :
+    m_local_folders(local_folders(source_format)),
+    m_destination_root(destination_root),
+    m_file_threshold(file_threshold),
+    m_fallback(source_format, destination_root, extra_providers, duplicates)
+{}
+
+void ArchiveCopyPlan::execute_plan(
+    DropActionCallback& callback, shared_ptr<sftp_provider> provider) const
+{
+    if (m_local_folders.empty())
+    {
+        m_fallback.execute_plan(callback, provider);
+        return;
+    }
+
+    // Counting a large tree takes a while, so the user sees it happening
+    // and can cancel it
+    auto_ptr<Progress> progress = callback.progress();
+
+    tree_totals totals;
+    if (!count_files(m_local_folders, *progress, totals) ||
+        totals.files < m_file_threshold)
+    {
+        progress.reset();
+        m_fallback.execute_plan(callback, provider);
+        return;
+    }
+
+    // tar replaces files without asking, so it only gets folders that are
+    // new to the server, where there's nothing to ask about
+    DestinationSnapshot destination;
+    BOOST_FOREACH(const boost::filesystem::path& folder, m_local_folders)
+    {
+        if (destination.exists(
+                *provider, target_for_folder(m_destination_root, folder)))
+        {
+            progress.reset();
+            m_fallback.execute_plan(callback, provider);
+            return;
+        }
+    }
+
+    uintmax_t done = 0;
+    for (size_t i = 0; i < m_local_folders.size(); ++i)
+    {
+        const boost::filesystem::path& folder = m_local_folders[i];
+        path target = target_for_folder(m_destination_root, folder);
+
+        progress->line_path(1, folder.wstring());
+        progress->line_path(2, target.wstring());
+
+        archive_statistics copied;
+        try
+        {
+            copied = provider->upload_tree(
+                folder, target,
+                bind(
+                    &report_progress, boost::ref(*progress), done,
+                    totals.bytes, _1, _2));
+        }
+        catch (const system_error& e)
+        {
+            // Nothing has been copied if the first folder finds the server
+            // can't run tar
+            if (i == 0 && is_not_supported(e))
+            {
+                trace("Server can't take archives; copying file by file");
+                progress.reset();
+                m_fallback.execute_plan(callback, provider);
+                return;
+            }
+
+            throw;
+        }
+
+        notify_shell_of_new_folder(m_destination_root, folder);
+
+        done += copied.bytes;
+        if (copied.skipped > 0)
+        {
+            trace("Left %d links and special files out of archive of %s")
+                % copied.skipped % folder;
+        }
+    }
+
+    progress->update(totals.bytes, totals.bytes);
+
+    trace("Sent %d files in %d archives") % totals.files
+        % m_local_folders.size();
+}
+
+}}
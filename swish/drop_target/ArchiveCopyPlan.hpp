@@ -0,0 +1,96 @@
+/**
+    @file
+
+    Plan copying trees of many small files as one archive.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <swish@lammy.co.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#ifndef SWISH_DROP_TARGET_ARCHIVECOPYPLAN_HPP
+#define SWISH_DROP_TARGET_ARCHIVECOPYPLAN_HPP
+#pragma once
+
+#include "swish/drop_target/DuplicateUploads.hpp" // duplicate_policy
+#include "swish/drop_target/ParallelPlan.hpp"
+#include "swish/drop_target/PidlCopyPlan.hpp"
+#include "swish/drop_target/Plan.hpp"
+#include "swish/provider/sftp_provider.hpp"
+#include "swish/shell_folder/data_object/ShellDataObject.hpp"  // PidlFormat
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef> // size_t
+#include <vector>
+
+namespace swish {
+namespace drop_target {
+
+/**
+ * Plan copying folders of many small files by streaming each one to `tar`
+ * on the server as an archive.
+ *
+ * Drops that don't suit this are copied by a `PidlCopyPlan` instead: those
+ * with fewer files than the threshold, items that aren't folders on a local
+ * disk, trees that can't all be read, folders that would overwrite
+ * something on the server and servers that can't run `tar`.
+ *
+ * The drop target only uses this when the user turns on the
+ * `ArchiveUploads` setting.  Otherwise drops go through `PidlCopyPlan`.
+ */
+class ArchiveCopyPlan /* final */ : public Plan
+{
+public:
+
+    /**
+     * Below this many files, the round trips saved don't pay for starting
+     * a command on the server.
+     */
+    static const std::size_t DEFAULT_FILE_THRESHOLD = 100;
+
+    ArchiveCopyPlan(
+        const swish::shell_folder::data_object::PidlFormat& source,
+        const washer::shell::pidl::apidl_t& destination,
+        ParallelPlan::provider_factory extra_providers=
+            ParallelPlan::provider_factory(),
+        duplicate_policy::value duplicates=duplicate_policy::upload,
+        std::size_t file_threshold=DEFAULT_FILE_THRESHOLD);
+
+public: // Plan
+
+    virtual void execute_plan(
+        DropActionCallback& callback,
+        boost::shared_ptr<swish::provider::sftp_provider> provider) const;
+
+private:
+
+    /**
+     * Empty unless every item is a local folder.
+     */
+    std::vector<boost::filesystem::path> m_local_folders;
+    washer::shell::pidl::apidl_t m_destination_root;
+    std::size_t m_file_threshold;
+    PidlCopyPlan m_fallback;
+};
+
+}}
+
+#endif
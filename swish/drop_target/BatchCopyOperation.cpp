@@ -0,0 +1,370 @@
+/**
+    @file
+
+    Operation copying many small files together.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#include "BatchCopyOperation.hpp"
+
+#include "swish/drop_target/CopyFileOperation.hpp"
+#include "swish/drop_target/DestinationSnapshot.hpp"
+#include "swish/remote_folder/remote_pidl.hpp" // create_remote_itemid
+
+#include <washer/shell/shell.hpp> // stream_from_pidl
+#include <washer/trace.hpp> // trace
+
+#include <ssh/filesystem.hpp> // batch_upload
+
+#include <comet/datetime.h> // datetime_t
+#include <comet/error.h> // com_error
+
+#include <boost/locale/message.hpp> // translate
+#include <boost/locale/format.hpp> // wformat
+#include <boost/shared_ptr.hpp>  // shared_ptr
+#include <boost/system/error_code.hpp>
+#include <boost/throw_exception.hpp>  // BOOST_THROW_EXCEPTION
+
+#include <cassert> // assert
+#include <exception>
+#include <string>
+#include <vector>
+
+#include <Shlwapi.h> // SHCreateMemStream
+
+using swish::provider::sftp_provider;
+using swish::remote_folder::create_remote_itemid;
+
+using washer::shell::pidl::cpidl_t;
+using washer::shell::stream_from_pidl;
+using washer::trace;
+
+using ssh::filesystem::batch_upload;
+using ssh::filesystem::path;
+
+using boost::locale::translate;
+using boost::locale::wformat;
+using boost::shared_ptr;
+using boost::system::error_code;
+using boost::uintmax_t;
+
+using comet::auto_attach;
+using comet::com_error;
+using comet::com_ptr;
+using comet::datetime_t;
+
+using std::exception;
+using std::size_t;
+using std::string;
+using std::vector;
+using std::wstring;
+
+namespace swish {
+namespace drop_target {
+
+namespace {
+
+    const ULONG READ_CHUNK_SIZE = 1024 * 32;
+
+    /**
+     * Read everything from the stream, starting where it is now, unless
+     * there is more than `limit`.
+     *
+     * @returns  Whether it all fitted.  If not, `contents` is left empty.
+     */
+    bool read_whole_stream(
+        const com_ptr<IStream>& stream, uintmax_t limit, string& contents)
+    {
+        vector<char> buffer(READ_CHUNK_SIZE);
+
+        while (true)
+        {
+            ULONG count = 0;
+            HRESULT hr = stream->Read(&buffer[0], READ_CHUNK_SIZE, &count);
+            if (FAILED(hr))
+                BOOST_THROW_EXCEPTION(com_error_from_interface(stream, hr));
+
+            if (count == 0)
+                return true;
+
+            if (contents.size() + count > limit)
+            {
+                string().swap(contents);
+                return false;
+            }
+
+            contents.append(&buffer[0], count);
+        }
+    }
+
+    /**
+     * Stream over a copy of bytes already read, so that a file copied on
+     * its own needn't be read from its source again.
+     */
+    com_ptr<IStream> stream_over(const string& contents)
+    {
+        com_ptr<IStream> stream = auto_attach(
+            ::SHCreateMemStream(
+                reinterpret_cast<const BYTE*>(contents.data()),
+                static_cast<UINT>(contents.size())));
+        if (!stream)
+            BOOST_THROW_EXCEPTION(com_error(E_OUTOFMEMORY));
+
+        return stream;
+    }
+
+    void notify_shell_of_new_file(
+        const resolved_destination& target, uintmax_t size)
+    {
+        try
+        {
+            // Including the size, otherwise Explorer shows a 0-byte file
+            cpidl_t file = create_remote_itemid(
+                target.filename(), false, false, L"", L"", 0, 0, 0,
+                size, datetime_t::now(), datetime_t::now());
+
+            ::SHChangeNotify(
+                SHCNE_CREATE, SHCNF_IDLIST | SHCNF_FLUSHNOWAIT,
+                (target.directory() + file).get(), NULL);
+        }
+        catch (const exception& e)
+        {
+            // Ignoring error; failing to update the shell doesn't
+            // warrant aborting the transfer
+            trace("Failed to notify shell of new file %s") % e.what();
+        }
+    }
+
+    /**
+     * Presents one file's progress as part of the whole batch.
+     */
+    class batch_member_callback : public OperationCallback
+    {
+    public:
+        batch_member_callback(
+            OperationCallback& batch_callback, uintmax_t offset,
+            uintmax_t batch_total)
+            : m_batch_callback(batch_callback), m_offset(offset),
+              m_batch_total(batch_total) {}
+
+        virtual void check_if_user_cancelled() const
+        {
+            m_batch_callback.check_if_user_cancelled();
+        }
+
+        virtual bool request_overwrite_permission(const path& target) const
+        {
+            return m_batch_callback.request_overwrite_permission(target);
+        }
+
+        virtual void update_progress(uintmax_t so_far, uintmax_t /*out_of*/)
+        {
+            m_batch_callback.update_progress(m_offset + so_far, m_batch_total);
+        }
+
+        virtual DestinationSnapshot& destination_snapshot() const
+        {
+            return m_batch_callback.destination_snapshot();
+        }
+
+    private:
+        OperationCallback& m_batch_callback;
+        uintmax_t m_offset;
+        uintmax_t m_batch_total;
+    };
+
+}
+
+BatchCopyOperation::BatchCopyOperation() : m_expected_size(0) {}
+
+void BatchCopyOperation::add_file(
+    const RootedSource& source, const SftpDestination& destination,
+    uintmax_t expected_size)
+{
+    m_files.push_back(std::make_pair(source, destination));
+    m_sizes.push_back(expected_size);
+    m_expected_size += expected_size;
+}
+
+size_t BatchCopyOperation::file_count() const
+{
+    return m_files.size();
+}
+
+uintmax_t BatchCopyOperation::expected_size() const
+{
+    return m_expected_size;
+}
+
+bool BatchCopyOperation::has_room_for(uintmax_t size) const
+{
+    return m_files.empty() ||
+        (m_files.size() < MAX_FILES && m_expected_size + size <= MAX_BYTES);
+}
+
+wstring BatchCopyOperation::title() const
+{
+    assert(!m_files.empty());
+
+    return (wformat(
+        translate(
+            L"Top line of a transfer progress window saying which "
+            L"file is being copied. {1} is replaced with the file path "
+            L"and must be included in your translation.",
+            L"Copying '{1}'"))
+        % m_files.front().first.relative_name()).str();
+}
+
+wstring BatchCopyOperation::description() const
+{
+    assert(!m_files.empty());
+
+    return (wformat(
+        translate(
+            L"Second line of a transfer progress window giving the destination "
+            L"directory. {1} is replaced with the directory path and must be "
+            L"included in your translation.",
+            L"To '{1}'"))
+        % m_files.front().second.root_name()).str();
+}
+
+void BatchCopyOperation::operator()(
+    OperationCallback& callback, shared_ptr<sftp_provider> provider) const
+{
+    callback.check_if_user_cancelled();
+
+    DestinationSnapshot& destination = callback.destination_snapshot();
+
+    // Reading every file before sending anything so that the transfer isn't
+    // held up by the local disk.  Each file's bytes are swapped into the
+    // batch, or held for copying it alone, rather than copied.
+    vector<resolved_destination> targets;
+    vector<string> held;
+    vector<com_ptr<IStream> > unread;
+    vector<bool> in_batch;
+    targets.reserve(m_files.size());
+    held.resize(m_files.size());
+    unread.resize(m_files.size());
+    in_batch.reserve(m_files.size());
+
+    vector<batch_upload> batch;
+    uintmax_t bytes_read = 0;
+    uintmax_t unread_size = 0;
+    for (size_t i = 0; i < m_files.size(); ++i)
+    {
+        targets.push_back(m_files[i].second.resolve_destination());
+        path target = targets.back().as_absolute_path();
+
+        // Only the files that still fit are held in memory.  One that has
+        // grown past what is left is copied alone, streamed from the source
+        // we already have open.
+        com_ptr<IStream> stream = stream_from_pidl(m_files[i].first.pidl());
+        if (!read_whole_stream(stream, MAX_BYTES - bytes_read, held[i]))
+        {
+            unread[i] = stream;
+            unread_size += m_sizes[i];
+            in_batch.push_back(false);
+            continue;
+        }
+
+        bytes_read += held[i].size();
+
+        // Replacing a file needs the user's permission, which only the
+        // file-by-file copy asks for
+        in_batch.push_back(!destination.exists(*provider, target));
+        if (in_batch.back())
+        {
+            batch.push_back(batch_upload(target, string(), false));
+            batch.back().contents.swap(held[i]);
+        }
+    }
+
+    callback.check_if_user_cancelled();
+
+    vector<error_code> results = provider->upload_batch(batch);
+    assert(results.size() == batch.size());
+
+    uintmax_t total = bytes_read + unread_size;
+    uintmax_t done = 0;
+    size_t next_in_batch = 0;
+    for (size_t i = 0; i < m_files.size(); ++i)
+    {
+        path target = targets[i].as_absolute_path();
+
+        bool copy_alone = !in_batch[i];
+        if (in_batch[i])
+        {
+            batch_upload& upload = batch[next_in_batch];
+            error_code error = results[next_in_batch];
+            ++next_in_batch;
+
+            if (error)
+            {
+                trace("Batched upload of %s failed (%s); copying it alone")
+                    % target.string() % error.message();
+                held[i].swap(upload.contents);
+                copy_alone = true;
+            }
+            else
+            {
+                destination.file_created(target);
+                notify_shell_of_new_file(targets[i], upload.contents.size());
+                done += upload.contents.size();
+            }
+        }
+
+        if (copy_alone)
+        {
+            uintmax_t size = (unread[i]) ? m_sizes[i] : held[i].size();
+            com_ptr<IStream> source =
+                (unread[i]) ? unread[i] : stream_over(held[i]);
+            string().swap(held[i]);
+
+            batch_member_callback member_callback(callback, done, total);
+
+            CopyFileOperation(
+                m_files[i].first, m_files[i].second, size, source)(
+                    member_callback, provider);
+
+            done += size;
+        }
+
+        // A failure to update the progress isn't a good enough reason
+        // to abort the copy so we swallow the exception.
+        try
+        {
+            callback.update_progress(done, total);
+        }
+        catch (const exception& e)
+        {
+            trace("Progress update threw exception: %s") % e.what();
+            assert(false);
+        }
+    }
+}
+
+Operation* BatchCopyOperation::do_clone() const
+{
+    return new BatchCopyOperation(*this);
+}
+
+}}
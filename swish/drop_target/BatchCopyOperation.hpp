@@ -0,0 +1,118 @@
+/**
+    @file
+
+    Operation copying many small files together.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#ifndef SWISH_DROP_TARGET_BATCHCOPYOPERATION_HPP
+#define SWISH_DROP_TARGET_BATCHCOPYOPERATION_HPP
+#pragma once
+
+#include "swish/drop_target/Operation.hpp"
+#include "swish/drop_target/RootedSource.hpp"
+#include "swish/drop_target/SftpDestination.hpp"
+#include "swish/provider/sftp_provider.hpp"
+
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef> // size_t
+#include <utility> // pair
+#include <vector>
+
+namespace swish {
+namespace drop_target {
+
+/**
+ * Copies a group of small files in one go.
+ *
+ * The files are read locally in full and then created on the server with
+ * their requests interleaved, so a batch takes little more than one round
+ * trip rather than several per file.
+ *
+ * Files are never overwritten by the batch.  Files that the destination
+ * snapshot says are already there, and any file that the batch fails to
+ * create, are copied on their own by a `CopyFileOperation`, which asks the
+ * user before replacing anything and reports a failure in the usual way.
+ * So is a file that has grown so much since it was added that the batch
+ * would hold more than `MAX_BYTES`.  The bytes already read are handed
+ * over rather than read again.
+ */
+class BatchCopyOperation : public Operation
+{
+public:
+
+    /**
+     * Files at most this size are worth batching.
+     */
+    static const boost::uintmax_t SMALL_FILE_THRESHOLD = 64 * 1024;
+
+    /**
+     * Limits on how much one batch holds in memory.
+     */
+    static const std::size_t MAX_FILES = 256;
+    static const boost::uintmax_t MAX_BYTES = 4 * 1024 * 1024;
+
+    BatchCopyOperation();
+
+    void add_file(
+        const RootedSource& source, const SftpDestination& destination,
+        boost::uintmax_t expected_size);
+
+    std::size_t file_count() const;
+
+    /**
+     * Whether a file of `size` bytes can join without going over either
+     * limit.
+     *
+     * An empty batch takes any file.
+     */
+    bool has_room_for(boost::uintmax_t size) const;
+
+public: // Operation
+
+    virtual std::wstring title() const;
+
+    virtual std::wstring description() const;
+
+    /**
+     * Total size of the files as it was when they were added.
+     */
+    virtual boost::uintmax_t expected_size() const;
+
+    virtual void operator()(
+        OperationCallback& callback,
+        boost::shared_ptr<swish::provider::sftp_provider> provider) const;
+
+private:
+
+    virtual Operation* do_clone() const;
+
+    std::vector<std::pair<RootedSource, SftpDestination>> m_files;
+    std::vector<boost::uintmax_t> m_sizes; ///< Each file's expected size
+    boost::uintmax_t m_expected_size;
+};
+
+}}
+
+#endif
@@ -26,16 +26,24 @@
 
 #include "CopyFileOperation.hpp"
 
+#include "swish/drop_target/DestinationSnapshot.hpp"
+#include "swish/drop_target/stream_hash.hpp" // md5_of_stream
 #include "swish/remote_folder/remote_pidl.hpp" // create_remote_itemid
 #include "swish/shell_folder/SftpDirectory.h" // CSftpDirectory
 
+#include <ssh/transfer.hpp> // transfer_engine
+
 #include <washer/shell/shell.hpp> // stream_from_pidl
 #include <washer/trace.hpp> // trace
 
 #include <comet/datetime.h> // datetime_t
 #include <comet/error.h> // com_error
 
-#include <boost/cstdint.hpp> // int64_t
+#include <boost/bind.hpp> // bind
+#include <boost/cstdint.hpp> // int64_t, uintmax_t
+#include <boost/filesystem/path.hpp>
+#include <boost/optional/optional.hpp>
+#include <boost/ref.hpp> // ref, cref
 #include <boost/locale/message.hpp> // translate
 #include <boost/locale/format.hpp> // wformat
 #include <boost/shared_ptr.hpp>  // shared_ptr
@@ -44,7 +52,11 @@
 #include <cassert> // assert
 #include <exception>
 #include <iosfwd> // wstringstream
+#include <memory> // auto_ptr
+
+#include <ShlObj.h> // SHGetPathFromIDListW
 
+using swish::provider::sftp_filesystem_item;
 using swish::provider::sftp_provider;
 using swish::remote_folder::create_remote_itemid;
 
@@ -54,16 +66,31 @@ using washer::shell::pidl::pidl_t;
 using washer::shell::stream_from_pidl;
 using washer::trace;
 
+using ssh::filesystem::mapped_file_source;
+using ssh::filesystem::sink_bound;
+using ssh::filesystem::source_bound;
+using ssh::filesystem::transfer_bottleneck;
+using ssh::filesystem::transfer_engine;
+using ssh::filesystem::transfer_sink;
+using ssh::filesystem::transfer_source;
+using ssh::filesystem::transfer_statistics;
+
+using boost::bind;
+using boost::cref;
 using boost::int64_t;
 using boost::function;
 using boost::locale::translate;
 using boost::locale::wformat;
+using boost::optional;
+using boost::ref;
 using boost::shared_ptr;
+using boost::uintmax_t;
 
 using comet::com_error;
 using comet::com_ptr;
 using comet::datetime_t;
 
+using std::auto_ptr;
 using std::exception;
 using std::wstringstream;
 
@@ -73,6 +100,17 @@ namespace drop_target {
 namespace {
 
     const size_t COPY_CHUNK_SIZE = 1024 * 32;
+    const size_t COPY_BUFFER_COUNT = 4;
+
+    /**
+     * Largest file we ask the server to hash before deciding whether to
+     * upload it.
+     *
+     * Hashing reads the whole file on both sides, which for big files takes
+     * about as long as uploading it again and keeps a worker busy the whole
+     * time.
+     */
+    const int64_t MAX_HASHED_SIZE = 64 * 1024 * 1024;
 
     /**
      * Return size of the streamed object in bytes.
@@ -87,17 +125,220 @@ namespace {
         return statstg.cbSize.QuadPart;
     }
 
+    /**
+     * Whether the file on the server already holds exactly what we would
+     * upload.
+     *
+     * Only a file of the same size can be the same, and only then do we
+     * compare hashes, the server hashing its copy so it doesn't have to be
+     * downloaded.  Not being able to find out, for example because the
+     * server has no way to hash files, counts as different.  So does a
+     * file too large to be worth hashing.
+     */
+    bool remote_file_is_identical(
+        const com_ptr<IStream>& local_stream, sftp_provider& provider,
+        const ssh::filesystem::path& remote_file)
+    {
+        try
+        {
+            sftp_filesystem_item remote = provider.stat(remote_file, true);
+            int64_t local_size = size_of_stream(local_stream);
+            if (static_cast<int64_t>(remote.size_in_bytes()) != local_size)
+                return false;
+
+            if (local_size > MAX_HASHED_SIZE)
+            {
+                trace("Not comparing %s with the local file: too large to hash")
+                    % remote_file.string();
+                return false;
+            }
+
+            return provider.remote_hash(remote_file, "md5") ==
+                md5_of_stream(local_stream);
+        }
+        catch (const exception& e)
+        {
+            trace("Unable to compare %s with the local file: %s")
+                % remote_file.string() % e.what();
+            return false;
+        }
+    }
+
+    /**
+     * Reads a local stream.
+     *
+     * The stream belongs to this thread's apartment and, unless it is
+     * agile, a call from another thread would wait for this one to pump
+     * messages, which it doesn't do while copying.  So the stream is read
+     * here and the transfer engine's thread does the writing.
+     */
+    class local_stream_source : public transfer_source
+    {
+    public:
+        explicit local_stream_source(com_ptr<IStream> stream)
+            : m_stream(stream) {}
+
+        virtual size_t read(char* buffer, size_t size)
+        {
+            ULONG cbRead = 0;
+            HRESULT hr = m_stream->Read(
+                buffer, static_cast<ULONG>(size), &cbRead);
+            if (FAILED(hr))
+                BOOST_THROW_EXCEPTION(com_error_from_interface(m_stream, hr));
+
+            return cbRead;
+        }
+
+    private:
+        com_ptr<IStream> m_stream;
+    };
+
+    /**
+     * The file on a local disk that the item is, if it is one.
+     *
+     * Items in virtual folders, such as the inside of a zip file, have no
+     * path and can only be read through their stream.
+     */
+    optional<boost::filesystem::path> local_file_path(const apidl_t& pidl)
+    {
+        wchar_t buffer[MAX_PATH];
+        if (!::SHGetPathFromIDListW(pidl.get(), buffer))
+            return optional<boost::filesystem::path>();
+
+        return boost::filesystem::path(buffer);
+    }
+
+    /**
+     * Where to read the file being uploaded from.
+     *
+     * A file on a local disk is mapped so that the engine uploads straight
+     * from the mapping rather than copying it out of the stream first.  If
+     * it can't be mapped, it is read through the stream like any other item.
+     */
+    auto_ptr<transfer_source> local_source(
+        com_ptr<IStream> local_stream,
+        const optional<boost::filesystem::path>& local_file)
+    {
+        if (local_file)
+        {
+            try
+            {
+                return auto_ptr<transfer_source>(
+                    new mapped_file_source(*local_file));
+            }
+            catch (const exception& e)
+            {
+                trace("Couldn't map %s (%s); reading it as a stream")
+                    % local_file->string() % e.what();
+            }
+        }
+
+        return auto_ptr<transfer_source>(
+            new local_stream_source(local_stream));
+    }
+
+    /**
+     * Writes to the stream for the file on the server.
+     *
+     * Written on the transfer engine's thread.  The provider's streams
+     * aren't tied to an apartment so that is safe.
+     */
+    class remote_stream_sink : public transfer_sink
+    {
+    public:
+        explicit remote_stream_sink(com_ptr<IStream> stream)
+            : m_stream(stream) {}
+
+        virtual void write(const char* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ULONG cbWritten = 0;
+                HRESULT hr = m_stream->Write(
+                    data, static_cast<ULONG>(size), &cbWritten);
+                if (FAILED(hr))
+                    BOOST_THROW_EXCEPTION(
+                        com_error_from_interface(m_stream, hr));
+                if (cbWritten == 0)
+                    BOOST_THROW_EXCEPTION(
+                        com_error_from_interface(m_stream, STG_E_WRITEFAULT));
+
+                data += cbWritten;
+                size -= cbWritten;
+            }
+        }
+
+    private:
+        com_ptr<IStream> m_stream;
+    };
+
+    /**
+     * Tell the user and the shell how far the copy has got.
+     *
+     * Throws if the user cancelled, which stops the transfer.
+     */
+    void report_progress(
+        OperationCallback& callback, const resolved_destination& target,
+        int64_t total, uintmax_t done)
+    {
+        callback.check_if_user_cancelled();
+
+        try
+        {
+            // We create a different version of the PIDL here whose filesize
+            // is the amount copied so far. Otherwise Explorer shows a
+            // 0-byte file when the copying is done.
+            cpidl_t file = create_remote_itemid(
+                target.filename(), false, false, L"", L"", 0, 0, 0,
+                done, datetime_t::now(), datetime_t::now());
+
+            ::SHChangeNotify(
+                SHCNE_UPDATEITEM, SHCNF_IDLIST | SHCNF_FLUSHNOWAIT,
+                (target.directory() + file).get(), NULL);
+        }
+        catch(const exception& e)
+        {
+            // Ignoring error; failing to update the shell doesn't
+            // warrant aborting the transfer
+            trace("Failed to notify shell of file update %s") % e.what();
+        }
+
+        // A failure to update the progress isn't a good enough reason
+        // to abort the copy so we swallow the exception.
+        try
+        {
+            callback.update_progress(done, total);
+        }
+        catch (const exception& e)
+        {
+            trace("Progress update threw exception: %s") % e.what();
+            assert(false);
+        }
+    }
+
+    const char* bottleneck_description(transfer_bottleneck bottleneck)
+    {
+        switch (bottleneck)
+        {
+        case source_bound:
+            return " (limited by reading the local file)";
+        case sink_bound:
+            return " (limited by the network)";
+        default:
+            return "";
+        }
+    }
+
     /**
      * Write a stream to the provider at the given path.
      *
-     * If it already exists, we want to ask the user for confirmation.
-     * The poor-mans way of checking if the file is already there is to
-     * try to get the file read-only first.  If this fails, assume the
-     * file noes not already exist.
+     * If it already exists, we want to ask the user for confirmation,
+     * unless it is identical to the local file, in which case we leave it.
+     * Whether it exists comes from the plan's snapshot of the destination
+     * rather than a trip to the server for each file.
      *
-     * @bug  The get may have failed for a different reason or this
-     *       may not work reliably on all SFTP servers.  A safer
-     *       solution would be an explicit stat on the file.
+     * The data is read from `local_file`, if given, which must be the file
+     * `local_stream` reads.
      *
      * @bug  Of course, there is a race condition here.  After we check if the
      *       file exists, someone else may have created it.  Unfortunately,
@@ -105,7 +346,9 @@ namespace {
      *       a way to do this atomically such as locking a file.
      */
     void copy_stream_to_remote_destination(
-        com_ptr<IStream> local_stream, shared_ptr<sftp_provider> provider,
+        com_ptr<IStream> local_stream,
+        const optional<boost::filesystem::path>& local_file,
+        shared_ptr<sftp_provider> provider,
         const resolved_destination& target,
         OperationCallback& callback)
     {
@@ -115,8 +358,20 @@ namespace {
             target.filename(), false, false, L"", L"", 0, 0, 0, 0,
             datetime_t::now(), datetime_t::now());
 
-        if (sftp_directory.exists(file))
+        DestinationSnapshot& destination = callback.destination_snapshot();
+
+        if (destination.exists(*provider, target.as_absolute_path()))
         {
+            // Re-sending a file that hasn't changed is a waste of the
+            // connection, and asking about it is a waste of the user's time
+            if (remote_file_is_identical(
+                local_stream, *provider, target.as_absolute_path()))
+            {
+                trace("Skipped %s: the same on the server already")
+                    % target.as_absolute_path().string();
+                return;
+            }
+
             bool can_overwrite = callback.request_overwrite_permission(
                 target.as_absolute_path());
 
@@ -148,6 +403,8 @@ namespace {
                     provider_error.help_file(), provider_error.help_context()));
         }
 
+        destination.file_created(target.as_absolute_path());
+
         ::SHChangeNotify(
             SHCNE_CREATE, SHCNF_IDLIST | SHCNF_FLUSHNOWAIT,
             (target.directory() + file).get(), NULL);
@@ -162,70 +419,40 @@ namespace {
         if (FAILED(hr))
             BOOST_THROW_EXCEPTION(com_error_from_interface(remote_stream, hr));
 
-        // Do the copy in chunks allowing us to cancel the operation
-        // and display progress
-        ULARGE_INTEGER cb;
-        cb.QuadPart = COPY_CHUNK_SIZE;
-        int64_t done = 0;
+        // The local disk is read on this thread while the engine's thread
+        // writes to the server, so neither waits for the other.  Progress
+        // and cancellation are dealt with between reads.
         int64_t total = size_of_stream(local_stream);
 
-        while (true)
-        {
-            callback.check_if_user_cancelled();
-
-            ULARGE_INTEGER cbRead = {0};
-            ULARGE_INTEGER cbWritten = {0};
-            // TODO: make our own CopyTo that propagates errors
-            hr = local_stream->CopyTo(
-                remote_stream.get(), cb, &cbRead, &cbWritten);
-            assert(FAILED(hr) || cbRead.QuadPart == cbWritten.QuadPart);
-            if (FAILED(hr))
-                BOOST_THROW_EXCEPTION(
-                    com_error_from_interface(local_stream, hr));
+        callback.check_if_user_cancelled();
 
-            try
-            {
-                // We create a different version of the PIDL here whose filesize
-                // is the amount copied so far. Otherwise Explorer shows a
-                // 0-byte file when the copying is done.
-                file = create_remote_itemid(
-                    target.filename(), false, false, L"", L"", 0, 0, 0,
-                    done, datetime_t::now(), datetime_t::now());
-
-                ::SHChangeNotify(
-                    SHCNE_UPDATEITEM, SHCNF_IDLIST | SHCNF_FLUSHNOWAIT,
-                    (target.directory() + file).get(), NULL);
-            }
-            catch(const exception& e)
-            {
-                // Ignoring error; failing to update the shell doesn't
-                // warrant aborting the transfer
-                trace("Failed to notify shell of file update %s") % e.what();
-            }
+        auto_ptr<transfer_source> source =
+            local_source(local_stream, local_file);
+        remote_stream_sink sink(remote_stream);
 
-            // A failure to update the progress isn't a good enough reason
-            // to abort the copy so we swallow the exception.
-            try
-            {
-                done += cbWritten.QuadPart;
-                callback.update_progress(done, total);
-            }
-            catch (const exception& e)
-            {
-                trace("Progress update threw exception: %s") % e.what();
-                assert(false);
-            }
+        transfer_engine engine(COPY_BUFFER_COUNT, COPY_CHUNK_SIZE);
+        transfer_statistics statistics = engine.transfer_reading_here(
+            *source, sink,
+            bind(&report_progress, ref(callback), cref(target), total, _1));
 
-            if (cbRead.QuadPart == 0)
-                break; // finished
-        }
+        trace("Copied %d bytes to %s at %.0f bytes/s%s")
+            % statistics.bytes % target.as_absolute_path().string()
+            % statistics.bytes_per_second()
+            % bottleneck_description(statistics.bottleneck());
     }
 
 }
 
 CopyFileOperation::CopyFileOperation(
-    const RootedSource& source, const SftpDestination& destination) :
-m_source(source), m_destination(destination) {}
+    const RootedSource& source, const SftpDestination& destination,
+    uintmax_t expected_size) :
+m_source(source), m_destination(destination), m_expected_size(expected_size) {}
+
+CopyFileOperation::CopyFileOperation(
+    const RootedSource& source, const SftpDestination& destination,
+    uintmax_t expected_size, com_ptr<IStream> source_stream) :
+m_source(source), m_destination(destination), m_expected_size(expected_size),
+m_source_stream(source_stream) {}
 
 std::wstring CopyFileOperation::title() const
 {
@@ -249,15 +476,30 @@ std::wstring CopyFileOperation::description() const
         % m_destination.root_name()).str();
 }
 
+uintmax_t CopyFileOperation::expected_size() const
+{
+    return m_expected_size;
+}
+
 void CopyFileOperation::operator()(
     OperationCallback& callback, shared_ptr<sftp_provider> provider) const
 {
-    com_ptr<IStream> stream = stream_from_pidl(m_source.pidl());
+    com_ptr<IStream> stream;
+    optional<boost::filesystem::path> local_file;
+    if (m_source_stream)
+    {
+        stream = m_source_stream;
+    }
+    else
+    {
+        stream = stream_from_pidl(m_source.pidl());
+        local_file = local_file_path(m_source.pidl());
+    }
 
     resolved_destination resolved_target(m_destination.resolve_destination());
 
     copy_stream_to_remote_destination(
-        stream, provider, resolved_target, callback);
+        stream, local_file, provider, resolved_target, callback);
 }
 
 Operation* CopyFileOperation::do_clone() const
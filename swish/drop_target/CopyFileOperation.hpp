@@ -33,10 +33,15 @@
 #include "swish/drop_target/SftpDestination.hpp"
 #include "swish/provider/sftp_provider.hpp"
 
+#include <boost/cstdint.hpp> // uintmax_t
 #include <boost/shared_ptr.hpp>
 
 #include <washer/shell/pidl.hpp> // apidl_t
 
+#include <comet/ptr.h> // com_ptr
+
+#include <ObjIdl.h> // IStream
+
 namespace swish {
 namespace drop_target {
 
@@ -45,7 +50,20 @@ class CopyFileOperation : public Operation
 public:
 
     CopyFileOperation(
-        const RootedSource& source, const SftpDestination& destination);
+        const RootedSource& source, const SftpDestination& destination,
+        boost::uintmax_t expected_size);
+
+    /**
+     * Copy from a stream the caller already has open on the source,
+     * rather than opening it again.
+     *
+     * The stream is read from the start, wherever it is when the copy
+     * begins.
+     */
+    CopyFileOperation(
+        const RootedSource& source, const SftpDestination& destination,
+        boost::uintmax_t expected_size,
+        comet::com_ptr<IStream> source_stream);
 
 public: // Operation
 
@@ -53,6 +71,8 @@ public: // Operation
 
     virtual std::wstring description() const;
 
+    virtual boost::uintmax_t expected_size() const;
+
     virtual void operator()(
         OperationCallback& callback,
         boost::shared_ptr<swish::provider::sftp_provider> provider) const;
@@ -63,6 +83,8 @@ private:
 
     RootedSource m_source;
     SftpDestination m_destination;
+    boost::uintmax_t m_expected_size;
+    comet::com_ptr<IStream> m_source_stream; ///< Null to open the source
 };
 
 }}
@@ -26,6 +26,7 @@
 
 #include "CreateDirectoryOperation.hpp"
 
+#include "swish/drop_target/DestinationSnapshot.hpp"
 #include "swish/shell_folder/SftpDirectory.h" // CSftpDirectory
 
 #include <boost/locale/message.hpp> // translate
@@ -40,6 +41,7 @@ using boost::function;
 using boost::locale::translate;
 using boost::locale::wformat;
 using boost::shared_ptr;
+using boost::uintmax_t;
 
 using comet::com_ptr;
 
@@ -74,6 +76,11 @@ wstring CreateDirectoryOperation::description() const
         % m_destination.root_name()).str();
 }
 
+uintmax_t CreateDirectoryOperation::expected_size() const
+{
+    return 0;
+}
+
 void CreateDirectoryOperation::operator()(
     OperationCallback& callback,
     shared_ptr<sftp_provider> provider) const
@@ -82,10 +89,18 @@ void CreateDirectoryOperation::operator()(
 
     resolved_destination resolved_target(m_destination.resolve_destination());
 
+    // Knowing a directory is new saves listing it when copying files into it
+    DestinationSnapshot& destination = callback.destination_snapshot();
+    bool is_new = !destination.exists(
+        *provider, resolved_target.as_absolute_path());
+
     CSftpDirectory sftp_directory(
         resolved_target.directory(), provider);
     sftp_directory.CreateDirectory(resolved_target.filename());
 
+    if (is_new)
+        destination.directory_created(resolved_target.as_absolute_path());
+
     callback.update_progress(1, 1);
 }
 
@@ -33,6 +33,7 @@
 #include "swish/drop_target/SftpDestination.hpp"
 #include "swish/provider/sftp_provider.hpp"
 
+#include <boost/cstdint.hpp> // uintmax_t
 #include <boost/shared_ptr.hpp>
 
 namespace swish {
@@ -49,6 +50,8 @@ public:
 
     virtual std::wstring description() const;
 
+    virtual boost::uintmax_t expected_size() const;
+
     virtual void operator()(
         OperationCallback& callback,
         boost::shared_ptr<swish::provider::sftp_provider> provider) const;
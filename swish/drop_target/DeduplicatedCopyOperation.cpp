@@ -0,0 +1,216 @@
+/**
+    @file
+
+    File copy operation that makes duplicates on the server.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#include "DeduplicatedCopyOperation.hpp"
+
+#include "swish/drop_target/CopyFileOperation.hpp"
+#include "swish/drop_target/DestinationSnapshot.hpp"
+#include "swish/drop_target/DuplicateUploads.hpp"
+#include "swish/remote_folder/remote_pidl.hpp" // create_remote_itemid
+
+#include <washer/trace.hpp> // trace
+
+#include <comet/datetime.h> // datetime_t
+
+#include <boost/shared_ptr.hpp>  // shared_ptr
+
+#include <exception>
+#include <string>
+
+using swish::provider::sftp_provider;
+using swish::remote_folder::create_remote_itemid;
+
+using washer::shell::pidl::cpidl_t;
+using washer::trace;
+
+using ssh::filesystem::path;
+
+using boost::optional;
+using boost::shared_ptr;
+using boost::uintmax_t;
+
+using comet::datetime_t;
+
+using std::exception;
+using std::wstring;
+
+namespace swish {
+namespace drop_target {
+
+namespace {
+
+    /**
+     * Make `target` hold the same as `original` without uploading it.
+     *
+     * @param link  Whether `target` may be a hard link to `original`.
+     *
+     * @returns whether the server managed it.
+     */
+    bool duplicate_on_server(
+        sftp_provider& provider, const path& original, const path& target,
+        bool link)
+    {
+        if (link)
+        {
+            try
+            {
+                provider.create_hard_link(target, original);
+                return true;
+            }
+            catch (const exception& e)
+            {
+                trace("Couldn't link %s to %s (%s); copying on the server")
+                    % target.string() % original.string() % e.what();
+            }
+        }
+
+        try
+        {
+            provider.copy_file(original, target);
+            return true;
+        }
+        catch (const exception& e)
+        {
+            trace("Couldn't copy %s to %s on the server (%s); uploading it")
+                % original.string() % target.string() % e.what();
+            return false;
+        }
+    }
+
+    void notify_shell_of_new_file(
+        const resolved_destination& target, uintmax_t size)
+    {
+        try
+        {
+            cpidl_t file = create_remote_itemid(
+                target.filename(), false, false, L"", L"", 0, 0, 0,
+                size, datetime_t::now(), datetime_t::now());
+
+            ::SHChangeNotify(
+                SHCNE_CREATE, SHCNF_IDLIST | SHCNF_FLUSHNOWAIT,
+                (target.directory() + file).get(), NULL);
+        }
+        catch (const exception& e)
+        {
+            trace("Failed to notify shell of new file %s") % e.what();
+        }
+    }
+
+}
+
+DeduplicatedCopyOperation::DeduplicatedCopyOperation(
+    const RootedSource& source, const SftpDestination& destination,
+    uintmax_t size, shared_ptr<DuplicateUploads> duplicates,
+    const optional<path>& original)
+    :
+    m_source(source), m_destination(destination), m_size(size),
+    m_duplicates(duplicates), m_original(original) {}
+
+wstring DeduplicatedCopyOperation::title() const
+{
+    return CopyFileOperation(m_source, m_destination, m_size).title();
+}
+
+wstring DeduplicatedCopyOperation::description() const
+{
+    return CopyFileOperation(m_source, m_destination, m_size).description();
+}
+
+uintmax_t DeduplicatedCopyOperation::expected_size() const
+{
+    return m_size;
+}
+
+void DeduplicatedCopyOperation::operator()(
+    OperationCallback& callback, shared_ptr<sftp_provider> provider) const
+{
+    if (m_original)
+        copy_duplicate(callback, provider);
+    else
+        copy_original(callback, provider);
+}
+
+void DeduplicatedCopyOperation::copy_original(
+    OperationCallback& callback, shared_ptr<sftp_provider> provider) const
+{
+    path target = m_destination.resolve_destination().as_absolute_path();
+
+    // A file that was there already might be kept rather than replaced, in
+    // which case it doesn't hold what the duplicates need
+    bool new_file =
+        !callback.destination_snapshot().exists(*provider, target);
+
+    try
+    {
+        CopyFileOperation(m_source, m_destination, m_size)(callback, provider);
+    }
+    catch (...)
+    {
+        m_duplicates->upload_finished(target, false);
+        throw;
+    }
+
+    m_duplicates->upload_finished(target, new_file);
+}
+
+void DeduplicatedCopyOperation::copy_duplicate(
+    OperationCallback& callback, shared_ptr<sftp_provider> provider) const
+{
+    DestinationSnapshot& destination = callback.destination_snapshot();
+
+    resolved_destination resolved = m_destination.resolve_destination();
+    path target = resolved.as_absolute_path();
+
+    if (m_duplicates->wait_for_original(*m_original, callback) &&
+        !destination.exists(*provider, target) &&
+        duplicate_on_server(
+            *provider, *m_original, target, m_duplicates->link_duplicates()))
+    {
+        destination.file_created(target);
+        notify_shell_of_new_file(resolved, m_size);
+        m_duplicates->upload_avoided(m_size);
+
+        try
+        {
+            callback.update_progress(m_size, m_size);
+        }
+        catch (const exception& e)
+        {
+            trace("Progress update threw exception: %s") % e.what();
+        }
+    }
+    else
+    {
+        CopyFileOperation(m_source, m_destination, m_size)(callback, provider);
+    }
+}
+
+Operation* DeduplicatedCopyOperation::do_clone() const
+{
+    return new DeduplicatedCopyOperation(*this);
+}
+
+}}
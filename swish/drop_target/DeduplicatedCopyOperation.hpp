@@ -0,0 +1,107 @@
+/**
+    @file
+
+    File copy operation that makes duplicates on the server.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#ifndef SWISH_DROP_TARGET_DEDUPLICATEDCOPYOPERATION_HPP
+#define SWISH_DROP_TARGET_DEDUPLICATEDCOPYOPERATION_HPP
+#pragma once
+
+#include "swish/drop_target/Operation.hpp"
+#include "swish/drop_target/RootedSource.hpp"
+#include "swish/drop_target/SftpDestination.hpp"
+#include "swish/provider/sftp_provider.hpp"
+
+#include <ssh/filesystem/path.hpp>
+
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/optional/optional.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace swish {
+namespace drop_target {
+
+class DuplicateUploads;
+
+/**
+ * Copies a file that may have the same contents as another in the drop.
+ *
+ * An original is copied by a `CopyFileOperation` as usual, and the outcome
+ * recorded so its duplicates know whether they can use it.  A duplicate
+ * waits for its original and then becomes a copy of it made by the server
+ * or, if the drop allows it, a hard link to it.  Either way the data isn't
+ * uploaded again.
+ *
+ * Duplicates fall back to a normal copy if anything stops them using the
+ * original, including a file already being where they are going, as only
+ * the normal copy asks before replacing it.
+ */
+class DeduplicatedCopyOperation : public Operation
+{
+public:
+
+    /**
+     * @param original  Where the file with the same contents is going, or
+     *                  nothing if this file is an original.
+     */
+    DeduplicatedCopyOperation(
+        const RootedSource& source, const SftpDestination& destination,
+        boost::uintmax_t size,
+        boost::shared_ptr<DuplicateUploads> duplicates,
+        const boost::optional<ssh::filesystem::path>& original);
+
+public: // Operation
+
+    virtual std::wstring title() const;
+
+    virtual std::wstring description() const;
+
+    virtual boost::uintmax_t expected_size() const;
+
+    virtual void operator()(
+        OperationCallback& callback,
+        boost::shared_ptr<swish::provider::sftp_provider> provider) const;
+
+private:
+
+    virtual Operation* do_clone() const;
+
+    void copy_original(
+        OperationCallback& callback,
+        boost::shared_ptr<swish::provider::sftp_provider> provider) const;
+
+    void copy_duplicate(
+        OperationCallback& callback,
+        boost::shared_ptr<swish::provider::sftp_provider> provider) const;
+
+    RootedSource m_source;
+    SftpDestination m_destination;
+    boost::uintmax_t m_size;
+    boost::shared_ptr<DuplicateUploads> m_duplicates;
+    boost::optional<ssh::filesystem::path> m_original;
+};
+
+}}
+
+#endif
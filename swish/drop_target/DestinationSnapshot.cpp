@@ -0,0 +1,172 @@
+/**
+    @file
+
+    What a drop knows about the files already at its destination.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#include "DestinationSnapshot.hpp"
+
+#include <washer/trace.hpp> // trace
+
+#include <boost/foreach.hpp> // BOOST_FOREACH
+#include <boost/system/system_error.hpp> // system_error, errc
+
+#include <exception>
+#include <set>
+#include <utility> // make_pair
+
+using swish::provider::sftp_filesystem_item;
+using swish::provider::sftp_provider;
+
+using washer::trace;
+
+using ssh::filesystem::path;
+
+using boost::mutex;
+using boost::optional;
+using boost::system::system_error;
+namespace errc = boost::system::errc;
+
+using std::exception;
+
+namespace swish {
+namespace drop_target {
+
+namespace {
+
+    optional<std::set<path>> list_names(
+        sftp_provider& provider, const path& directory)
+    {
+        try
+        {
+            std::set<path> names;
+            BOOST_FOREACH(
+                const sftp_filesystem_item& item, provider.listing(directory))
+            {
+                names.insert(item.filename());
+            }
+
+            return names;
+        }
+        catch (const exception& e)
+        {
+            trace("Couldn't list destination %s: %s") % directory.string()
+                % e.what();
+            return optional<std::set<path>>();
+        }
+    }
+
+    /**
+     * Only a missing file counts as not there.  Anything else, such as
+     * being refused permission to look, means we don't know, and guessing
+     * could overwrite something.
+     */
+    bool exists_on_server(sftp_provider& provider, const path& target)
+    {
+        try
+        {
+            provider.stat(target, false);
+            return true;
+        }
+        catch (const system_error& e)
+        {
+            if (e.code() == errc::no_such_file_or_directory)
+                return false;
+            else
+                throw;
+        }
+    }
+
+}
+
+bool DestinationSnapshot::exists(sftp_provider& provider, const path& target)
+{
+    path directory = target.parent_path();
+    bool seen_before;
+
+    {
+        mutex::scoped_lock lock(m_mutex);
+
+        directory_map::const_iterator listing = m_directories.find(directory);
+        seen_before = listing != m_directories.end();
+        if (seen_before && listing->second)
+            return listing->second->count(target.filename()) > 0;
+    }
+
+    if (!seen_before)
+    {
+        // Listing without the lock so workers needing other directories
+        // aren't held up.  Two workers may list the same directory; the
+        // first listing stored wins, so nothing recorded in the meantime is
+        // lost.  The listing may have missed files created while it ran,
+        // so those are added as it is stored.
+        optional<name_set> names = list_names(provider, directory);
+
+        mutex::scoped_lock lock(m_mutex);
+
+        std::pair<directory_map::iterator, bool> stored =
+            m_directories.insert(std::make_pair(directory, names));
+        if (stored.second)
+        {
+            std::map<path, name_set>::iterator created =
+                m_unlisted_creations.find(directory);
+            if (created != m_unlisted_creations.end())
+            {
+                if (stored.first->second)
+                {
+                    stored.first->second->insert(
+                        created->second.begin(), created->second.end());
+                }
+                m_unlisted_creations.erase(created);
+            }
+        }
+
+        if (stored.first->second)
+            return stored.first->second->count(target.filename()) > 0;
+    }
+
+    return exists_on_server(provider, target);
+}
+
+void DestinationSnapshot::file_created(const path& file)
+{
+    mutex::scoped_lock lock(m_mutex);
+
+    directory_map::iterator listing = m_directories.find(file.parent_path());
+    if (listing == m_directories.end())
+        m_unlisted_creations[file.parent_path()].insert(file.filename());
+    else if (listing->second)
+        listing->second->insert(file.filename());
+}
+
+void DestinationSnapshot::directory_created(const path& directory)
+{
+    file_created(directory);
+
+    mutex::scoped_lock lock(m_mutex);
+
+    m_directories[directory] = name_set();
+    m_unlisted_creations.erase(directory);
+}
+
+}}
@@ -0,0 +1,110 @@
+/**
+    @file
+
+    What a drop knows about the files already at its destination.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#ifndef SWISH_DROP_TARGET_DESTINATIONSNAPSHOT_HPP
+#define SWISH_DROP_TARGET_DESTINATIONSNAPSHOT_HPP
+#pragma once
+
+#include "swish/provider/sftp_provider.hpp"
+
+#include <ssh/filesystem/path.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/optional/optional.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <set>
+
+namespace swish {
+namespace drop_target {
+
+/**
+ * Answers whether files exist at the destination without asking the server
+ * about each one.
+ *
+ * Each destination directory is listed once, the first time something in it
+ * is asked about, and the answers come from that listing.  Files and
+ * directories that the drop itself creates are added as they are created,
+ * so the snapshot stays true to the server for everything the drop touches,
+ * even when they are created while their directory is being listed.
+ * A directory the drop created is known to have started empty and is never
+ * listed at all.
+ *
+ * If a directory can't be listed (it may allow writing but not reading), the
+ * files in it are checked one at a time instead.
+ *
+ * Safe to use from several workers at once.
+ */
+class DestinationSnapshot : private boost::noncopyable
+{
+public:
+
+    /**
+     * Whether anything exists at `target`.
+     *
+     * @param provider  Used to list the directory if this is the first
+     *                  time it has been asked about.
+     */
+    bool exists(
+        swish::provider::sftp_provider& provider,
+        const ssh::filesystem::path& target);
+
+    /**
+     * Record that the drop created a file.
+     */
+    void file_created(const ssh::filesystem::path& file);
+
+    /**
+     * Record that the drop created a directory that wasn't there before.
+     */
+    void directory_created(const ssh::filesystem::path& directory);
+
+private:
+
+    typedef std::set<ssh::filesystem::path> name_set;
+
+    /**
+     * Names in each directory, or nothing for a directory that couldn't be
+     * listed.
+     */
+    typedef std::map<ssh::filesystem::path, boost::optional<name_set>>
+        directory_map;
+
+    directory_map m_directories;
+
+    /**
+     * Names the drop created in each directory not listed yet, to add to
+     * its listing when there is one.
+     */
+    std::map<ssh::filesystem::path, name_set> m_unlisted_creations;
+
+    boost::mutex m_mutex;
+};
+
+}}
+
+#endif
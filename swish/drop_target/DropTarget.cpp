@@ -27,6 +27,7 @@
 
 #include "DropTarget.hpp"
 
+#include "swish/drop_target/ArchiveCopyPlan.hpp"
 #include "swish/drop_target/PidlCopyPlan.hpp"
 #include "swish/provider/sftp_provider.hpp" // sftp_provider, ISftpConsumer
 #include "swish/shell_folder/data_object/ShellDataObject.hpp"
@@ -41,6 +42,7 @@
 #include <comet/error.h> // com_error
 #include <comet/git.h>
 #include <comet/ptr.h>  // com_ptr
+#include <comet/regkey.h>
 #include <comet/util.h> // auto_coinit
 
 using swish::shell_folder::data_object::ShellDataObject;
@@ -58,6 +60,7 @@ using comet::com_error;
 using comet::com_ptr;
 using comet::GIT;
 using comet::GIT_cookie;
+using comet::regkey;
 
 template<> struct comet::comtype<IAsyncOperation>
 {
@@ -97,6 +100,71 @@ namespace { // private
         return DROPEFFECT_NONE;
     }
 
+    /**
+     * Where the user's Swish settings are kept.
+     */
+    const wchar_t SETTINGS_KEY[] = L"Software\\Swish";
+
+    /**
+     * Setting saying what a drop does with files that are the same as one
+     * it has already uploaded.
+     *
+     * 0 uploads them, 1 has the server copy them and 2 hard links them.
+     */
+    const wchar_t DUPLICATE_UPLOADS_VALUE[] = L"DuplicateUploads";
+
+    /**
+     * Setting saying whether drops send large local folders to the server
+     * as archives.
+     *
+     * 1 sends them as archives; anything else copies them file by file.
+     */
+    const wchar_t ARCHIVE_UPLOADS_VALUE[] = L"ArchiveUploads";
+
+}
+
+/**
+ * What the user wants drops to do with files that have the same contents.
+ *
+ * Unless the user says otherwise, the server copies them.  A copy can't
+ * surprise anyone by changing when the other file does, as a hard link
+ * would, and servers that can't copy files fall back to uploading them.
+ */
+duplicate_policy::value duplicate_policy_from_registry()
+{
+    if (regkey settings =
+        regkey(HKEY_CURRENT_USER).open_nothrow(SETTINGS_KEY))
+    {
+        regkey::mapped_type setting = settings[DUPLICATE_UPLOADS_VALUE];
+        if (setting.exists())
+        {
+            if (setting == 0U)
+                return duplicate_policy::upload;
+            else if (setting == 2U)
+                return duplicate_policy::link;
+        }
+    }
+
+    return duplicate_policy::copy;
+}
+
+/**
+ * Whether the user wants large folders sent to the server as archives.
+ *
+ * Off unless the user turns it on.  Archives need a server that lets
+ * Swish run `tar`, and they replace files without asking.
+ */
+bool archive_uploads_from_registry()
+{
+    if (regkey settings =
+        regkey(HKEY_CURRENT_USER).open_nothrow(SETTINGS_KEY))
+    {
+        regkey::mapped_type setting = settings[ARCHIVE_UPLOADS_VALUE];
+        if (setting.exists())
+            return setting == 1U;
+    }
+
+    return false;
 }
 
 /**
@@ -107,14 +175,31 @@ namespace { // private
  * @param destination_root  PIDL to target directory in the remote filesystem
  *                          to copy items into.
  * @param progress          Progress dialogue.
+ * @param extra_providers   Source of sessions for parallel copying.
+ * @param duplicates        What to do with files that are the same as one
+ *                          already uploaded.
+ * @param archive_folders   Whether to send large local folders as archives.
  */
 void copy_format_to_provider(
     PidlFormat source_format, shared_ptr<sftp_provider> provider,
-    const apidl_t& destination_root, shared_ptr<DropActionCallback> callback)
+    const apidl_t& destination_root, shared_ptr<DropActionCallback> callback,
+    ParallelPlan::provider_factory extra_providers,
+    duplicate_policy::value duplicates, bool archive_folders)
 {
-    PidlCopyPlan copy_list(source_format, destination_root);
+    if (archive_folders)
+    {
+        ArchiveCopyPlan copy_list(
+            source_format, destination_root, extra_providers, duplicates);
+
+        copy_list.execute_plan(*callback, provider);
+    }
+    else
+    {
+        PidlCopyPlan copy_list(
+            source_format, destination_root, extra_providers, duplicates);
 
-    copy_list.execute_plan(*callback, provider);
+        copy_list.execute_plan(*callback, provider);
+    }
 }
 
 namespace {
@@ -122,7 +207,9 @@ namespace {
 void async_copy_format_to_provider(
     GIT_cookie<IDataObject> marshalling_cookie,
     shared_ptr<sftp_provider> provider,
-    apidl_t destination_root, shared_ptr<DropActionCallback> callback)
+    apidl_t destination_root, shared_ptr<DropActionCallback> callback,
+    ParallelPlan::provider_factory extra_providers,
+    duplicate_policy::value duplicates, bool archive_folders)
 {
     auto_coinit com;
     GIT git;
@@ -138,7 +225,7 @@ void async_copy_format_to_provider(
         {
             copy_format_to_provider(
                 PidlFormat(data_object), provider, destination_root,
-                callback);
+                callback, extra_providers, duplicates, archive_folders);
         }
         catch (...)
         {
@@ -167,10 +254,16 @@ void async_copy_format_to_provider(
  * @param provider          SFTP connection to copy data over.
  * @param remote_directory  PIDL to target directory in the remote filesystem
  *                          to copy items into.
+ * @param extra_providers   Source of sessions for parallel copying.
+ * @param duplicates        What to do with files that are the same as one
+ *                          already uploaded.
+ * @param archive_folders   Whether to send large local folders as archives.
  */
 void copy_data_to_provider(
     com_ptr<IDataObject> data_object, shared_ptr<sftp_provider> provider, 
-    const apidl_t& remote_directory, shared_ptr<DropActionCallback> callback)
+    const apidl_t& remote_directory, shared_ptr<DropActionCallback> callback,
+    ParallelPlan::provider_factory extra_providers,
+    duplicate_policy::value duplicates, bool archive_folders)
 {
     ShellDataObject data(data_object);
     if (data.has_pidl_format())
@@ -191,13 +284,14 @@ void copy_data_to_provider(
 
             thread(
                 &async_copy_format_to_provider, marshalling_cookie,
-                provider, remote_directory, callback).detach();
+                provider, remote_directory, callback,
+                extra_providers, duplicates, archive_folders).detach();
         }
         else
         {
             copy_format_to_provider(
                 PidlFormat(data_object), provider, remote_directory,
-                callback);
+                callback, extra_providers, duplicates, archive_folders);
         }
     }
     else
@@ -212,10 +306,12 @@ void copy_data_to_provider(
  */
 CDropTarget::CDropTarget(
     shared_ptr<sftp_provider> provider, const apidl_t& remote_directory,
-    shared_ptr<DropActionCallback> callback)
+    shared_ptr<DropActionCallback> callback,
+    ParallelPlan::provider_factory extra_providers)
     :
     m_provider(provider),
-    m_remote_directory(remote_directory), m_callback(callback) {}
+    m_remote_directory(remote_directory), m_callback(callback),
+    m_extra_providers(extra_providers) {}
 
 /**
  * Indicate whether the contents of the DataObject can be dropped on
@@ -302,7 +398,9 @@ STDMETHODIMP CDropTarget::Drop(
             if (pdo && *pdwEffect == DROPEFFECT_COPY)
             {
                 copy_data_to_provider(
-                    pdo, m_provider, m_remote_directory, m_callback);
+                    pdo, m_provider, m_remote_directory, m_callback,
+                    m_extra_providers, duplicate_policy_from_registry(),
+                    archive_uploads_from_registry());
             }
         }
         catch (...)
@@ -31,6 +31,8 @@
 
 #include "swish/provider/sftp_provider.hpp" // sftp_provider
 #include "swish/drop_target/DropActionCallback.hpp" // DropActionCallback
+#include "swish/drop_target/DuplicateUploads.hpp" // duplicate_policy
+#include "swish/drop_target/ParallelPlan.hpp" // ParallelPlan::provider_factory
 #include "swish/drop_target/Progress.hpp" // Progress
 
 #include <washer/object_with_site.hpp> // object_with_site
@@ -63,11 +65,17 @@ public:
 
     /**
      * Create SFTP drop target.
+     *
+     * @param extra_providers  Source of further session reservations so that
+     *                         items can be copied in parallel.  If empty, the
+     *                         copy shares `provider`.
      */
     CDropTarget(
         boost::shared_ptr<swish::provider::sftp_provider> provider,
         const washer::shell::pidl::apidl_t& remote_directory,
-        boost::shared_ptr<DropActionCallback> callback);
+        boost::shared_ptr<DropActionCallback> callback,
+        ParallelPlan::provider_factory extra_providers=
+            ParallelPlan::provider_factory());
 
     /** @name IDropTarget methods */
     // @{
@@ -100,13 +108,22 @@ private:
     washer::shell::pidl::apidl_t m_remote_directory;
     comet::com_ptr<IDataObject> m_data_object;
     boost::shared_ptr<DropActionCallback> m_callback;
+    ParallelPlan::provider_factory m_extra_providers;
 };
 
 void copy_data_to_provider(
     comet::com_ptr<IDataObject> data_object,
     boost::shared_ptr<swish::provider::sftp_provider> provider,
     const washer::shell::pidl::apidl_t& remote_directory,
-    boost::shared_ptr<DropActionCallback> callback);
+    boost::shared_ptr<DropActionCallback> callback,
+    ParallelPlan::provider_factory extra_providers=
+        ParallelPlan::provider_factory(),
+    duplicate_policy::value duplicates=duplicate_policy::upload,
+    bool archive_folders=false);
+
+duplicate_policy::value duplicate_policy_from_registry();
+
+bool archive_uploads_from_registry();
 
 }} // namespace swish::drop_target
 
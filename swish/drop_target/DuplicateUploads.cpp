@@ -0,0 +1,180 @@
+/**
+    @file
+
+    Files in a drop with the same contents.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#include "DuplicateUploads.hpp"
+
+#include "swish/drop_target/Operation.hpp" // OperationCallback
+#include "swish/drop_target/stream_hash.hpp" // md5_of_stream
+
+#include <washer/shell/shell.hpp> // stream_from_pidl
+#include <washer/trace.hpp> // trace
+
+#include <boost/date_time/posix_time/posix_time_duration.hpp> // milliseconds
+
+#include <exception>
+#include <utility> // make_pair
+
+using washer::shell::stream_from_pidl;
+using washer::trace;
+
+using ssh::filesystem::path;
+
+using boost::mutex;
+using boost::optional;
+using boost::posix_time::milliseconds;
+using boost::uintmax_t;
+
+using std::exception;
+using std::make_pair;
+using std::string;
+
+namespace swish {
+namespace drop_target {
+
+namespace {
+
+    /**
+     * How often a copy waiting for its original checks for cancellation.
+     */
+    const milliseconds CANCELLATION_POLL_INTERVAL(100);
+
+    optional<string> hash_of_source(const RootedSource& source)
+    {
+        try
+        {
+            return md5_of_stream(stream_from_pidl(source.pidl()));
+        }
+        catch (const exception& e)
+        {
+            trace("Couldn't hash a file to look for duplicates: %s")
+                % e.what();
+            return optional<string>();
+        }
+    }
+
+}
+
+DuplicateUploads::DuplicateUploads(bool link_duplicates)
+    : m_link_duplicates(link_duplicates), m_bytes_saved(0) {}
+
+bool DuplicateUploads::link_duplicates() const
+{
+    return m_link_duplicates;
+}
+
+void DuplicateUploads::clear()
+{
+    mutex::scoped_lock lock(m_mutex);
+
+    m_unhashed.clear();
+    m_originals.clear();
+    m_finished.clear();
+    m_bytes_saved = 0;
+}
+
+optional<path> DuplicateUploads::find_original(
+    const RootedSource& source, const path& target, uintmax_t size)
+{
+    // Only the producer looks for originals so the hashing needn't hold the
+    // lock
+    std::map<uintmax_t, unhashed_file>::iterator first =
+        m_unhashed.find(size);
+    if (first != m_unhashed.end())
+    {
+        optional<string> hash = hash_of_source(first->second.first);
+        if (hash)
+            m_originals.insert(
+                make_pair(make_pair(size, *hash), first->second.second));
+        m_unhashed.erase(first);
+    }
+    else
+    {
+        original_map::const_iterator same_size =
+            m_originals.lower_bound(make_pair(size, string()));
+        if (same_size == m_originals.end() || same_size->first.first != size)
+        {
+            m_unhashed.insert(make_pair(size, make_pair(source, target)));
+            return optional<path>();
+        }
+    }
+
+    optional<string> hash = hash_of_source(source);
+    if (!hash)
+        return optional<path>();
+
+    original_map::const_iterator original =
+        m_originals.find(make_pair(size, *hash));
+    if (original != m_originals.end())
+        return original->second;
+
+    m_originals.insert(make_pair(make_pair(size, *hash), target));
+    return optional<path>();
+}
+
+void DuplicateUploads::upload_finished(const path& target, bool usable)
+{
+    mutex::scoped_lock lock(m_mutex);
+
+    m_finished[target] = usable;
+    m_upload_finished.notify_all();
+}
+
+bool DuplicateUploads::wait_for_original(
+    const path& original, const OperationCallback& callback)
+{
+    mutex::scoped_lock lock(m_mutex);
+
+    // The original was planned earlier so it has already started; waiting
+    // for it can't hold it up
+    while (true)
+    {
+        std::map<path, bool>::const_iterator finished =
+            m_finished.find(original);
+        if (finished != m_finished.end())
+            return finished->second;
+
+        lock.unlock();
+        callback.check_if_user_cancelled();
+        lock.lock();
+
+        if (m_finished.count(original) == 0)
+            m_upload_finished.timed_wait(lock, CANCELLATION_POLL_INTERVAL);
+    }
+}
+
+void DuplicateUploads::upload_avoided(uintmax_t size)
+{
+    mutex::scoped_lock lock(m_mutex);
+    m_bytes_saved += size;
+}
+
+uintmax_t DuplicateUploads::bytes_saved() const
+{
+    mutex::scoped_lock lock(m_mutex);
+    return m_bytes_saved;
+}
+
+}}
@@ -0,0 +1,167 @@
+/**
+    @file
+
+    Files in a drop with the same contents.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#ifndef SWISH_DROP_TARGET_DUPLICATEUPLOADS_HPP
+#define SWISH_DROP_TARGET_DUPLICATEUPLOADS_HPP
+#pragma once
+
+#include "swish/drop_target/RootedSource.hpp"
+
+#include <ssh/filesystem/path.hpp>
+
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/noncopyable.hpp>
+#include <boost/optional/optional.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <string>
+#include <utility> // pair
+
+namespace swish {
+namespace drop_target {
+
+class OperationCallback;
+
+/**
+ * What a drop does with a file that has the same contents as one it has
+ * already uploaded.
+ */
+namespace duplicate_policy
+{
+enum value
+{
+    upload, ///< Upload it like any other file.
+    copy,   ///< Have the server copy the uploaded file.
+
+    /**
+     * Hard link it to the uploaded file, or copy it if the server can't.
+     * The files then share any later changes.
+     */
+    link
+};
+}
+
+/**
+ * Keeps track of the files in a drop that have the same contents, so that
+ * each content is uploaded once and the other copies are made on the server.
+ *
+ * The plan's producer asks about each file as it finds it.  The first file
+ * with some content is the original and is uploaded as usual.  Operations
+ * for later files with the same content wait for the original to arrive
+ * and then link to it.
+ *
+ * A file is only hashed once another file of the same size turns up, so a
+ * drop without duplicates costs nothing but the bookkeeping.
+ *
+ * Safe to use from several workers at once.
+ */
+class DuplicateUploads : private boost::noncopyable
+{
+public:
+
+    /**
+     * @param link_duplicates  Whether duplicates may be hard links to their
+     *                         original rather than copies.
+     */
+    explicit DuplicateUploads(bool link_duplicates);
+
+    bool link_duplicates() const;
+
+    /**
+     * Forget everything, ready for the plan to execute again.
+     */
+    void clear();
+
+    /**
+     * The file planned earlier with the same contents as `source`, if any.
+     *
+     * Called by the producer for each file, in the order they are planned.
+     * A file that can't be read to hash it is treated as unique.
+     *
+     * @param target  Where the file is going on the server.
+     */
+    boost::optional<ssh::filesystem::path> find_original(
+        const RootedSource& source, const ssh::filesystem::path& target,
+        boost::uintmax_t size);
+
+    /**
+     * Record what happened to a file that may be an original.
+     *
+     * @param usable  Whether the file on the server now holds what was
+     *                uploaded, so copies can be made from it.
+     */
+    void upload_finished(const ssh::filesystem::path& target, bool usable);
+
+    /**
+     * Wait for the upload of an original to finish.
+     *
+     * @returns whether copies can be made from it.
+     * @throws if the user cancels while we wait.
+     */
+    bool wait_for_original(
+        const ssh::filesystem::path& original,
+        const OperationCallback& callback);
+
+    /**
+     * Record that a file was copied on the server rather than uploaded.
+     */
+    void upload_avoided(boost::uintmax_t size);
+
+    /**
+     * Bytes not uploaded because a copy was already on the server.
+     */
+    boost::uintmax_t bytes_saved() const;
+
+private:
+
+    /**
+     * A file whose size no other file has had so far, so it hasn't been
+     * hashed.
+     */
+    typedef std::pair<RootedSource, ssh::filesystem::path> unhashed_file;
+
+    /**
+     * Originals by size and hash.
+     */
+    typedef std::map<
+        std::pair<boost::uintmax_t, std::string>, ssh::filesystem::path>
+        original_map;
+
+    std::map<boost::uintmax_t, unhashed_file> m_unhashed;
+    original_map m_originals;
+
+    const bool m_link_duplicates;
+    std::map<ssh::filesystem::path, bool> m_finished;
+    boost::uintmax_t m_bytes_saved;
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_upload_finished;
+};
+
+}}
+
+#endif
@@ -44,6 +44,7 @@
 namespace swish {
 namespace drop_target {
 
+class DestinationSnapshot;
 class DropActionCallback;
 
 /**
@@ -72,6 +73,14 @@ public:
     virtual void update_progress(
         boost::uintmax_t so_far, boost::uintmax_t out_of) = 0;
 
+    /**
+     * What the plan knows about the files already at the destination.
+     *
+     * Shared by every operation in the plan.  Operations should consult it
+     * rather than probe the server and should record what they create.
+     */
+    virtual DestinationSnapshot& destination_snapshot() const = 0;
+
     virtual ~OperationCallback() {}
 };
 
@@ -86,6 +95,15 @@ public:
 
     virtual std::wstring description() const = 0;
 
+    /**
+     * Bytes the operation expects to copy, as far as was known when it was
+     * planned.
+     *
+     * Plans weight progress by this so the bar and time remaining follow
+     * the data moved rather than the number of operations done.
+     */
+    virtual boost::uintmax_t expected_size() const = 0;
+
     virtual void operator()(
         OperationCallback& callback,
         boost::shared_ptr<swish::provider::sftp_provider> provider)
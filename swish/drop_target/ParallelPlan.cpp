@@ -0,0 +1,723 @@
+/**
+    @file
+
+    Drop operation plan executed by a pool of workers.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#include "ParallelPlan.hpp"
+
+#include "swish/drop_target/CreateDirectoryOperation.hpp"
+#include "swish/drop_target/DestinationSnapshot.hpp"
+#include "swish/drop_target/DropActionCallback.hpp"
+#include "swish/drop_target/Operation.hpp"
+#include "swish/drop_target/Progress.hpp"
+#include "swish/provider/sftp_provider.hpp" // sftp_provider, ISftpConsumer
+
+#include <boost/bind.hpp> // bind
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/date_time/posix_time/posix_time_duration.hpp> // milliseconds
+#include <boost/exception_ptr.hpp> // current_exception, rethrow_exception
+#include <boost/noncopyable.hpp>
+#include <boost/optional/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp> // thread_group
+#include <boost/throw_exception.hpp>  // BOOST_THROW_EXCEPTION
+
+#include <comet/error.h> // com_error
+#include <comet/util.h> // auto_coinit
+
+#include <ssh/filesystem/path.hpp>
+
+#include <algorithm> // max, min
+#include <cassert> // assert
+#include <deque>
+#include <map>
+#include <memory> // auto_ptr
+#include <vector>
+
+#include <Windows.h> // PeekMessage, DispatchMessage
+
+using swish::provider::sftp_provider;
+
+using comet::auto_coinit;
+using comet::com_error;
+
+using ssh::filesystem::path;
+
+using boost::bind;
+using boost::exception_ptr;
+using boost::mutex;
+using boost::noncopyable;
+using boost::optional;
+using boost::posix_time::milliseconds;
+using boost::ref;
+using boost::shared_ptr;
+using boost::thread_group;
+using boost::uintmax_t;
+
+using std::auto_ptr;
+using std::deque;
+using std::map;
+using std::max;
+using std::min;
+using std::size_t;
+using std::vector;
+
+namespace swish {
+namespace drop_target {
+
+namespace {
+
+    /**
+     * Dispatch any messages waiting for this thread.
+     *
+     * Workers can call into this thread's apartment, for instance to ask
+     * the user for a password when they reserve a session, and those calls
+     * arrive as messages.
+     */
+    void pump_messages()
+    {
+        MSG msg;
+        while (::PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+        {
+            if (msg.message == WM_QUIT)
+            {
+                ::PostQuitMessage(static_cast<int>(msg.wParam));
+                return;
+            }
+
+            ::TranslateMessage(&msg);
+            ::DispatchMessage(&msg);
+        }
+    }
+
+    /**
+     * How long the user waits, at most, for the progress display to change
+     * or for a cancellation to be noticed.
+     */
+    const milliseconds USER_INTERFACE_POLL_INTERVAL(100);
+
+    /**
+     * An operation waiting for a worker.
+     */
+    struct queued_operation
+    {
+        shared_ptr<const Operation> operation;
+        size_t serial;
+
+        /**
+         * How many directory-creating operations must have finished before
+         * this one may start.
+         */
+        size_t prerequisites;
+
+        /**
+         * This operation's place amongst the directory-creating operations,
+         * if it is one.
+         */
+        optional<size_t> directory;
+    };
+
+    struct operation_progress
+    {
+        operation_progress() : so_far(0), out_of(0) {}
+
+        uintmax_t so_far;
+        uintmax_t out_of;
+    };
+
+    struct progress_snapshot
+    {
+        uintmax_t so_far;
+        uintmax_t out_of;
+        shared_ptr<const Operation> latest_operation;
+    };
+
+    /**
+     * State shared between the producer, the workers and the thread talking
+     * to the user.
+     *
+     * Operations are queued in order.  Workers take them from the front,
+     * subject to the directory prerequisites, and post their progress and
+     * overwrite questions here.  The user-facing thread reads the progress,
+     * answers the questions and raises the cancellation flag.
+     *
+     * Only the operations waiting or running are kept; finished ones
+     * survive only in the running totals.
+     */
+    class execution_state : private noncopyable
+    {
+    public:
+
+        explicit execution_state(size_t worker_count)
+            :
+            m_added_operations(0),
+            m_production_finished(false), m_directories_finished(0),
+            m_so_far(0), m_known_total(0), m_unstarted_total(0),
+            m_running_workers(worker_count), m_cancelled(false) {}
+
+        /**
+         * Queue an operation, waiting for room if `bounded`.
+         */
+        void add_operation(const Operation& operation, bool bounded)
+        {
+            shared_ptr<const Operation> copy(operation.clone());
+
+            mutex::scoped_lock lock(m_mutex);
+
+            while (bounded && !m_cancelled &&
+                m_queue.size() >= ParallelPlan::MAX_WAITING_STAGES)
+            {
+                m_state_changed.wait(lock);
+            }
+            throw_if_cancelled();
+
+            queued_operation entry;
+            entry.operation = copy;
+            entry.serial = m_added_operations++;
+            entry.prerequisites = m_directory_finished.size();
+            if (dynamic_cast<const CreateDirectoryOperation*>(&operation))
+            {
+                entry.directory = m_directory_finished.size();
+                m_directory_finished.push_back(false);
+            }
+
+            m_queue.push_back(entry);
+            m_unstarted_total += copy->expected_size();
+            m_state_changed.notify_all();
+        }
+
+        void production_finished()
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            m_production_finished = true;
+            m_state_changed.notify_all();
+        }
+
+        /**
+         * Claim the next operation, waiting for it to be produced and for
+         * the directories it depends on.
+         *
+         * Returns nothing once there is no more work or the plan has been
+         * cancelled.
+         */
+        optional<queued_operation> next_operation()
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            while (true)
+            {
+                if (m_cancelled ||
+                    (m_queue.empty() && m_production_finished))
+                {
+                    return optional<queued_operation>();
+                }
+
+                if (!m_queue.empty() &&
+                    m_directories_finished >= m_queue.front().prerequisites)
+                {
+                    queued_operation next = m_queue.front();
+                    m_queue.pop_front();
+
+                    // Count the operation at its planned size until it
+                    // reports its own progress
+                    uintmax_t expected = next.operation->expected_size();
+                    m_unstarted_total -= expected;
+                    set_progress(m_running[next.serial], 0, expected);
+
+                    m_latest_operation = next.operation;
+                    m_state_changed.notify_all();
+                    return next;
+                }
+
+                m_state_changed.wait(lock);
+            }
+        }
+
+        void update_progress(size_t serial, uintmax_t so_far, uintmax_t out_of)
+        {
+            mutex::scoped_lock lock(m_mutex);
+            set_progress(m_running[serial], so_far, out_of);
+        }
+
+        void operation_finished(const queued_operation& operation)
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            // Fix the progress to the operation boundary as we don't
+            // completely trust the intra-operation progress.  A stream could
+            // have lied about its size.
+            operation_progress& progress = m_running[operation.serial];
+            set_progress(progress, progress.out_of, progress.out_of);
+            m_running.erase(operation.serial);
+
+            if (operation.directory)
+            {
+                m_directory_finished[*operation.directory] = true;
+
+                while (m_directories_finished < m_directory_finished.size() &&
+                    m_directory_finished[m_directories_finished])
+                {
+                    ++m_directories_finished;
+                }
+            }
+
+            m_state_changed.notify_all();
+        }
+
+        /**
+         * Record the exception being handled and stop the other workers.
+         *
+         * Only the first failure is kept; the rest are usually consequences
+         * of it.
+         */
+        void fail()
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            if (!m_error)
+                m_error = boost::current_exception();
+
+            m_cancelled = true;
+            m_state_changed.notify_all();
+        }
+
+        void worker_exited()
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            assert(m_running_workers > 0);
+            --m_running_workers;
+            m_state_changed.notify_all();
+        }
+
+        void check_if_cancelled() const
+        {
+            mutex::scoped_lock lock(m_mutex);
+            throw_if_cancelled();
+        }
+
+        /**
+         * Ask the user-facing thread whether `target` may be overwritten
+         * and wait for the answer.
+         *
+         * Only one question is outstanding at a time so the user isn't
+         * buried under simultaneous prompts.
+         */
+        bool request_overwrite_permission(const path& target)
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            while (m_question && !m_cancelled)
+                m_state_changed.wait(lock);
+            throw_if_cancelled();
+
+            m_question = target;
+            m_state_changed.notify_all();
+
+            while (!m_answer && !m_cancelled)
+                m_state_changed.wait(lock);
+
+            bool answer = m_answer.get_value_or(false);
+            m_question = optional<path>();
+            m_answer = optional<bool>();
+            m_state_changed.notify_all();
+
+            throw_if_cancelled();
+            return answer;
+        }
+
+        /**
+         * Wait until the workers have all exited or something happens that
+         * the user should see.
+         *
+         * @returns  whether the workers have all exited.
+         */
+        bool wait_for_workers()
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            if (m_running_workers > 0 && !unanswered_question())
+            {
+                m_state_changed.timed_wait(
+                    lock, USER_INTERFACE_POLL_INTERVAL);
+            }
+
+            return m_running_workers == 0;
+        }
+
+        void cancel()
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            m_cancelled = true;
+            m_state_changed.notify_all();
+        }
+
+        optional<path> pending_question() const
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            if (unanswered_question())
+                return m_question;
+            else
+                return optional<path>();
+        }
+
+        void answer_question(bool answer)
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            // The worker may have given up waiting because the plan was
+            // cancelled while the user was deciding
+            if (unanswered_question())
+            {
+                m_answer = answer;
+                m_state_changed.notify_all();
+            }
+        }
+
+        /**
+         * Byte-accurate progress across all the workers.
+         *
+         * The operations that haven't started yet count at the size they
+         * were planned with, so the total is right from the start rather
+         * than guessed from the operations seen so far.  While the producer
+         * is still going, the total grows as it queues more operations.
+         */
+        progress_snapshot progress() const
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            progress_snapshot snapshot;
+            snapshot.so_far = m_so_far;
+            snapshot.out_of = m_known_total + m_unstarted_total;
+            snapshot.latest_operation = m_latest_operation;
+
+            return snapshot;
+        }
+
+        void rethrow_error() const
+        {
+            mutex::scoped_lock lock(m_mutex);
+
+            if (m_error)
+                boost::rethrow_exception(m_error);
+        }
+
+        /**
+         * Snapshot shared by every worker.  It does its own locking.
+         */
+        DestinationSnapshot& destination_snapshot()
+        {
+            return m_destination;
+        }
+
+    private:
+
+        void set_progress(
+            operation_progress& progress, uintmax_t so_far, uintmax_t out_of)
+        {
+            m_so_far = m_so_far - progress.so_far + so_far;
+            m_known_total = m_known_total - progress.out_of + out_of;
+            progress.so_far = so_far;
+            progress.out_of = out_of;
+        }
+
+        bool unanswered_question() const
+        {
+            return m_question && !m_answer;
+        }
+
+        void throw_if_cancelled() const
+        {
+            if (m_cancelled)
+                BOOST_THROW_EXCEPTION(com_error(E_ABORT));
+        }
+
+        mutable mutex m_mutex;
+        boost::condition_variable m_state_changed;
+
+        deque<queued_operation> m_queue;
+        size_t m_added_operations;
+        bool m_production_finished;
+
+        /**
+         * Whether each directory-creating operation has finished, in the
+         * order they were added.
+         */
+        vector<bool> m_directory_finished;
+
+        /**
+         * Length of the run of finished directories at the start of
+         * `m_directory_finished`.
+         */
+        size_t m_directories_finished;
+
+        map<size_t, operation_progress> m_running;
+        shared_ptr<const Operation> m_latest_operation;
+        uintmax_t m_so_far;
+        uintmax_t m_known_total;
+
+        /**
+         * Planned size of the operations queued but not yet started.
+         */
+        uintmax_t m_unstarted_total;
+
+        size_t m_running_workers;
+        bool m_cancelled;
+        exception_ptr m_error;
+
+        optional<path> m_question;
+        optional<bool> m_answer;
+
+        DestinationSnapshot m_destination;
+    };
+
+    /**
+     * Callback given to an operation running on a worker.
+     *
+     * Passes everything to the user-facing thread via the shared state.
+     */
+    class WorkerCallback : public OperationCallback
+    {
+    public:
+
+        WorkerCallback(execution_state& state, size_t operation_serial)
+            : m_state(state), m_operation_serial(operation_serial) {}
+
+        virtual void check_if_user_cancelled() const
+        {
+            m_state.check_if_cancelled();
+        }
+
+        virtual bool request_overwrite_permission(const path& target) const
+        {
+            return m_state.request_overwrite_permission(target);
+        }
+
+        virtual void update_progress(uintmax_t so_far, uintmax_t out_of)
+        {
+            m_state.update_progress(m_operation_serial, so_far, out_of);
+        }
+
+        virtual DestinationSnapshot& destination_snapshot() const
+        {
+            return m_state.destination_snapshot();
+        }
+
+    private:
+        execution_state& m_state;
+        size_t m_operation_serial;
+    };
+
+    /**
+     * Run operations until there are none left.
+     *
+     * A worker given no provider reserves its own from the factory, but only
+     * once it has some work; there is no point holding up disconnection for
+     * a worker that never gets to run.
+     */
+    void run_worker(
+        execution_state& state, shared_ptr<sftp_provider> provider,
+        ParallelPlan::provider_factory factory)
+    {
+        try
+        {
+            // Operations use the shell to read their sources
+            auto_coinit com;
+
+            while (optional<queued_operation> next = state.next_operation())
+            {
+                if (!provider)
+                    provider = factory();
+
+                WorkerCallback callback(state, next->serial);
+                (*next->operation)(callback, provider);
+                state.operation_finished(*next);
+            }
+        }
+        catch (...)
+        {
+            state.fail();
+        }
+
+        state.worker_exited();
+    }
+
+    void add_bounded_operation(
+        execution_state& state, const Operation& operation)
+    {
+        state.add_operation(operation, true);
+    }
+
+    void run_producer(
+        execution_state& state, ParallelPlan::stage_producer producer)
+    {
+        try
+        {
+            // Producers typically enumerate the shell
+            auto_coinit com;
+
+            producer(bind(&add_bounded_operation, ref(state), _1));
+        }
+        catch (...)
+        {
+            state.fail();
+        }
+
+        state.production_finished();
+    }
+
+    /**
+     * Make sure no thread outlives the plan execution, however it ends.
+     */
+    class worker_pool : private noncopyable
+    {
+    public:
+
+        explicit worker_pool(execution_state& state) : m_state(state) {}
+
+        ~worker_pool()
+        {
+            m_state.cancel();
+            m_threads.join_all();
+        }
+
+        void start_worker(
+            shared_ptr<sftp_provider> provider,
+            ParallelPlan::provider_factory factory)
+        {
+            m_threads.create_thread(
+                bind(&run_worker, ref(m_state), provider, factory));
+        }
+
+        void start_producer(ParallelPlan::stage_producer producer)
+        {
+            m_threads.create_thread(
+                bind(&run_producer, ref(m_state), producer));
+        }
+
+    private:
+        execution_state& m_state;
+        thread_group m_threads;
+    };
+
+    void show_progress(
+        Progress& progress, const progress_snapshot& snapshot,
+        shared_ptr<const Operation>& shown_operation)
+    {
+        if (snapshot.latest_operation &&
+            snapshot.latest_operation != shown_operation)
+        {
+            progress.line_path(1, snapshot.latest_operation->title());
+            progress.line_path(2, snapshot.latest_operation->description());
+            shown_operation = snapshot.latest_operation;
+        }
+
+        if (snapshot.out_of > 0)
+            progress.update(snapshot.so_far, snapshot.out_of);
+    }
+}
+
+ParallelPlan::ParallelPlan(
+    unsigned int worker_count, provider_factory factory,
+    stage_producer producer)
+    : m_worker_count(max(worker_count, 1U)),
+      m_provider_factory(factory), m_producer(producer) {}
+
+void ParallelPlan::execute_plan(
+    DropActionCallback& callback, shared_ptr<sftp_provider> provider) const
+{
+    if (m_copy_list.empty() && !m_producer)
+        return;
+
+    // Without a producer, we know how much work there is and needn't start
+    // workers that will have nothing to do
+    size_t worker_count = (m_producer) ?
+        m_worker_count : min<size_t>(m_worker_count, m_copy_list.size());
+
+    execution_state state(worker_count);
+
+    // These are already in memory so there's no point holding them back
+    for (size_t i = 0; i < m_copy_list.size(); ++i)
+        state.add_operation(m_copy_list[i], false);
+
+    auto_ptr<Progress> progress = callback.progress();
+    shared_ptr<const Operation> shown_operation;
+    bool user_cancelled = false;
+
+    {
+        worker_pool workers(state);
+
+        if (m_producer)
+            workers.start_producer(m_producer);
+        else
+            state.production_finished();
+
+        for (size_t i = 0; i < worker_count; ++i)
+        {
+            // The first worker uses the reservation we were given
+            if (i == 0 || !m_provider_factory)
+                workers.start_worker(provider, m_provider_factory);
+            else
+                workers.start_worker(
+                    shared_ptr<sftp_provider>(), m_provider_factory);
+        }
+
+        while (!state.wait_for_workers())
+        {
+            pump_messages();
+
+            if (!user_cancelled && progress->user_cancelled())
+            {
+                user_cancelled = true;
+                state.cancel();
+            }
+
+            if (optional<path> target = state.pending_question())
+            {
+                state.answer_question(callback.can_overwrite(*target));
+            }
+
+            show_progress(*progress, state.progress(), shown_operation);
+        }
+    }
+
+    state.rethrow_error();
+
+    if (user_cancelled)
+        BOOST_THROW_EXCEPTION(com_error(E_ABORT));
+
+    show_progress(*progress, state.progress(), shown_operation);
+}
+
+void ParallelPlan::add_stage(const Operation& entry)
+{
+    m_copy_list.push_back(entry.clone());
+}
+
+}}
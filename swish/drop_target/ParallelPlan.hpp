@@ -0,0 +1,141 @@
+/**
+    @file
+
+    Drop operation plan executed by a pool of workers.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#ifndef SWISH_DROP_TARGET_PARALLELPLAN_HPP
+#define SWISH_DROP_TARGET_PARALLELPLAN_HPP
+#pragma once
+
+#include "swish/drop_target/Plan.hpp"
+#include "swish/provider/sftp_provider.hpp"
+
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef> // size_t
+
+namespace swish {
+namespace drop_target {
+
+class Operation;
+
+/**
+ * Plan implementation that runs its operations on several workers at once.
+ *
+ * Operations are started in the order they are added but as many as
+ * `worker_count` may be running at any moment.  The one ordering that is
+ * preserved is that of directories: an operation doesn't start until every
+ * `CreateDirectoryOperation` added before it has finished, so no file is
+ * copied into a directory that doesn't exist yet.
+ *
+ * Stages can be added up front, with `add_stage`, or be generated by a
+ * producer that runs alongside the workers.  A producer lets the first
+ * operations start while the rest of the plan is still being worked out.
+ * It is held back when too many operations are waiting so that enumerating
+ * a huge selection doesn't fill memory.
+ *
+ * All interaction with the user (progress, cancellation and overwrite
+ * confirmation) happens on the thread that calls `execute_plan`; the workers
+ * only ever talk to it.  Progress is the sum of the bytes reported by every
+ * worker.
+ */
+class ParallelPlan /* final */ : public Plan
+{
+public:
+
+    /**
+     * Source of the providers, each holding its own session reservation,
+     * used by the workers after the first.
+     *
+     * Called on the worker's thread.  Anything it calls in the apartment of
+     * the thread running `execute_plan` gets through, as that thread
+     * dispatches messages while it waits for the workers.
+     */
+    typedef boost::function<
+        boost::shared_ptr<swish::provider::sftp_provider>()>
+        provider_factory;
+
+    /**
+     * Receives stages from a producer.
+     *
+     * Blocks while the plan has enough work waiting and throws if the plan
+     * has been cancelled or has failed.
+     */
+    typedef boost::function<void(const Operation&)> stage_sink;
+
+    /**
+     * Generates stages, passing each to the sink in the order they must
+     * start.
+     *
+     * Runs on its own thread, once per execution of the plan, after any
+     * stages added with `add_stage`.
+     */
+    typedef boost::function<void(stage_sink)> stage_producer;
+
+    static const unsigned int DEFAULT_WORKER_COUNT = 4;
+
+    /**
+     * Most operations the producer can get ahead of the workers by.
+     */
+    static const std::size_t MAX_WAITING_STAGES = 256;
+
+    /**
+     * Create a plan.
+     *
+     * @param worker_count  Maximum number of operations to run at once.
+     * @param factory       Creates providers for the extra workers.  If empty,
+     *                      all workers share the provider passed to
+     *                      `execute_plan`.
+     * @param producer      Generates the stages as the plan executes.  If
+     *                      empty, the plan is only the stages added with
+     *                      `add_stage`.
+     */
+    explicit ParallelPlan(
+        unsigned int worker_count=DEFAULT_WORKER_COUNT,
+        provider_factory factory=provider_factory(),
+        stage_producer producer=stage_producer());
+
+public: // Plan
+
+    virtual void execute_plan(
+        DropActionCallback& callback,
+        boost::shared_ptr<swish::provider::sftp_provider> provider) const;
+
+public:
+
+    void add_stage(const Operation& entry);
+
+private:
+
+    boost::ptr_vector<Operation> m_copy_list;
+    unsigned int m_worker_count;
+    provider_factory m_provider_factory;
+    stage_producer m_producer;
+};
+
+}}
+
+#endif
@@ -26,15 +26,27 @@
 
 #include "PidlCopyPlan.hpp"
 
+#include "swish/drop_target/BatchCopyOperation.hpp"
 #include "swish/drop_target/CopyFileOperation.hpp"
 #include "swish/drop_target/CreateDirectoryOperation.hpp"
+#include "swish/drop_target/DeduplicatedCopyOperation.hpp"
+#include "swish/drop_target/DestinationSnapshot.hpp"
+#include "swish/drop_target/DuplicateUploads.hpp"
 #include "swish/drop_target/RootedSource.hpp"
 #include "swish/provider/sftp_provider.hpp" // sftp_provider, ISftpConsumer
+#include "swish/remote_folder/swish_pidl.hpp" // absolute_path_from_swish_pidl
+#include "swish/trace.hpp" // trace
 
 #include <ssh/filesystem.hpp> // path
 
 #include <boost/bind.hpp> // bind
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/foreach.hpp> // BOOST_FOREACH
 #include <boost/function_output_iterator.hpp>
+#include <boost/locale/message.hpp> // translate
+#include <boost/make_shared.hpp> // make_shared
+#include <boost/noncopyable.hpp>
+#include <boost/optional/optional.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/throw_exception.hpp>  // BOOST_THROW_EXCEPTION
 
@@ -43,10 +55,15 @@
 
 #include <comet/error.h> // com_error
 
+#include <exception>
+#include <memory> // auto_ptr
 #include <string>
+#include <vector>
 
 using swish::provider::sftp_provider;
+using swish::remote_folder::absolute_path_from_swish_pidl;
 using swish::shell_folder::data_object::PidlFormat;
+using swish::tracing::trace;
 
 using washer::shell::bind_to_handler_object;
 using washer::shell::pidl::apidl_t;
@@ -61,15 +78,151 @@ using comet::com_error;
 using comet::com_ptr;
 
 using boost::bind;
+using boost::locale::translate;
 using boost::make_function_output_iterator;
+using boost::make_shared;
+using boost::optional;
 using boost::shared_ptr;
-using boost::ref;
+using boost::uintmax_t;
 
+using std::auto_ptr;
+using std::exception;
+using std::vector;
 using std::wstring;
 
 namespace swish {
 namespace drop_target {
 
+/**
+ * Keeps count of how much the plan adds to the server, so that a drop too
+ * big for the space left stops as soon as that is known rather than when
+ * the disk fills up.
+ *
+ * Only new files are counted.  A file that replaces one already there is
+ * assumed to need no more room than the old one.  Finding out whether a
+ * file is already there needs a provider of the budget's own, as the
+ * workers are using theirs at the same time.  Without a factory to reserve
+ * one, every file is counted as new.
+ *
+ * The plan starts the count before its producer runs and the producer is
+ * the only one to add to it, so no locking is needed.
+ */
+class SpaceBudget : private boost::noncopyable
+{
+public:
+
+    SpaceBudget() : m_needed(0) {}
+
+    /**
+     * Start counting for an execution of the plan.
+     *
+     * Asks for the space left using `provider`, so must be called before
+     * the workers start using it.  If the server can't say how much space
+     * it has, nothing is checked.
+     */
+    void start(
+        shared_ptr<sftp_provider> provider, const apidl_t& destination_root,
+        ParallelPlan::provider_factory provider_factory)
+    {
+        m_provider.reset();
+        m_provider_factory = provider_factory;
+        m_available = optional<uintmax_t>();
+        m_needed = 0;
+        m_snapshot.reset(new DestinationSnapshot);
+
+        try
+        {
+            m_available = provider->available_space(
+                absolute_path_from_swish_pidl(destination_root));
+        }
+        catch (const exception& e)
+        {
+            trace("Server can't say how much space is left (%s)") % e.what();
+        }
+    }
+
+    /**
+     * Count a file the plan will copy.
+     *
+     * @throws if the new files planned so far won't fit on the server.
+     *         The workers may already have copied some of them.
+     */
+    void plan_file(const SftpDestination& target, uintmax_t size)
+    {
+        if (!m_available)
+            return;
+
+        if (exists(target))
+            return;
+
+        m_needed += size;
+        if (m_needed > *m_available)
+        {
+            BOOST_THROW_EXCEPTION(
+                com_error(
+                    wstring(translate(
+                        L"Copying stopped because these items won't fit in "
+                        L"the space left on the server.  Some of them may "
+                        L"have been copied already.")),
+                    STG_E_MEDIUMFULL));
+        }
+    }
+
+    /**
+     * Note a directory the plan will copy into.
+     *
+     * A directory that isn't there yet will start empty, so nothing in it
+     * needs to be looked for.
+     */
+    void plan_directory(const SftpDestination& target)
+    {
+        if (!m_available)
+            return;
+
+        if (!exists(target))
+        {
+            m_snapshot->directory_created(
+                target.resolve_destination().as_absolute_path());
+        }
+    }
+
+    /**
+     * Stop counting so we don't keep the connection once the plan is done.
+     */
+    void finish()
+    {
+        m_provider.reset();
+        m_provider_factory = ParallelPlan::provider_factory();
+        m_snapshot.reset();
+    }
+
+private:
+
+    /**
+     * Whether the target is on the server already.
+     *
+     * Reserves the budget's provider the first time it is needed, on the
+     * producer's thread.
+     */
+    bool exists(const SftpDestination& target)
+    {
+        if (!m_provider_factory)
+            return false;
+
+        if (!m_provider)
+            m_provider = m_provider_factory();
+
+        return m_snapshot->exists(
+            *m_provider, target.resolve_destination().as_absolute_path());
+    }
+
+    shared_ptr<sftp_provider> m_provider;
+    ParallelPlan::provider_factory m_provider_factory;
+    optional<uintmax_t> m_available;
+    uintmax_t m_needed;
+    auto_ptr<DestinationSnapshot> m_snapshot;
+};
+
 namespace {
 
     /**
@@ -81,29 +234,131 @@ namespace {
             pidl_shell_item::friendly_name_type::relative);
     }
 
+    /**
+     * Return size of the streamed object in bytes.
+     */
+    uintmax_t size_of_stream(const com_ptr<IStream>& stream)
+    {
+        STATSTG statstg;
+        HRESULT hr = stream->Stat(&statstg, STATFLAG_NONAME);
+        if (FAILED(hr))
+            BOOST_THROW_EXCEPTION(com_error_from_interface(stream, hr));
+
+        return statstg.cbSize.QuadPart;
+    }
+
+    /**
+     * Gathers small files into batches that are copied together.
+     *
+     * A batch is passed on when it is full or when `flush` is called.
+     * Directories go straight to the plan so a batch never comes before the
+     * directories its files go in.
+     */
+    class small_file_batcher
+    {
+    public:
+        explicit small_file_batcher(ParallelPlan::stage_sink sink)
+            : m_sink(sink) {}
+
+        void add(
+            const RootedSource& source, const SftpDestination& destination,
+            uintmax_t size)
+        {
+            if (!m_batch.has_room_for(size))
+                flush();
+            m_batch.add_file(source, destination, size);
+        }
+
+        void flush()
+        {
+            if (m_batch.file_count() > 0)
+            {
+                m_sink(m_batch);
+                m_batch = BatchCopyOperation();
+            }
+        }
+
+    private:
+        ParallelPlan::stage_sink m_sink;
+        BatchCopyOperation m_batch;
+    };
+
+    /**
+     * What the expansion of the drop keeps track of as it goes.
+     */
+    struct expansion
+    {
+        expansion(
+            small_file_batcher& batcher, SpaceBudget& space,
+            copy_statistics& statistics,
+            shared_ptr<DuplicateUploads> duplicates)
+            :
+            batcher(batcher), space(space), statistics(statistics),
+            duplicates(duplicates) {}
+
+        small_file_batcher& batcher;
+        SpaceBudget& space;
+        copy_statistics& statistics;
+
+        /**
+         * Null unless the plan is looking for duplicates.
+         */
+        shared_ptr<DuplicateUploads> duplicates;
+    };
+
     template<typename OutIt>
     void output_operations_for_stream_pidl(
         const RootedSource& source, const SftpDestination& destination,
-        OutIt output_iterator)
+        uintmax_t size, OutIt output_iterator, expansion& state)
     {
         path new_name = target_name_from_source(source);
 
         SftpDestination new_destination = destination / new_name;
 
-        CopyFileOperation operation(source, new_destination);
+        state.statistics.bytes_copied += size;
+
+        if (size <= BatchCopyOperation::SMALL_FILE_THRESHOLD)
+        {
+            state.space.plan_file(new_destination, size);
+            state.batcher.add(source, new_destination, size);
+        }
+        else if (state.duplicates)
+        {
+            path target =
+                new_destination.resolve_destination().as_absolute_path();
+            optional<path> original =
+                state.duplicates->find_original(source, target, size);
+
+            // A duplicate takes no more room unless it falls back to being
+            // uploaded, which is rare enough to ignore
+            if (!original)
+                state.space.plan_file(new_destination, size);
+
+            *output_iterator++ = DeduplicatedCopyOperation(
+                source, new_destination, size, state.duplicates, original);
+        }
+        else
+        {
+            state.space.plan_file(new_destination, size);
+
+            CopyFileOperation operation(source, new_destination, size);
 
-        *output_iterator++ = operation;
+            *output_iterator++ = operation;
+        }
     }
 
     template<typename OutIt>
     void output_operations_for_folder_pidl(
         com_ptr<IShellFolder> folder, const RootedSource& source,
-        const SftpDestination& destination, OutIt output_iterator)
+        const SftpDestination& destination, OutIt output_iterator,
+        expansion& state)
     {
         path new_name = target_name_from_source(source);
 
         SftpDestination new_destination = destination / new_name;
 
+        state.space.plan_directory(new_destination);
+
         *output_iterator++ = CreateDirectoryOperation(source, new_destination);
 
         com_ptr<IEnumIDList> e;
@@ -118,15 +373,16 @@ namespace {
         while (hr == S_OK && e->Next(1, item.out(), NULL) == S_OK)
         {
             output_operations_for_pidl(
-                source / item, new_destination, output_iterator);
+                source / item, new_destination, output_iterator, state);
         }
     }
 
     template<typename OutIt>
     void output_operations_for_pidl(
         const RootedSource& source, const SftpDestination& destination,
-        OutIt output_iterator)
+        OutIt output_iterator, expansion& state)
     {
+        optional<uintmax_t> size;
         try
         {
             /*
@@ -134,54 +390,154 @@ namespace {
             We don't use this stream to perform the operation as that would
             mean large transfers keeping open a large number of file handles
             while building the copy plan - a bad idea, especially if the files
-            are on another remote server
+            are on another remote server.  We do use it to find out if the
+            file is small enough to batch.
             */
-            stream_from_pidl(source.pidl());
-
-            output_operations_for_stream_pidl(
-                source, destination, output_iterator);
+            size = size_of_stream(stream_from_pidl(source.pidl()));
         }
         catch (const com_error&)
         {
             // Treating the item as something with an IStream has failed
             // Now we try to treat it as an IShellFolder and hope we
             // have more success
+        }
 
+        // Planning happens outside the try so that its errors, such as
+        // running out of space, aren't mistaken for the item not being a
+        // stream
+        if (size)
+        {
+            output_operations_for_stream_pidl(
+                source, destination, *size, output_iterator, state);
+        }
+        else
+        {
             com_ptr<IShellFolder> folder =
                 bind_to_handler_object<IShellFolder>(source.pidl());
 
             output_operations_for_folder_pidl(
-                folder, source, destination, output_iterator);
+                folder, source, destination, output_iterator, state);
+        }
+    }
+
+    vector<RootedSource> top_level_sources(const PidlFormat& format)
+    {
+        vector<RootedSource> sources;
+        for (unsigned int i = 0; i < format.pidl_count(); ++i)
+        {
+            sources.push_back(
+                RootedSource(format.parent_folder(), format.relative_file(i)));
+        }
+
+        return sources;
+    }
+
+    /**
+     * Expand the top-level items into operations for everything in their
+     * hierarchy, in an order where directories come before their contents.
+     *
+     * Small files are gathered into batches rather than each having an
+     * operation of its own.  Fails as soon as the files found won't fit on
+     * the server.
+     *
+     * If `duplicates` isn't null, larger files with the same contents as
+     * one found earlier are made on the server instead of being uploaded.
+     */
+    void produce_operations(
+        const vector<RootedSource>& sources, const apidl_t& destination_root,
+        shared_ptr<SpaceBudget> space, shared_ptr<copy_statistics> statistics,
+        shared_ptr<DuplicateUploads> duplicates,
+        ParallelPlan::stage_sink sink)
+    {
+        small_file_batcher batcher(sink);
+        expansion state(batcher, *space, *statistics, duplicates);
+
+        BOOST_FOREACH(const RootedSource& source, sources)
+        {
+            output_operations_for_pidl(
+                source, SftpDestination(destination_root, path()),
+                make_function_output_iterator(sink), state);
         }
+
+        batcher.flush();
+    }
+
+    shared_ptr<DuplicateUploads> duplicate_tracker(
+        duplicate_policy::value policy)
+    {
+        if (policy == duplicate_policy::upload)
+            return shared_ptr<DuplicateUploads>();
+        else
+            return make_shared<DuplicateUploads>(
+                policy == duplicate_policy::link);
     }
 
 }
 
+copy_statistics::copy_statistics() : bytes_copied(0), bytes_saved(0) {}
+
+uintmax_t copy_statistics::bytes_uploaded() const
+{
+    return bytes_copied - bytes_saved;
+}
+
 /**
  * Create plan to copy items represented by clipboard PIDL format.
  *
- * Expands the top-level PIDLs into a list of all items in the hierarchy.
+ * Only the top-level items are read here.  The hierarchy beneath them is
+ * expanded while the plan executes so that copying starts straight away,
+ * however large the selection.
+ *
+ * The items are copied in parallel.  The extra workers reserve their
+ * sessions from `extra_providers`, if given, or share the provider the plan
+ * is executed with.
+ *
+ * Unless `duplicates` says to upload everything, files too big to batch
+ * are hashed locally when another of the same size turns up, and each
+ * content is only uploaded once.  The other files with that content are
+ * made by the server as `duplicates` says, or uploaded if the server can't
+ * make them.
  */
 PidlCopyPlan::PidlCopyPlan(
-    const PidlFormat& source_format, const apidl_t& destination_root)
-{
-    for (unsigned int i = 0; i < source_format.pidl_count(); ++i)
-    {
-        apidl_t pidl = source_format.file(i);
-
-        output_operations_for_pidl(
-            RootedSource(
-                source_format.parent_folder(), source_format.relative_file(i)),
-            SftpDestination(destination_root, path()),
-            make_function_output_iterator(
-                bind(&SequentialPlan::add_stage, ref(m_plan), _1)));
-    }
-}
+    const PidlFormat& source_format, const apidl_t& destination_root,
+    ParallelPlan::provider_factory extra_providers,
+    duplicate_policy::value duplicates)
+    :
+    m_space(make_shared<SpaceBudget>()),
+    m_statistics(make_shared<copy_statistics>()),
+    m_duplicates(duplicate_tracker(duplicates)),
+    m_destination_root(destination_root),
+    m_extra_providers(extra_providers),
+    m_plan(
+        ParallelPlan::DEFAULT_WORKER_COUNT, extra_providers,
+        bind(
+            &produce_operations, top_level_sources(source_format),
+            destination_root, m_space, m_statistics, m_duplicates, _1))
+{}
 
 void PidlCopyPlan::execute_plan(
     DropActionCallback& callback, shared_ptr<sftp_provider> provider) const
 {
-    m_plan.execute_plan(callback, provider);
+    m_space->start(provider, m_destination_root, m_extra_providers);
+    *m_statistics = copy_statistics();
+    if (m_duplicates)
+        m_duplicates->clear();
+
+    try
+    {
+        m_plan.execute_plan(callback, provider);
+    }
+    catch (...)
+    {
+        m_space->finish();
+        throw;
+    }
+
+    m_space->finish();
+
+    copy_statistics totals = statistics();
+    trace("Copied %d bytes, of which %d were duplicates made on the server")
+        % totals.bytes_copied % totals.bytes_saved;
 }
 
 void PidlCopyPlan::add_stage(const Operation& entry)
@@ -189,4 +545,13 @@ void PidlCopyPlan::add_stage(const Operation& entry)
     m_plan.add_stage(entry);
 }
 
+copy_statistics PidlCopyPlan::statistics() const
+{
+    copy_statistics totals = *m_statistics;
+    if (m_duplicates)
+        totals.bytes_saved = m_duplicates->bytes_saved();
+
+    return totals;
+}
+
 }}
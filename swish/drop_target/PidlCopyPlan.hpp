@@ -28,17 +28,39 @@
 #define SWISH_DROP_TARGET_PIDLCOPYPLAN_HPP
 #pragma once
 
+#include "swish/drop_target/DuplicateUploads.hpp" // duplicate_policy
 #include "swish/drop_target/Operation.hpp"
+#include "swish/drop_target/ParallelPlan.hpp"
 #include "swish/drop_target/Plan.hpp"
-#include "swish/drop_target/SequentialPlan.hpp"
 #include "swish/provider/sftp_provider.hpp"
 #include "swish/shell_folder/data_object/ShellDataObject.hpp"  // PidlFormat
 
+#include <boost/cstdint.hpp> // uintmax_t
 #include <boost/shared_ptr.hpp>
 
 namespace swish {
 namespace drop_target {
 
+class SpaceBudget;
+
+/**
+ * How much a plan copied to the server.
+ */
+struct copy_statistics
+{
+    copy_statistics();
+
+    boost::uintmax_t bytes_uploaded() const;
+
+    boost::uintmax_t bytes_copied; ///< Size of every file copied.
+
+    /**
+     * Bytes of `bytes_copied` made on the server from a duplicate rather
+     * than uploaded.
+     */
+    boost::uintmax_t bytes_saved;
+};
+
 /**
  * Plan copying items in PIDL clipboard format to remote server.
  */
@@ -48,7 +70,10 @@ public:
 
     PidlCopyPlan(
         const swish::shell_folder::data_object::PidlFormat& source,
-        const washer::shell::pidl::apidl_t& destination);
+        const washer::shell::pidl::apidl_t& destination,
+        ParallelPlan::provider_factory extra_providers=
+            ParallelPlan::provider_factory(),
+        duplicate_policy::value duplicates=duplicate_policy::upload);
 
 public: // Plan
 
@@ -60,9 +85,19 @@ public:
 
     void add_stage(const Operation& stage);
 
+    /**
+     * What the last execution of the plan copied.
+     */
+    copy_statistics statistics() const;
+
 private:
 
-    SequentialPlan m_plan;
+    boost::shared_ptr<SpaceBudget> m_space;
+    boost::shared_ptr<copy_statistics> m_statistics;
+    boost::shared_ptr<DuplicateUploads> m_duplicates;
+    washer::shell::pidl::apidl_t m_destination_root;
+    ParallelPlan::provider_factory m_extra_providers;
+    ParallelPlan m_plan;
 };
 
 }}
@@ -27,11 +27,11 @@
 #include "SequentialPlan.hpp"
 
 #include "swish/provider/sftp_provider.hpp" // sftp_provider, ISftpConsumer
+#include "swish/drop_target/DestinationSnapshot.hpp"
 #include "swish/drop_target/DropActionCallback.hpp"
 #include "swish/drop_target/Operation.hpp"
 
 #include <boost/cstdint.hpp> // uintmax_t
-#include <boost/numeric/conversion/cast.hpp> // numeric_cast
 #include <boost/shared_array.hpp>
 #include <boost/throw_exception.hpp>  // BOOST_THROW_EXCEPTION
 
@@ -49,12 +49,10 @@ using comet::com_ptr;
 
 using ssh::filesystem::path;
 
-using boost::numeric_cast;
 using boost::shared_ptr;
 using boost::uintmax_t;
 
 using std::auto_ptr;
-using std::size_t;
 
 namespace swish {
 namespace drop_target {
@@ -62,16 +60,30 @@ namespace drop_target {
 namespace {
 
     /**
-     * Calculate percentage.
+     * The part of `weight` that `done` out of `total` represents.
      *
-     * @bug  Throws if using ludicrously large sizes.
+     * Goes through floating point as the product of two file sizes can
+     * overflow.
      */
-    uintmax_t percentage(uintmax_t done, uintmax_t total)
+    uintmax_t share(uintmax_t weight, uintmax_t done, uintmax_t total)
     {
-        if (total == 0)
-            return 100;
+        if (total == 0 || done >= total)
+            return weight;
         else
-            return numeric_cast<uintmax_t>((done * 100) / total);
+            return static_cast<uintmax_t>(
+                static_cast<double>(weight) * done / total);
+    }
+
+    /**
+     * How much an operation counts towards the progress of the sequence.
+     *
+     * Operations count by the bytes they expect to copy, so a large file
+     * moves the progress further than a small one.  If the sequence copies
+     * no bytes at all, each operation counts the same.
+     */
+    uintmax_t weight_of(const Operation& operation, bool by_bytes)
+    {
+        return (by_bytes) ? operation.expected_size() : 1;
     }
 
     /**
@@ -86,18 +98,21 @@ namespace {
      * progress when only a small number of files are being dropped where the
      * time spent on a single file makes up a significant portion of the
      * overall transfer.
+     *
+     * The operation takes up `weight` of the sequence's `total_weight`,
+     * starting at `weight_before`.
      */
     class IntraSequenceCallback : public OperationCallback
     {
     public:
 
         IntraSequenceCallback(
-            OperationCallback& sequence_callback, size_t current_file_index,
-            size_t total_files)
+            OperationCallback& sequence_callback, uintmax_t weight_before,
+            uintmax_t weight, uintmax_t total_weight)
             :
             m_callback(sequence_callback),
-            m_current_file_index(current_file_index),
-            m_total_files(total_files) {}
+            m_weight_before(weight_before), m_weight(weight),
+            m_total_weight(total_weight) {}
 
         virtual void check_if_user_cancelled() const
         {
@@ -113,23 +128,27 @@ namespace {
          * Update the overall sequence progress with the intra-operation
          * progress.
          *
-         * This uses of resolution of 100 update intervals per file in the
-         * sequence.  In other words, the intra-operation is converted to a
-         * percentage.
+         * The operation's progress is scaled to its share of the sequence,
+         * so with byte weights the overall progress counts bytes.
          */
         virtual void update_progress(uintmax_t so_far, uintmax_t out_of)
         {
-            uintmax_t percent_done = percentage(so_far, out_of);
+            uintmax_t current =
+                m_weight_before + share(m_weight, so_far, out_of);
 
-            uintmax_t current = (m_current_file_index * 100) + percent_done;
+            m_callback.update_progress(current, m_total_weight);
+        }
 
-            m_callback.update_progress(current, m_total_files * 100);
+        virtual DestinationSnapshot& destination_snapshot() const
+        {
+            return m_callback.destination_snapshot();
         }
 
     private:
         OperationCallback& m_callback;
-        size_t m_current_file_index;
-        const size_t m_total_files;
+        const uintmax_t m_weight_before;
+        const uintmax_t m_weight;
+        const uintmax_t m_total_weight;
     };
 
     /**
@@ -149,15 +168,15 @@ namespace {
             : m_callback(callback) {}
 
         void operator()(
-            const Operation& operation, size_t operation_index,
-            size_t total_operations,
+            const Operation& operation, uintmax_t weight_before,
+            uintmax_t weight, uintmax_t total_weight,
             shared_ptr<sftp_provider> provider)
         {
             progress().line_path(1, operation.title());
             progress().line_path(2, operation.description());
 
             IntraSequenceCallback micro_updater(
-                *this, operation_index, total_operations);
+                *this, weight_before, weight, total_weight);
 
             check_if_user_cancelled();
 
@@ -168,8 +187,8 @@ namespace {
             // progress.  A stream could have lied about its size messing
             // up the count.  This will override any such errors.
 
-            assert(operation_index + 1 <= total_operations);
-            progress().update(operation_index + 1, total_operations);
+            assert(weight_before + weight <= total_weight);
+            progress().update(weight_before + weight, total_weight);
         }
 
         virtual void check_if_user_cancelled() const
@@ -191,6 +210,11 @@ namespace {
             progress().update(so_far, out_of);
         }
 
+        virtual DestinationSnapshot& destination_snapshot() const
+        {
+            return m_destination;
+        }
+
     private:
 
         Progress& progress()
@@ -203,6 +227,7 @@ namespace {
 
         DropActionCallback& m_callback;
         auto_ptr<Progress> m_progress;
+        mutable DestinationSnapshot m_destination;
     };
 
 }
@@ -212,10 +237,24 @@ void SequentialPlan::execute_plan(
 {
     OperationExecutor executor(callback);
 
+    uintmax_t total_bytes = 0;
+    for (unsigned int i = 0; i < m_copy_list.size(); ++i)
+    {
+        total_bytes += m_copy_list.at(i).expected_size();
+    }
+
+    bool by_bytes = total_bytes > 0;
+    uintmax_t total_weight = (by_bytes) ? total_bytes : m_copy_list.size();
+
+    uintmax_t weight_before = 0;
     for (unsigned int i = 0; i < m_copy_list.size(); ++i)
     {
         const Operation& operation = m_copy_list.at(i);
-        executor(operation, i, m_copy_list.size(), provider);
+        uintmax_t weight = weight_of(operation, by_bytes);
+
+        executor(operation, weight_before, weight, total_weight, provider);
+
+        weight_before += weight;
     }
 }
 
@@ -0,0 +1,142 @@
+/**
+    @file
+
+    Hashing the contents of local streams.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#include "stream_hash.hpp"
+
+#include <washer/error.hpp> // last_error
+
+#include <comet/error.h> // com_error
+
+#include <boost/throw_exception.hpp>  // BOOST_THROW_EXCEPTION
+
+#include <string>
+
+#include <Wincrypt.h> // CryptAcquireContext, CryptCreateHash, CALG_MD5
+
+using washer::last_error;
+
+using comet::com_error;
+using comet::com_ptr;
+
+using std::string;
+
+namespace swish {
+namespace drop_target {
+
+namespace {
+
+    const ULONG READ_CHUNK_SIZE = 1024 * 32;
+
+    /**
+     * Hashing context that releases itself.
+     */
+    class md5_hasher
+    {
+    public:
+        md5_hasher() : m_provider(0), m_hash(0)
+        {
+            if (!::CryptAcquireContextW(
+                &m_provider, NULL, NULL, PROV_RSA_FULL,
+                CRYPT_VERIFYCONTEXT))
+                BOOST_THROW_EXCEPTION(last_error());
+
+            if (!::CryptCreateHash(m_provider, CALG_MD5, 0, 0, &m_hash))
+            {
+                ::CryptReleaseContext(m_provider, 0);
+                BOOST_THROW_EXCEPTION(last_error());
+            }
+        }
+
+        ~md5_hasher()
+        {
+            ::CryptDestroyHash(m_hash);
+            ::CryptReleaseContext(m_provider, 0);
+        }
+
+        void update(const BYTE* data, ULONG size)
+        {
+            if (!::CryptHashData(m_hash, data, size, 0))
+                BOOST_THROW_EXCEPTION(last_error());
+        }
+
+        /**
+         * The hash in lower-case hex, as the server reports it.
+         */
+        string hex_digest()
+        {
+            BYTE digest[16];
+            DWORD digest_size = sizeof(digest);
+            if (!::CryptGetHashParam(
+                m_hash, HP_HASHVAL, digest, &digest_size, 0))
+                BOOST_THROW_EXCEPTION(last_error());
+
+            static const char digits[] = "0123456789abcdef";
+            string hex;
+            for (DWORD i = 0; i < digest_size; ++i)
+            {
+                hex += digits[digest[i] >> 4];
+                hex += digits[digest[i] & 0x0F];
+            }
+            return hex;
+        }
+
+    private:
+        md5_hasher(const md5_hasher&);
+        md5_hasher& operator=(const md5_hasher&);
+
+        HCRYPTPROV m_provider;
+        HCRYPTHASH m_hash;
+    };
+
+}
+
+string md5_of_stream(const com_ptr<IStream>& stream)
+{
+    LARGE_INTEGER move = {0};
+    HRESULT hr = stream->Seek(move, SEEK_SET, NULL);
+    if (FAILED(hr))
+        BOOST_THROW_EXCEPTION(com_error_from_interface(stream, hr));
+
+    md5_hasher hasher;
+
+    BYTE buffer[READ_CHUNK_SIZE];
+    for (;;)
+    {
+        ULONG cbRead = 0;
+        hr = stream->Read(buffer, sizeof(buffer), &cbRead);
+        if (FAILED(hr))
+            BOOST_THROW_EXCEPTION(com_error_from_interface(stream, hr));
+
+        if (cbRead == 0)
+            break;
+
+        hasher.update(buffer, cbRead);
+    }
+
+    return hasher.hex_digest();
+}
+
+}} // namespace swish::drop_target
@@ -0,0 +1,47 @@
+/**
+    @file
+
+    Hashing the contents of local streams.
+
+    @if license
+
+    Copyright (C) 2016  Alexander Lamaison <awl03@doc.ic.ac.uk>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    @endif
+*/
+
+#ifndef SWISH_DROP_TARGET_STREAM_HASH_HPP
+#define SWISH_DROP_TARGET_STREAM_HASH_HPP
+#pragma once
+
+#include <comet/ptr.h> // com_ptr
+
+#include <string>
+
+namespace swish {
+namespace drop_target {
+
+/**
+ * MD5 hash of everything in the stream, from the start.
+ *
+ * @returns the hash in lower-case hex, as the server reports it.
+ */
+std::string md5_of_stream(const comet::com_ptr<IStream>& stream);
+
+}}
+
+#endif
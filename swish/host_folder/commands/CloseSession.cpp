@@ -17,6 +17,7 @@
 
 #include "CloseSession.hpp"
 
+#include "swish/connection/connection_spec.hpp"
 #include "swish/connection/session_manager.hpp"
 #include "swish/shell/shell_item_array.hpp"
 #include "swish/shell/parent_and_item.hpp"
@@ -31,12 +32,14 @@
 
 #include <boost/bind/bind.hpp>
 #include <boost/foreach.hpp> // BOOST_FOREACH
+#include <boost/function.hpp>
 #include <boost/locale.hpp> // translate
 #include <boost/locale/encoding_utf.hpp> // utf_to_utf
 #include <boost/noncopyable.hpp>
 #include <boost/optional/optional.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/future.hpp> // promise, packaged_task
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
 #include <boost/utility/in_place_factory.hpp> // in_place
@@ -49,6 +52,7 @@
 
 #include <ShlObj.h> // SHChangeNotify
 
+using swish::connection::connection_spec;
 using swish::connection::session_manager;
 using swish::frontend::best_taskdialog;
 using swish::nse::Command;
@@ -65,9 +69,11 @@ using comet::com_ptr;
 using comet::uuid_t;
 
 using boost::bind;
+using boost::function;
 using boost::unique_future;
 using boost::locale::conv::utf_to_utf;
 using boost::locale::translate;
+using boost::mutex;
 using boost::noncopyable;
 using boost::optional;
 using boost::packaged_task;
@@ -173,8 +179,6 @@ namespace {
         return content.str();
     }
 
-    void do_nothing_command() {}
-
     template<typename Result, typename Callable>
     pair<shared_ptr<unique_future<Result>>, shared_ptr<thread>>
     start_async(Callable operation)
@@ -292,7 +296,8 @@ namespace {
     };
 
     template<typename PendingTaskRange>
-    running_dialog run_task_dialog(const PendingTaskRange& pending_tasks)
+    running_dialog run_task_dialog(
+        const PendingTaskRange& pending_tasks, function<void()> on_cancel)
     {
         task_dialog_builder<void, best_taskdialog> builder(
             NULL, //m_parent_window,
@@ -302,8 +307,7 @@ namespace {
 
         builder.include_progress_bar(start_marquee);
 
-        command_id id = builder.add_button(
-            button_type::cancel, do_nothing_command);
+        command_id id = builder.add_button(button_type::cancel, on_cancel);
 
         auto_ptr<async_task_dialog_runner<void, best_taskdialog>> runner(
             new async_task_dialog_runner<void, best_taskdialog>(builder));
@@ -315,8 +319,9 @@ namespace {
     {
     public:
         template<typename PendingTaskRange>
-        explicit waiting_ui(const PendingTaskRange& pending_tasks)
-            : m_dialog(run_task_dialog(pending_tasks)) {}
+        waiting_ui(
+            const PendingTaskRange& pending_tasks, function<void()> on_cancel)
+            : m_dialog(run_task_dialog(pending_tasks, on_cancel)) {}
 
         template<typename PendingTaskRange>
         bool update(const PendingTaskRange& pending_tasks)
@@ -339,10 +344,20 @@ namespace {
         running_dialog m_dialog;
     };
 
+    /**
+     * Shows the tasks a disconnection is waiting for and lets the user
+     * give up waiting.
+     *
+     * The user cancels on the dialog's thread, so this tells the session
+     * manager to ask it again rather than waiting for a task to finish.
+     */
     class disconnection_progress : private noncopyable
     {
     public:
 
+        explicit disconnection_progress(const connection_spec& specification)
+            : m_specification(specification), m_cancelled(false) {}
+
         template<typename PendingTaskRange>
         bool operator()(const PendingTaskRange& pending_tasks)
         {
@@ -354,18 +369,59 @@ namespace {
                     // Using in-place-factory because waiting_ui's copy
                     // constructor requires NON-const ref which optional
                     // assignment doesn't allow
-                    m_dialog = in_place(pending_tasks);
+                    m_dialog = in_place(
+                        pending_tasks,
+                        function<void()>(
+                            bind(&disconnection_progress::on_cancel, this)));
                 }
 
                 return true;
             }
+            else if (boost::empty(pending_tasks))
+            {
+                m_dialog->update(pending_tasks);
+
+                // Waits for the dialog to close, so nothing can still be
+                // cancelling it when we forget it was cancelled.  A task
+                // might yet arrive before we disconnect and that gets a
+                // dialog of its own.
+                m_dialog = boost::none;
+                set_cancelled(false);
+
+                return true;
+            }
             else
             {
-                return m_dialog->update(pending_tasks);
+                return !cancelled() && m_dialog->update(pending_tasks);
             }
         }
 
     private:
+
+        void on_cancel()
+        {
+            set_cancelled(true);
+            session_manager().recheck_disconnection(m_specification);
+        }
+
+        void set_cancelled(bool cancelled)
+        {
+            mutex::scoped_lock lock(m_guard);
+            m_cancelled = cancelled;
+        }
+
+        bool cancelled()
+        {
+            mutex::scoped_lock lock(m_guard);
+            return m_cancelled;
+        }
+
+        connection_spec m_specification;
+        mutex m_guard;
+        bool m_cancelled;
+
+        // Last, so that the dialog's thread is finished with the members
+        // above before they are destroyed
         optional<waiting_ui> m_dialog;
     };
 
@@ -383,11 +439,11 @@ const
     com_ptr<IShellItem> item = selection->at(0);
     com_ptr<IParentAndItem> folder_and_pidls = try_cast(item);
     apidl_t selected_item = folder_and_pidls->absolute_item_pidl();
+    connection_spec specification = connection_from_pidl(selected_item);
 
-    disconnection_progress progress;
+    disconnection_progress progress(specification);
 
-    session_manager().disconnect_session(
-        connection_from_pidl(selected_item), boost::ref(progress));
+    session_manager().disconnect_session(specification, boost::ref(progress));
 
     notify_shell(selected_item);
 }
@@ -30,22 +30,32 @@
 #include <comet/server.h>   // simple_object for STL holder with AddRef lifetime
 #include <comet/stream.h>   // adapt_stream_pointer
 
-#include <ssh/filesystem.hpp> // directory_iterator
-#include <ssh/stream.hpp>     // ofstream, ifstream
+#include <ssh/archive.hpp>       // upload_tree, download_tree
+#include <ssh/content_cache.hpp> // content_cache, cached_copy
+#include <ssh/filesystem.hpp>    // directory_iterator
+#include <ssh/stream.hpp>     // ofstream, ifstream, sftp_io_device
 
+#include <boost/cstdint.hpp>                  // uintmax_t
 #include <boost/filesystem/path.hpp>          // path
+#include <boost/iostreams/stream.hpp>         // stream
 #include <boost/iterator/filter_iterator.hpp> // make_filter_iterator
 #include <boost/make_shared.hpp>              // make_shared
 #include <boost/move/move.hpp>                // BOOST_RV_REF
+#include <boost/optional/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/once.hpp>              // call_once
 #include <boost/throw_exception.hpp>          // BOOST_THROW_EXCEPTION
 #include <boost/system/system_error.hpp>      // system_error, system_category
 
 #include <cassert> // assert
 #include <exception>
+#include <istream>
 #include <stdexcept> // invalid_argument
 #include <string>
 #include <vector> // to hold listing
 
+#include <ShlObj.h> // SHGetFolderPathW
+
 using swish::connection::authenticated_session;
 using swish::connection::session_reservation;
 using swish::tracing::trace;
@@ -57,21 +67,33 @@ using comet::com_ptr;
 using comet::datetime_t;
 using comet::stl_enumeration;
 
+using boost::call_once;
 using boost::make_filter_iterator;
 using boost::make_shared;
+using boost::once_flag;
+using boost::shared_ptr;
+using boost::uintmax_t;
 namespace errc = boost::system::errc;
+using boost::system::error_code;
 using boost::system::system_category;
 using boost::system::system_error;
 
+using ssh::filesystem::archive_statistics;
+using ssh::filesystem::batch_upload;
+using ssh::filesystem::cached_copy;
+using ssh::filesystem::content_cache;
+using ssh::filesystem::content_copy;
 using ssh::filesystem::directory_iterator;
 using ssh::filesystem::file_attributes;
-using ssh::filesystem::fstream;
+using ssh::filesystem::file_status;
 using ssh::filesystem::ifstream;
 using ssh::filesystem::ofstream;
 using ssh::filesystem::overwrite_behaviour;
 using ssh::filesystem::path;
 using ssh::filesystem::sftp_filesystem;
 using ssh::filesystem::sftp_file;
+using ssh::filesystem::sftp_io_device;
+using ssh::filesystem::tree_item;
 
 using std::exception;
 using std::invalid_argument;
@@ -87,10 +109,13 @@ namespace provider
 class provider
 {
 public:
-    explicit provider(BOOST_RV_REF(session_reservation) session_ticket);
+    provider(BOOST_RV_REF(session_reservation) session_ticket,
+             const string& cache_origin);
 
     directory_listing listing(const path& directory);
 
+    directory_tree listing_tree(const path& directory);
+
     comet::com_ptr<IStream> get_file(const path& file_path,
                                      std::ios_base::openmode open_mode);
 
@@ -105,13 +130,47 @@ public:
 
     sftp_filesystem_item stat(const path& path, bool follow_links);
 
+    vector<error_code> upload_batch(const vector<batch_upload>& files);
+
+    string remote_hash(const path& file, const string& algorithm);
+
+    uintmax_t available_space(const path& path);
+
+    void create_hard_link(const path& link, const path& target);
+
+    void copy_file(const path& from, const path& to);
+
+    archive_statistics upload_tree(
+        const boost::filesystem::path& local_directory,
+        const path& remote_directory, sftp_provider::tree_progress progress);
+
+    archive_statistics download_tree(
+        const path& remote_directory,
+        const boost::filesystem::path& local_directory,
+        sftp_provider::tree_progress progress);
+
 private:
+    ssh::session& session_for_archives();
+
+    com_ptr<IStream> cached_file(sftp_filesystem& channel,
+                                 const path& file_path);
+
     session_reservation m_ticket;
+    boost::optional<bool> m_can_exchange_archives;
+    string m_cache_origin;
+    shared_ptr<content_cache> m_cache; ///< Null if files aren't cached
 };
 
-CProvider::CProvider(BOOST_RV_REF(session_reservation) session_ticket)
+/**
+ * @param cache_origin  Identifies the server in the local cache of remote
+ *                      files, for example `user@host:port`.  If empty,
+ *                      files are always read from the server.
+ */
+CProvider::CProvider(BOOST_RV_REF(session_reservation) session_ticket,
+                     const string& cache_origin)
 {
-    m_provider = make_shared<provider>(boost::ref(session_ticket));
+    m_provider = make_shared<provider>(boost::ref(session_ticket),
+                                       cache_origin);
 }
 
 directory_listing CProvider::listing(const path& directory)
@@ -119,6 +178,11 @@ directory_listing CProvider::listing(const path& directory)
     return m_provider->listing(directory);
 }
 
+directory_tree CProvider::listing_tree(const path& directory)
+{
+    return m_provider->listing_tree(directory);
+}
+
 comet::com_ptr<IStream> CProvider::get_file(const path& file_path,
                                             std::ios_base::openmode open_mode)
 {
@@ -151,11 +215,100 @@ sftp_filesystem_item CProvider::stat(const path& path, bool follow_links)
     return m_provider->stat(path, follow_links);
 }
 
+vector<error_code> CProvider::upload_batch(const vector<batch_upload>& files)
+{
+    return m_provider->upload_batch(files);
+}
+
+string CProvider::remote_hash(const path& file, const string& algorithm)
+{
+    return m_provider->remote_hash(file, algorithm);
+}
+
+uintmax_t CProvider::available_space(const path& path)
+{
+    return m_provider->available_space(path);
+}
+
+void CProvider::create_hard_link(const path& link, const path& target)
+{
+    m_provider->create_hard_link(link, target);
+}
+
+void CProvider::copy_file(const path& from, const path& to)
+{
+    m_provider->copy_file(from, to);
+}
+
+archive_statistics CProvider::upload_tree(
+    const boost::filesystem::path& local_directory,
+    const path& remote_directory, tree_progress progress)
+{
+    return m_provider->upload_tree(local_directory, remote_directory, progress);
+}
+
+archive_statistics CProvider::download_tree(
+    const path& remote_directory,
+    const boost::filesystem::path& local_directory, tree_progress progress)
+{
+    return m_provider->download_tree(
+        remote_directory, local_directory, progress);
+}
+
+namespace
+{
+
+/**
+ * Largest file read from the local cache of remote files.
+ *
+ * The whole file is downloaded before any of it is handed over, which for
+ * a big file keeps the caller waiting far longer than streaming it would.
+ */
+const uintmax_t MAX_CACHED_FILE_SIZE = 16 * 1024 * 1024;
+
+shared_ptr<content_cache> the_content_cache;
+once_flag content_cache_created = BOOST_ONCE_INIT;
+
+void create_content_cache()
+{
+    try
+    {
+        wchar_t local_app_data[MAX_PATH];
+        HRESULT hr = ::SHGetFolderPathW(NULL, CSIDL_LOCAL_APPDATA, NULL,
+                                        SHGFP_TYPE_CURRENT, local_app_data);
+        if (FAILED(hr))
+            BOOST_THROW_EXCEPTION(com_error(hr));
+
+        the_content_cache = make_shared<content_cache>(
+            boost::filesystem::path(local_app_data) / L"Swish" / L"Cache");
+    }
+    catch (const exception& e)
+    {
+        trace("Not keeping local copies of remote files: %s") % e.what();
+    }
+}
+
+/**
+ * Local copies of remote files shared by every provider in the process.
+ *
+ * Null if there is nowhere to keep them.
+ */
+shared_ptr<content_cache> user_content_cache()
+{
+    call_once(content_cache_created, &create_content_cache);
+    return the_content_cache;
+}
+}
+
 /**
  * Create libssh2-based data provider.
  */
-provider::provider(BOOST_RV_REF(session_reservation) ticket) : m_ticket(ticket)
+provider::provider(BOOST_RV_REF(session_reservation) ticket,
+                   const string& cache_origin)
+    : m_ticket(ticket), m_cache_origin(cache_origin)
 {
+    if (!m_cache_origin.empty())
+        m_cache = user_content_cache();
 }
 
 namespace
@@ -165,6 +318,8 @@ bool not_special_file(const sftp_file& file)
 {
     return file.path().filename() != "." && file.path().filename() != "..";
 }
+
+typedef boost::iostreams::stream<sftp_io_device> io_stream;
 }
 
 /**
@@ -190,6 +345,38 @@ directory_listing provider::listing(const path& directory)
     return files;
 }
 
+/**
+ * Retrieves everything below a directory, listing many directories at once.
+ *
+ * The items have no owner or group names, as those only come from the long
+ * form of a single directory's listing.
+ *
+ * @param directory  Absolute path of the directory to list.
+ */
+directory_tree provider::listing_tree(const path& directory)
+{
+    if (directory.empty())
+        BOOST_THROW_EXCEPTION(com_error(E_INVALIDARG));
+
+    sftp_filesystem& channel = m_ticket.session().get_sftp_filesystem();
+
+    vector<tree_item> items = list_tree(channel, directory);
+
+    directory_tree tree;
+    tree.reserve(items.size());
+    for (vector<tree_item>::const_iterator it = items.begin();
+         it != items.end(); ++it)
+    {
+        tree.push_back(
+            std::make_pair(
+                it->relative_path.parent_path(),
+                libssh2_sftp_filesystem_item::create_from_libssh2_attributes(
+                    it->relative_path.filename(), it->attributes)));
+    }
+
+    return tree;
+}
+
 com_ptr<IStream> provider::get_file(const path& file_path,
                                     std::ios_base::openmode mode)
 {
@@ -198,10 +385,18 @@ com_ptr<IStream> provider::get_file(const path& file_path,
 
     sftp_filesystem& channel = m_ticket.session().get_sftp_filesystem();
 
+    // A file rewritten within the same second to the same size would still
+    // match its old copy
+    if (m_cache && mode & std::ios_base::out)
+        m_cache->invalidate(m_cache_origin, file_path.string());
+
     if (mode & std::ios_base::out && mode & std::ios_base::in)
     {
+        // The shell often lets go of a stream without committing it, so
+        // any write held back until then could fail with nobody to tell.
+        // Sending each write as it is made reports its failure from Write.
         return adapt_stream_pointer(
-            make_shared<fstream>(boost::ref(channel), file_path, mode),
+            make_shared<io_stream>(sftp_io_device(channel, file_path, mode, 0)),
             file_path.filename().wstring());
     }
     else if (mode & std::ios_base::out)
@@ -212,6 +407,13 @@ com_ptr<IStream> provider::get_file(const path& file_path,
     }
     else if (mode & std::ios_base::in)
     {
+        if (m_cache)
+        {
+            com_ptr<IStream> cached = cached_file(channel, file_path);
+            if (cached)
+                return cached;
+        }
+
         return adapt_stream_pointer(
             make_shared<ifstream>(boost::ref(channel), file_path, mode),
             file_path.filename().wstring());
@@ -223,6 +425,44 @@ com_ptr<IStream> provider::get_file(const path& file_path,
     }
 }
 
+/**
+ * Stream of the local copy of a file, downloading the file into the cache
+ * if the copy isn't of the version on the server.
+ *
+ * @returns null if the file is better read from the server, such as when
+ *          it is too big, or if the cache can't be used.
+ */
+com_ptr<IStream> provider::cached_file(sftp_filesystem& channel,
+                                       const path& file_path)
+{
+    try
+    {
+        file_status remote_status =
+            ssh::filesystem::status(channel, file_path);
+        if (!is_regular_file(remote_status) ||
+            remote_status.file_size() > MAX_CACHED_FILE_SIZE)
+        {
+            return com_ptr<IStream>();
+        }
+
+        shared_ptr<content_copy> copy = make_shared<content_copy>(
+            cached_copy(*m_cache, channel, m_cache_origin, file_path,
+                        remote_status));
+
+        // The stream holds on to the copy, keeping it open for as long as
+        // the stream is read
+        return adapt_stream_pointer(
+            shared_ptr<std::istream>(copy, &copy->stream()),
+            file_path.filename().wstring());
+    }
+    catch (const exception& e)
+    {
+        trace("Reading %s from the server rather than the cache: %s") %
+            file_path.string() % e.what();
+        return com_ptr<IStream>();
+    }
+}
+
 namespace
 {
 
@@ -260,7 +500,7 @@ void rename_non_atomic_overwrite(authenticated_session& session,
         // Rename failed, rename our temporary back to its old name
         try
         {
-            rename(session.get_sftp_filesystem(), from, to,
+            rename(session.get_sftp_filesystem(), temporary, to,
                    overwrite_behaviour::prevent_overwrite);
         }
         catch (const exception&)
@@ -284,6 +524,38 @@ void rename_non_atomic_overwrite(authenticated_session& session,
     }
 }
 
+/**
+ * Rename file or directory, replacing any obstruction.
+ *
+ * A single atomic request if the server can do it, which includes any server
+ * with the `posix-rename@openssh.com` extension.  Otherwise, or if the
+ * obstruction is a directory, which can't be replaced atomically unless it
+ * is empty, falls back to moving the obstruction out of the way first.
+ *
+ * @throws  ssh_error if the operation fails.
+ */
+void rename_overwrite(authenticated_session& session, const string& from,
+                      const string& to)
+{
+    try
+    {
+        rename(session.get_sftp_filesystem(), from, to,
+               overwrite_behaviour::atomic_overwrite);
+    }
+    catch (const system_error& e)
+    {
+        if (e.code() == errc::operation_not_supported ||
+            is_directory(session.get_sftp_filesystem(), to))
+        {
+            rename_non_atomic_overwrite(session, from, to);
+        }
+        else
+        {
+            throw;
+        }
+    }
+}
+
 /**
  * Retry renaming after seeking permission to overwrite the obstruction at
  * the target.
@@ -332,26 +604,8 @@ bool rename_retry_with_overwrite(authenticated_session& session,
 
         // Attempt rename again this time allowing it to atomically overwrite
         // any obstruction.
-        // This will only work on a server supporting SFTP version 5 or above.
-
-        try
-        {
-            rename(session.get_sftp_filesystem(), from, to,
-                   overwrite_behaviour::atomic_overwrite);
-            return true;
-        }
-        catch (const system_error& e)
-        {
-            if (e.code() == errc::operation_not_supported)
-            {
-                rename_non_atomic_overwrite(session, from, to);
-                return true;
-            }
-            else
-            {
-                throw;
-            }
-        }
+        rename_overwrite(session, from, to);
+        return true;
     }
     else
     {
@@ -360,7 +614,9 @@ bool rename_retry_with_overwrite(authenticated_session& session,
         // file already exists as they don't explicitly support overwriting.
         // We need to stat() the file to find out if this is the case and if
         // the user confirms the overwrite we will have to explicitly delete
-        // the target file first (via a temporary) and then repeat the rename.
+        // the target file first (via a temporary) and then repeat the rename,
+        // unless the server can overwrite atomically after all, as OpenSSH
+        // can with its posix-rename extension.
         //
         // NOTE: this is not a perfect solution due to the possibility
         // for race conditions.
@@ -377,7 +633,7 @@ bool rename_retry_with_overwrite(authenticated_session& session,
             if (FAILED(hr))
                 return false;
 
-            rename_non_atomic_overwrite(session, from, to);
+            rename_overwrite(session, from, to);
             return true;
         }
         else
@@ -509,5 +765,91 @@ sftp_filesystem_item provider::stat(const path& path, bool follow_links)
     return libssh2_sftp_filesystem_item::create_from_libssh2_attributes(
         path, stat_result);
 }
+
+/**
+ * Create small files with their requests interleaved rather than one after
+ * another.
+ */
+vector<error_code> provider::upload_batch(const vector<batch_upload>& files)
+{
+    return ssh::filesystem::upload_batch(
+        m_ticket.session().get_sftp_filesystem(), files);
+}
+
+/**
+ * Hash a file on the server so it needn't be downloaded to compare it.
+ */
+string provider::remote_hash(const path& file, const string& algorithm)
+{
+    return ssh::filesystem::remote_hash(
+        m_ticket.session().get_sftp_filesystem(), file, algorithm);
+}
+
+/**
+ * Ask the server how much room is left so big uploads can be refused
+ * before they start.
+ */
+uintmax_t provider::available_space(const path& path)
+{
+    return ssh::filesystem::space(
+        m_ticket.session().get_sftp_filesystem(), path).available;
+}
+
+void provider::create_hard_link(const path& link, const path& target)
+{
+    ssh::filesystem::create_hard_link(
+        m_ticket.session().get_sftp_filesystem(), link, target);
+}
+
+void provider::copy_file(const path& from, const path& to)
+{
+    ssh::filesystem::copy_file(
+        m_ticket.session().get_sftp_filesystem(), from, to);
+}
+
+/**
+ * The session, once we know its server can run `tar`.
+ *
+ * The server is only asked the first time.
+ */
+ssh::session& provider::session_for_archives()
+{
+    ssh::session& session = m_ticket.session().get_session();
+
+    if (!m_can_exchange_archives)
+        m_can_exchange_archives =
+            ssh::filesystem::can_exchange_archives(session);
+
+    if (!*m_can_exchange_archives)
+    {
+        BOOST_THROW_EXCEPTION(
+            system_error(
+                errc::make_error_code(errc::function_not_supported),
+                "The server can't run tar"));
+    }
+
+    return session;
+}
+
+/**
+ * Stream a tree to `tar` on the server, which for many small files is far
+ * quicker than creating them one by one over SFTP.
+ */
+archive_statistics provider::upload_tree(
+    const boost::filesystem::path& local_directory,
+    const path& remote_directory, sftp_provider::tree_progress progress)
+{
+    return ssh::filesystem::upload_tree(
+        session_for_archives(), local_directory, remote_directory, progress);
+}
+
+archive_statistics provider::download_tree(
+    const path& remote_directory,
+    const boost::filesystem::path& local_directory,
+    sftp_provider::tree_progress progress)
+{
+    return ssh::filesystem::download_tree(
+        session_for_archives(), remote_directory, local_directory, progress);
+}
 }
 } // namespace swish::provider
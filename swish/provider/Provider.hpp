@@ -45,6 +45,8 @@
 #include <boost/move/move.hpp> // BOOST_RV_REF
 #include <boost/shared_ptr.hpp> // shared_ptr
 
+#include <string>
+
 namespace swish {
 namespace provider {
 
@@ -55,10 +57,14 @@ class CProvider : public sftp_provider
 public:
 
     explicit CProvider(
-        BOOST_RV_REF(swish::connection::session_reservation) session_ticket);
+        BOOST_RV_REF(swish::connection::session_reservation) session_ticket,
+        const std::string& cache_origin=std::string());
 
     virtual directory_listing listing(const ssh::filesystem::path& directory);
 
+    virtual directory_tree listing_tree(
+        const ssh::filesystem::path& directory);
+
     virtual comet::com_ptr<IStream> get_file(
         const ssh::filesystem::path& file_path, std::ios_base::openmode open_mode);
 
@@ -76,6 +82,32 @@ public:
     virtual sftp_filesystem_item stat(
         const ssh::filesystem::path& path, bool follow_links);
 
+    virtual std::vector<boost::system::error_code> upload_batch(
+        const std::vector<ssh::filesystem::batch_upload>& files);
+
+    virtual std::string remote_hash(
+        const ssh::filesystem::path& file, const std::string& algorithm);
+
+    virtual boost::uintmax_t available_space(
+        const ssh::filesystem::path& path);
+
+    virtual void create_hard_link(
+        const ssh::filesystem::path& link,
+        const ssh::filesystem::path& target);
+
+    virtual void copy_file(
+        const ssh::filesystem::path& from, const ssh::filesystem::path& to);
+
+    virtual ssh::filesystem::archive_statistics upload_tree(
+        const boost::filesystem::path& local_directory,
+        const ssh::filesystem::path& remote_directory,
+        tree_progress progress);
+
+    virtual ssh::filesystem::archive_statistics download_tree(
+        const ssh::filesystem::path& remote_directory,
+        const boost::filesystem::path& local_directory,
+        tree_progress progress);
+
 private:
     boost::shared_ptr<provider> m_provider;
 };
@@ -33,17 +33,28 @@
 
 #include <ssh/filesystem/path.hpp>
 
+#include <boost/cstdint.hpp> // uintmax_t
 #include <boost/filesystem/path.hpp>
+#include <boost/function.hpp>
 #include <boost/optional/optional.hpp>
+#include <boost/system/error_code.hpp>
 //#include <boost/range/any_range.hpp> USE ONCE WE UPGRADE BOOST
 
 #include <comet/interface.h> // comtype
 #include <comet/ptr.h> // com_ptr
 
-#include <string> // wstring
+#include <string> // string, wstring
 #include <utility> // pair
 #include <vector>
 
+namespace ssh {
+namespace filesystem {
+
+struct archive_statistics;
+struct batch_upload;
+
+}}
+
 class ISftpConsumer : public IUnknown
 {
 public:
@@ -106,6 +117,14 @@ namespace provider {
 //    directory_listing;
 typedef std::vector<sftp_filesystem_item> directory_listing;
 
+/**
+ * Everything below a directory, each item paired with the path of its
+ * parent relative to that directory.  Items directly in the directory have
+ * an empty parent path.
+ */
+typedef std::vector<std::pair<ssh::filesystem::path, sftp_filesystem_item> >
+    directory_tree;
+
 class sftp_provider
 {
 public:
@@ -114,6 +133,17 @@ public:
     virtual directory_listing listing(
         const ssh::filesystem::path& directory) = 0;
 
+    /**
+     * Everything below a directory, however deep, in no particular order.
+     *
+     * Many directories are listed at once, so this is much quicker than
+     * calling `listing` on each in turn.
+     *
+     * @throws if the directory, or any directory below it, can't be listed.
+     */
+    virtual directory_tree listing_tree(
+        const ssh::filesystem::path& directory) = 0;
+
     virtual comet::com_ptr<IStream> get_file(
         const ssh::filesystem::path& file_path, std::ios_base::openmode mode) = 0;
 
@@ -136,6 +166,79 @@ public:
 
     virtual sftp_filesystem_item stat(
         const ssh::filesystem::path& path, bool follow_links) = 0;
+
+    /**
+     * Create many small files at once.
+     *
+     * @returns the outcome of each upload in the same order as `files`.
+     */
+    virtual std::vector<boost::system::error_code> upload_batch(
+        const std::vector<ssh::filesystem::batch_upload>& files) = 0;
+
+    /**
+     * Hash of a file, worked out by the server.
+     *
+     * @param algorithm  `md5`, `sha1`, `sha256` and so on.
+     * @returns the hash in lower-case hex.
+     */
+    virtual std::string remote_hash(
+        const ssh::filesystem::path& file, const std::string& algorithm) = 0;
+
+    /**
+     * Bytes we can still write to the server filesystem holding a path.
+     *
+     * @throws if the server can't say.
+     */
+    virtual boost::uintmax_t available_space(
+        const ssh::filesystem::path& path) = 0;
+
+    /**
+     * Give an existing file a second name.
+     *
+     * @throws if the server doesn't support hard links or refuses this one.
+     */
+    virtual void create_hard_link(
+        const ssh::filesystem::path& link,
+        const ssh::filesystem::path& target) = 0;
+
+    /**
+     * Copy a file to a new file without the data leaving the server.
+     */
+    virtual void copy_file(
+        const ssh::filesystem::path& from,
+        const ssh::filesystem::path& to) = 0;
+
+    /**
+     * Told each local file as it is finished with and the running total of
+     * bytes copied.  May throw to cancel.
+     */
+    typedef boost::function<
+        void(const boost::filesystem::path&, boost::uintmax_t)>
+        tree_progress;
+
+    /**
+     * Copy the contents of a local directory into a directory on the server
+     * as one archive streamed to `tar`, rather than file by file.
+     *
+     * Existing files are replaced without asking.
+     *
+     * @throws `function_not_supported` if the server can't run `tar`.
+     */
+    virtual ssh::filesystem::archive_statistics upload_tree(
+        const boost::filesystem::path& local_directory,
+        const ssh::filesystem::path& remote_directory,
+        tree_progress progress) = 0;
+
+    /**
+     * Copy the contents of a directory on the server into a local directory
+     * as one archive streamed from `tar`.
+     *
+     * @throws `function_not_supported` if the server can't run `tar`.
+     */
+    virtual ssh::filesystem::archive_statistics download_tree(
+        const ssh::filesystem::path& remote_directory,
+        const boost::filesystem::path& local_directory,
+        tree_progress progress) = 0;
 };
 
 }}
@@ -31,6 +31,8 @@
 #include "swish/host_folder/host_pidl.hpp" // find_host_itemid, host_itemid_view
 #include "swish/provider/Provider.hpp" // CProvider
 
+#include <boost/lexical_cast.hpp>
+#include <boost/locale/encoding_utf.hpp> // utf_to_utf
 #include <boost/shared_ptr.hpp>
 
 #include <string>
@@ -46,6 +48,8 @@ using washer::shell::pidl::apidl_t;
 
 using comet::com_ptr;
 
+using boost::lexical_cast;
+using boost::locale::conv::utf_to_utf;
 using boost::shared_ptr;
 
 using std::string;
@@ -87,13 +91,28 @@ connection_spec connection_from_pidl(const apidl_t& pidl)
 shared_ptr<sftp_provider> provider_from_pidl(
     const apidl_t& pidl, com_ptr<ISftpConsumer> consumer,
     const string& task_name)
+{
+    return provider_from_pidl_on_lane(pidl, consumer, task_name, 0);
+}
+
+shared_ptr<sftp_provider> provider_from_pidl_on_lane(
+    const apidl_t& pidl, com_ptr<ISftpConsumer> consumer,
+    const string& task_name, unsigned int lane)
 {
     connection_spec specification = connection_from_pidl(pidl);
 
+    // Names the server among the local copies of remote files
+    wstring user, host;
+    int port;
+    params_from_pidl(pidl, user, host, port);
+    string origin = utf_to_utf<char>(user + L"@" + host) + ":" +
+        lexical_cast<string>(port);
+
     return shared_ptr<CProvider>(
         new CProvider(
             session_manager().reserve_session(
-                specification, consumer, task_name)));
+                specification, consumer, task_name, lane),
+            origin));
 }
 
 }} // namespace swish::remote_folder
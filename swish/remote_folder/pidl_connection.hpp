@@ -60,6 +60,18 @@ boost::shared_ptr<swish::provider::sftp_provider> provider_from_pidl(
     comet::com_ptr<ISftpConsumer> consumer,
     const std::string& task_name);
 
+/**
+ * Creates a provider, as `provider_from_pidl` does, on one of the extra
+ * sessions the pool keeps to the server for tasks that run side by side.
+ *
+ * @param lane  Which extra session to use.  Lane 0 is the session that
+ *              `provider_from_pidl` uses.
+ */
+boost::shared_ptr<swish::provider::sftp_provider> provider_from_pidl_on_lane(
+    const washer::shell::pidl::apidl_t& pidl,
+    comet::com_ptr<ISftpConsumer> consumer,
+    const std::string& task_name, unsigned int lane);
+
 }} // namespace swish::remote_folder
 
 #endif
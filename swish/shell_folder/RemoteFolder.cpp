@@ -24,11 +24,13 @@
 #include "swish/debug.hpp"
 #include "swish/drop_target/DropTarget.hpp" // CDropTarget
 #include "swish/drop_target/DropUI.hpp" // DropUI
+#include "swish/drop_target/ParallelPlan.hpp" // DEFAULT_WORKER_COUNT
 #include "swish/frontend/announce_error.hpp" // announce_last_exception
 #include "swish/remote_folder/columns.hpp" // property_key_from_column_index
 #include "swish/remote_folder/commands/commands.hpp"
                                            // remote_folder_command_provider
-#include "swish/remote_folder/pidl_connection.hpp" // provider_from_pidl
+#include "swish/remote_folder/pidl_connection.hpp"
+                         // provider_from_pidl, provider_from_pidl_on_lane
 #include "swish/remote_folder/context_menu_callback.hpp"
                                                        // context_menu_callback
 #include "swish/remote_folder/properties.hpp" // property_from_pidl
@@ -43,20 +45,28 @@
 #include <washer/window/window.hpp>
 
 #include <comet/datetime.h> // datetime_t
+#include <comet/git.h> // GIT
 #include <comet/regkey.h>
+#include <comet/server.h> // simple_object
 
 #include <boost/bind.hpp> // bind
 #include <boost/exception/diagnostic_information.hpp> // diagnostic_information
 #include <boost/filesystem/path.hpp> // path
 #include <boost/locale.hpp> // translate
 #include <boost/make_shared.hpp> // make_shared
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
 
 #include <cassert> // assert
+#include <exception>
 #include <string>
+#include <utility> // pair
+#include <vector>
 
 using swish::drop_target::CDropTarget;
 using swish::drop_target::DropUI;
+using swish::drop_target::ParallelPlan;
 using swish::frontend::announce_last_exception;
 using swish::provider::sftp_provider;
 using swish::remote_folder::CViewCallback;
@@ -66,6 +76,7 @@ using swish::remote_folder::create_remote_itemid;
 using swish::remote_folder::property_from_pidl;
 using swish::remote_folder::property_key_from_column_index;
 using swish::remote_folder::provider_from_pidl;
+using swish::remote_folder::provider_from_pidl_on_lane;
 using swish::remote_folder::remote_itemid_view;
 using swish::tracing::trace;
 
@@ -80,7 +91,10 @@ using washer::window::window_handle;
 using comet::com_ptr;
 using comet::com_error;
 using comet::datetime_t;
+using comet::GIT;
+using comet::GIT_cookie;
 using comet::regkey;
+using comet::simple_object;
 using comet::throw_com_error;
 using comet::variant_t;
 
@@ -88,12 +102,17 @@ using boost::bind;
 using boost::filesystem::path;
 using boost::locale::translate;
 using boost::make_shared;
+using boost::mutex;
+using boost::noncopyable;
 using boost::optional;
 using boost::shared_ptr;
 
 using ATL::CComPtr;
 
+using std::exception;
+using std::pair;
 using std::string;
+using std::vector;
 using std::wstring;
 
 
@@ -146,6 +165,218 @@ namespace {
             }
         }
     }
+
+    /**
+     * Keeps a consumer in the GIT so that other threads can call it.
+     */
+    class registered_consumer : private noncopyable
+    {
+    public:
+        explicit registered_consumer(com_ptr<ISftpConsumer> consumer)
+            : m_cookie(m_git.register_interface(consumer)) {}
+
+        ~registered_consumer()
+        {
+            m_git.revoke_interface(m_cookie);
+        }
+
+        /**
+         * The consumer, as callable from the calling thread's apartment.
+         */
+        com_ptr<ISftpConsumer> consumer() const
+        {
+            return m_git.get_interface(m_cookie);
+        }
+
+    private:
+        GIT m_git;
+        GIT_cookie<ISftpConsumer> m_cookie;
+    };
+
+    /**
+     * Setting saying how many connections a copy may open to a server
+     * besides the folder's own.
+     *
+     * 0 makes every copy worker share the folder's connection.
+     */
+    const wchar_t COPY_CONNECTIONS_VALUE[] = L"CopyConnections";
+
+    /**
+     * Most extra connections the user lets a copy open to a server.
+     *
+     * Unless the user says otherwise, every copy worker but the first gets
+     * a connection of its own.
+     */
+    unsigned int copy_connections_from_registry()
+    {
+        if (regkey settings =
+            regkey(HKEY_CURRENT_USER).open_nothrow(L"Software\\Swish"))
+        {
+            regkey::mapped_type setting = settings[COPY_CONNECTIONS_VALUE];
+            if (setting.exists())
+                return setting.dword();
+        }
+
+        return ParallelPlan::DEFAULT_WORKER_COUNT - 1;
+    }
+
+    /**
+     * Consumer for the extra connections of a copy, which must never
+     * interrupt the user.
+     *
+     * Anything that needs the user, such as typing a password or accepting
+     * a host key, fails the connection instead.  Connections that only
+     * need the agent or key files still succeed.
+     */
+    class unattended_consumer : public simple_object<ISftpConsumer>
+    {
+    public:
+
+        typedef ISftpConsumer interface_is;
+
+        explicit unattended_consumer(com_ptr<ISftpConsumer> consumer)
+            : m_consumer(consumer) {}
+
+        virtual optional<wstring> prompt_for_password()
+        {
+            return optional<wstring>();
+        }
+
+        virtual optional<pair<path, path>> key_files()
+        {
+            return m_consumer->key_files();
+        }
+
+        virtual optional<vector<string>> challenge_response(
+            const string& title, const string& instructions,
+            const vector<pair<string, bool>>& prompts)
+        {
+            // Kb-int authentication often ends with an empty interaction,
+            // which needs no answer from the user
+            if (title.empty() && instructions.empty() && prompts.empty())
+                return vector<string>();
+            else
+                return optional<vector<string>>();
+        }
+
+        HRESULT OnConfirmOverwrite(BSTR, BSTR)
+        {
+            return E_ABORT;
+        }
+
+        HRESULT OnHostkeyMismatch(BSTR, BSTR, BSTR)
+        {
+            return E_ABORT;
+        }
+
+        HRESULT OnHostkeyUnknown(BSTR, BSTR, BSTR)
+        {
+            return E_ABORT;
+        }
+
+    private:
+        com_ptr<ISftpConsumer> m_consumer;
+    };
+
+    /**
+     * Hands out the pool's extra sessions to a copy's workers.
+     */
+    class lane_allocator : private noncopyable
+    {
+    public:
+        explicit lane_allocator(unsigned int lanes)
+            : m_lanes(lanes), m_handed_out(0), m_refused(false) {}
+
+        /**
+         * Lane for the next worker, or 0 to share the folder's session.
+         *
+         * Once every lane is in use, the next worker shares the lane that
+         * was handed out longest ago.
+         */
+        unsigned int next()
+        {
+            mutex::scoped_lock lock(m_guard);
+
+            if (m_lanes == 0 || m_refused)
+                return 0;
+            else
+                return 1 + (m_handed_out++ % m_lanes);
+        }
+
+        /**
+         * Stop handing out lanes because the server wouldn't let one
+         * connect without the user.
+         */
+        void refused()
+        {
+            mutex::scoped_lock lock(m_guard);
+
+            m_refused = true;
+        }
+
+    private:
+        mutex m_guard;
+        const unsigned int m_lanes;
+        unsigned int m_handed_out;
+        bool m_refused;
+    };
+
+    /**
+     * Reserves providers for the drop target's extra copy workers.
+     *
+     * The reservations are made on the workers' threads but the consumer
+     * belongs to the apartment of the thread that created the drop target.
+     * Each worker is given its own proxy to it through the GIT, and the
+     * calls are carried out on the creating thread while it waits for the
+     * copy.
+     *
+     * Each worker gets a session of its own, up to the user's limit, so
+     * that the workers' transfers don't queue behind each other on one
+     * connection.  Those sessions never prompt the user.  Once a server
+     * refuses one, the workers share the folder's session, overlapping
+     * each other's round trips but not their transfers.
+     */
+    class worker_provider_factory
+    {
+    public:
+        worker_provider_factory(
+            const apidl_t& pidl, com_ptr<ISftpConsumer> consumer,
+            const string& task_name, unsigned int lanes)
+            : m_pidl(pidl),
+              m_consumer(make_shared<registered_consumer>(consumer)),
+              m_task_name(task_name),
+              m_lanes(make_shared<lane_allocator>(lanes)) {}
+
+        shared_ptr<sftp_provider> operator()() const
+        {
+            com_ptr<ISftpConsumer> consumer = m_consumer->consumer();
+
+            if (unsigned int lane = m_lanes->next())
+            {
+                com_ptr<ISftpConsumer> unattended =
+                    new unattended_consumer(consumer);
+                try
+                {
+                    return provider_from_pidl_on_lane(
+                        m_pidl, unattended, m_task_name, lane);
+                }
+                catch (const exception& e)
+                {
+                    trace("Copy workers will share one session: %s")
+                        % e.what();
+                    m_lanes->refused();
+                }
+            }
+
+            return provider_from_pidl(m_pidl, consumer, m_task_name);
+        }
+
+    private:
+        apidl_t m_pidl;
+        shared_ptr<registered_consumer> m_consumer;
+        string m_task_name;
+        shared_ptr<lane_allocator> m_lanes;
+    };
 }
 
 /*--------------------------------------------------------------------------*/
@@ -818,12 +1049,13 @@ CComPtr<IDropTarget> CRemoteFolder::drop_target(HWND hwnd)
 
     try
     {
-        // TODO: pass a provider factory instead of the provider to the
-        // drop target and create more specific reservations when needed
+        // The drop target makes further reservations, on its workers'
+        // threads, so that it can copy several items at once
         com_ptr<ISftpConsumer> consumer = m_consumer_factory(hwnd);
+        string task_name = translate(
+            "Name of a running task", "Copying to directory");
         shared_ptr<sftp_provider> provider =
-            provider_from_pidl(root_pidl(), consumer, translate(
-                "Name of a running task", "Copying to directory"));
+            provider_from_pidl(root_pidl(), consumer, task_name);
 
         optional< window<wchar_t> > owner;
         if (hwnd)
@@ -849,7 +1081,10 @@ CComPtr<IDropTarget> CRemoteFolder::drop_target(HWND hwnd)
         // drop target is in use.  Nevertheless, this seems to work so it's
         // what we're doing for now.
         return new CDropTarget(
-            provider, root_pidl(), make_shared<DropUI>(owner));
+            provider, root_pidl(), make_shared<DropUI>(owner),
+            worker_provider_factory(
+                root_pidl(), consumer, task_name,
+                copy_connections_from_registry()));
     }
     catch (...)
     {
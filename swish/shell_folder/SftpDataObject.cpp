@@ -43,6 +43,7 @@
 #include <algorithm> // replace
 #include <stdexcept> // runtime_error
 #include <string>
+#include <vector>
 
 using swish::provider::sftp_provider;
 using swish::remote_folder::path_from_remote_pidl;
@@ -67,6 +68,7 @@ using boost::shared_ptr;
 
 using std::replace;
 using std::runtime_error;
+using std::vector;
 using std::wstring;
 
 namespace comet {
@@ -463,6 +465,9 @@ throw(...)
  * a given parent PIDL. This allows this method to be used recursively and still
  * produce a list of PIDLs relative to a common root.
  *
+ * The whole tree is listed in one go, many directories at a time, so large
+ * trees don't cost a round trip to the server for every directory.
+ *
  * @param[in,out] vecPidl  List of flattened PIDLs to append our flattened
  *                         PIDLs.
  * @param[in] pidlPrefix   PIDL with which to prefix the PIDLs below this
@@ -474,43 +479,22 @@ void CSftpDataObject::_ExpandDirectoryTreeInto(
     ExpandedList& descriptors)
 const throw(...)
 {
-    com_ptr<IEnumIDList> listing = _GetEnumAll(
-        CAbsolutePidl(pidlParent, pidlDirectory));
+    CSftpDirectory directory(
+        CAbsolutePidl(pidlParent, pidlDirectory), m_provider);
 
     // Add all items below this directory (this directory added by caller)
-    HRESULT hr;
-    while(true)
-    {
-        cpidl_t pidl;
-        hr = listing->Next(1, pidl.out(), NULL);
-        if (hr != S_OK)
-            break;
-
-        // Create version of pidl relative to the common root (pidlParent)
-        pidl_t relative_pidl = pidlDirectory.m_pidl + pidl;
+    vector<pidl_t> tree = directory.GetTree(pidlDirectory.m_pidl);
 
-        // Add simple item - common case
-        ATLENSURE_THROW(
-            descriptors.size() < descriptors.max_size() - 1, E_OUTOFMEMORY);
-        descriptors.push_back(make_descriptor(relative_pidl, true));
+    ATLENSURE_THROW(
+        descriptors.size() < descriptors.max_size() - tree.size(),
+        E_OUTOFMEMORY);
+    descriptors.reserve(descriptors.size() + tree.size());
 
-        // Explode the contents of subfolders into the list
-        if (remote_itemid_view(pidl).is_folder())
-        {
-            pidl = NULL; // Reduce recursion footprint
-            _ExpandDirectoryTreeInto(
-                pidlParent, relative_pidl.get(), descriptors);
-        }
+    for (vector<pidl_t>::const_iterator it = tree.begin();
+         it != tree.end(); ++it)
+    {
+        descriptors.push_back(make_descriptor(*it, true));
     }
-    ATLENSURE(hr == S_FALSE);
-}
-
-com_ptr<IEnumIDList> CSftpDataObject::_GetEnumAll(const CAbsolutePidl& pidl)
-const throw(...)
-{
-    CSftpDirectory dir(pidl, m_provider);
-    return dir.GetEnum(
-        SHCONTF_FOLDERS | SHCONTF_NONFOLDERS | SHCONTF_INCLUDEHIDDEN);
 }
 
 /**
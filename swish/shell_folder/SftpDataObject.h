@@ -140,8 +140,6 @@ private:
     void _ExpandDirectoryTreeInto(
         const CAbsolutePidl& pidlParent, const CRelativePidl& pidlDirectory,
         __inout ExpandedList& descriptors) const throw(...);
-    comet::com_ptr<IEnumIDList> _GetEnumAll(const CAbsolutePidl& pidl)
-        const throw(...);
     inline bool _WantProgressDialogue() const throw();
     // @}
 };
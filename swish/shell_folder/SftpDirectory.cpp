@@ -44,12 +44,15 @@
 #include <boost/shared_ptr.hpp> // shared_ptr
 #include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
 
-#include <algorithm> // transform
+#include <algorithm> // sort, transform
 #include <exception> // exception
+#include <map>
+#include <utility> // pair
 #include <vector>
 
 using ssh::filesystem::path;
 
+using swish::provider::directory_tree;
 using swish::provider::sftp_provider;
 using swish::remote_folder::absolute_path_from_swish_pidl;
 using swish::remote_folder::create_remote_itemid;
@@ -63,6 +66,7 @@ using swish::host_folder::host_itemid_view;
 using washer::shell::pidl::apidl_t;
 using washer::shell::pidl::cpidl_t;
 using washer::shell::pidl::pidl_iterator;
+using washer::shell::pidl::pidl_t;
 using washer::shell::pidl::raw_pidl_iterator;
 using washer::trace;
 
@@ -82,6 +86,9 @@ using boost::ref;
 using boost::shared_ptr;
 
 using std::exception;
+using std::map;
+using std::pair;
+using std::sort;
 using std::vector;
 using std::wstring;
 
@@ -186,6 +193,18 @@ namespace {
             file.last_modified(), file.last_accessed());
     }
 
+    path tree_path(const pair<path, sftp_filesystem_item>& item)
+    {
+        return item.first / item.second.filename();
+    }
+
+    bool tree_order(
+        const pair<path, sftp_filesystem_item>& lhs,
+        const pair<path, sftp_filesystem_item>& rhs)
+    {
+        return tree_path(lhs) < tree_path(rhs);
+    }
+
     /**
      * Notify the shell that a new directory was created.
      *
@@ -283,6 +302,66 @@ com_ptr<IEnumIDList> CSftpDirectory::GetEnum(SHCONTF flags)
     return make_smart_enumeration<IEnumIDList>(pidls);
 }
 
+/**
+ * List everything below this directory, however deep.
+ *
+ * Many directories are listed at once, so this is much quicker than
+ * enumerating each directory in turn.  Every directory comes before the
+ * items in it.  Hidden items are included.  Links to directories are
+ * followed, as `GetEnum` treats them as directories.
+ *
+ * @param prefix  PIDL with which to prefix the returned PIDLs, which are
+ *                otherwise relative to this directory.
+ *
+ * @throws  if any directory can't be listed.
+ */
+vector<pidl_t> CSftpDirectory::GetTree(const pidl_t& prefix)
+{
+    directory_tree tree = m_provider->listing_tree(m_directory);
+
+    // Sorting by path puts every directory before its contents
+    sort(tree.begin(), tree.end(), tree_order);
+
+    map<path, apidl_t> absolute_directories;
+    map<path, pidl_t> prefixed_directories;
+    absolute_directories[path()] = m_directory_pidl;
+    prefixed_directories[path()] = prefix;
+
+    vector<pidl_t> pidls;
+    for (directory_tree::const_iterator it = tree.begin();
+         it != tree.end(); ++it)
+    {
+        const path& parent = it->first;
+        const sftp_filesystem_item& file = it->second;
+
+        cpidl_t item = convert_directory_entry_to_pidl(
+            file, m_directory / parent, *m_provider);
+
+        apidl_t absolute = absolute_directories[parent] + item;
+        pidl_t prefixed = prefixed_directories[parent] + item;
+        pidls.push_back(prefixed);
+
+        if (remote_itemid_view(item).is_folder())
+        {
+            if (is_link(file))
+            {
+                // The listing doesn't follow links, so the link's target
+                // is listed on its own
+                vector<pidl_t> below =
+                    CSftpDirectory(absolute, m_provider).GetTree(prefixed);
+                pidls.insert(pidls.end(), below.begin(), below.end());
+            }
+            else
+            {
+                absolute_directories[parent / file.filename()] = absolute;
+                prefixed_directories[parent / file.filename()] = prefixed;
+            }
+        }
+    }
+
+    return pidls;
+}
+
 /**
  * Get instance of CSftpDirectory for a subdirectory of this directory.
  *
@@ -359,8 +438,9 @@ bool CSftpDirectory::exists(const cpidl_t& file)
 
     try
     {
-        // std::ios_base::in makes it fail if file doesn't exist
-        m_provider->get_file(file_path, std::ios_base::in);
+        // Not opening the file, which would cost an extra round trip to
+        // close it and would fail for files we can't read
+        m_provider->stat(file_path, false);
     }
     catch (const exception&)
     {
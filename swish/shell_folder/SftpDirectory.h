@@ -39,6 +39,7 @@
 #include <boost/shared_ptr.hpp>
 
 #include <string>
+#include <vector>
 
 class CSftpDirectory
 {
@@ -48,6 +49,8 @@ public:
         boost::shared_ptr<swish::provider::sftp_provider> provider);
 
     comet::com_ptr<IEnumIDList> GetEnum(SHCONTF flags);
+    std::vector<washer::shell::pidl::pidl_t> GetTree(
+        const washer::shell::pidl::pidl_t& prefix);
     CSftpDirectory GetSubdirectory(
         const washer::shell::pidl::cpidl_t& directory);
     comet::com_ptr<IStream> GetFile(
@@ -29,6 +29,7 @@
 #include "Swish.h"  // Swish type-library
 
 #include "swish/atl.hpp"
+#include "swish/connection/session_pool.hpp"
 
 namespace swish {
 namespace shell_folder {
@@ -62,10 +63,20 @@ extern "C" BOOL WINAPI DllMain(
     return _Module.DllMain(dwReason, lpReserved); 
 }
 
-/** Used to determine whether the DLL can be unloaded by OLE. */
+/**
+ * Used to determine whether the DLL can be unloaded by OLE.
+ *
+ * Before agreeing, stops the session pool's maintenance thread, which
+ * couldn't be stopped safely once unloading had started.
+ */
 STDAPI DllCanUnloadNow()
 {
-    return _Module.DllCanUnloadNow();
+    HRESULT hr = _Module.DllCanUnloadNow();
+    if (hr == S_OK)
+    {
+        swish::connection::session_pool().stop_maintenance();
+    }
+    return hr;
 }
 
 /** Return a class factory to create an object of the requested type. */
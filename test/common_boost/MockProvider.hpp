@@ -32,6 +32,9 @@
 
 #include "swish/provider/sftp_provider.hpp" // sftp_provider
 
+#include <ssh/archive.hpp> // archive_statistics
+#include <ssh/filesystem.hpp> // batch_upload
+
 #include <comet/bstr.h> // bstr_t
 #include <comet/datetime.h> // datetime_t
 
@@ -40,6 +43,7 @@
 #include <boost/foreach.hpp> // BOOST_FOREACH
 #include <boost/format.hpp> // wformat
 #include <boost/shared_ptr.hpp>
+#include <boost/system/system_error.hpp> // system_error, errc
 #include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
 
 #include <functional> // equal_to, less
@@ -87,7 +91,11 @@ namespace detail {
             {
                 std::string message =
                     str(boost::format("Mock file '%s' not found") % name);
-                BOOST_THROW_EXCEPTION(std::exception(message.c_str()));
+                BOOST_THROW_EXCEPTION(
+                    boost::system::system_error(
+                        boost::system::errc::make_error_code(
+                            boost::system::errc::no_such_file_or_directory),
+                        message));
             }
 
             current_dir = dir;
@@ -458,8 +466,19 @@ public:
         FailRename          ///< Return E_FAIL.
     } RenameBehaviour;
 
+    /**
+    * Possible behaviours of mock create_hard_link() and copy_file() methods.
+    */
+    typedef enum tagDuplicateBehaviour {
+        CantDuplicate,   ///< Both fail as unsupported.
+        CopyOnly,        ///< Copying succeeds; linking fails as unsupported.
+        LinkAndCopy      ///< Both succeed.
+    } DuplicateBehaviour;
+
     MockProvider() :
-        m_listing_behaviour(MockListing), m_rename_behaviour(RenameOK)
+        m_listing_behaviour(MockListing), m_rename_behaviour(RenameOK),
+        m_duplicate_behaviour(CantDuplicate), m_links_made(0),
+        m_copies_made(0)
     {
         // Create filesystem root
         detail::FilesystemLocation root = m_filesystem.insert(
@@ -493,6 +512,21 @@ public:
         m_rename_behaviour = behaviour;
     }
 
+    void set_duplicate_behaviour(DuplicateBehaviour behaviour)
+    {
+        m_duplicate_behaviour = behaviour;
+    }
+
+    unsigned int links_made() const
+    {
+        return m_links_made;
+    }
+
+    unsigned int copies_made() const
+    {
+        return m_copies_made;
+    }
+
     virtual swish::provider::directory_listing listing(
         const ssh::filesystem::path& directory)
     {
@@ -534,6 +568,18 @@ public:
         return files;
     }
 
+    /**
+     * Lists each directory in turn, as the mock filesystem is no quicker at
+     * listing many at once.
+     */
+    virtual swish::provider::directory_tree listing_tree(
+        const ssh::filesystem::path& directory)
+    {
+        swish::provider::directory_tree tree;
+        add_tree(directory, ssh::filesystem::path(), tree);
+        return tree;
+    }
+
     virtual comet::com_ptr<IStream> get_file(
         const ssh::filesystem::path& file_path, std::ios_base::openmode /*mode*/)
     {
@@ -626,11 +672,146 @@ public:
         return *dir;
     }
 
+    /**
+     * Pretend every file was created.
+     */
+    virtual std::vector<boost::system::error_code> upload_batch(
+        const std::vector<ssh::filesystem::batch_upload>& files)
+    {
+        return std::vector<boost::system::error_code>(files.size());
+    }
+
+    /**
+     * Pretend the server has no way to hash files.
+     */
+    virtual std::string remote_hash(
+        const ssh::filesystem::path& /*file*/,
+        const std::string& /*algorithm*/)
+    {
+        BOOST_THROW_EXCEPTION(
+            boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::function_not_supported)));
+    }
+
+    /**
+     * Pretend the server can't say how much space it has.
+     */
+    virtual boost::uintmax_t available_space(
+        const ssh::filesystem::path& /*path*/)
+    {
+        BOOST_THROW_EXCEPTION(
+            boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::function_not_supported)));
+    }
+
+    /**
+     * Add a file like `target` at `link`, if the behaviour allows linking.
+     */
+    virtual void create_hard_link(
+        const ssh::filesystem::path& link,
+        const ssh::filesystem::path& target)
+    {
+        if (m_duplicate_behaviour != LinkAndCopy)
+        {
+            BOOST_THROW_EXCEPTION(
+                boost::system::system_error(
+                    boost::system::errc::make_error_code(
+                        boost::system::errc::function_not_supported)));
+        }
+
+        duplicate(target, link);
+        ++m_links_made;
+    }
+
+    /**
+     * Add a file like `from` at `to`, if the behaviour allows copying.
+     */
+    virtual void copy_file(
+        const ssh::filesystem::path& from,
+        const ssh::filesystem::path& to)
+    {
+        if (m_duplicate_behaviour == CantDuplicate)
+        {
+            BOOST_THROW_EXCEPTION(
+                boost::system::system_error(
+                    boost::system::errc::make_error_code(
+                        boost::system::errc::function_not_supported)));
+        }
+
+        duplicate(from, to);
+        ++m_copies_made;
+    }
+
+    /**
+     * Pretend the server can't run tar.
+     */
+    virtual ssh::filesystem::archive_statistics upload_tree(
+        const boost::filesystem::path& /*local_directory*/,
+        const ssh::filesystem::path& /*remote_directory*/,
+        tree_progress /*progress*/)
+    {
+        BOOST_THROW_EXCEPTION(
+            boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::function_not_supported)));
+    }
+
+    /**
+     * Pretend the server can't run tar.
+     */
+    virtual ssh::filesystem::archive_statistics download_tree(
+        const ssh::filesystem::path& /*remote_directory*/,
+        const boost::filesystem::path& /*local_directory*/,
+        tree_progress /*progress*/)
+    {
+        BOOST_THROW_EXCEPTION(
+            boost::system::system_error(
+                boost::system::errc::make_error_code(
+                    boost::system::errc::function_not_supported)));
+    }
+
 private:
 
+    void duplicate(
+        const ssh::filesystem::path& from, const ssh::filesystem::path& to)
+    {
+        swish::provider::sftp_filesystem_item original =
+            *detail::find_location_from_path(m_filesystem, from);
+
+        detail::make_item_in(
+            m_filesystem, to.parent_path(),
+            detail::mock_filesystem_file::create(
+                to.filename().wstring(), original.permissions(),
+                original.size_in_bytes(), original.last_modified()));
+    }
+
+    void add_tree(
+        const ssh::filesystem::path& root,
+        const ssh::filesystem::path& relative_directory,
+        swish::provider::directory_tree& tree)
+    {
+        swish::provider::directory_listing files =
+            listing(root / relative_directory);
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            tree.push_back(std::make_pair(relative_directory, files[i]));
+
+            if (files[i].type() == swish::provider::
+                    sftp_filesystem_item_interface::type::directory)
+            {
+                add_tree(root, relative_directory / files[i].filename(), tree);
+            }
+        }
+    }
+
     detail::Filesystem m_filesystem;
     ListingBehaviour m_listing_behaviour;
     RenameBehaviour m_rename_behaviour;
+    DuplicateBehaviour m_duplicate_behaviour;
+    unsigned int m_links_made;
+    unsigned int m_copies_made;
 };
 
 } // namespace test
@@ -24,12 +24,15 @@
 
 #include <comet/ptr.h> // com_ptr
 
+#include <boost/bind.hpp>
 #include <boost/container/vector.hpp> // move-aware vector
+#include <boost/date_time/posix_time/posix_time_types.hpp> // microsec_clock
 #include <boost/move/move.hpp>
 #include <boost/test/unit_test.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
 
+#include <algorithm> // max
 #include <exception>
 #include <string>
 #include <vector>
@@ -44,13 +47,20 @@ using test::fixtures::openssh_fixture;
 
 using comet::com_ptr;
 
+using boost::bind;
 using boost::container::vector;
 using boost::move;
 using boost::mutex;
+using boost::posix_time::microsec_clock;
+using boost::posix_time::milliseconds;
+using boost::posix_time::ptime;
+using boost::posix_time::seconds;
+using boost::posix_time::time_duration;
 using boost::shared_ptr;
 using boost::ref;
 using boost::test_tools::predicate_result;
 using boost::thread;
+using boost::thread_group;
 
 using std::exception;
 using std::string;
@@ -302,4 +312,155 @@ BOOST_AUTO_TEST_CASE(removing_session_with_colliding_task_names)
     BOOST_CHECK_EQUAL(progress.notifications()[2].size(), 0U);
 }
 
+namespace
+{
+void release_after(session_reservation* ticket, time_duration delay)
+{
+    boost::this_thread::sleep(delay);
+    session_reservation released(move(*ticket));
+}
+
+/**
+ * Progress callback that gives up once told to by another thread.
+ */
+class cancellable_progress : boost::noncopyable
+{
+public:
+    cancellable_progress() : m_cancelled(false) {}
+
+    template <typename Range>
+    bool operator()(const Range&)
+    {
+        mutex::scoped_lock lock(m_mutex);
+        return !m_cancelled;
+    }
+
+    void cancel()
+    {
+        mutex::scoped_lock lock(m_mutex);
+        m_cancelled = true;
+    }
+
+private:
+    mutex m_mutex;
+    bool m_cancelled;
+};
+
+void cancel_after(
+    cancellable_progress* progress, const connection_spec& spec,
+    time_duration delay)
+{
+    boost::this_thread::sleep(delay);
+    progress->cancel();
+    session_manager().recheck_disconnection(spec);
+}
+
+void make_reservations(
+    const connection_spec& spec, com_ptr<ISftpConsumer> consumer, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        session_reservation ticket =
+            session_manager().reserve_session(spec, consumer, "Benchmark");
+    }
+}
+}
+
+/**
+ * Disconnection must proceed as soon as the last task lets go, not when it
+ * next happens to check.
+ */
+BOOST_AUTO_TEST_CASE(disconnection_wakes_when_tasks_finish)
+{
+    connection_spec spec(get_connection());
+
+    session_reservation ticket =
+        session_manager().reserve_session(spec, consumer(), "Testing");
+
+    thread releaser(bind(&release_after, &ticket, milliseconds(100)));
+
+    ptime start = microsec_clock::universal_time();
+
+    progress_callback progress;
+    session_manager().disconnect_session(spec, ref(progress));
+
+    time_duration waited = microsec_clock::universal_time() - start;
+    releaser.join();
+
+    BOOST_CHECK(!session_manager().has_session(spec));
+    BOOST_CHECK_LT(waited, seconds(1));
+}
+
+/**
+ * Cancelling must stop the wait as soon as the waiter is told, even though
+ * the task it is waiting for carries on.
+ */
+BOOST_AUTO_TEST_CASE(disconnection_wakes_when_cancelled)
+{
+    connection_spec spec(get_connection());
+
+    session_reservation ticket =
+        session_manager().reserve_session(spec, consumer(), "Testing");
+
+    cancellable_progress progress;
+    thread canceller(
+        bind(&cancel_after, &progress, spec, milliseconds(100)));
+
+    ptime start = microsec_clock::universal_time();
+
+    session_manager().disconnect_session(spec, ref(progress));
+
+    time_duration waited = microsec_clock::universal_time() - start;
+    canceller.join();
+
+    BOOST_CHECK(session_manager().has_session(spec));
+    BOOST_CHECK(alive(ticket.session()));
+    BOOST_CHECK_LT(waited, seconds(1));
+}
+
+/**
+ * Contention benchmark for the reservation ledger.
+ *
+ * Explorer calls `provider_from_pidl`, and so reserves a session, for
+ * almost every item it touches, from many threads at once.  Each
+ * reservation is short-lived, so reserving and releasing must stay cheap
+ * under contention.
+ *
+ * This only reports the rate.  How fast is fast enough depends on the
+ * machine, so it isn't something a test can pass or fail on.
+ */
+BOOST_AUTO_TEST_CASE(reservation_throughput)
+{
+    const int thread_count = 8;
+    const int reservations_per_thread = 5000;
+
+    connection_spec spec(get_connection());
+    com_ptr<ISftpConsumer> benchmark_consumer = consumer();
+
+    // Connect first so that we measure the ledger, not the handshake
+    session_reservation warm_up =
+        session_manager().reserve_session(spec, benchmark_consumer, "Warm-up");
+
+    ptime start = microsec_clock::universal_time();
+
+    thread_group threads;
+    for (int i = 0; i < thread_count; ++i)
+    {
+        threads.create_thread(
+            bind(&make_reservations, spec, benchmark_consumer,
+                 reservations_per_thread));
+    }
+    threads.join_all();
+
+    time_duration elapsed = microsec_clock::universal_time() - start;
+
+    double total = thread_count * reservations_per_thread;
+    double per_second =
+        total / (std::max)(elapsed.total_microseconds() / 1000000.0, 1e-6);
+
+    BOOST_TEST_MESSAGE(
+        total << " reservations in " << elapsed << " (" << per_second
+        << " per second)");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -35,6 +35,8 @@
 
 using swish::connection::authenticated_session;
 using swish::connection::connection_spec;
+using swish::connection::pooled_session_statistics;
+using swish::connection::session_maintenance_policy;
 using swish::connection::session_pool;
 
 using test::CConsumerStub;
@@ -44,6 +46,7 @@ using comet::com_ptr;
 using comet::thread;
 
 using boost::exception_ptr;
+using boost::posix_time::seconds;
 using boost::shared_ptr;
 using boost::test_tools::predicate_result;
 
@@ -88,6 +91,50 @@ public:
             return res;
         }
     }
+
+    /**
+     * Statistics of the given connection's pooled session in a lane.
+     */
+    pooled_session_statistics statistics_for(
+        const connection_spec& spec, unsigned int lane=0)
+    {
+        vector<pooled_session_statistics> stats =
+            session_pool().statistics();
+
+        for (size_t i = 0; i < stats.size(); ++i)
+        {
+            if (!(stats[i].specification < spec) &&
+                !(spec < stats[i].specification) && stats[i].lane == lane)
+            {
+                return stats[i];
+            }
+        }
+
+        BOOST_FAIL("No statistics for session");
+        return pooled_session_statistics(spec, lane);
+    }
+};
+
+/**
+ * Maintenance policy that closes any session as soon as it isn't in use.
+ *
+ * Restores the default policy when it goes out of scope so that other
+ * tests don't see their sessions vanish.
+ */
+class aggressive_reaping
+{
+public:
+    aggressive_reaping()
+    {
+        session_maintenance_policy policy;
+        policy.idle_limit = seconds(0);
+        session_pool().configure_maintenance(policy);
+    }
+
+    ~aggressive_reaping()
+    {
+        session_pool().configure_maintenance(session_maintenance_policy());
+    }
 };
 }
 
@@ -262,6 +309,49 @@ BOOST_AUTO_TEST_CASE(remove_session)
     BOOST_CHECK(!session_pool().has_session(spec));
 }
 
+/**
+ * Each lane is a connection of its own, used and released separately.
+ */
+BOOST_AUTO_TEST_CASE(lanes_are_separate_sessions)
+{
+    connection_spec spec(get_connection());
+
+    authenticated_session& main =
+        session_pool().pooled_session_in_use(spec, consumer());
+    authenticated_session& worker =
+        session_pool().pooled_session_in_use(spec, consumer(), 1);
+
+    BOOST_CHECK(&main != &worker);
+    BOOST_CHECK(alive(main));
+    BOOST_CHECK(alive(worker));
+
+    session_pool().end_use(spec, 1);
+    BOOST_CHECK_EQUAL(statistics_for(spec).users, 1U);
+    BOOST_CHECK_EQUAL(statistics_for(spec, 1).users, 0U);
+
+    session_pool().end_use(spec);
+}
+
+BOOST_AUTO_TEST_CASE(remove_session_removes_every_lane)
+{
+    connection_spec spec(get_connection());
+
+    session_pool().pooled_session(spec, consumer());
+    session_pool().pooled_session_in_use(spec, consumer(), 1);
+    session_pool().end_use(spec, 1);
+
+    session_pool().remove_session(spec);
+
+    BOOST_CHECK(!session_pool().has_session(spec));
+
+    vector<pooled_session_statistics> stats = session_pool().statistics();
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        BOOST_CHECK(
+            stats[i].specification < spec || spec < stats[i].specification);
+    }
+}
+
 /**
  * Test that sessions in the pool survive server restarts
  * (modulo re-authentication).
@@ -283,4 +373,143 @@ BOOST_AUTO_TEST_CASE(sessions_across_server_restart)
     BOOST_CHECK(alive(session_pool().pooled_session(spec, consumer())));
 }
 
+BOOST_AUTO_TEST_CASE(statistics_track_users)
+{
+    connection_spec spec(get_connection());
+
+    session_pool().pooled_session(spec, consumer());
+
+    BOOST_CHECK_EQUAL(statistics_for(spec).users, 0U);
+    BOOST_CHECK(statistics_for(spec).alive);
+
+    session_pool().begin_use(spec);
+    BOOST_CHECK_EQUAL(statistics_for(spec).users, 1U);
+    BOOST_CHECK_EQUAL(statistics_for(spec).idle_time, seconds(0));
+
+    session_pool().end_use(spec);
+    BOOST_CHECK_EQUAL(statistics_for(spec).users, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(maintenance_keeps_live_sessions_by_default)
+{
+    connection_spec spec(get_connection());
+
+    authenticated_session& session =
+        session_pool().pooled_session(spec, consumer());
+
+    session_pool().perform_maintenance();
+
+    BOOST_CHECK(session_pool().has_session(spec));
+    BOOST_CHECK(alive(session));
+}
+
+BOOST_AUTO_TEST_CASE(maintenance_reaps_idle_sessions)
+{
+    aggressive_reaping policy;
+
+    connection_spec spec(get_connection());
+
+    session_pool().pooled_session(spec, consumer());
+
+    session_pool().perform_maintenance();
+
+    BOOST_CHECK(!session_pool().has_session(spec));
+}
+
+BOOST_AUTO_TEST_CASE(maintenance_reaps_idle_lanes_but_not_main_session)
+{
+    session_maintenance_policy policy;
+    policy.lane_idle_limit = seconds(0);
+    session_pool().configure_maintenance(policy);
+
+    connection_spec spec(get_connection());
+
+    session_pool().pooled_session(spec, consumer());
+    session_pool().pooled_session_in_use(spec, consumer(), 1);
+    session_pool().end_use(spec, 1);
+
+    session_pool().perform_maintenance();
+
+    session_pool().configure_maintenance(session_maintenance_policy());
+
+    BOOST_CHECK(session_pool().has_session(spec));
+
+    vector<pooled_session_statistics> stats = session_pool().statistics();
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(stats[i].lane, 0U);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(maintenance_never_reaps_sessions_in_use)
+{
+    aggressive_reaping policy;
+
+    connection_spec spec(get_connection());
+
+    authenticated_session& session =
+        session_pool().pooled_session(spec, consumer());
+    session_pool().begin_use(spec);
+
+    session_pool().perform_maintenance();
+
+    BOOST_CHECK(session_pool().has_session(spec));
+    BOOST_CHECK(alive(session));
+
+    session_pool().end_use(spec);
+}
+
+BOOST_AUTO_TEST_CASE(session_handed_over_in_use_is_never_reaped)
+{
+    aggressive_reaping policy;
+
+    connection_spec spec(get_connection());
+
+    authenticated_session& session =
+        session_pool().pooled_session_in_use(spec, consumer());
+    BOOST_CHECK_EQUAL(statistics_for(spec).users, 1U);
+
+    session_pool().perform_maintenance();
+
+    BOOST_CHECK(session_pool().has_session(spec));
+    BOOST_CHECK(alive(session));
+
+    session_pool().end_use(spec);
+}
+
+/**
+ * The module stops maintenance before it unloads, but COM may keep it
+ * loaded and hand out more objects, so the pool must carry on working.
+ */
+BOOST_AUTO_TEST_CASE(pool_works_after_maintenance_stops)
+{
+    connection_spec spec(get_connection());
+
+    authenticated_session& session =
+        session_pool().pooled_session(spec, consumer());
+
+    session_pool().stop_maintenance();
+    session_pool().stop_maintenance();
+
+    BOOST_CHECK(alive(session));
+    BOOST_CHECK(alive(session_pool().pooled_session(spec, consumer())));
+}
+
+/**
+ * A dead session should be gone from the pool before anyone asks for it,
+ * so that the next request connects afresh rather than stalling.
+ */
+BOOST_AUTO_TEST_CASE(maintenance_evicts_dead_sessions)
+{
+    connection_spec spec(get_connection());
+
+    session_pool().pooled_session(spec, consumer());
+
+    stop_server();
+
+    session_pool().perform_maintenance();
+
+    BOOST_CHECK(!session_pool().has_session(spec));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,100 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "swish/drop_target/BatchCopyOperation.hpp" // Test subject
+
+#include "swish/drop_target/RootedSource.hpp"
+#include "swish/drop_target/SftpDestination.hpp"
+
+#include <test/fixtures/local_sandbox_fixture.hpp>
+
+#include <washer/shell/shell.hpp> // pidl_from_parsing_name
+#include <washer/shell/pidl.hpp>  // apidl_t
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstddef> // size_t
+
+using swish::drop_target::BatchCopyOperation;
+using swish::drop_target::RootedSource;
+using swish::drop_target::SftpDestination;
+
+using test::fixtures::local_sandbox_fixture;
+
+using washer::shell::pidl::apidl_t;
+using washer::shell::pidl_from_parsing_name;
+
+using std::size_t;
+
+namespace
+{
+
+class BatchFixture : public local_sandbox_fixture
+{
+public:
+    BatchFixture()
+        : m_file(pidl_from_parsing_name(new_file_in_local_sandbox().wstring()))
+    {
+    }
+
+    /**
+     * Add a file claiming to be the given size.  Nothing is read until
+     * the batch runs, so the file needn't really be that big.
+     */
+    void add(BatchCopyOperation& batch, boost::uintmax_t size)
+    {
+        batch.add_file(
+            RootedSource(m_file.parent(), m_file.last_item()),
+            SftpDestination(m_file.parent(), L"file"), size);
+    }
+
+private:
+    apidl_t m_file;
+};
+}
+
+BOOST_FIXTURE_TEST_SUITE(batch_copy_operation_tests, BatchFixture)
+
+BOOST_AUTO_TEST_CASE(bytes_are_capped)
+{
+    BatchCopyOperation batch;
+
+    add(batch, BatchCopyOperation::MAX_BYTES - 10);
+
+    BOOST_CHECK(batch.has_room_for(10));
+    BOOST_CHECK(!batch.has_room_for(11));
+}
+
+BOOST_AUTO_TEST_CASE(files_are_capped)
+{
+    BatchCopyOperation batch;
+
+    for (size_t i = 0; i < BatchCopyOperation::MAX_FILES; ++i)
+    {
+        BOOST_REQUIRE(batch.has_room_for(0));
+        add(batch, 0);
+    }
+
+    BOOST_CHECK(!batch.has_room_for(0));
+}
+
+BOOST_AUTO_TEST_CASE(empty_batch_takes_any_file)
+{
+    BatchCopyOperation batch;
+
+    BOOST_CHECK(batch.has_room_for(BatchCopyOperation::MAX_BYTES + 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
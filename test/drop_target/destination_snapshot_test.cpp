@@ -0,0 +1,189 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "swish/drop_target/DestinationSnapshot.hpp" // Test subject
+
+#include "test/common_boost/MockProvider.hpp"
+
+#include <ssh/filesystem/path.hpp>
+
+#include <boost/system/system_error.hpp> // system_error, errc
+#include <boost/test/unit_test.hpp>
+
+using swish::drop_target::DestinationSnapshot;
+using swish::provider::directory_listing;
+using swish::provider::sftp_filesystem_item;
+
+using test::MockProvider;
+
+using ssh::filesystem::path;
+
+using boost::system::system_error;
+namespace errc = boost::system::errc;
+
+namespace
+{
+
+/**
+ * Mock provider that counts the trips to the server we care about.
+ */
+class counting_provider : public MockProvider
+{
+public:
+    counting_provider() : listings(0), stats(0)
+    {
+    }
+
+    virtual directory_listing listing(const path& directory)
+    {
+        ++listings;
+        return MockProvider::listing(directory);
+    }
+
+    virtual sftp_filesystem_item stat(const path& target, bool follow_links)
+    {
+        ++stats;
+        return MockProvider::stat(target, follow_links);
+    }
+
+    int listings;
+    int stats;
+};
+
+/**
+ * Mock provider where another worker creates a file while the directory
+ * is being listed, too late for the listing to include it.
+ */
+class racing_provider : public MockProvider
+{
+public:
+    racing_provider(DestinationSnapshot& snapshot, const path& created)
+        : m_snapshot(snapshot), m_created(created)
+    {
+    }
+
+    virtual directory_listing listing(const path& directory)
+    {
+        directory_listing names = MockProvider::listing(directory);
+        m_snapshot.file_created(m_created);
+        return names;
+    }
+
+private:
+    DestinationSnapshot& m_snapshot;
+    path m_created;
+};
+
+/**
+ * Mock provider that won't say whether anything exists.
+ */
+class secretive_provider : public MockProvider
+{
+public:
+    secretive_provider()
+    {
+        set_listing_behaviour(MockProvider::FailListing);
+    }
+
+    virtual sftp_filesystem_item stat(const path&, bool)
+    {
+        BOOST_THROW_EXCEPTION(
+            system_error(errc::make_error_code(errc::permission_denied)));
+    }
+};
+
+class SnapshotFixture
+{
+public:
+    counting_provider provider;
+    DestinationSnapshot snapshot;
+};
+}
+
+BOOST_FIXTURE_TEST_SUITE(destination_snapshot_tests, SnapshotFixture)
+
+BOOST_AUTO_TEST_CASE(existing_file_is_found)
+{
+    BOOST_CHECK(snapshot.exists(provider, "/tmp/testtmpfile"));
+}
+
+BOOST_AUTO_TEST_CASE(missing_file_is_not_found)
+{
+    BOOST_CHECK(!snapshot.exists(provider, "/tmp/nothing-here"));
+}
+
+BOOST_AUTO_TEST_CASE(each_directory_is_listed_once)
+{
+    snapshot.exists(provider, "/tmp/testtmpfile");
+    snapshot.exists(provider, "/tmp/testtmpfile.txt");
+    snapshot.exists(provider, "/tmp/nothing-here");
+    BOOST_CHECK_EQUAL(provider.listings, 1);
+
+    snapshot.exists(provider, "/tmp/swish/testswishfile");
+    snapshot.exists(provider, "/tmp/swish/nothing-here");
+    BOOST_CHECK_EQUAL(provider.listings, 2);
+
+    BOOST_CHECK_EQUAL(provider.stats, 0);
+}
+
+BOOST_AUTO_TEST_CASE(created_file_is_remembered)
+{
+    BOOST_CHECK(!snapshot.exists(provider, "/tmp/new-file"));
+
+    snapshot.file_created("/tmp/new-file");
+
+    BOOST_CHECK(snapshot.exists(provider, "/tmp/new-file"));
+    BOOST_CHECK_EQUAL(provider.listings, 1);
+}
+
+BOOST_AUTO_TEST_CASE(file_created_while_listing_is_remembered)
+{
+    racing_provider racing(snapshot, "/tmp/new-file");
+
+    BOOST_CHECK(!snapshot.exists(racing, "/tmp/nothing-here"));
+    BOOST_CHECK(snapshot.exists(racing, "/tmp/new-file"));
+}
+
+BOOST_AUTO_TEST_CASE(created_directory_is_never_listed)
+{
+    BOOST_CHECK(!snapshot.exists(provider, "/tmp/new-directory"));
+
+    snapshot.directory_created("/tmp/new-directory");
+
+    BOOST_CHECK(snapshot.exists(provider, "/tmp/new-directory"));
+    BOOST_CHECK(!snapshot.exists(provider, "/tmp/new-directory/file"));
+    BOOST_CHECK_EQUAL(provider.listings, 1);
+}
+
+BOOST_AUTO_TEST_CASE(unlistable_directory_checks_each_file)
+{
+    provider.set_listing_behaviour(MockProvider::FailListing);
+
+    BOOST_CHECK(snapshot.exists(provider, "/tmp/testtmpfile"));
+    BOOST_CHECK(!snapshot.exists(provider, "/tmp/nothing-here"));
+
+    BOOST_CHECK_EQUAL(provider.listings, 1);
+    BOOST_CHECK_EQUAL(provider.stats, 2);
+}
+
+BOOST_AUTO_TEST_CASE(only_missing_files_are_not_found)
+{
+    secretive_provider secretive;
+
+    BOOST_CHECK_THROW(
+        snapshot.exists(secretive, "/tmp/testtmpfile"), system_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
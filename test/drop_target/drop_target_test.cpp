@@ -14,6 +14,11 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "swish/drop_target/DropTarget.hpp" // Test subject
+#include "swish/drop_target/ArchiveCopyPlan.hpp"
+#include "swish/drop_target/CopyFileOperation.hpp"
+#include "swish/drop_target/PidlCopyPlan.hpp"
+#include "swish/drop_target/SequentialPlan.hpp"
+#include "swish/shell_folder/data_object/ShellDataObject.hpp" // PidlFormat
 #include "swish/shell/shell.hpp"            // data_object_for_files
 
 #include "test/common_boost/data_object_utils.hpp" // DataObjects on zip
@@ -25,8 +30,12 @@
 #include <ssh/stream.hpp>
 #include <ssh/filesystem.hpp>
 
+#include <washer/shell/shell.hpp> // pidl_from_parsing_name
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
@@ -37,11 +46,21 @@
 #include <iterator>
 #include <algorithm>
 
+using swish::drop_target::ArchiveCopyPlan;
 using swish::drop_target::CDropTarget;
+using swish::drop_target::CopyFileOperation;
 using swish::drop_target::DropActionCallback;
 using swish::drop_target::copy_data_to_provider;
+using swish::drop_target::duplicate_policy;
+using swish::drop_target::ParallelPlan;
+using swish::drop_target::PidlCopyPlan;
 using swish::drop_target::Progress;
+using swish::drop_target::RootedSource;
+using swish::drop_target::SequentialPlan;
+using swish::drop_target::SftpDestination;
+using swish::provider::sftp_provider;
 using swish::shell::data_object_for_files;
+using swish::shell_folder::data_object::PidlFormat;
 
 using test::ComFixture;
 using test::fixtures::provider_fixture;
@@ -57,6 +76,10 @@ using ssh::filesystem::sftp_filesystem;
 using boost::filesystem::ofstream;
 using boost::filesystem::path;
 using boost::make_shared;
+using boost::mutex;
+using boost::posix_time::microsec_clock;
+using boost::posix_time::ptime;
+using boost::posix_time::time_duration;
 using boost::shared_ptr;
 using boost::test_tools::predicate_result;
 
@@ -66,6 +89,7 @@ using std::vector;
 using std::istreambuf_iterator;
 
 using washer::shell::pidl::apidl_t;
+using washer::shell::pidl_from_parsing_name;
 
 namespace
 { // private
@@ -114,6 +138,50 @@ void fill_file(const path& file)
     stream.write(test_data().c_str(), test_data().size());
 }
 
+/**
+ * Create a folder of small files, half of them in a subfolder.
+ */
+void create_tree_of_files(const path& folder, int file_count)
+{
+    create_directory(folder);
+    create_directory(folder / L"nested");
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        path parent = (i % 2) ? folder : folder / L"nested";
+        fill_file(parent / (L"file" + std::to_wstring(i)));
+    }
+}
+
+/**
+ * Reserves each provider asked for on a lane of its own.
+ */
+class lane_providers
+{
+public:
+    explicit lane_providers(provider_fixture& fixture)
+        : m_fixture(&fixture), m_guard(make_shared<mutex>()),
+          m_lanes_used(make_shared<unsigned int>(0))
+    {
+    }
+
+    shared_ptr<sftp_provider> operator()() const
+    {
+        unsigned int lane;
+        {
+            mutex::scoped_lock lock(*m_guard);
+            lane = ++*m_lanes_used;
+        }
+
+        return m_fixture->LaneProvider(lane);
+    }
+
+private:
+    provider_fixture* m_fixture;
+    shared_ptr<mutex> m_guard;
+    shared_ptr<unsigned int> m_lanes_used;
+};
+
 /**
  * Create a new empty file at the given path.
  */
@@ -277,6 +345,39 @@ BOOST_AUTO_TEST_CASE(copy_single)
     BOOST_REQUIRE(file_contents_correct(expected));
 }
 
+/**
+ * Copy a regular file too big to be batched.
+ *
+ * Files on a local disk are uploaded from a mapping of the file rather than
+ * through their stream, so this checks that the mapped data arrives intact.
+ */
+BOOST_AUTO_TEST_CASE(copy_single_large)
+{
+    path file = new_file_in_local_sandbox();
+    string data;
+    for (size_t i = 0; i < 256 * 1024; ++i)
+    {
+        data.push_back(static_cast<char>(i % 251));
+    }
+    {
+        ofstream stream(file, std::ios_base::binary);
+        stream.write(data.data(), data.size());
+    }
+
+    ssh::filesystem::path destination = new_directory_in_sandbox();
+
+    shared_ptr<CopyCallbackStub> cb(new CopyCallbackStub);
+    copy_data_to_provider(
+        data_object_for_files(&file, &file + 1), Provider(),
+        directory_pidl(destination), cb);
+
+    ssh::filesystem::path expected = destination / file.filename().wstring();
+    ifstream stream(filesystem(), expected);
+    string contents = string(istreambuf_iterator<char>(stream),
+                             istreambuf_iterator<char>());
+    BOOST_CHECK(contents == data);
+}
+
 /**
  * Copy several regular files.
  *
@@ -460,6 +561,143 @@ BOOST_AUTO_TEST_CASE(copy_virtual_hierarchy_recursively)
     BOOST_REQUIRE(exists(filesystem(), expected));
 }
 
+/**
+ * Copy a folder with enough small files that it goes as an archive.
+ *
+ * The drop target only sends archives when asked to.
+ */
+BOOST_AUTO_TEST_CASE(copy_large_tree)
+{
+    path folder = local_sandbox() / L"many-files";
+    create_tree_of_files(folder, 150);
+
+    com_ptr<IDataObject> spdo = data_object_for_files(&folder, &folder + 1);
+
+    ssh::filesystem::path destination = new_directory_in_sandbox();
+
+    shared_ptr<CopyCallbackStub> cb(new CopyCallbackStub);
+    copy_data_to_provider(
+        spdo, Provider(), directory_pidl(destination), cb,
+        ParallelPlan::provider_factory(), duplicate_policy::upload, true);
+
+    for (int i = 0; i < 150; ++i)
+    {
+        ssh::filesystem::path parent = destination / L"many-files";
+        if (i % 2 == 0)
+            parent = parent / L"nested";
+
+        ssh::filesystem::path expected =
+            parent / (L"file" + std::to_wstring(i));
+        BOOST_REQUIRE(exists(filesystem(), expected));
+        BOOST_REQUIRE(file_contents_correct(expected));
+    }
+}
+
+/**
+ * Time the same tree of small files sent file by file and as an archive.
+ *
+ * Against a local server round trips cost little, so the gap here is the
+ * least a real network would show.
+ */
+BOOST_AUTO_TEST_CASE(archive_against_file_by_file)
+{
+    path by_file_folder = local_sandbox() / L"by-file";
+    path archive_folder = local_sandbox() / L"by-archive";
+    create_tree_of_files(by_file_folder, 500);
+    create_tree_of_files(archive_folder, 500);
+
+    ssh::filesystem::path destination = new_directory_in_sandbox();
+    CopyCallbackStub callback;
+
+    PidlCopyPlan by_file(
+        PidlFormat(data_object_for_files(
+            &by_file_folder, &by_file_folder + 1)),
+        directory_pidl(destination));
+    ptime start = microsec_clock::universal_time();
+    by_file.execute_plan(callback, Provider());
+    time_duration by_file_time = microsec_clock::universal_time() - start;
+
+    ArchiveCopyPlan by_archive(
+        PidlFormat(data_object_for_files(
+            &archive_folder, &archive_folder + 1)),
+        directory_pidl(destination));
+    start = microsec_clock::universal_time();
+    by_archive.execute_plan(callback, Provider());
+    time_duration archive_time = microsec_clock::universal_time() - start;
+
+    BOOST_TEST_MESSAGE("500 small files: " << by_file_time.total_milliseconds()
+                       << "ms file by file, "
+                       << archive_time.total_milliseconds()
+                       << "ms as an archive");
+
+    BOOST_CHECK(file_contents_correct(
+        destination / L"by-file" / L"nested" / L"file498"));
+    BOOST_CHECK(file_contents_correct(
+        destination / L"by-archive" / L"nested" / L"file498"));
+}
+
+/**
+ * Time the same large files copied one at a time and by workers that each
+ * have a connection of their own.
+ */
+BOOST_AUTO_TEST_CASE(parallel_against_sequential)
+{
+    string data(1024 * 1024, 'p');
+    vector<path> files;
+    for (int i = 0; i < 8; ++i)
+    {
+        files.push_back(new_file_in_local_sandbox());
+        ofstream stream(files.back(), std::ios_base::binary);
+        stream.write(data.data(), data.size());
+    }
+
+    ssh::filesystem::path one_at_a_time = new_directory_in_sandbox();
+    ssh::filesystem::path side_by_side = new_directory_in_sandbox();
+
+    SequentialPlan sequential;
+    ParallelPlan parallel(
+        ParallelPlan::DEFAULT_WORKER_COUNT, lane_providers(*this));
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        apidl_t file = pidl_from_parsing_name(files[i].wstring());
+        RootedSource source(file.parent(), file.last_item());
+        wstring name = files[i].filename().wstring();
+
+        sequential.add_stage(CopyFileOperation(
+            source, SftpDestination(directory_pidl(one_at_a_time), name),
+            data.size()));
+        parallel.add_stage(CopyFileOperation(
+            source, SftpDestination(directory_pidl(side_by_side), name),
+            data.size()));
+    }
+
+    CopyCallbackStub callback;
+
+    ptime start = microsec_clock::universal_time();
+    sequential.execute_plan(callback, Provider());
+    time_duration sequential_time = microsec_clock::universal_time() - start;
+
+    start = microsec_clock::universal_time();
+    parallel.execute_plan(callback, Provider());
+    time_duration parallel_time = microsec_clock::universal_time() - start;
+
+    BOOST_TEST_MESSAGE("8 files of 1MB: "
+                       << sequential_time.total_milliseconds()
+                       << "ms one at a time, "
+                       << parallel_time.total_milliseconds()
+                       << "ms on " << ParallelPlan::DEFAULT_WORKER_COUNT
+                       << " connections");
+
+    BOOST_CHECK(parallel_time < sequential_time);
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(
+            file_size(filesystem(),
+                      side_by_side / files[i].filename().wstring()),
+            data.size());
+    }
+}
+
 /**
  * Overwrite an existing file.
  *
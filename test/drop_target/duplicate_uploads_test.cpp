@@ -0,0 +1,270 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "swish/drop_target/DuplicateUploads.hpp" // Test subject
+#include "swish/drop_target/DeduplicatedCopyOperation.hpp" // Test subject
+
+#include "swish/drop_target/DestinationSnapshot.hpp"
+#include "swish/drop_target/Operation.hpp" // OperationCallback
+#include "swish/drop_target/RootedSource.hpp"
+#include "swish/drop_target/SftpDestination.hpp"
+
+#include "test/common_boost/MockProvider.hpp"
+#include "test/common_boost/SwishPidlFixture.hpp"
+#include <test/fixtures/local_sandbox_fixture.hpp>
+
+#include <washer/shell/pidl.hpp>  // apidl_t
+#include <washer/shell/shell.hpp> // pidl_from_parsing_name
+
+#include <comet/error.h> // com_error
+
+#include <ssh/filesystem/path.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/date_time/posix_time/posix_time_duration.hpp> // milliseconds
+#include <boost/make_shared.hpp>
+#include <boost/ref.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/throw_exception.hpp> // BOOST_THROW_EXCEPTION
+
+using swish::drop_target::DeduplicatedCopyOperation;
+using swish::drop_target::DestinationSnapshot;
+using swish::drop_target::DuplicateUploads;
+using swish::drop_target::OperationCallback;
+using swish::drop_target::RootedSource;
+using swish::drop_target::SftpDestination;
+
+using test::MockProvider;
+using test::SwishPidlFixture;
+using test::fixtures::local_sandbox_fixture;
+
+using washer::shell::pidl::apidl_t;
+using washer::shell::pidl_from_parsing_name;
+
+using comet::com_error;
+
+using ssh::filesystem::path;
+
+using boost::bind;
+using boost::make_shared;
+using boost::posix_time::milliseconds;
+using boost::shared_ptr;
+using boost::thread;
+using boost::uintmax_t;
+
+namespace
+{
+
+class cancellable_callback : public OperationCallback
+{
+public:
+    cancellable_callback() : cancelled(false)
+    {
+    }
+
+    virtual void check_if_user_cancelled() const
+    {
+        if (cancelled)
+            BOOST_THROW_EXCEPTION(com_error(E_ABORT));
+    }
+
+    virtual bool request_overwrite_permission(const path&) const
+    {
+        return false;
+    }
+
+    virtual void update_progress(uintmax_t, uintmax_t)
+    {
+    }
+
+    virtual DestinationSnapshot& destination_snapshot() const
+    {
+        return snapshot;
+    }
+
+    volatile bool cancelled;
+    mutable DestinationSnapshot snapshot;
+};
+
+void finish_later(DuplicateUploads& duplicates, const path& target,
+                  bool usable)
+{
+    boost::this_thread::sleep(milliseconds(50));
+    duplicates.upload_finished(target, usable);
+}
+
+void cancel_later(cancellable_callback& callback)
+{
+    boost::this_thread::sleep(milliseconds(50));
+    callback.cancelled = true;
+}
+
+class DuplicatesFixture
+{
+public:
+    DuplicatesFixture() : duplicates(false)
+    {
+    }
+
+    DuplicateUploads duplicates;
+    cancellable_callback callback;
+};
+
+/**
+ * A file the mock provider has in the directory of the dummy root PIDL.
+ */
+const path ORIGINAL = "/tmp/swish/testswishfile";
+
+class DeduplicatedCopyFixture : public local_sandbox_fixture,
+                                public SwishPidlFixture
+{
+public:
+    DeduplicatedCopyFixture()
+        : provider(make_shared<MockProvider>()),
+          m_file(pidl_from_parsing_name(new_file_in_local_sandbox().wstring()))
+    {
+    }
+
+    /**
+     * Copy a local file to /tmp/swish/copy as a duplicate of an original
+     * that has finished uploading.
+     */
+    void copy_duplicate(shared_ptr<DuplicateUploads> duplicates)
+    {
+        duplicates->upload_finished(ORIGINAL, true);
+
+        DeduplicatedCopyOperation operation(
+            RootedSource(m_file.parent(), m_file.last_item()),
+            SftpDestination(create_dummy_root_pidl(), L"copy"), 42,
+            duplicates, ORIGINAL);
+
+        operation(callback, provider);
+    }
+
+    shared_ptr<MockProvider> provider;
+    cancellable_callback callback;
+
+private:
+    apidl_t m_file;
+};
+}
+
+BOOST_FIXTURE_TEST_SUITE(duplicate_uploads_tests, DuplicatesFixture)
+
+BOOST_AUTO_TEST_CASE(finished_original_is_usable)
+{
+    duplicates.upload_finished("/tmp/original", true);
+
+    BOOST_CHECK(duplicates.wait_for_original("/tmp/original", callback));
+}
+
+BOOST_AUTO_TEST_CASE(failed_original_is_not_usable)
+{
+    duplicates.upload_finished("/tmp/original", false);
+
+    BOOST_CHECK(!duplicates.wait_for_original("/tmp/original", callback));
+}
+
+BOOST_AUTO_TEST_CASE(waits_for_original_to_finish)
+{
+    thread uploader(bind(&finish_later, boost::ref(duplicates),
+                         path("/tmp/original"), true));
+
+    BOOST_CHECK(duplicates.wait_for_original("/tmp/original", callback));
+
+    uploader.join();
+}
+
+BOOST_AUTO_TEST_CASE(cancelling_stops_the_wait)
+{
+    thread canceller(bind(&cancel_later, boost::ref(callback)));
+
+    BOOST_CHECK_THROW(
+        duplicates.wait_for_original("/tmp/original", callback), com_error);
+
+    canceller.join();
+}
+
+BOOST_AUTO_TEST_CASE(bytes_saved_are_totalled)
+{
+    duplicates.upload_avoided(100);
+    duplicates.upload_avoided(23);
+
+    BOOST_CHECK_EQUAL(duplicates.bytes_saved(), 123U);
+}
+
+BOOST_AUTO_TEST_CASE(clear_forgets_everything)
+{
+    duplicates.upload_avoided(100);
+    duplicates.upload_finished("/tmp/original", true);
+
+    duplicates.clear();
+
+    BOOST_CHECK_EQUAL(duplicates.bytes_saved(), 0U);
+
+    callback.cancelled = true;
+    BOOST_CHECK_THROW(
+        duplicates.wait_for_original("/tmp/original", callback), com_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(deduplicated_copy_tests, DeduplicatedCopyFixture)
+
+BOOST_AUTO_TEST_CASE(duplicate_is_linked_when_allowed)
+{
+    provider->set_duplicate_behaviour(MockProvider::LinkAndCopy);
+    shared_ptr<DuplicateUploads> duplicates =
+        make_shared<DuplicateUploads>(true);
+
+    copy_duplicate(duplicates);
+
+    BOOST_CHECK_EQUAL(provider->links_made(), 1U);
+    BOOST_CHECK_EQUAL(provider->copies_made(), 0U);
+    BOOST_CHECK_EQUAL(duplicates->bytes_saved(), 42U);
+    BOOST_CHECK_NO_THROW(provider->stat("/tmp/swish/copy", false));
+}
+
+BOOST_AUTO_TEST_CASE(duplicate_is_copied_unless_links_are_allowed)
+{
+    provider->set_duplicate_behaviour(MockProvider::LinkAndCopy);
+    shared_ptr<DuplicateUploads> duplicates =
+        make_shared<DuplicateUploads>(false);
+
+    copy_duplicate(duplicates);
+
+    BOOST_CHECK_EQUAL(provider->links_made(), 0U);
+    BOOST_CHECK_EQUAL(provider->copies_made(), 1U);
+    BOOST_CHECK_EQUAL(duplicates->bytes_saved(), 42U);
+    BOOST_CHECK_NO_THROW(provider->stat("/tmp/swish/copy", false));
+}
+
+BOOST_AUTO_TEST_CASE(duplicate_is_copied_when_server_cant_link)
+{
+    provider->set_duplicate_behaviour(MockProvider::CopyOnly);
+    shared_ptr<DuplicateUploads> duplicates =
+        make_shared<DuplicateUploads>(true);
+
+    copy_duplicate(duplicates);
+
+    BOOST_CHECK_EQUAL(provider->copies_made(), 1U);
+    BOOST_CHECK_EQUAL(duplicates->bytes_saved(), 42U);
+    BOOST_CHECK_NO_THROW(provider->stat("/tmp/swish/copy", false));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
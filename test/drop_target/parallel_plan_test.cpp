@@ -0,0 +1,609 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "swish/drop_target/ParallelPlan.hpp" // Test subject
+
+#include "swish/drop_target/DropActionCallback.hpp"
+#include "swish/drop_target/Operation.hpp"
+#include "swish/drop_target/Progress.hpp"
+#include "swish/provider/sftp_provider.hpp"
+
+#include "test/common_boost/MockProvider.hpp"
+
+#include <comet/error.h> // com_error
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm> // max
+#include <memory>    // auto_ptr
+#include <set>
+#include <stdexcept> // runtime_error
+#include <string>
+
+using swish::drop_target::DropActionCallback;
+using swish::drop_target::Operation;
+using swish::drop_target::OperationCallback;
+using swish::drop_target::ParallelPlan;
+using swish::drop_target::Progress;
+using swish::provider::sftp_provider;
+
+using test::MockProvider;
+
+using comet::com_error;
+
+using boost::make_shared;
+using boost::mutex;
+using boost::posix_time::microsec_clock;
+using boost::posix_time::milliseconds;
+using boost::posix_time::ptime;
+using boost::shared_ptr;
+using boost::this_thread::get_id;
+using boost::thread;
+using boost::uintmax_t;
+
+using std::auto_ptr;
+using std::runtime_error;
+using std::set;
+using std::wstring;
+
+namespace
+{
+
+/**
+ * What the stub operations got up to, shared between all the workers.
+ */
+class activity_log
+{
+public:
+    activity_log()
+        : m_started(0), m_running(0), m_most_running(0), m_completed(0)
+    {
+    }
+
+    void started(shared_ptr<sftp_provider> provider)
+    {
+        mutex::scoped_lock lock(m_mutex);
+        ++m_started;
+        ++m_running;
+        m_most_running = (std::max)(m_most_running, m_running);
+        m_providers.insert(provider.get());
+    }
+
+    void finished()
+    {
+        mutex::scoped_lock lock(m_mutex);
+        --m_running;
+        ++m_completed;
+    }
+
+    void abandoned()
+    {
+        mutex::scoped_lock lock(m_mutex);
+        --m_running;
+    }
+
+    unsigned int started() const
+    {
+        mutex::scoped_lock lock(m_mutex);
+        return m_started;
+    }
+
+    unsigned int most_running() const
+    {
+        mutex::scoped_lock lock(m_mutex);
+        return m_most_running;
+    }
+
+    unsigned int completed() const
+    {
+        mutex::scoped_lock lock(m_mutex);
+        return m_completed;
+    }
+
+    size_t distinct_providers() const
+    {
+        mutex::scoped_lock lock(m_mutex);
+        return m_providers.size();
+    }
+
+private:
+    mutable mutex m_mutex;
+    unsigned int m_started;
+    unsigned int m_running;
+    unsigned int m_most_running;
+    unsigned int m_completed;
+    set<sftp_provider*> m_providers;
+};
+
+/**
+ * Pretends to copy a file of the given size in four chunks.
+ */
+class StubOperation : public Operation
+{
+public:
+    StubOperation(shared_ptr<activity_log> log, uintmax_t size,
+                  unsigned int chunk_delay_ms = 1)
+        : m_log(log),
+          m_size(size),
+          m_chunk_delay_ms(chunk_delay_ms),
+          m_ask_to_overwrite(false),
+          m_fail(false)
+    {
+    }
+
+    StubOperation& asks_to_overwrite()
+    {
+        m_ask_to_overwrite = true;
+        return *this;
+    }
+
+    StubOperation& fails()
+    {
+        m_fail = true;
+        return *this;
+    }
+
+    wstring title() const
+    {
+        return L"title";
+    }
+
+    wstring description() const
+    {
+        return L"description";
+    }
+
+    uintmax_t expected_size() const
+    {
+        return m_size;
+    }
+
+    void operator()(OperationCallback& callback,
+                    shared_ptr<sftp_provider> provider) const
+    {
+        m_log->started(provider);
+        try
+        {
+            if (m_ask_to_overwrite &&
+                !callback.request_overwrite_permission("/tmp/file"))
+            {
+                m_log->finished();
+                return;
+            }
+
+            if (m_fail)
+                throw runtime_error("operation failed");
+
+            for (int chunk = 1; chunk <= 4; ++chunk)
+            {
+                callback.check_if_user_cancelled();
+                boost::this_thread::sleep(milliseconds(m_chunk_delay_ms));
+                callback.update_progress(m_size * chunk / 4, m_size);
+            }
+        }
+        catch (...)
+        {
+            m_log->abandoned();
+            throw;
+        }
+        m_log->finished();
+    }
+
+private:
+    Operation* do_clone() const
+    {
+        return new StubOperation(*this);
+    }
+
+    shared_ptr<activity_log> m_log;
+    uintmax_t m_size;
+    unsigned int m_chunk_delay_ms;
+    bool m_ask_to_overwrite;
+    bool m_fail;
+};
+
+/**
+ * What the user saw.
+ */
+struct user_view
+{
+    user_view()
+        : so_far(0),
+          out_of(0),
+          first_out_of(0),
+          went_backwards(false),
+          cancel_after_updates(0),
+          updates(0),
+          questions(0),
+          off_thread_interaction(false),
+          calling_thread(get_id())
+    {
+    }
+
+    void interaction()
+    {
+        if (get_id() != calling_thread)
+            off_thread_interaction = true;
+    }
+
+    ULONGLONG so_far;
+    ULONGLONG out_of;
+
+    /**
+     * The first total the user was shown.
+     */
+    ULONGLONG first_out_of;
+
+    bool went_backwards;
+    unsigned int cancel_after_updates;
+    unsigned int updates;
+    unsigned int questions;
+    bool off_thread_interaction;
+    thread::id calling_thread;
+};
+
+class ProgressStub : public Progress
+{
+public:
+    explicit ProgressStub(user_view& view) : m_view(view)
+    {
+    }
+
+    bool user_cancelled()
+    {
+        m_view.interaction();
+        return m_view.cancel_after_updates > 0 &&
+               m_view.updates >= m_view.cancel_after_updates;
+    }
+
+    void line(DWORD, const wstring&)
+    {
+        m_view.interaction();
+    }
+
+    void line_path(DWORD, const wstring&)
+    {
+        m_view.interaction();
+    }
+
+    void update(ULONGLONG so_far, ULONGLONG out_of)
+    {
+        m_view.interaction();
+        if (so_far < m_view.so_far)
+            m_view.went_backwards = true;
+        m_view.so_far = so_far;
+        m_view.out_of = out_of;
+        if (m_view.first_out_of == 0)
+            m_view.first_out_of = out_of;
+        ++m_view.updates;
+    }
+
+    void hide()
+    {
+    }
+
+    void show()
+    {
+    }
+
+private:
+    user_view& m_view;
+};
+
+class CallbackStub : public DropActionCallback
+{
+public:
+    explicit CallbackStub(bool allow_overwrite = true)
+        : m_allow_overwrite(allow_overwrite)
+    {
+    }
+
+    bool can_overwrite(const ssh::filesystem::path&)
+    {
+        view.interaction();
+        ++view.questions;
+        return m_allow_overwrite;
+    }
+
+    std::auto_ptr<Progress> progress()
+    {
+        view.interaction();
+        return std::auto_ptr<Progress>(new ProgressStub(view));
+    }
+
+    void handle_last_exception()
+    {
+    }
+
+    user_view view;
+
+private:
+    bool m_allow_overwrite;
+};
+
+class counting_factory
+{
+public:
+    explicit counting_factory(shared_ptr<unsigned int> count) : m_count(count)
+    {
+    }
+
+    shared_ptr<sftp_provider> operator()() const
+    {
+        ++*m_count;
+        return make_shared<MockProvider>();
+    }
+
+private:
+    shared_ptr<unsigned int> m_count;
+};
+
+/**
+ * Produces `count` operations but, after the first, waits to see it start.
+ */
+class watchful_producer
+{
+public:
+    watchful_producer(shared_ptr<activity_log> log, int count,
+                      shared_ptr<bool> saw_first_start)
+        : m_log(log), m_count(count), m_saw_first_start(saw_first_start)
+    {
+    }
+
+    void operator()(ParallelPlan::stage_sink sink) const
+    {
+        sink(StubOperation(m_log, 100));
+
+        ptime deadline = microsec_clock::universal_time() + milliseconds(2000);
+        while (m_log->started() == 0 &&
+               microsec_clock::universal_time() < deadline)
+        {
+            boost::this_thread::sleep(milliseconds(1));
+        }
+        *m_saw_first_start = m_log->started() > 0;
+
+        for (int i = 1; i < m_count; ++i)
+            sink(StubOperation(m_log, 100, 0));
+    }
+
+private:
+    shared_ptr<activity_log> m_log;
+    int m_count;
+    shared_ptr<bool> m_saw_first_start;
+};
+
+void failing_producer(shared_ptr<activity_log> log,
+                      ParallelPlan::stage_sink sink)
+{
+    sink(StubOperation(log, 100));
+    throw runtime_error("enumeration failed");
+}
+
+class ParallelPlanFixture
+{
+public:
+    ParallelPlanFixture()
+        : log(make_shared<activity_log>()),
+          provider(make_shared<MockProvider>())
+    {
+    }
+
+    shared_ptr<activity_log> log;
+    shared_ptr<sftp_provider> provider;
+};
+}
+
+BOOST_FIXTURE_TEST_SUITE(parallel_plan_tests, ParallelPlanFixture)
+
+BOOST_AUTO_TEST_CASE(empty_plan)
+{
+    ParallelPlan plan;
+    CallbackStub callback;
+
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK_EQUAL(callback.view.updates, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(every_operation_runs)
+{
+    ParallelPlan plan;
+    for (int i = 0; i < 50; ++i)
+        plan.add_stage(StubOperation(log, 100));
+
+    CallbackStub callback;
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK_EQUAL(log->completed(), 50U);
+}
+
+BOOST_AUTO_TEST_CASE(operations_overlap_up_to_worker_count)
+{
+    ParallelPlan plan(3);
+    for (int i = 0; i < 12; ++i)
+        plan.add_stage(StubOperation(log, 100, 10));
+
+    CallbackStub callback;
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK_GT(log->most_running(), 1U);
+    BOOST_CHECK_LE(log->most_running(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(single_worker_is_sequential)
+{
+    ParallelPlan plan(1);
+    for (int i = 0; i < 5; ++i)
+        plan.add_stage(StubOperation(log, 100));
+
+    CallbackStub callback;
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK_EQUAL(log->most_running(), 1U);
+    BOOST_CHECK_EQUAL(log->completed(), 5U);
+}
+
+/**
+ * The final progress must count every byte of every operation, whichever
+ * worker ran it, and must never go backwards along the way.
+ */
+BOOST_AUTO_TEST_CASE(progress_is_total_bytes)
+{
+    ParallelPlan plan;
+    uintmax_t total = 0;
+    for (int i = 1; i <= 20; ++i)
+    {
+        plan.add_stage(StubOperation(log, i * 1000, 5));
+        total += i * 1000;
+    }
+
+    CallbackStub callback;
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK_EQUAL(callback.view.so_far, total);
+    BOOST_CHECK_EQUAL(callback.view.out_of, total);
+    BOOST_CHECK(!callback.view.went_backwards);
+}
+
+/**
+ * Operations that haven't started count at their planned size, so the
+ * total is right before the mix of sizes has been seen.
+ */
+BOOST_AUTO_TEST_CASE(total_known_before_operations_start)
+{
+    ParallelPlan plan(2);
+    uintmax_t total = 0;
+    for (int i = 0; i < 10; ++i)
+    {
+        uintmax_t size = (i == 0) ? 10 : 100000;
+        plan.add_stage(StubOperation(log, size, 5));
+        total += size;
+    }
+
+    CallbackStub callback;
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK_EQUAL(callback.view.first_out_of, total);
+}
+
+BOOST_AUTO_TEST_CASE(user_is_only_contacted_from_calling_thread)
+{
+    ParallelPlan plan;
+    for (int i = 0; i < 8; ++i)
+        plan.add_stage(StubOperation(log, 100, 5).asks_to_overwrite());
+
+    CallbackStub callback;
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK_EQUAL(callback.view.questions, 8U);
+    BOOST_CHECK(!callback.view.off_thread_interaction);
+    BOOST_CHECK_EQUAL(log->completed(), 8U);
+}
+
+BOOST_AUTO_TEST_CASE(extra_workers_reserve_their_own_provider)
+{
+    shared_ptr<unsigned int> reservations = make_shared<unsigned int>(0);
+    ParallelPlan plan(4, counting_factory(reservations));
+    for (int i = 0; i < 16; ++i)
+        plan.add_stage(StubOperation(log, 100, 10));
+
+    CallbackStub callback;
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK_LE(*reservations, 3U);
+    BOOST_CHECK_EQUAL(log->distinct_providers(), *reservations + 1);
+}
+
+BOOST_AUTO_TEST_CASE(failure_stops_the_plan)
+{
+    ParallelPlan plan(2);
+    plan.add_stage(StubOperation(log, 100).fails());
+    for (int i = 0; i < 100; ++i)
+        plan.add_stage(StubOperation(log, 100, 10));
+
+    CallbackStub callback;
+    BOOST_CHECK_THROW(plan.execute_plan(callback, provider), runtime_error);
+
+    BOOST_CHECK_LT(log->completed(), 100U);
+}
+
+BOOST_AUTO_TEST_CASE(cancelling_stops_every_worker_promptly)
+{
+    ParallelPlan plan(4);
+    for (int i = 0; i < 100; ++i)
+        plan.add_stage(StubOperation(log, 100, 50));
+
+    CallbackStub callback;
+    callback.view.cancel_after_updates = 1;
+
+    ptime start = microsec_clock::universal_time();
+    BOOST_CHECK_THROW(plan.execute_plan(callback, provider), com_error);
+
+    // Running all 100 operations would take at least five seconds
+    BOOST_CHECK(microsec_clock::universal_time() - start < milliseconds(1000));
+    BOOST_CHECK_LT(log->completed(), 100U);
+}
+
+BOOST_AUTO_TEST_CASE(first_stage_starts_before_production_finishes)
+{
+    shared_ptr<bool> saw_first_start = make_shared<bool>(false);
+    ParallelPlan plan(
+        4, ParallelPlan::provider_factory(),
+        watchful_producer(log, 10, saw_first_start));
+
+    CallbackStub callback;
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK(*saw_first_start);
+    BOOST_CHECK_EQUAL(log->completed(), 10U);
+}
+
+/**
+ * The producer must be held back, not fail, when it gets far ahead of the
+ * workers.
+ */
+BOOST_AUTO_TEST_CASE(producer_larger_than_queue)
+{
+    shared_ptr<bool> saw_first_start = make_shared<bool>(false);
+    int count = ParallelPlan::MAX_WAITING_STAGES * 4;
+    ParallelPlan plan(
+        2, ParallelPlan::provider_factory(),
+        watchful_producer(log, count, saw_first_start));
+
+    CallbackStub callback;
+    plan.execute_plan(callback, provider);
+
+    BOOST_CHECK_EQUAL(log->completed(), static_cast<unsigned int>(count));
+    BOOST_CHECK_EQUAL(callback.view.so_far, count * 100U);
+    BOOST_CHECK_EQUAL(callback.view.out_of, count * 100U);
+}
+
+BOOST_AUTO_TEST_CASE(producer_failure_stops_the_plan)
+{
+    ParallelPlan plan(4, ParallelPlan::provider_factory(),
+                      boost::bind(&failing_producer, log, _1));
+
+    CallbackStub callback;
+    BOOST_CHECK_THROW(plan.execute_plan(callback, provider), runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -80,6 +80,15 @@ shared_ptr<sftp_provider> provider_fixture::Provider()
     return boost::shared_ptr<CProvider>(new CProvider(ticket));
 }
 
+shared_ptr<sftp_provider> provider_fixture::LaneProvider(unsigned int lane)
+{
+    session_reservation ticket(session_manager().reserve_session(
+        connection_spec(whost(), wuser(), port()), Consumer(),
+        "Running tests", lane));
+
+    return boost::shared_ptr<CProvider>(new CProvider(ticket));
+}
+
 com_ptr<test::MockConsumer> provider_fixture::Consumer()
 {
     com_ptr<test::MockConsumer> consumer = new test::MockConsumer();
@@ -52,6 +52,13 @@ public:
      */
     boost::shared_ptr<swish::provider::sftp_provider> Provider();
 
+    /**
+     * Get an sftp_provider on one of the pool's extra sessions to the
+     * fixture SSH server, so that it has a connection of its own.
+     */
+    boost::shared_ptr<swish::provider::sftp_provider>
+    LaneProvider(unsigned int lane);
+
     /**
      * Get a dummy consumer to use in calls to provider.
      */
@@ -0,0 +1,224 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sftp_fixture.hpp"
+
+#include <ssh/archive.hpp> // test subject
+#include <ssh/filesystem.hpp>
+#include <ssh/stream.hpp>
+
+#include <boost/cstdint.hpp> // uintmax_t
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <iterator> // istreambuf_iterator
+#include <stdexcept> // runtime_error
+#include <string>
+
+using ssh::filesystem::archive_statistics;
+using ssh::filesystem::can_exchange_archives;
+using ssh::filesystem::create_directory;
+using ssh::filesystem::download_tree;
+using ssh::filesystem::ifstream;
+using ssh::filesystem::is_directory;
+using ssh::filesystem::path;
+using ssh::filesystem::upload_tree;
+
+using test::ssh::sftp_fixture;
+
+using boost::system::system_error;
+using boost::uintmax_t;
+
+using std::istreambuf_iterator;
+using std::runtime_error;
+using std::string;
+
+namespace
+{
+
+/**
+ * Local directory deleted when the test ends.
+ */
+class archive_fixture : public sftp_fixture
+{
+public:
+    archive_fixture()
+        : local_directory(boost::filesystem::temp_directory_path() /
+                          boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(local_directory);
+    }
+
+    ~archive_fixture()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(local_directory, ec);
+    }
+
+    void make_local_file(const boost::filesystem::path& name,
+                         const string& data)
+    {
+        boost::filesystem::create_directories(
+            (local_directory / name).parent_path());
+        boost::filesystem::ofstream file(local_directory / name,
+                                         std::ios_base::binary);
+        file << data;
+    }
+
+    string local_data(const boost::filesystem::path& file)
+    {
+        boost::filesystem::ifstream stream(file, std::ios_base::binary);
+        return string(istreambuf_iterator<char>(stream),
+                      istreambuf_iterator<char>());
+    }
+
+    string remote_data(const path& file)
+    {
+        ifstream stream(filesystem(), file);
+        return string(istreambuf_iterator<char>(stream),
+                      istreambuf_iterator<char>());
+    }
+
+    boost::filesystem::path local_directory;
+};
+
+void cancel(const boost::filesystem::path&, uintmax_t)
+{
+    throw runtime_error("cancelled");
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(archive_tests, archive_fixture)
+
+BOOST_AUTO_TEST_CASE(server_can_exchange_archives)
+{
+    BOOST_CHECK(can_exchange_archives(test_session()));
+}
+
+BOOST_AUTO_TEST_CASE(upload)
+{
+    make_local_file("a", "gobbledy gook");
+    make_local_file("dir/b", "");
+    make_local_file("dir/nested/c", string(100000, 'c'));
+    boost::filesystem::create_directories(local_directory / "empty");
+
+    path target = absolute_sandbox() / "tree";
+    archive_statistics statistics =
+        upload_tree(test_session(), local_directory, target);
+
+    BOOST_CHECK_EQUAL(statistics.files, 3U);
+    BOOST_CHECK_EQUAL(statistics.directories, 3U);
+    BOOST_CHECK_EQUAL(statistics.bytes, 13U + 100000U);
+
+    BOOST_CHECK_EQUAL(remote_data(target / "a"), "gobbledy gook");
+    BOOST_CHECK_EQUAL(remote_data(target / "dir/b"), "");
+    BOOST_CHECK_EQUAL(remote_data(target / "dir/nested/c"),
+                      string(100000, 'c'));
+    BOOST_CHECK(is_directory(filesystem(), target / "empty"));
+}
+
+BOOST_AUTO_TEST_CASE(upload_replaces_files)
+{
+    path existing = new_file_in_sandbox_containing_data("a", "old");
+    make_local_file("a", "new");
+
+    upload_tree(test_session(), local_directory, absolute_sandbox());
+
+    BOOST_CHECK_EQUAL(remote_data(existing), "new");
+}
+
+BOOST_AUTO_TEST_CASE(download)
+{
+    path source = new_directory_in_sandbox();
+    new_file_in_sandbox_containing_data(source.filename() / "a",
+                                        "gobbledy gook");
+    create_directory(filesystem(), source / "dir");
+    new_file_in_sandbox_containing_data(source.filename() / "dir/b",
+                                        string(100000, 'b'));
+
+    archive_statistics statistics =
+        download_tree(test_session(), absolute_sandbox() / source.filename(),
+                      local_directory / "tree");
+
+    BOOST_CHECK_EQUAL(statistics.files, 2U);
+    BOOST_CHECK_EQUAL(statistics.directories, 1U);
+    BOOST_CHECK_EQUAL(local_data(local_directory / "tree/a"),
+                      "gobbledy gook");
+    BOOST_CHECK_EQUAL(local_data(local_directory / "tree/dir/b"),
+                      string(100000, 'b'));
+}
+
+BOOST_AUTO_TEST_CASE(download_skips_links)
+{
+    path source = new_directory_in_sandbox();
+    path file = new_file_in_sandbox_containing_data(source.filename() / "a",
+                                                    "data");
+    create_symlink(source / "link", file);
+
+    archive_statistics statistics =
+        download_tree(test_session(), absolute_sandbox() / source.filename(),
+                      local_directory);
+
+    BOOST_CHECK_EQUAL(statistics.files, 1U);
+    BOOST_CHECK_EQUAL(statistics.skipped, 1U);
+    BOOST_CHECK(!boost::filesystem::exists(
+        boost::filesystem::symlink_status(local_directory / "link")));
+}
+
+BOOST_AUTO_TEST_CASE(round_trip_keeps_times)
+{
+    make_local_file("a", "data");
+    boost::filesystem::last_write_time(local_directory / "a", 1000000000);
+
+    path tree = absolute_sandbox() / "tree";
+    upload_tree(test_session(), local_directory, tree);
+    download_tree(test_session(), tree, local_directory / "back");
+
+    BOOST_CHECK_EQUAL(
+        boost::filesystem::last_write_time(local_directory / "back/a"),
+        1000000000);
+}
+
+BOOST_AUTO_TEST_CASE(download_missing_directory)
+{
+    BOOST_CHECK_THROW(download_tree(test_session(),
+                                    absolute_sandbox() / "missing",
+                                    local_directory),
+                      system_error);
+}
+
+BOOST_AUTO_TEST_CASE(upload_to_file_fails)
+{
+    path file = new_file_in_sandbox();
+    make_local_file("a", "data");
+
+    BOOST_CHECK_THROW(upload_tree(test_session(), local_directory,
+                                  absolute_sandbox() / file.filename()),
+                      system_error);
+}
+
+BOOST_AUTO_TEST_CASE(cancelled_upload)
+{
+    make_local_file("a", "data");
+
+    BOOST_CHECK_THROW(upload_tree(test_session(), local_directory,
+                                  absolute_sandbox() / "tree", &cancel),
+                      runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,189 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <ssh/block_cache.hpp> // test subject
+
+#include <boost/make_shared.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <cstddef> // size_t
+#include <string>
+#include <vector>
+
+using ssh::filesystem::block_cache;
+using ssh::filesystem::block_cache_statistics;
+using ssh::filesystem::block_id;
+
+using boost::make_shared;
+
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+block_cache::block_pointer make_block(size_t size, char fill = 'x')
+{
+    return make_shared<const vector<char>>(size, fill);
+}
+
+block_id block_of(const string& file, boost::uint64_t index)
+{
+    return block_id(file, 1000, 42, index);
+}
+}
+
+BOOST_AUTO_TEST_SUITE(block_cache_tests)
+
+BOOST_AUTO_TEST_CASE(empty_cache_misses)
+{
+    block_cache cache;
+
+    BOOST_CHECK(!cache.find(block_of("/a", 0)));
+
+    block_cache_statistics statistics = cache.statistics();
+    BOOST_CHECK_EQUAL(statistics.misses, 1U);
+    BOOST_CHECK_EQUAL(statistics.hits, 0U);
+    BOOST_CHECK_EQUAL(statistics.bytes, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(inserted_block_is_found)
+{
+    block_cache cache;
+    block_cache::block_pointer block = make_block(10, 'q');
+
+    cache.insert(block_of("/a", 3), block, false);
+
+    BOOST_CHECK(cache.find(block_of("/a", 3)) == block);
+    BOOST_CHECK(!cache.find(block_of("/a", 4)));
+    BOOST_CHECK(!cache.find(block_of("/b", 3)));
+
+    block_cache_statistics statistics = cache.statistics();
+    BOOST_CHECK_EQUAL(statistics.hits, 1U);
+    BOOST_CHECK_EQUAL(statistics.misses, 2U);
+    BOOST_CHECK_EQUAL(statistics.bytes, 10U);
+}
+
+BOOST_AUTO_TEST_CASE(other_version_of_file_misses)
+{
+    block_cache cache;
+    cache.insert(block_id("/a", 1000, 42, 0), make_block(10), false);
+
+    BOOST_CHECK(!cache.find(block_id("/a", 1001, 42, 0)));
+    BOOST_CHECK(!cache.find(block_id("/a", 1000, 43, 0)));
+    BOOST_CHECK(cache.find(block_id("/a", 1000, 42, 0)));
+}
+
+BOOST_AUTO_TEST_CASE(replacing_block_keeps_accounting_right)
+{
+    block_cache cache;
+    cache.insert(block_of("/a", 0), make_block(10), false);
+    cache.insert(block_of("/a", 0), make_block(4, 'z'), false);
+
+    BOOST_CHECK_EQUAL(cache.statistics().bytes, 4U);
+    BOOST_CHECK_EQUAL((*cache.find(block_of("/a", 0)))[0], 'z');
+}
+
+BOOST_AUTO_TEST_CASE(least_recently_used_is_evicted)
+{
+    block_cache cache(30, 10);
+    cache.insert(block_of("/a", 0), make_block(10), false);
+    cache.insert(block_of("/a", 1), make_block(10), false);
+    cache.insert(block_of("/a", 2), make_block(10), false);
+
+    // Using block 0 makes block 1 the oldest
+    BOOST_CHECK(cache.find(block_of("/a", 0)));
+
+    cache.insert(block_of("/a", 3), make_block(10), false);
+
+    BOOST_CHECK(cache.find(block_of("/a", 0)));
+    BOOST_CHECK(!cache.find(block_of("/a", 1)));
+    BOOST_CHECK(cache.find(block_of("/a", 2)));
+    BOOST_CHECK(cache.find(block_of("/a", 3)));
+
+    block_cache_statistics statistics = cache.statistics();
+    BOOST_CHECK_EQUAL(statistics.evictions, 1U);
+    BOOST_CHECK_EQUAL(statistics.bytes, 30U);
+}
+
+BOOST_AUTO_TEST_CASE(evicted_block_stays_alive_for_its_user)
+{
+    block_cache cache(10, 10);
+    cache.insert(block_of("/a", 0), make_block(10, 'k'), false);
+
+    block_cache::block_pointer held = cache.find(block_of("/a", 0));
+    cache.insert(block_of("/a", 1), make_block(10), false);
+
+    BOOST_CHECK(!cache.find(block_of("/a", 0)));
+    BOOST_CHECK_EQUAL((*held)[9], 'k');
+}
+
+BOOST_AUTO_TEST_CASE(read_ahead_is_counted)
+{
+    block_cache cache;
+    cache.insert(block_of("/a", 0), make_block(10), false);
+    cache.insert(block_of("/a", 1), make_block(10), true);
+    cache.insert(block_of("/a", 2), make_block(10), true);
+
+    BOOST_CHECK_EQUAL(cache.statistics().read_ahead, 2U);
+}
+
+BOOST_AUTO_TEST_CASE(invalidate_drops_every_version_of_file)
+{
+    block_cache cache;
+    cache.insert(block_id("/a", 1, 1, 0), make_block(10), false);
+    cache.insert(block_id("/a", 2, 2, 7), make_block(10), false);
+    cache.insert(block_id("/ab", 1, 1, 0), make_block(10), false);
+
+    cache.invalidate("/a");
+
+    BOOST_CHECK(!cache.find(block_id("/a", 1, 1, 0)));
+    BOOST_CHECK(!cache.find(block_id("/a", 2, 2, 7)));
+    BOOST_CHECK(cache.find(block_id("/ab", 1, 1, 0)));
+    BOOST_CHECK_EQUAL(cache.statistics().bytes, 10U);
+}
+
+BOOST_AUTO_TEST_CASE(invalidate_directory_drops_files_beneath_it)
+{
+    block_cache cache;
+    cache.insert(block_of("/dir/x", 0), make_block(10), false);
+    cache.insert(block_of("/dir/sub/y", 0), make_block(10), false);
+    cache.insert(block_of("/dir-x", 0), make_block(10), false);
+
+    cache.invalidate("/dir");
+
+    BOOST_CHECK(!cache.find(block_of("/dir/x", 0)));
+    BOOST_CHECK(!cache.find(block_of("/dir/sub/y", 0)));
+    BOOST_CHECK(cache.find(block_of("/dir-x", 0)));
+}
+
+BOOST_AUTO_TEST_CASE(invalidate_root_drops_everything)
+{
+    block_cache cache;
+    cache.insert(block_of("/x", 0), make_block(10), false);
+    cache.insert(block_of("/y/z", 0), make_block(10), false);
+
+    cache.invalidate("/");
+
+    BOOST_CHECK_EQUAL(cache.statistics().bytes, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(zero_block_size_is_rejected)
+{
+    BOOST_CHECK_THROW(block_cache(100, 0), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,166 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sftp_fixture.hpp"
+
+#include <ssh/command.hpp> // test subject
+#include <ssh/session.hpp>
+#include <ssh/stream.hpp>
+
+#include <boost/move/move.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <iterator> // istreambuf_iterator
+#include <string>
+
+using ssh::filesystem::ifstream;
+using ssh::filesystem::path;
+using ssh::remote_command;
+
+using test::ssh::sftp_fixture;
+
+using boost::move;
+
+using std::istreambuf_iterator;
+using std::string;
+
+namespace
+{
+
+string read_all(std::istream& stream)
+{
+    return string(istreambuf_iterator<char>(stream),
+                  istreambuf_iterator<char>());
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(command_tests, sftp_fixture)
+
+BOOST_AUTO_TEST_CASE(output_is_read)
+{
+    remote_command command = test_session().exec("echo hello");
+
+    BOOST_CHECK_EQUAL(read_all(command.io()), "hello\n");
+    BOOST_CHECK_EQUAL(command.exit_status(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(input_reaches_command)
+{
+    remote_command command = test_session().exec("cat");
+
+    command.io() << "gobbledy gook";
+    command.close_input();
+
+    BOOST_CHECK_EQUAL(read_all(command.io()), "gobbledy gook");
+    BOOST_CHECK_EQUAL(command.exit_status(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(large_input_round_trip)
+{
+    string data;
+    for (int i = 0; i < 100000; ++i)
+    {
+        data += static_cast<char>(i % 251);
+    }
+
+    remote_command command = test_session().exec("cat");
+
+    // More than fits in the channel window, so the output has to be read
+    // while the input is still being written
+    string output;
+    for (string::size_type offset = 0; offset < data.size(); offset += 1000)
+    {
+        command.io().write(data.data() + offset, 1000);
+        command.io().flush();
+
+        char buffer[1000];
+        command.io().read(buffer, sizeof(buffer));
+        output.append(buffer,
+                      static_cast<string::size_type>(command.io().gcount()));
+    }
+    command.close_input();
+    output += read_all(command.io());
+
+    BOOST_CHECK(output == data);
+}
+
+BOOST_AUTO_TEST_CASE(errors_are_separate)
+{
+    remote_command command =
+        test_session().exec("echo output; echo error >&2");
+
+    BOOST_CHECK_EQUAL(read_all(command.io()), "output\n");
+    BOOST_CHECK_EQUAL(read_all(command.errors()), "error\n");
+}
+
+BOOST_AUTO_TEST_CASE(exit_status_is_reported)
+{
+    remote_command command = test_session().exec("exit 3");
+
+    BOOST_CHECK_EQUAL(command.exit_status(), 3);
+    BOOST_CHECK_EQUAL(command.exit_signal(), "");
+}
+
+BOOST_AUTO_TEST_CASE(killed_command_reports_signal)
+{
+    remote_command command = test_session().exec("kill -TERM $$");
+
+    BOOST_CHECK_EQUAL(command.exit_signal(), "TERM");
+}
+
+BOOST_AUTO_TEST_CASE(unread_output_is_discarded)
+{
+    remote_command command = test_session().exec(
+        "head -c 1000000 /dev/zero; head -c 1000000 /dev/zero >&2");
+
+    BOOST_CHECK_EQUAL(command.exit_status(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(commands_run_together)
+{
+    remote_command first = test_session().exec("cat");
+    remote_command second = test_session().exec("cat");
+
+    first.io() << "first";
+    second.io() << "second";
+    second.close_input();
+    first.close_input();
+
+    BOOST_CHECK_EQUAL(read_all(second.io()), "second");
+    BOOST_CHECK_EQUAL(read_all(first.io()), "first");
+}
+
+BOOST_AUTO_TEST_CASE(command_alongside_sftp)
+{
+    path file = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    remote_command command =
+        test_session().exec("cat " + (absolute_sandbox() / file.filename())
+                                         .string());
+
+    ifstream stream(filesystem(), file);
+    BOOST_CHECK_EQUAL(read_all(stream), read_all(command.io()));
+}
+
+BOOST_AUTO_TEST_CASE(moved_command)
+{
+    remote_command command = test_session().exec("echo hello");
+    remote_command moved(move(command));
+
+    BOOST_CHECK_EQUAL(read_all(moved.io()), "hello\n");
+    BOOST_CHECK_EQUAL(moved.exit_status(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
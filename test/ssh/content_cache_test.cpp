@@ -0,0 +1,287 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <ssh/content_cache.hpp> // test subject
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/optional/optional.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <ctime>     // time_t
+#include <sstream>   // istringstream
+#include <stdexcept> // runtime_error
+#include <string>
+
+using ssh::filesystem::content_cache;
+using ssh::filesystem::content_cache_statistics;
+using ssh::filesystem::content_copy;
+
+using boost::filesystem::path;
+using boost::optional;
+
+using std::istringstream;
+using std::runtime_error;
+using std::string;
+
+namespace
+{
+
+const std::time_t MODIFIED = 1000;
+
+/**
+ * Cache directory deleted when the test ends.
+ */
+class cache_directory_fixture
+{
+public:
+    cache_directory_fixture()
+        : m_directory(boost::filesystem::temp_directory_path() /
+                      boost::filesystem::unique_path())
+    {
+    }
+
+    ~cache_directory_fixture()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(m_directory, ec);
+    }
+
+    path directory() const
+    {
+        return m_directory;
+    }
+
+    content_copy insert(content_cache& cache, const string& remote_file,
+                        const string& data, std::time_t modified = MODIFIED)
+    {
+        istringstream content(data);
+        return cache.insert("user@host:22", remote_file, data.size(), modified,
+                            content);
+    }
+
+    optional<content_copy> find(content_cache& cache,
+                                const string& remote_file, const string& data,
+                                std::time_t modified = MODIFIED)
+    {
+        return cache.find("user@host:22", remote_file, data.size(), modified);
+    }
+
+private:
+    path m_directory;
+};
+
+string contents_of(const content_copy& copy)
+{
+    return string(std::istreambuf_iterator<char>(copy.stream()),
+                  std::istreambuf_iterator<char>());
+}
+
+/**
+ * Make the cache believe the copy came from somewhere else, as a copy of a
+ * file whose name hashes the same would have.
+ */
+void pretend_copy_is_of(const content_copy& copy, const string& remote_file)
+{
+    boost::filesystem::ofstream origin(
+        copy.file().string() + ".origin",
+        std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    string identity = string("user@host:22") + '\0' + remote_file;
+    origin.write(identity.data(), identity.size());
+}
+
+size_t files_in(const path& directory)
+{
+    size_t count = 0;
+    for (boost::filesystem::directory_iterator it(directory), end; it != end;
+         ++it)
+    {
+        ++count;
+    }
+
+    return count;
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(content_cache_tests, cache_directory_fixture)
+
+BOOST_AUTO_TEST_CASE(empty_cache_misses)
+{
+    content_cache cache(directory());
+
+    BOOST_CHECK(!find(cache, "/a", "data"));
+
+    content_cache_statistics statistics = cache.statistics();
+    BOOST_CHECK_EQUAL(statistics.misses, 1U);
+    BOOST_CHECK_EQUAL(statistics.hits, 0U);
+    BOOST_CHECK_EQUAL(statistics.bytes, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(inserted_file_is_found)
+{
+    content_cache cache(directory());
+
+    content_copy copy = insert(cache, "/a", "gobbledy gook");
+
+    optional<content_copy> found = find(cache, "/a", "gobbledy gook");
+    BOOST_REQUIRE(found);
+    BOOST_CHECK(found->file() == copy.file());
+    BOOST_CHECK_EQUAL(contents_of(*found), "gobbledy gook");
+
+    content_cache_statistics statistics = cache.statistics();
+    BOOST_CHECK_EQUAL(statistics.hits, 1U);
+    BOOST_CHECK_EQUAL(statistics.bytes, 13U);
+}
+
+BOOST_AUTO_TEST_CASE(other_version_misses)
+{
+    content_cache cache(directory());
+    insert(cache, "/a", "gobbledy gook");
+
+    BOOST_CHECK(!find(cache, "/a", "gobbledy gook", MODIFIED + 1));
+    BOOST_CHECK(!find(cache, "/a", "gobbledy gook!"));
+    BOOST_CHECK(!find(cache, "/b", "gobbledy gook"));
+    BOOST_CHECK(!cache.find("other@host:22", "/a", 13, MODIFIED));
+}
+
+BOOST_AUTO_TEST_CASE(new_version_replaces_old)
+{
+    content_cache cache(directory());
+    insert(cache, "/a", "old");
+    insert(cache, "/a", "newer", MODIFIED + 1);
+
+    BOOST_CHECK(!find(cache, "/a", "old"));
+    BOOST_CHECK(find(cache, "/a", "newer", MODIFIED + 1));
+
+    // The copy and the record of its origin
+    BOOST_CHECK_EQUAL(files_in(directory()), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(copies_survive_the_cache_object)
+{
+    {
+        content_cache cache(directory());
+        insert(cache, "/a", "gobbledy gook");
+    }
+
+    content_cache cache(directory());
+    BOOST_CHECK(find(cache, "/a", "gobbledy gook"));
+    BOOST_CHECK_EQUAL(cache.statistics().bytes, 13U);
+}
+
+BOOST_AUTO_TEST_CASE(short_content_is_not_kept)
+{
+    content_cache cache(directory());
+
+    istringstream content("short");
+    BOOST_CHECK_THROW(
+        cache.insert("user@host:22", "/a", 100, MODIFIED, content),
+        runtime_error);
+
+    BOOST_CHECK(!cache.find("user@host:22", "/a", 100, MODIFIED));
+    BOOST_CHECK_EQUAL(files_in(directory()), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(least_recently_used_is_evicted)
+{
+    content_cache cache(directory(), 25);
+    path first = insert(cache, "/a", "0123456789").file();
+    path second = insert(cache, "/b", "0123456789").file();
+
+    // Make the first copy the most recently used, regardless of how coarse
+    // the filesystem's timestamps are
+    boost::filesystem::last_write_time(second, 100);
+    boost::filesystem::last_write_time(first, 200);
+
+    insert(cache, "/c", "0123456789");
+
+    BOOST_CHECK(find(cache, "/a", "0123456789"));
+    BOOST_CHECK(!find(cache, "/b", "0123456789"));
+    BOOST_CHECK(find(cache, "/c", "0123456789"));
+
+    content_cache_statistics statistics = cache.statistics();
+    BOOST_CHECK_EQUAL(statistics.evictions, 1U);
+    BOOST_CHECK_EQUAL(statistics.bytes, 20U);
+}
+
+BOOST_AUTO_TEST_CASE(file_larger_than_budget_is_still_served)
+{
+    content_cache cache(directory(), 5);
+
+    content_copy copy = insert(cache, "/a", "0123456789");
+
+    BOOST_CHECK_EQUAL(contents_of(copy), "0123456789");
+}
+
+BOOST_AUTO_TEST_CASE(found_copy_stays_readable_when_evicted)
+{
+    content_cache cache(directory(), 15);
+    insert(cache, "/a", "0123456789");
+
+    optional<content_copy> found = find(cache, "/a", "0123456789");
+    BOOST_REQUIRE(found);
+
+    // Pushes the first copy out of the budget.  Whether it is deleted
+    // depends on the platform letting open files go, but either way what
+    // we found must still read in full.
+    boost::filesystem::last_write_time(found->file(), 100);
+    insert(cache, "/b", "abcdefghij");
+
+    BOOST_CHECK_EQUAL(contents_of(*found), "0123456789");
+}
+
+BOOST_AUTO_TEST_CASE(invalidate_drops_every_version)
+{
+    content_cache cache(directory());
+    insert(cache, "/a", "data");
+    insert(cache, "/b", "data");
+
+    cache.invalidate("user@host:22", "/a");
+
+    BOOST_CHECK(!find(cache, "/a", "data"));
+    BOOST_CHECK(find(cache, "/b", "data"));
+}
+
+BOOST_AUTO_TEST_CASE(copy_of_file_with_same_hash_misses)
+{
+    content_cache cache(directory());
+    pretend_copy_is_of(insert(cache, "/a", "data"), "/b");
+
+    BOOST_CHECK(!find(cache, "/a", "data"));
+}
+
+BOOST_AUTO_TEST_CASE(copy_of_file_with_same_hash_gives_way)
+{
+    content_cache cache(directory());
+    pretend_copy_is_of(insert(cache, "/a", "old"), "/b");
+
+    content_copy copy = insert(cache, "/a", "new");
+
+    BOOST_CHECK_EQUAL(contents_of(copy), "new");
+    BOOST_CHECK(find(cache, "/a", "new"));
+}
+
+BOOST_AUTO_TEST_CASE(invalidate_spares_file_with_same_hash)
+{
+    content_cache cache(directory());
+    path copy = insert(cache, "/a", "data").file();
+    pretend_copy_is_of(content_copy(copy), "/b");
+
+    cache.invalidate("user@host:22", "/a");
+
+    BOOST_CHECK(boost::filesystem::exists(copy));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
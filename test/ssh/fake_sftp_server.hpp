@@ -0,0 +1,679 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef TEST_SSH_FAKE_SFTP_SERVER_HPP
+#define TEST_SSH_FAKE_SFTP_SERVER_HPP
+
+#include <ssh/detail/sftp_protocol.hpp>
+#include <ssh/detail/wire.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm> // copy, min, max, reverse
+#include <cstddef>   // size_t
+#include <deque>
+#include <map>
+#include <set>
+#include <stdexcept> // runtime_error
+#include <string>
+#include <vector>
+
+#include <libssh2_sftp.h>
+
+namespace test
+{
+namespace ssh
+{
+
+/**
+ * In-memory SFTP server that the pipeline talks to in place of a channel.
+ *
+ * Answers each request as soon as it is complete.  Keeps track of how many
+ * requests the client had waiting at once.
+ */
+class fake_sftp_server
+{
+public:
+    fake_sftp_server()
+        : m_next_handle(0), m_unanswered(0), m_most_unanswered(0),
+          m_most_open_handles(0), m_largest_write(0), m_read_limit(0),
+          m_round_trips(0), m_reverse_replies(false)
+    {
+        extensions["posix-rename@openssh.com"] = "1";
+    }
+
+    void write(const char* data, std::size_t size)
+    {
+        m_input.append(data, size);
+
+        while (m_input.size() >= 4)
+        {
+            std::size_t length = ::ssh::detail::load_uint32(m_input.data());
+            if (m_input.size() < 4 + length)
+                break;
+
+            std::string request = m_input.substr(4, length);
+            m_input.erase(0, 4 + length);
+
+            handle_request(request);
+        }
+    }
+
+    void read(char* buffer, std::size_t size)
+    {
+        while (size > 0)
+        {
+            if (m_replies.empty())
+                release_held_replies();
+
+            if (m_replies.empty())
+            {
+                throw std::runtime_error(
+                    "Client waiting for a reply that will never come");
+            }
+
+            std::string& reply = m_replies.front();
+            std::size_t count = (std::min)(size, reply.size());
+            std::copy(reply.begin(), reply.begin() + count, buffer);
+            reply.erase(0, count);
+            buffer += count;
+            size -= count;
+
+            if (reply.empty())
+            {
+                m_replies.pop_front();
+                --m_unanswered;
+            }
+        }
+    }
+
+    /**
+     * Hold replies back until the client runs out, then send them newest
+     * first.
+     */
+    void reverse_replies()
+    {
+        m_reverse_replies = true;
+    }
+
+    void refuse(const std::string& path)
+    {
+        m_refused.insert(path);
+    }
+
+    /**
+     * Return no more than `limit` bytes from any read, as servers may.
+     */
+    void limit_reads(std::size_t limit)
+    {
+        m_read_limit = limit;
+    }
+
+    /**
+     * Extensions announced in the version packet, and the only ones the
+     * server will carry out.
+     */
+    std::map<std::string, std::string> extensions;
+
+    std::map<std::string, std::string> files;
+
+    /**
+     * Permissions of files, where they were set on creation.
+     */
+    std::map<std::string, unsigned long> permissions;
+
+    /**
+     * Directories, by full path.  Files are listed in the directory their
+     * path puts them in, whether or not it is here.
+     */
+    std::set<std::string> directories;
+
+    /**
+     * Modification times, where they were set.
+     */
+    std::map<std::string, unsigned long> mtimes;
+
+    /**
+     * Contents of files as they were when they were last fsynced.
+     */
+    std::map<std::string, std::string> synced;
+
+    /**
+     * Number of extended requests received, by extension name.
+     */
+    std::map<std::string, std::size_t> extended_requests;
+
+    std::size_t most_unanswered() const
+    {
+        return m_most_unanswered;
+    }
+
+    std::size_t open_handles() const
+    {
+        return m_handles.size();
+    }
+
+    std::size_t most_open_handles() const
+    {
+        return m_most_open_handles;
+    }
+
+    std::size_t largest_write() const
+    {
+        return m_largest_write;
+    }
+
+    /**
+     * Number of times the client waited for held-back replies.
+     *
+     * With `reverse_replies`, this is how many round trips the client would
+     * pay for on a real network.
+     */
+    std::size_t round_trips() const
+    {
+        return m_round_trips;
+    }
+
+private:
+    void handle_request(const std::string& request)
+    {
+        namespace packet_type = ::ssh::detail::sftp_protocol::packet_type;
+        namespace open_flags = ::ssh::detail::sftp_protocol::open_flags;
+
+        ::ssh::detail::wire_reader in(request);
+        boost::uint8_t type = in.get_uint8();
+
+        ++m_unanswered;
+        m_most_unanswered = (std::max)(m_most_unanswered, m_unanswered);
+
+        if (type == packet_type::init)
+        {
+            ::ssh::detail::wire_writer version;
+            version.put_uint8(packet_type::version).put_uint32(3);
+            for (std::map<std::string, std::string>::const_iterator it =
+                     extensions.begin();
+                 it != extensions.end(); ++it)
+            {
+                version.put_string(it->first).put_string(it->second);
+            }
+            reply(version.buffer());
+            return;
+        }
+
+        boost::uint32_t id = in.get_uint32();
+        switch (type)
+        {
+        case packet_type::open:
+            {
+                std::string path = in.get_string();
+                boost::uint32_t flags = in.get_uint32();
+                LIBSSH2_SFTP_ATTRIBUTES attributes =
+                    ::ssh::detail::sftp_protocol::get_attributes(in);
+
+                if (m_refused.count(path))
+                {
+                    reply_status(id, LIBSSH2_FX_PERMISSION_DENIED);
+                }
+                else if ((flags & open_flags::exclusive) && files.count(path))
+                {
+                    reply_status(id, LIBSSH2_FX_FAILURE);
+                }
+                else if (!(flags & open_flags::create) && !files.count(path))
+                {
+                    reply_status(id, LIBSSH2_FX_NO_SUCH_FILE);
+                }
+                else
+                {
+                    if (!files.count(path) &&
+                        attributes.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)
+                    {
+                        permissions[path] = attributes.permissions;
+                    }
+
+                    if (flags & open_flags::truncate || !files.count(path))
+                        files[path] = std::string();
+
+                    std::string handle =
+                        boost::lexical_cast<std::string>(m_next_handle++);
+                    m_handles[handle] = path;
+                    m_most_open_handles =
+                        (std::max)(m_most_open_handles, m_handles.size());
+
+                    ::ssh::detail::wire_writer out;
+                    out.put_uint8(packet_type::handle)
+                        .put_uint32(id)
+                        .put_string(handle);
+                    reply(out.buffer());
+                }
+            }
+            break;
+
+        case packet_type::read:
+            {
+                std::string handle = in.get_string();
+                boost::uint64_t offset = in.get_uint64();
+                boost::uint32_t length = in.get_uint32();
+
+                const std::string& file = files[m_handles.at(handle)];
+                if (offset >= file.size())
+                {
+                    reply_status(id, LIBSSH2_FX_EOF);
+                }
+                else
+                {
+                    std::size_t count = length;
+                    if (m_read_limit > 0)
+                        count = (std::min)(count, m_read_limit);
+
+                    ::ssh::detail::wire_writer out;
+                    out.put_uint8(packet_type::data)
+                        .put_uint32(id)
+                        .put_string(file.substr(
+                            static_cast<std::size_t>(offset), count));
+                    reply(out.buffer());
+                }
+            }
+            break;
+
+        case packet_type::fstat:
+            {
+                std::string path = m_handles.at(in.get_string());
+
+                LIBSSH2_SFTP_ATTRIBUTES attributes = LIBSSH2_SFTP_ATTRIBUTES();
+                attributes.flags =
+                    LIBSSH2_SFTP_ATTR_SIZE | LIBSSH2_SFTP_ATTR_PERMISSIONS;
+                attributes.filesize = files[path].size();
+                attributes.permissions =
+                    LIBSSH2_SFTP_S_IFREG |
+                    ((permissions.count(path)) ? permissions[path] : 0644);
+
+                ::ssh::detail::wire_writer out;
+                out.put_uint8(packet_type::attrs).put_uint32(id);
+                ::ssh::detail::sftp_protocol::put_attributes(out, attributes);
+                reply(out.buffer());
+            }
+            break;
+
+        case packet_type::write:
+            {
+                std::string handle = in.get_string();
+                boost::uint64_t offset = in.get_uint64();
+                std::string data = in.get_string();
+                m_largest_write = (std::max)(m_largest_write, data.size());
+
+                std::string& file = files[m_handles.at(handle)];
+                if (file.size() < offset + data.size())
+                {
+                    file.resize(static_cast<std::size_t>(offset) +
+                                data.size());
+                }
+                std::copy(data.begin(), data.end(),
+                          file.begin() + static_cast<std::size_t>(offset));
+
+                reply_status(id, LIBSSH2_FX_OK);
+            }
+            break;
+
+        case packet_type::close:
+            {
+                std::string handle = in.get_string();
+                m_handles.erase(handle);
+                m_listed.erase(handle);
+                reply_status(id, LIBSSH2_FX_OK);
+            }
+            break;
+
+        case packet_type::opendir:
+            {
+                std::string path = in.get_string();
+
+                if (m_refused.count(path))
+                {
+                    reply_status(id, LIBSSH2_FX_PERMISSION_DENIED);
+                }
+                else if (!directories.count(path))
+                {
+                    reply_status(id, LIBSSH2_FX_NO_SUCH_FILE);
+                }
+                else
+                {
+                    std::string handle =
+                        boost::lexical_cast<std::string>(m_next_handle++);
+                    m_handles[handle] = path;
+                    m_listed[handle] = false;
+                    m_most_open_handles =
+                        (std::max)(m_most_open_handles, m_handles.size());
+
+                    ::ssh::detail::wire_writer out;
+                    out.put_uint8(packet_type::handle)
+                        .put_uint32(id)
+                        .put_string(handle);
+                    reply(out.buffer());
+                }
+            }
+            break;
+
+        case packet_type::readdir:
+            {
+                std::string handle = in.get_string();
+
+                // Everything in the first reply, then the end
+                if (m_listed.at(handle))
+                {
+                    reply_status(id, LIBSSH2_FX_EOF);
+                }
+                else
+                {
+                    m_listed[handle] = true;
+                    reply_listing(id, m_handles.at(handle));
+                }
+            }
+            break;
+
+        case packet_type::mkdir:
+            {
+                std::string path = in.get_string();
+
+                if (directories.count(path) || files.count(path))
+                {
+                    reply_status(id, LIBSSH2_FX_FAILURE);
+                }
+                else
+                {
+                    directories.insert(path);
+                    reply_status(id, LIBSSH2_FX_OK);
+                }
+            }
+            break;
+
+        case packet_type::rmdir:
+            {
+                std::string path = in.get_string();
+
+                if (!directories.count(path))
+                    reply_status(id, LIBSSH2_FX_NO_SUCH_FILE);
+                else if (!children(path).empty())
+                    reply_status(id, LIBSSH2_FX_FAILURE);
+                else
+                {
+                    directories.erase(path);
+                    reply_status(id, LIBSSH2_FX_OK);
+                }
+            }
+            break;
+
+        case packet_type::remove:
+            {
+                std::string path = in.get_string();
+
+                if (!files.count(path))
+                {
+                    reply_status(id, LIBSSH2_FX_NO_SUCH_FILE);
+                }
+                else
+                {
+                    files.erase(path);
+                    permissions.erase(path);
+                    mtimes.erase(path);
+                    reply_status(id, LIBSSH2_FX_OK);
+                }
+            }
+            break;
+
+        case packet_type::setstat:
+            {
+                std::string path = in.get_string();
+                LIBSSH2_SFTP_ATTRIBUTES attributes =
+                    ::ssh::detail::sftp_protocol::get_attributes(in);
+
+                if (!files.count(path) && !directories.count(path))
+                {
+                    reply_status(id, LIBSSH2_FX_NO_SUCH_FILE);
+                }
+                else
+                {
+                    if (attributes.flags & LIBSSH2_SFTP_ATTR_ACMODTIME)
+                        mtimes[path] = attributes.mtime;
+                    reply_status(id, LIBSSH2_FX_OK);
+                }
+            }
+            break;
+
+        case packet_type::extended:
+            {
+                std::string name = in.get_string();
+                ++extended_requests[name];
+
+                if (extensions.count(name))
+                    handle_extended(id, name, in);
+                else
+                    reply_status(id, LIBSSH2_FX_OP_UNSUPPORTED);
+            }
+            break;
+
+        default:
+            reply_status(id, LIBSSH2_FX_OP_UNSUPPORTED);
+        }
+    }
+
+    void handle_extended(boost::uint32_t id, const std::string& name,
+                         ::ssh::detail::wire_reader& in)
+    {
+        namespace packet_type = ::ssh::detail::sftp_protocol::packet_type;
+
+        if (name == "posix-rename@openssh.com")
+        {
+            std::string from = in.get_string();
+            std::string to = in.get_string();
+
+            if (!files.count(from))
+            {
+                reply_status(id, LIBSSH2_FX_NO_SUCH_FILE);
+            }
+            else
+            {
+                files[to] = files[from];
+                files.erase(from);
+                reply_status(id, LIBSSH2_FX_OK);
+            }
+        }
+        else if (name == "copy-data")
+        {
+            std::string& source = files[m_handles.at(in.get_string())];
+            std::size_t read_offset = static_cast<std::size_t>(in.get_uint64());
+            std::size_t length = static_cast<std::size_t>(in.get_uint64());
+            std::string& target = files[m_handles.at(in.get_string())];
+            std::size_t write_offset =
+                static_cast<std::size_t>(in.get_uint64());
+
+            std::string data = source.substr(
+                (std::min)(read_offset, source.size()),
+                (length == 0) ? std::string::npos : length);
+            if (target.size() < write_offset + data.size())
+                target.resize(write_offset + data.size());
+            std::copy(data.begin(), data.end(), target.begin() + write_offset);
+
+            reply_status(id, LIBSSH2_FX_OK);
+        }
+        else if (name == "fsync@openssh.com")
+        {
+            std::string path = m_handles.at(in.get_string());
+            synced[path] = files[path];
+            reply_status(id, LIBSSH2_FX_OK);
+        }
+        else if (name == "limits@openssh.com")
+        {
+            ::ssh::detail::wire_writer out;
+            out.put_uint8(packet_type::extended_reply)
+                .put_uint32(id)
+                .put_uint64(256 * 1024)
+                .put_uint64(255 * 1024)
+                .put_uint64(255 * 1024)
+                .put_uint64(64);
+            reply(out.buffer());
+        }
+        else
+        {
+            reply_status(id, LIBSSH2_FX_OP_UNSUPPORTED);
+        }
+    }
+
+    /**
+     * Names of the files and directories directly in a directory.
+     */
+    std::vector<std::string> children(const std::string& directory) const
+    {
+        std::string prefix = directory_prefix(directory);
+
+        std::vector<std::string> names;
+        for (std::map<std::string, std::string>::const_iterator it =
+                 files.begin();
+             it != files.end(); ++it)
+        {
+            if (is_child(prefix, it->first))
+                names.push_back(it->first.substr(prefix.size()));
+        }
+
+        for (std::set<std::string>::const_iterator it = directories.begin();
+             it != directories.end(); ++it)
+        {
+            if (is_child(prefix, *it))
+                names.push_back(it->substr(prefix.size()));
+        }
+
+        return names;
+    }
+
+    static std::string directory_prefix(const std::string& directory)
+    {
+        if (!directory.empty() && directory[directory.size() - 1] == '/')
+            return directory;
+        else
+            return directory + "/";
+    }
+
+    static bool is_child(const std::string& prefix, const std::string& path)
+    {
+        return path.size() > prefix.size() &&
+               path.compare(0, prefix.size(), prefix) == 0 &&
+               path.find('/', prefix.size()) == std::string::npos;
+    }
+
+    void reply_listing(boost::uint32_t id, const std::string& directory)
+    {
+        namespace packet_type = ::ssh::detail::sftp_protocol::packet_type;
+
+        std::vector<std::string> names = children(directory);
+
+        ::ssh::detail::wire_writer out;
+        out.put_uint8(packet_type::name)
+            .put_uint32(id)
+            .put_uint32(static_cast<boost::uint32_t>(names.size() + 2));
+
+        LIBSSH2_SFTP_ATTRIBUTES self = LIBSSH2_SFTP_ATTRIBUTES();
+        self.flags = LIBSSH2_SFTP_ATTR_PERMISSIONS;
+        self.permissions = LIBSSH2_SFTP_S_IFDIR | 0755;
+        out.put_string(".").put_string("");
+        ::ssh::detail::sftp_protocol::put_attributes(out, self);
+        out.put_string("..").put_string("");
+        ::ssh::detail::sftp_protocol::put_attributes(out, self);
+
+        for (std::vector<std::string>::const_iterator it = names.begin();
+             it != names.end(); ++it)
+        {
+            std::string path = directory_prefix(directory) + *it;
+
+            LIBSSH2_SFTP_ATTRIBUTES attributes = LIBSSH2_SFTP_ATTRIBUTES();
+            attributes.flags = LIBSSH2_SFTP_ATTR_PERMISSIONS;
+            if (directories.count(path))
+            {
+                attributes.permissions = LIBSSH2_SFTP_S_IFDIR | 0755;
+            }
+            else
+            {
+                attributes.flags |=
+                    LIBSSH2_SFTP_ATTR_SIZE | LIBSSH2_SFTP_ATTR_ACMODTIME;
+                attributes.permissions = LIBSSH2_SFTP_S_IFREG | 0644;
+                attributes.filesize = files.find(path)->second.size();
+                std::map<std::string, unsigned long>::const_iterator mtime =
+                    mtimes.find(path);
+                if (mtime != mtimes.end())
+                {
+                    attributes.atime = mtime->second;
+                    attributes.mtime = mtime->second;
+                }
+            }
+
+            out.put_string(*it).put_string("");
+            ::ssh::detail::sftp_protocol::put_attributes(out, attributes);
+        }
+
+        reply(out.buffer());
+    }
+
+    void reply_status(boost::uint32_t id, boost::uint32_t code)
+    {
+        namespace packet_type = ::ssh::detail::sftp_protocol::packet_type;
+
+        ::ssh::detail::wire_writer out;
+        out.put_uint8(packet_type::status)
+            .put_uint32(id)
+            .put_uint32(code)
+            .put_string("")
+            .put_string("");
+        reply(out.buffer());
+    }
+
+    void reply(const std::string& payload)
+    {
+        ::ssh::detail::wire_writer framed;
+        framed.put_string(payload);
+
+        if (m_reverse_replies)
+            m_held.push_back(framed.buffer());
+        else
+            m_replies.push_back(framed.buffer());
+    }
+
+    void release_held_replies()
+    {
+        if (!m_held.empty())
+            ++m_round_trips;
+
+        std::reverse(m_held.begin(), m_held.end());
+        m_replies.insert(m_replies.end(), m_held.begin(), m_held.end());
+        m_held.clear();
+    }
+
+    std::string m_input;
+    std::deque<std::string> m_replies;
+    std::deque<std::string> m_held;
+    std::map<std::string, std::string> m_handles;
+    std::map<std::string, bool> m_listed;
+    std::set<std::string> m_refused;
+    unsigned int m_next_handle;
+    std::size_t m_unanswered;
+    std::size_t m_most_unanswered;
+    std::size_t m_most_open_handles;
+    std::size_t m_largest_write;
+    std::size_t m_read_limit;
+    std::size_t m_round_trips;
+    bool m_reverse_replies;
+};
+}
+} // namespace test::ssh
+
+#endif
@@ -0,0 +1,207 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sftp_fixture.hpp"
+
+#include <ssh/file_handle.hpp> // test subject
+#include <ssh/stream.hpp>
+
+#include <boost/system/system_error.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+using ssh::filesystem::const_buffer;
+using ssh::filesystem::ifstream;
+using ssh::filesystem::mutable_buffer;
+using ssh::filesystem::openmode;
+using ssh::filesystem::path;
+using ssh::filesystem::sftp_file_handle;
+
+using boost::system::system_error;
+
+using test::ssh::sftp_fixture;
+
+using std::string;
+using std::vector;
+
+namespace
+{
+
+// More than libssh2 reads ahead in one go
+string large_data()
+{
+    string data;
+    for (int i = 0; i < 100000; ++i)
+    {
+        data.push_back(static_cast<char>('a' + i % 26));
+    }
+
+    return data;
+}
+
+string file_contents(sftp_fixture& fixture, const path& target)
+{
+    ifstream stream(fixture.filesystem(), target);
+    return string(std::istreambuf_iterator<char>(stream),
+                  std::istreambuf_iterator<char>());
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(file_handle_tests, sftp_fixture)
+
+BOOST_AUTO_TEST_CASE(read_at_start)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+    sftp_file_handle file(filesystem(), target);
+
+    char buffer[8];
+    BOOST_CHECK_EQUAL(file.read_at(0, buffer, sizeof(buffer)), 8U);
+    BOOST_CHECK_EQUAL(string(buffer, 8), "gobbledy");
+}
+
+BOOST_AUTO_TEST_CASE(read_at_out_of_order)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+    sftp_file_handle file(filesystem(), target);
+
+    char buffer[4];
+    BOOST_CHECK_EQUAL(file.read_at(9, buffer, sizeof(buffer)), 4U);
+    BOOST_CHECK_EQUAL(string(buffer, 4), "gook");
+
+    BOOST_CHECK_EQUAL(file.read_at(3, buffer, sizeof(buffer)), 4U);
+    BOOST_CHECK_EQUAL(string(buffer, 4), "bled");
+
+    BOOST_CHECK_EQUAL(file.read_at(0, buffer, sizeof(buffer)), 4U);
+    BOOST_CHECK_EQUAL(string(buffer, 4), "gobb");
+}
+
+BOOST_AUTO_TEST_CASE(read_at_past_end_is_short)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+    sftp_file_handle file(filesystem(), target);
+
+    char buffer[10];
+    BOOST_CHECK_EQUAL(file.read_at(10, buffer, sizeof(buffer)), 3U);
+    BOOST_CHECK_EQUAL(string(buffer, 3), "ook");
+
+    BOOST_CHECK_EQUAL(file.read_at(100, buffer, sizeof(buffer)), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(read_at_sequential_large)
+{
+    string data = large_data();
+    path target = new_file_in_sandbox_containing_data(data);
+    sftp_file_handle file(filesystem(), target);
+
+    string result;
+    vector<char> buffer(1000);
+    while (size_t count = file.read_at(result.size(), &buffer[0],
+                                       buffer.size()))
+    {
+        result.append(&buffer[0], count);
+    }
+
+    BOOST_CHECK(result == data);
+}
+
+BOOST_AUTO_TEST_CASE(read_at_leaves_stream_alone)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+    ifstream stream(filesystem(), target);
+    sftp_file_handle file(filesystem(), target);
+
+    string word;
+    BOOST_CHECK(stream >> word);
+
+    char buffer[4];
+    file.read_at(3, buffer, sizeof(buffer));
+
+    BOOST_CHECK(stream >> word);
+    BOOST_CHECK_EQUAL(word, "gook");
+}
+
+BOOST_AUTO_TEST_CASE(readv_at_fills_buffers_in_turn)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+    sftp_file_handle file(filesystem(), target);
+
+    char first[3];
+    char second[5];
+    vector<mutable_buffer> buffers;
+    buffers.push_back(mutable_buffer(first, sizeof(first)));
+    buffers.push_back(mutable_buffer(second, sizeof(second)));
+
+    BOOST_CHECK_EQUAL(file.readv_at(2, buffers), 8U);
+    BOOST_CHECK_EQUAL(string(first, 3), "bbl");
+    BOOST_CHECK_EQUAL(string(second, 5), "edy g");
+}
+
+BOOST_AUTO_TEST_CASE(readv_at_stops_at_end)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+    sftp_file_handle file(filesystem(), target);
+
+    char first[3];
+    char second[5];
+    vector<mutable_buffer> buffers;
+    buffers.push_back(mutable_buffer(first, sizeof(first)));
+    buffers.push_back(mutable_buffer(second, sizeof(second)));
+
+    BOOST_CHECK_EQUAL(file.readv_at(9, buffers), 4U);
+    BOOST_CHECK_EQUAL(string(first, 3), "goo");
+    BOOST_CHECK_EQUAL(second[0], 'k');
+}
+
+BOOST_AUTO_TEST_CASE(write_at_overwrites_in_place)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    {
+        sftp_file_handle file(filesystem(), target,
+                              openmode::in | openmode::out);
+        file.write_at(9, "b", 1);
+        file.write_at(1, "r", 1);
+    }
+
+    BOOST_CHECK_EQUAL(file_contents(*this, target), "grbbledy book");
+}
+
+BOOST_AUTO_TEST_CASE(writev_at_writes_buffers_in_turn)
+{
+    path target = new_file_in_sandbox();
+
+    {
+        sftp_file_handle file(filesystem(), target, openmode::out);
+
+        vector<const_buffer> buffers;
+        buffers.push_back(const_buffer("he", 2));
+        buffers.push_back(const_buffer("llo", 3));
+        file.writev_at(0, buffers);
+    }
+
+    BOOST_CHECK_EQUAL(file_contents(*this, target), "hello");
+}
+
+BOOST_AUTO_TEST_CASE(read_only_handle_cannot_write)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+    sftp_file_handle file(filesystem(), target);
+
+    BOOST_CHECK_THROW(file.write_at(0, "x", 1), system_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
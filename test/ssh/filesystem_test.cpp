@@ -32,20 +32,28 @@
 #include <boost/uuid/uuid_io.hpp>         // to_string
 
 #include <algorithm> // find, sort, transform
+#include <iterator>  // istreambuf_iterator
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+using ssh::filesystem::byte_range;
 using ssh::filesystem::directory_iterator;
 using ssh::filesystem::file_attributes;
 using ssh::filesystem::file_status;
 using ssh::filesystem::file_type;
+using ssh::filesystem::ifstream;
 using ssh::filesystem::ofstream;
 using ssh::filesystem::overwrite_behaviour;
 using ssh::filesystem::path;
 using ssh::filesystem::perms;
+using ssh::filesystem::sftp_extensions;
 using ssh::filesystem::sftp_file;
 using ssh::filesystem::sftp_filesystem;
+using ssh::filesystem::sftp_limits;
+using ssh::filesystem::space_info;
+using ssh::filesystem::tree_item;
 using ssh::session;
 
 using boost::bind;
@@ -63,6 +71,7 @@ using test::ssh::sftp_fixture;
 using std::auto_ptr;
 using std::find;
 using std::make_pair;
+using std::map;
 using std::pair;
 using std::string;
 using std::vector;
@@ -106,6 +115,13 @@ namespace
 class filesystem_fixture : public sftp_fixture
 {
 public:
+    string file_contents(const path& file)
+    {
+        ifstream stream(filesystem(), file);
+        return string(std::istreambuf_iterator<char>(stream),
+                      std::istreambuf_iterator<char>());
+    }
+
     // The following functions return the link and target path as a pair.  Both
     // paths are relative to the sandbox, regardless of whether the symlink was
     // created with a relative or absolute path
@@ -564,33 +580,177 @@ BOOST_AUTO_TEST_CASE(rename_file_obstacle_no_overwrite)
 }
 
 BOOST_AUTO_TEST_CASE(rename_file_obstacle_allow_overwrite)
+{
+    path test_file = new_file_in_sandbox_containing_data("new");
+
+    path target = new_file_in_sandbox_containing_data("target", "old");
+
+    // OpenSSH only supports SFTP 3 (no overwrite flags) but replaces the
+    // target using its posix-rename extension
+    rename(filesystem(), test_file, target,
+           overwrite_behaviour::allow_overwrite);
+    BOOST_CHECK(!exists(filesystem(), test_file));
+    BOOST_CHECK_EQUAL(file_contents(target), "new");
+}
+
+BOOST_AUTO_TEST_CASE(rename_file_obstacle_atomic_overwrite)
+{
+    path test_file = new_file_in_sandbox_containing_data("new");
+
+    path target = new_file_in_sandbox_containing_data("target", "old");
+
+    // OpenSSH only supports SFTP 3 (no overwrite flags) but replaces the
+    // target using its posix-rename extension
+    rename(filesystem(), test_file, target,
+           overwrite_behaviour::atomic_overwrite);
+    BOOST_CHECK(!exists(filesystem(), test_file));
+    BOOST_CHECK_EQUAL(file_contents(target), "new");
+}
+
+BOOST_AUTO_TEST_CASE(rename_directory_obstacle_atomic_overwrite)
+{
+    path test_directory = new_directory_in_sandbox();
+    path target = sandbox() / "target";
+    create_directory(filesystem(), target);
+    new_file_in_sandbox(path("target") / "blocker");
+
+    // Not even POSIX rename can replace a directory that has anything in it
+    BOOST_CHECK_THROW(rename(filesystem(), test_directory, target,
+                             overwrite_behaviour::atomic_overwrite),
+                      system_error);
+    BOOST_CHECK(exists(filesystem(), test_directory));
+    BOOST_CHECK(exists(filesystem(), target / "blocker"));
+}
+
+BOOST_AUTO_TEST_CASE(copy_file_copies_contents)
+{
+    string data(1024 * 1024 + 3, 'x');
+    for (size_t i = 0; i < data.size(); i += 97)
+    {
+        data[i] = static_cast<char>('a' + i % 26);
+    }
+    path test_file = new_file_in_sandbox_containing_data(data);
+    path target = sandbox() / "target";
+
+    copy_file(filesystem(), test_file, target);
+
+    BOOST_CHECK_EQUAL(file_contents(target), data);
+    BOOST_CHECK_EQUAL(file_contents(test_file), data);
+}
+
+BOOST_AUTO_TEST_CASE(copy_file_keeps_permissions)
 {
     path test_file = new_file_in_sandbox();
+    permissions(filesystem(), test_file, perms::owner_all);
+    path target = sandbox() / "target";
 
-    path target = new_file_in_sandbox("target");
+    copy_file(filesystem(), test_file, target);
 
-    // Using OpenSSH server which only supports SFTP 3 (no overwrite) so
-    // failure expected
-    BOOST_CHECK_THROW(rename(filesystem(), test_file, target,
-                             overwrite_behaviour::allow_overwrite),
+    BOOST_CHECK_EQUAL(status(filesystem(), target).permissions(),
+                      perms::owner_all);
+}
+
+BOOST_AUTO_TEST_CASE(copy_file_obstacle)
+{
+    path test_file = new_file_in_sandbox_containing_data("new");
+    path target = new_file_in_sandbox_containing_data("target", "old");
+
+    BOOST_CHECK_THROW(copy_file(filesystem(), test_file, target),
                       system_error);
-    BOOST_CHECK(exists(filesystem(), test_file));
-    BOOST_CHECK(exists(filesystem(), target));
+    BOOST_CHECK_EQUAL(file_contents(target), "old");
+
+    // Channel still usable
+    copy_file(filesystem(), test_file, sandbox() / "other");
+    BOOST_CHECK_EQUAL(file_contents(sandbox() / "other"), "new");
 }
 
-BOOST_AUTO_TEST_CASE(rename_file_obstacle_atomic_overwrite)
+BOOST_AUTO_TEST_CASE(copy_file_missing_source)
+{
+    path target = sandbox() / "target";
+
+    BOOST_CHECK_THROW(
+        copy_file(filesystem(), sandbox() / "missing", target), system_error);
+    BOOST_CHECK(!exists(filesystem(), target));
+}
+
+BOOST_AUTO_TEST_CASE(create_hard_link_shares_contents)
+{
+    path test_file = new_file_in_sandbox_containing_data("shared");
+    path link = sandbox() / "link";
+
+    create_hard_link(filesystem(), link, test_file);
+
+    BOOST_CHECK_EQUAL(file_contents(link), "shared");
+    BOOST_CHECK(is_regular_file(filesystem(), link));
+
+    {
+        ofstream stream(filesystem(), test_file);
+        stream << "changed";
+    }
+    BOOST_CHECK_EQUAL(file_contents(link), "changed");
+}
+
+BOOST_AUTO_TEST_CASE(create_hard_link_obstacle)
+{
+    path test_file = new_file_in_sandbox_containing_data("new");
+    path link = new_file_in_sandbox_containing_data("link", "old");
+
+    BOOST_CHECK_THROW(create_hard_link(filesystem(), link, test_file),
+                      system_error);
+    BOOST_CHECK_EQUAL(file_contents(link), "old");
+}
+
+BOOST_AUTO_TEST_CASE(create_hard_link_missing_target)
+{
+    path link = sandbox() / "link";
+
+    BOOST_CHECK_THROW(
+        create_hard_link(filesystem(), link, sandbox() / "missing"),
+        system_error);
+    BOOST_CHECK(!exists(filesystem(), link));
+}
+
+BOOST_AUTO_TEST_CASE(remote_hash_of_file)
+{
+    path test_file = new_file_in_sandbox_containing_data(
+        "mary had a little lamb");
+
+    BOOST_CHECK_EQUAL(remote_hash(filesystem(), test_file, "md5"),
+                      "fa198d47557433b6b99e8ac6d3cca6eb");
+    BOOST_CHECK_EQUAL(
+        remote_hash(filesystem(), test_file, "sha256"),
+        "f1839d59792aa7dffc46738332c0390003418b0a9be9fd25ac71e178da5fc301");
+}
+
+BOOST_AUTO_TEST_CASE(remote_hash_of_range)
+{
+    path test_file = new_file_in_sandbox_containing_data(
+        "mary had a little lamb");
+
+    BOOST_CHECK_EQUAL(
+        remote_hash(filesystem(), test_file, "md5", byte_range(5, 3)),
+        "a1e6cd7f9480f01643245e0b648d9fbe");
+    BOOST_CHECK_EQUAL(
+        remote_hash(filesystem(), test_file, "md5", byte_range(5, 0)),
+        "4f44f3b1d6a0ed15851a656654824b40");
+}
+
+BOOST_AUTO_TEST_CASE(remote_hash_of_empty_file)
 {
     path test_file = new_file_in_sandbox();
 
-    path target = new_file_in_sandbox("target");
+    BOOST_CHECK_EQUAL(remote_hash(filesystem(), test_file, "md5"),
+                      "d41d8cd98f00b204e9800998ecf8427e");
+}
 
-    // Using OpenSSH server which only supports SFTP 3 (no overwrite) so
-    // failure expected
-    BOOST_CHECK_THROW(rename(filesystem(), test_file, target,
-                             overwrite_behaviour::atomic_overwrite),
+BOOST_AUTO_TEST_CASE(remote_hash_of_missing_file)
+{
+    BOOST_CHECK_THROW(
+        remote_hash(filesystem(), sandbox() / "missing", "md5"),
+        system_error);
+    BOOST_CHECK_THROW(remote_hash(filesystem(), sandbox() / "missing", "md5",
+                                  byte_range(1, 1)),
                       system_error);
-    BOOST_CHECK(exists(filesystem(), test_file));
-    BOOST_CHECK(exists(filesystem(), target));
 }
 
 BOOST_AUTO_TEST_CASE(exists_true)
@@ -799,4 +959,74 @@ BOOST_AUTO_TEST_CASE(non_empty_directory_is_not_empty)
     BOOST_CHECK(!is_empty(filesystem(), sandbox()));
 }
 
+BOOST_AUTO_TEST_CASE(openssh_announces_its_extensions)
+{
+    sftp_extensions extensions = filesystem().extensions();
+
+    BOOST_CHECK(extensions.posix_rename());
+    BOOST_CHECK(extensions.statvfs());
+    BOOST_CHECK(extensions.hardlink());
+    BOOST_CHECK(extensions.fsync());
+}
+
+BOOST_AUTO_TEST_CASE(openssh_reports_its_limits)
+{
+    sftp_limits limits = filesystem().limits();
+
+    BOOST_CHECK_GT(limits.max_packet_length, 0U);
+    BOOST_CHECK_GE(limits.max_read_length, 32 * 1024U);
+    BOOST_CHECK_GE(limits.max_write_length, 32 * 1024U);
+    BOOST_CHECK_LT(limits.max_write_length, limits.max_packet_length);
+}
+
+BOOST_AUTO_TEST_CASE(space_of_sandbox)
+{
+    space_info info = space(filesystem(), sandbox());
+
+    BOOST_CHECK_GT(info.capacity, 0U);
+    BOOST_CHECK_LE(info.free, info.capacity);
+    BOOST_CHECK_LE(info.available, info.free);
+}
+
+BOOST_AUTO_TEST_CASE(space_of_missing_path)
+{
+    BOOST_CHECK_THROW(space(filesystem(), sandbox() / "missing"),
+                      system_error);
+}
+
+BOOST_AUTO_TEST_CASE(list_tree_of_sandbox)
+{
+    path directory = new_directory_in_sandbox();
+    create_directory(filesystem(), directory / "nested");
+    new_file_in_sandbox_containing_data(directory.filename() / "a",
+                                        "gobbledy gook");
+    new_file_in_sandbox_containing_data(directory.filename() / "nested/b",
+                                        string(100000, 'b'));
+    create_symlink(directory / "link", directory / "a");
+
+    vector<tree_item> items = list_tree(filesystem(), directory);
+
+    map<string, file_attributes::file_type> types;
+    map<string, uintmax_t> sizes;
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        types[items[i].relative_path.string()] = items[i].attributes.type();
+        sizes[items[i].relative_path.string()] =
+            items[i].attributes.size().get_value_or(0);
+    }
+
+    BOOST_REQUIRE_EQUAL(types.size(), 4U);
+    BOOST_CHECK(types["a"] == file_attributes::normal_file);
+    BOOST_CHECK(types["nested"] == file_attributes::directory);
+    BOOST_CHECK(types["nested/b"] == file_attributes::normal_file);
+    BOOST_CHECK(types["link"] == file_attributes::symbolic_link);
+    BOOST_CHECK_EQUAL(sizes["nested/b"], 100000U);
+}
+
+BOOST_AUTO_TEST_CASE(list_tree_of_missing_path)
+{
+    BOOST_CHECK_THROW(list_tree(filesystem(), sandbox() / "missing"),
+                      system_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -15,8 +15,14 @@
 
 #include "sftp_fixture.hpp"
 
+#include <ssh/block_cache.hpp>
+#include <ssh/content_cache.hpp>
 #include <ssh/stream.hpp> // test subject
 
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/system/system_error.hpp>
 #include <boost/test/unit_test.hpp>
 #include <boost/uuid/uuid_generators.hpp> // random_generator
@@ -25,12 +31,22 @@
 #include <string>
 #include <vector>
 
+using ssh::filesystem::block_cache;
+using ssh::filesystem::block_cache_statistics;
+using ssh::filesystem::cached_copy;
+using ssh::filesystem::content_cache;
+using ssh::filesystem::content_cache_statistics;
+using ssh::filesystem::content_copy;
+using ssh::filesystem::fstream;
 using ssh::filesystem::ifstream;
+using ssh::filesystem::ofstream;
 using ssh::filesystem::openmode;
 using ssh::filesystem::path;
 using ssh::filesystem::perms;
 using ssh::filesystem::sftp_filesystem;
 
+using boost::make_shared;
+using boost::shared_ptr;
 using boost::uuids::random_generator;
 using boost::system::system_error;
 
@@ -81,6 +97,56 @@ void make_file_read_only(sftp_filesystem& filesystem, const path& target)
 }
 
 const wchar_t WIDE_STRING1[] = L"\x92e\x939\x938\x941\x938";
+
+/**
+ * Filesystem caching blocks small enough for the tests to reason about.
+ */
+class cached_sftp_fixture : public sftp_fixture
+{
+public:
+    cached_sftp_fixture() : cache(make_shared<block_cache>(1024 * 1024, 1024))
+    {
+        filesystem().use_block_cache(cache);
+    }
+
+    shared_ptr<block_cache> cache;
+};
+
+string read_all(ifstream& stream)
+{
+    return string(std::istreambuf_iterator<char>(stream),
+                  std::istreambuf_iterator<char>());
+}
+
+/**
+ * Content cache in a local directory deleted when the test ends.
+ */
+class content_cache_fixture : public sftp_fixture
+{
+public:
+    content_cache_fixture()
+        : local_directory(boost::filesystem::temp_directory_path() /
+                          boost::filesystem::unique_path()),
+          cache(local_directory)
+    {
+    }
+
+    ~content_cache_fixture()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(local_directory, ec);
+    }
+
+    string copy_of(const path& target)
+    {
+        content_copy copy = cached_copy(cache, filesystem(), "test", target);
+        return string(std::istreambuf_iterator<char>(copy.stream()),
+                      std::istreambuf_iterator<char>());
+    }
+
+    boost::filesystem::path local_directory;
+    content_cache cache;
+};
 }
 
 BOOST_FIXTURE_TEST_SUITE(ifstream_tests, sftp_fixture)
@@ -403,6 +469,42 @@ BOOST_AUTO_TEST_CASE(input_stream_seek_input_end)
     BOOST_CHECK_EQUAL(bob, "ook");
 }
 
+// Changing the file behind the stream's back shows whether the stream goes
+// back to the server when seeking from the end
+BOOST_AUTO_TEST_CASE(input_stream_seek_end_asks_server_once)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    ifstream s(filesystem(), target);
+    BOOST_CHECK_EQUAL(s.seekg(0, std::ios_base::end).tellg(), 13);
+
+    {
+        ofstream other(filesystem(), target);
+        other << "gobbledy gooks";
+    }
+
+    BOOST_CHECK_EQUAL(s.seekg(0, std::ios_base::end).tellg(), 13);
+    BOOST_CHECK_EQUAL(s.seekg(-4, std::ios_base::end).tellg(), 9);
+
+    s->refresh();
+    BOOST_CHECK_EQUAL(s.seekg(0, std::ios_base::end).tellg(), 14);
+}
+
+BOOST_AUTO_TEST_CASE(input_stream_shared_seek_end_always_asks_server)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    ifstream s(filesystem(), target, openmode::in | openmode::shared);
+    BOOST_CHECK_EQUAL(s.seekg(0, std::ios_base::end).tellg(), 13);
+
+    {
+        ofstream other(filesystem(), target);
+        other << "gobbledy gooks";
+    }
+
+    BOOST_CHECK_EQUAL(s.seekg(0, std::ios_base::end).tellg(), 14);
+}
+
 BOOST_AUTO_TEST_CASE(input_stream_seek_input_too_far_absolute)
 {
     path target = new_file_in_sandbox();
@@ -431,3 +533,132 @@ BOOST_AUTO_TEST_CASE(input_stream_seek_input_too_far_relative)
 }
 
 BOOST_AUTO_TEST_SUITE_END();
+
+BOOST_FIXTURE_TEST_SUITE(cached_ifstream_tests, cached_sftp_fixture)
+
+BOOST_AUTO_TEST_CASE(cached_input_stream_reads_file)
+{
+    string data = large_data();
+    path target = new_file_in_sandbox_containing_data(data);
+
+    ifstream s(filesystem(), target);
+
+    BOOST_CHECK(read_all(s) == data);
+}
+
+BOOST_AUTO_TEST_CASE(cached_input_stream_header_tail_header)
+{
+    string data = large_data();
+    path target = new_file_in_sandbox_containing_data(data);
+
+    // Stream buffer no bigger than the reads so we know what the device sees
+    vector<char> buffer(100);
+    {
+        ifstream s(filesystem(), target, openmode::in, buffer.size());
+
+        BOOST_CHECK(s.read(&buffer[0], buffer.size()));
+        BOOST_CHECK(string(buffer.begin(), buffer.end()) ==
+                    data.substr(0, buffer.size()));
+
+        s.seekg(-100, std::ios_base::end);
+        BOOST_CHECK(s.read(&buffer[0], buffer.size()));
+        BOOST_CHECK(string(buffer.begin(), buffer.end()) ==
+                    data.substr(data.size() - buffer.size()));
+    }
+
+    {
+        ifstream s(filesystem(), target, openmode::in, buffer.size());
+
+        BOOST_CHECK(s.read(&buffer[0], buffer.size()));
+        BOOST_CHECK(string(buffer.begin(), buffer.end()) ==
+                    data.substr(0, buffer.size()));
+    }
+
+    block_cache_statistics statistics = cache->statistics();
+    BOOST_CHECK_EQUAL(statistics.misses, 2U);
+    BOOST_CHECK_EQUAL(statistics.hits, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(cached_input_stream_reads_ahead_in_order)
+{
+    string data = large_data();
+    path target = new_file_in_sandbox_containing_data(data);
+
+    ifstream s(filesystem(), target, openmode::in, 1024);
+    BOOST_CHECK(read_all(s) == data);
+
+    block_cache_statistics statistics = cache->statistics();
+    BOOST_CHECK_GT(statistics.read_ahead, 0U);
+    BOOST_CHECK_LT(statistics.misses, data.size() / 1024 / 4);
+}
+
+BOOST_AUTO_TEST_CASE(cached_input_stream_sees_overwrite)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    {
+        ifstream s(filesystem(), target);
+        BOOST_CHECK_EQUAL(read_all(s), "gobbledy gook");
+    }
+
+    {
+        ofstream s(filesystem(), target);
+        s << "fresh";
+    }
+
+    ifstream s(filesystem(), target);
+    BOOST_CHECK_EQUAL(read_all(s), "fresh");
+}
+
+BOOST_AUTO_TEST_CASE(cached_io_stream_reads_own_write)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    {
+        ifstream s(filesystem(), target);
+        BOOST_CHECK_EQUAL(read_all(s), "gobbledy gook");
+    }
+
+    fstream s(filesystem(), target);
+    s.seekp(9, std::ios_base::beg);
+    BOOST_CHECK(s << "b");
+    s.flush();
+    s.seekg(0, std::ios_base::beg);
+
+    string bob;
+    BOOST_CHECK(s >> bob);
+    BOOST_CHECK(s >> bob);
+    BOOST_CHECK_EQUAL(bob, "book");
+}
+
+BOOST_AUTO_TEST_SUITE_END();
+
+BOOST_FIXTURE_TEST_SUITE(content_cache_tests, content_cache_fixture)
+
+BOOST_AUTO_TEST_CASE(cached_copy_downloads_once)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    BOOST_CHECK_EQUAL(copy_of(target), "gobbledy gook");
+    BOOST_CHECK_EQUAL(copy_of(target), "gobbledy gook");
+
+    content_cache_statistics statistics = cache.statistics();
+    BOOST_CHECK_EQUAL(statistics.misses, 1U);
+    BOOST_CHECK_EQUAL(statistics.hits, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(cached_copy_sees_remote_change)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+    BOOST_CHECK_EQUAL(copy_of(target), "gobbledy gook");
+
+    {
+        ofstream s(filesystem(), target);
+        s << "changed";
+    }
+
+    BOOST_CHECK_EQUAL(copy_of(target), "changed");
+    BOOST_CHECK_EQUAL(cache.statistics().misses, 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -17,9 +17,12 @@
 
 #include <ssh/stream.hpp> // test subject
 
+#include <boost/iostreams/stream.hpp> // stream
 #include <boost/system/system_error.hpp>
 #include <boost/test/unit_test.hpp>
 
+#include <ios> // ios_base
+#include <iterator> // istreambuf_iterator
 #include <string>
 #include <vector>
 
@@ -29,11 +32,13 @@ using ssh::filesystem::openmode;
 using ssh::filesystem::path;
 using ssh::filesystem::perms;
 using ssh::filesystem::sftp_filesystem;
+using ssh::filesystem::sftp_io_device;
 
 using boost::system::system_error;
 
 using test::ssh::sftp_fixture;
 
+using std::ios_base;
 using std::runtime_error;
 using std::string;
 using std::vector;
@@ -242,6 +247,9 @@ BOOST_AUTO_TEST_CASE(io_stream_write_no_buffer)
     fstream io_stream(chan, target, openmode::in | openmode::out, 0);
     BOOST_CHECK(io_stream.write(data.data(), data.size()));
 
+    // The device still holds writes back until flushed
+    BOOST_CHECK(io_stream.flush());
+
     ifstream input_stream(filesystem(), target);
 
     string bob;
@@ -510,4 +518,102 @@ BOOST_AUTO_TEST_CASE(io_stream_seek_interleaved)
     BOOST_CHECK_EQUAL(bob, "ahhk");
 }
 
+BOOST_AUTO_TEST_CASE(io_stream_scattered_writes_all_arrive)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    {
+        fstream s(filesystem(), target);
+
+        // Header update, append, then header update again
+        s.seekp(0, std::ios_base::beg);
+        BOOST_CHECK(s << "G");
+        s.seekp(0, std::ios_base::end);
+        BOOST_CHECK(s << " and more");
+        s.seekp(1, std::ios_base::beg);
+        BOOST_CHECK(s << "O");
+
+        BOOST_CHECK(s.flush());
+    }
+
+    ifstream input_stream(filesystem(), target);
+
+    string contents((std::istreambuf_iterator<char>(input_stream)),
+                    std::istreambuf_iterator<char>());
+    BOOST_CHECK_EQUAL(contents, "GObbledy gook and more");
+}
+
+BOOST_AUTO_TEST_CASE(io_stream_reads_unflushed_writes)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    fstream s(filesystem(), target);
+    s.seekp(9, std::ios_base::beg);
+    BOOST_CHECK(s << "b");
+
+    s.seekg(0, std::ios_base::beg);
+
+    string bob;
+    BOOST_CHECK(s >> bob);
+    BOOST_CHECK_EQUAL(bob, "gobbledy");
+    BOOST_CHECK(s >> bob);
+    BOOST_CHECK_EQUAL(bob, "book");
+}
+
+BOOST_AUTO_TEST_CASE(io_stream_seek_end_sees_unflushed_append)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    fstream s(filesystem(), target);
+    s.seekp(0, std::ios_base::end);
+    BOOST_CHECK(s << "s");
+
+    BOOST_CHECK_EQUAL(s.seekg(0, std::ios_base::end).tellg(), 14);
+
+    s.seekg(-5, std::ios_base::end);
+    string bob;
+    BOOST_CHECK(s >> bob);
+    BOOST_CHECK_EQUAL(bob, "gooks");
+}
+
+BOOST_AUTO_TEST_CASE(io_stream_write_past_end_leaves_zeros)
+{
+    path target = new_file_in_sandbox_containing_data("abc");
+
+    fstream s(filesystem(), target);
+    s.seekp(5, std::ios_base::beg);
+    BOOST_CHECK(s << "z");
+
+    s.seekg(0, std::ios_base::beg);
+    vector<char> buffer(6);
+    BOOST_CHECK(s.read(&buffer[0], buffer.size()));
+    BOOST_CHECK_EQUAL(string(buffer.begin(), buffer.end()),
+                      string("abc\0\0z", 6));
+}
+
+BOOST_AUTO_TEST_CASE(io_stream_failed_flush_reported_by_close)
+{
+    path target = new_file_in_sandbox();
+    make_file_read_only(filesystem(), target);
+
+    fstream s(filesystem(), target, openmode::in);
+    BOOST_CHECK(s << "gobbledy gook");
+
+    BOOST_CHECK_THROW(s.close(), system_error);
+}
+
+// Without a write-back threshold, a write that fails says so itself rather
+// than leaving it to a flush the owner may never make
+BOOST_AUTO_TEST_CASE(io_stream_write_through_failed_write_reported_by_write)
+{
+    path target = new_file_in_sandbox();
+    make_file_read_only(filesystem(), target);
+
+    boost::iostreams::stream<sftp_io_device> s(
+        sftp_io_device(filesystem(), target, ios_base::in, 0), 0);
+
+    BOOST_CHECK(!s.write("gobbledy gook", 13));
+    BOOST_CHECK(s.bad());
+}
+
 BOOST_AUTO_TEST_SUITE_END();
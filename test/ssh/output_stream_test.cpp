@@ -15,7 +15,9 @@
 
 #include "sftp_fixture.hpp"
 
+#include <ssh/file_handle.hpp>
 #include <ssh/stream.hpp> // test subject
+#include <ssh/transfer.hpp>
 
 #include <boost/system/system_error.hpp>
 #include <boost/test/unit_test.hpp>
@@ -25,12 +27,17 @@
 #include <string>
 #include <vector>
 
+using ssh::filesystem::device_sink;
 using ssh::filesystem::ifstream;
+using ssh::filesystem::memory_source;
 using ssh::filesystem::ofstream;
 using ssh::filesystem::openmode;
 using ssh::filesystem::path;
 using ssh::filesystem::perms;
+using ssh::filesystem::sftp_file_handle;
 using ssh::filesystem::sftp_filesystem;
+using ssh::filesystem::sftp_output_device;
+using ssh::filesystem::transfer_engine;
 
 using boost::uuids::random_generator;
 using boost::system::system_error;
@@ -779,4 +786,105 @@ BOOST_AUTO_TEST_CASE(output_stream_seek_output_before_end)
     BOOST_CHECK_EQUAL(bob, "grok");
 }
 
+// The file is truncated on opening so the stream knows its size without
+// asking.  Extending the file behind its back shows it doesn't ask later.
+BOOST_AUTO_TEST_CASE(output_stream_seek_end_tracks_own_writes)
+{
+    path target = new_file_in_sandbox();
+
+    ofstream s(filesystem(), target);
+    BOOST_CHECK_EQUAL(s.seekp(0, std::ios_base::end).tellp(), 0);
+
+    BOOST_CHECK(s << "gobbledy");
+    BOOST_CHECK_EQUAL(s.seekp(0, std::ios_base::end).tellp(), 8);
+
+    sftp_file_handle other(filesystem(), target, openmode::out | openmode::in);
+    other.write_at(8, " gook", 5);
+
+    BOOST_CHECK_EQUAL(s.seekp(0, std::ios_base::end).tellp(), 8);
+
+    s->refresh();
+    BOOST_CHECK_EQUAL(s.seekp(0, std::ios_base::end).tellp(), 13);
+}
+
+BOOST_AUTO_TEST_CASE(output_stream_durable_flag)
+{
+    path target = new_file_in_sandbox();
+    string data = large_data();
+
+    ofstream output_stream(filesystem(), target,
+                           openmode::out | openmode::durable);
+    output_stream.exceptions(std::ios_base::badbit | std::ios_base::failbit);
+    output_stream << data;
+    output_stream.close();
+
+    ifstream input_stream(filesystem(), target);
+
+    string bob;
+
+    BOOST_CHECK(input_stream >> bob);
+    BOOST_CHECK(bob == data);
+}
+
+BOOST_AUTO_TEST_CASE(output_device_write_at)
+{
+    path target = new_file_in_sandbox_containing_data("gobbledy gook");
+
+    {
+        sftp_output_device device(filesystem(), target, openmode::in);
+        BOOST_CHECK_EQUAL(device.write_at(9, "b", 1), 1);
+        BOOST_CHECK_EQUAL(device.write_at(1, "r", 1), 1);
+    }
+
+    ifstream input_stream(filesystem(), target);
+
+    string bob;
+
+    BOOST_CHECK(input_stream >> bob);
+    BOOST_CHECK_EQUAL(bob, "grbbledy");
+    BOOST_CHECK(input_stream >> bob);
+    BOOST_CHECK_EQUAL(bob, "book");
+}
+
+BOOST_AUTO_TEST_CASE(output_device_write_at_continues_from_end_of_write)
+{
+    path target = new_file_in_sandbox();
+
+    {
+        sftp_output_device device(filesystem(), target);
+        device.write_at(2, "ll", 2);
+        device.write("o", 1);
+        device.write_at(0, "he", 2);
+    }
+
+    ifstream input_stream(filesystem(), target);
+
+    string bob;
+
+    BOOST_CHECK(input_stream >> bob);
+    BOOST_CHECK_EQUAL(bob, "hello");
+}
+
+BOOST_AUTO_TEST_CASE(output_device_transfer_large_data)
+{
+    path target = new_file_in_sandbox();
+    string data = large_binary_data();
+
+    {
+        sftp_output_device device(filesystem(), target);
+        device_sink<sftp_output_device> sink(device);
+        memory_source source(data);
+
+        transfer_engine().transfer(source, sink);
+    }
+
+    ifstream input_stream(filesystem(), target);
+
+    vector<char> buffer(data.size());
+    BOOST_CHECK(input_stream.read(&buffer[0], buffer.size()));
+
+    BOOST_CHECK_EQUAL_COLLECTIONS(buffer.begin(), buffer.end(), data.begin(),
+                                  data.end());
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,137 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <ssh/detail/remote_hash.hpp> // test subject
+#include <ssh/detail/wire.hpp>
+
+#include <boost/system/system_error.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+using ssh::detail::check_file_arguments;
+using ssh::detail::hash_command;
+using ssh::detail::hash_from_check_file_reply;
+using ssh::detail::hash_from_command_output;
+using ssh::detail::hash_from_md5_hash_reply;
+using ssh::detail::shell_quote;
+using ssh::detail::to_hex;
+using ssh::detail::wire_reader;
+using ssh::detail::wire_writer;
+
+using boost::system::system_error;
+
+using std::string;
+
+BOOST_AUTO_TEST_SUITE(remote_hash_tests)
+
+BOOST_AUTO_TEST_CASE(hex_is_lower_case)
+{
+    BOOST_CHECK_EQUAL(to_hex(string("\x00\x1f\xa0\xff", 4)), "001fa0ff");
+}
+
+BOOST_AUTO_TEST_CASE(check_file_asks_for_one_hash)
+{
+    string arguments = check_file_arguments("/file", "sha1", 5, 10);
+    wire_reader in(arguments);
+
+    BOOST_CHECK_EQUAL(in.get_string(), "/file");
+    BOOST_CHECK_EQUAL(in.get_string(), "sha1");
+    BOOST_CHECK_EQUAL(in.get_uint64(), 5U);
+    BOOST_CHECK_EQUAL(in.get_uint64(), 10U);
+    BOOST_CHECK_EQUAL(in.get_uint32(), 0U);
+    BOOST_CHECK(in.empty());
+}
+
+BOOST_AUTO_TEST_CASE(check_file_reply)
+{
+    wire_writer reply;
+    reply.put_string("check-file").put_string("md5").put_raw("\xab\xcd", 2);
+
+    BOOST_CHECK_EQUAL(hash_from_check_file_reply(reply.buffer(), "md5"),
+                      "abcd");
+}
+
+BOOST_AUTO_TEST_CASE(check_file_reply_with_other_algorithm)
+{
+    wire_writer reply;
+    reply.put_string("check-file").put_string("sha1").put_raw("\xab\xcd", 2);
+
+    BOOST_CHECK_THROW(hash_from_check_file_reply(reply.buffer(), "md5"),
+                      system_error);
+}
+
+BOOST_AUTO_TEST_CASE(md5_hash_reply)
+{
+    wire_writer reply;
+    reply.put_string("md5-hash").put_string("\x01\x23", 2);
+
+    BOOST_CHECK_EQUAL(hash_from_md5_hash_reply(reply.buffer()), "0123");
+}
+
+BOOST_AUTO_TEST_CASE(quoting_survives_quotes)
+{
+    BOOST_CHECK_EQUAL(shell_quote("it's $HOME"), "'it'\\''s $HOME'");
+}
+
+BOOST_AUTO_TEST_CASE(command_for_whole_file)
+{
+    BOOST_CHECK_EQUAL(hash_command("/a b", "md5", 0, 0), "md5sum < '/a b'");
+}
+
+BOOST_AUTO_TEST_CASE(command_for_range)
+{
+    BOOST_CHECK_EQUAL(hash_command("/f", "sha256", 5, 3),
+                      "test -r '/f' && tail -c +6 '/f' | head -c 3 | "
+                      "sha256sum");
+}
+
+BOOST_AUTO_TEST_CASE(command_for_rest_of_file)
+{
+    BOOST_CHECK_EQUAL(hash_command("/f", "sha1", 5, 0),
+                      "test -r '/f' && tail -c +6 '/f' | sha1sum");
+}
+
+BOOST_AUTO_TEST_CASE(no_command_for_unknown_algorithm)
+{
+    BOOST_CHECK(hash_command("/f", "crc32", 0, 0).empty());
+}
+
+BOOST_AUTO_TEST_CASE(command_output)
+{
+    BOOST_CHECK_EQUAL(
+        hash_from_command_output("d41d8cd98f00b204e9800998ecf8427e  -\n",
+                                 "md5"),
+        "d41d8cd98f00b204e9800998ecf8427e");
+}
+
+BOOST_AUTO_TEST_CASE(command_output_of_wrong_length)
+{
+    BOOST_CHECK(
+        hash_from_command_output("d41d8cd98f00b204e9800998ecf8427e00  -\n",
+                                 "md5")
+            .empty());
+    BOOST_CHECK(hash_from_command_output("d41d8cd9  -\n", "md5").empty());
+}
+
+BOOST_AUTO_TEST_CASE(command_output_that_is_not_a_hash)
+{
+    BOOST_CHECK(
+        hash_from_command_output("sh: md5sum: command not found     \n",
+                                 "md5")
+            .empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
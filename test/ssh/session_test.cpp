@@ -112,4 +112,29 @@ BOOST_AUTO_TEST_CASE(move_assign)
     s2 = move(s1);
 }
 
+BOOST_AUTO_TEST_CASE(keepalive_disabled_by_default)
+{
+    io_service io;
+    tcp::socket socket(io);
+    open_socket_to_host(io, socket, host(), port());
+    session s(socket.native());
+
+    // With keepalives unconfigured, libssh2 never considers one due
+    BOOST_CHECK_EQUAL(s.send_keepalive(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(keepalive_reports_time_to_next)
+{
+    io_service io;
+    tcp::socket socket(io);
+    open_socket_to_host(io, socket, host(), port());
+    session s(socket.native());
+
+    s.keepalive_config(true, 30);
+
+    unsigned int seconds_to_next = s.send_keepalive();
+    BOOST_CHECK_GT(seconds_to_next, 0U);
+    BOOST_CHECK_LE(seconds_to_next, 30U);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,448 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "fake_sftp_server.hpp"
+
+#include <ssh/detail/sftp_batch.hpp>
+#include <ssh/detail/sftp_protocol.hpp>
+#include <ssh/detail/wire.hpp>
+#include <ssh/sftp_error.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <cstddef> // size_t
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <libssh2_sftp.h>
+
+using ssh::detail::sftp_protocol::request_pipeline;
+using ssh::detail::sftp_protocol::request_sizing;
+using ssh::detail::sftp_protocol::run_requests;
+using ssh::detail::sftp_protocol::sizing_for;
+using ssh::detail::sftp_protocol::status_request;
+using ssh::detail::sftp_protocol::upload_files;
+using ssh::detail::sftp_protocol::upload_job;
+using ssh::detail::wire_writer;
+using ssh::filesystem::sftp_error_category;
+using ssh::filesystem::sftp_limits;
+
+using test::ssh::fake_sftp_server;
+
+using boost::lexical_cast;
+using boost::system::error_code;
+
+using std::deque;
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+class batch_fixture
+{
+public:
+    /**
+     * Queue a file to upload.
+     *
+     * The contents are kept by the fixture so the job can point at them.
+     */
+    void add_file(const string& path, const string& contents,
+                  bool overwrite = true, bool durable = false)
+    {
+        m_contents.push_back(contents);
+        m_jobs.push_back(upload_job(path, m_contents.back().data(),
+                                    m_contents.back().size(), overwrite,
+                                    durable));
+    }
+
+    vector<error_code> upload(const request_sizing& sizing = request_sizing())
+    {
+        request_pipeline<fake_sftp_server> pipeline(server);
+        vector<error_code> results = upload_files(pipeline, m_jobs, sizing);
+        BOOST_CHECK_EQUAL(pipeline.outstanding(), 0U);
+        return results;
+    }
+
+    fake_sftp_server server;
+
+private:
+    deque<string> m_contents; // deque so earlier elements don't move
+    vector<upload_job> m_jobs;
+};
+
+string file_contents(size_t size, char seed)
+{
+    string contents(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+    {
+        contents[i] = static_cast<char>(seed + i % 23);
+    }
+    return contents;
+}
+
+status_request remove_request(const string& path)
+{
+    wire_writer body;
+    body.put_string(path);
+    return status_request(
+        ssh::detail::sftp_protocol::packet_type::remove, body.buffer());
+}
+
+/**
+ * Round trips a fresh server needs to create the files, either all in one
+ * batch or each in a batch of its own.
+ */
+size_t round_trips_to_upload(const vector<upload_job>& jobs,
+                             bool one_at_a_time)
+{
+    fake_sftp_server server;
+    server.extensions["fsync@openssh.com"] = "1";
+    server.reverse_replies();
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    size_t handshake = server.round_trips();
+
+    if (one_at_a_time)
+    {
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            upload_files(pipeline, vector<upload_job>(1, jobs[i]));
+        }
+    }
+    else
+    {
+        upload_files(pipeline, jobs);
+    }
+
+    return server.round_trips() - handshake;
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(sftp_batch_tests, batch_fixture)
+
+BOOST_AUTO_TEST_CASE(handshake_learns_version_and_extensions)
+{
+    request_pipeline<fake_sftp_server> pipeline(server);
+
+    BOOST_CHECK_EQUAL(pipeline.version(), 3U);
+    BOOST_CHECK(pipeline.supports("posix-rename@openssh.com", "1"));
+    BOOST_CHECK(!pipeline.supports("posix-rename@openssh.com", "2"));
+    BOOST_CHECK(!pipeline.supports("hardlink@openssh.com", "1"));
+}
+
+BOOST_AUTO_TEST_CASE(empty_batch)
+{
+    BOOST_CHECK(upload().empty());
+    BOOST_CHECK(server.files.empty());
+}
+
+BOOST_AUTO_TEST_CASE(every_file_is_created_with_its_contents)
+{
+    add_file("/a", "alpha");
+    add_file("/empty", "");
+    add_file("/big", file_contents(100 * 1024 + 7, 'b'));
+
+    vector<error_code> results = upload();
+
+    BOOST_REQUIRE_EQUAL(results.size(), 3U);
+    BOOST_CHECK(!results[0]);
+    BOOST_CHECK(!results[1]);
+    BOOST_CHECK(!results[2]);
+    BOOST_CHECK_EQUAL(server.files["/a"], "alpha");
+    BOOST_CHECK_EQUAL(server.files["/empty"], "");
+    BOOST_CHECK(server.files["/big"] == file_contents(100 * 1024 + 7, 'b'));
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(files_are_in_flight_together)
+{
+    for (int i = 0; i < 500; ++i)
+    {
+        add_file("/" + lexical_cast<string>(i), file_contents(2048, 'a'));
+    }
+
+    vector<error_code> results = upload();
+
+    BOOST_CHECK_EQUAL(server.files.size(), 500U);
+    BOOST_CHECK_GT(server.most_unanswered(), 1U);
+    BOOST_CHECK_LE(server.most_unanswered(),
+                   ssh::detail::sftp_protocol::default_max_outstanding + 1);
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(replies_out_of_order)
+{
+    server.reverse_replies();
+
+    for (int i = 0; i < 100; ++i)
+    {
+        add_file("/" + lexical_cast<string>(i),
+                 file_contents(40 * 1024, static_cast<char>('a' + i % 26)));
+    }
+
+    vector<error_code> results = upload();
+
+    for (int i = 0; i < 100; ++i)
+    {
+        BOOST_CHECK(!results[i]);
+        BOOST_CHECK(server.files["/" + lexical_cast<string>(i)] ==
+                    file_contents(40 * 1024, static_cast<char>('a' + i % 26)));
+    }
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(existing_file_is_kept_unless_overwrite_allowed)
+{
+    server.files["/keep"] = "old";
+    server.files["/replace"] = "old";
+
+    add_file("/keep", "new", false);
+    add_file("/replace", "new", true);
+    add_file("/fresh", "new", false);
+
+    vector<error_code> results = upload();
+
+    BOOST_CHECK(results[0]);
+    BOOST_CHECK(!results[1]);
+    BOOST_CHECK(!results[2]);
+    BOOST_CHECK_EQUAL(server.files["/keep"], "old");
+    BOOST_CHECK_EQUAL(server.files["/replace"], "new");
+    BOOST_CHECK_EQUAL(server.files["/fresh"], "new");
+}
+
+BOOST_AUTO_TEST_CASE(failure_is_reported_for_that_file_only)
+{
+    server.refuse("/b");
+
+    add_file("/a", "a");
+    add_file("/b", "b");
+    add_file("/c", "c");
+
+    vector<error_code> results = upload();
+
+    BOOST_CHECK(!results[0]);
+    BOOST_CHECK(results[1] == error_code(LIBSSH2_FX_PERMISSION_DENIED,
+                                         sftp_error_category()));
+    BOOST_CHECK(!results[2]);
+    BOOST_CHECK_EQUAL(server.files.count("/b"), 0U);
+    BOOST_CHECK_EQUAL(server.files["/c"], "c");
+}
+
+BOOST_AUTO_TEST_CASE(open_files_are_limited)
+{
+    for (int i = 0; i < 100; ++i)
+    {
+        add_file("/" + lexical_cast<string>(i), file_contents(2048, 'a'));
+    }
+
+    request_sizing sizing;
+    sizing.max_open_handles = 3;
+    vector<error_code> results = upload(sizing);
+
+    BOOST_CHECK_EQUAL(server.files.size(), 100U);
+    BOOST_CHECK_LE(server.most_open_handles(), 3U);
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(writes_are_the_requested_size)
+{
+    add_file("/big", file_contents(300 * 1024 + 5, 'b'));
+
+    request_sizing sizing;
+    sizing.request_size = 100 * 1024;
+    vector<error_code> results = upload(sizing);
+
+    BOOST_CHECK(!results[0]);
+    BOOST_CHECK(server.files["/big"] == file_contents(300 * 1024 + 5, 'b'));
+    BOOST_CHECK_EQUAL(server.largest_write(), 100 * 1024U);
+}
+
+BOOST_AUTO_TEST_CASE(durable_files_are_synced_before_closing)
+{
+    server.extensions["fsync@openssh.com"] = "1";
+
+    add_file("/durable", file_contents(100 * 1024 + 7, 'd'), true, true);
+    add_file("/ordinary", "ordinary");
+
+    vector<error_code> results = upload();
+
+    BOOST_CHECK(!results[0]);
+    BOOST_CHECK(!results[1]);
+    BOOST_CHECK(server.synced["/durable"] ==
+                file_contents(100 * 1024 + 7, 'd'));
+    BOOST_CHECK_EQUAL(server.synced.count("/ordinary"), 0U);
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(durable_file_fails_without_fsync)
+{
+    add_file("/durable", "data", true, true);
+
+    vector<error_code> results = upload();
+
+    BOOST_CHECK(results[0] ==
+                error_code(LIBSSH2_FX_OP_UNSUPPORTED, sftp_error_category()));
+    BOOST_CHECK_EQUAL(server.files["/durable"], "data");
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(refused_durable_file_is_not_synced)
+{
+    server.extensions["fsync@openssh.com"] = "1";
+    server.refuse("/durable");
+
+    add_file("/durable", "data", true, true);
+
+    vector<error_code> results = upload();
+
+    BOOST_CHECK(results[0]);
+    BOOST_CHECK_EQUAL(server.extended_requests["fsync@openssh.com"], 0U);
+}
+
+// Stands in for a benchmark: on a real network each round trip costs a
+// full latency, so these counts are the time the syncs add
+BOOST_AUTO_TEST_CASE(durability_costs_one_round_trip_per_batch)
+{
+    vector<upload_job> ordinary;
+    vector<upload_job> durable;
+    string contents = file_contents(2048, 'r');
+    for (int i = 0; i < 20; ++i)
+    {
+        string path = "/" + lexical_cast<string>(i);
+        ordinary.push_back(
+            upload_job(path, contents.data(), contents.size(), true));
+        durable.push_back(
+            upload_job(path, contents.data(), contents.size(), true, true));
+    }
+
+    size_t batched = round_trips_to_upload(ordinary, false);
+    size_t batched_durable = round_trips_to_upload(durable, false);
+    size_t serial = round_trips_to_upload(ordinary, true);
+    size_t serial_durable = round_trips_to_upload(durable, true);
+
+    BOOST_TEST_MESSAGE("Round trips for 20 files: "
+                       << batched << " batched, " << batched_durable
+                       << " batched and durable, " << serial
+                       << " one at a time, " << serial_durable
+                       << " one at a time and durable");
+
+    BOOST_CHECK_EQUAL(batched_durable, batched + 1);
+    BOOST_CHECK_EQUAL(serial_durable, serial + 20);
+}
+
+BOOST_AUTO_TEST_CASE(requests_run_together)
+{
+    fake_sftp_server server;
+    vector<status_request> requests;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        string path = "/tmp/" + lexical_cast<string>(i);
+        server.files[path] = "data";
+        requests.push_back(remove_request(path));
+    }
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    vector<error_code> results = run_requests(pipeline, requests);
+
+    BOOST_CHECK_EQUAL(results.size(), 100U);
+    for (size_t i = 0; i < results.size(); ++i)
+        BOOST_CHECK(!results[i]);
+    BOOST_CHECK(server.files.empty());
+    BOOST_CHECK_EQUAL(server.most_unanswered(),
+                      ssh::detail::sftp_protocol::default_max_outstanding);
+    BOOST_CHECK_EQUAL(pipeline.outstanding(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(request_failures_are_kept_in_order)
+{
+    fake_sftp_server server;
+    server.reverse_replies();
+    server.files["/tmp/a"] = "data";
+    server.files["/tmp/c"] = "data";
+
+    vector<status_request> requests;
+    requests.push_back(remove_request("/tmp/a"));
+    requests.push_back(remove_request("/tmp/b"));
+    requests.push_back(remove_request("/tmp/c"));
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    vector<error_code> results = run_requests(pipeline, requests);
+
+    BOOST_CHECK(!results[0]);
+    BOOST_CHECK_EQUAL(results[1], error_code(LIBSSH2_FX_NO_SUCH_FILE,
+                                             sftp_error_category()));
+    BOOST_CHECK(!results[2]);
+}
+
+BOOST_AUTO_TEST_CASE(sizing_without_limits_fits_any_server)
+{
+    request_sizing sizing = sizing_for(sftp_limits());
+
+    BOOST_CHECK_EQUAL(sizing.request_size, 32 * 1024U);
+    BOOST_CHECK_EQUAL(sizing.max_open_handles, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(sizing_uses_server_limits)
+{
+    sftp_limits limits;
+    limits.max_packet_length = 256 * 1024;
+    limits.max_read_length = 255 * 1024;
+    limits.max_write_length = 200 * 1024;
+    limits.max_open_handles = 10;
+
+    request_sizing sizing = sizing_for(limits);
+
+    BOOST_CHECK_EQUAL(sizing.request_size, 200 * 1024U);
+    BOOST_CHECK_EQUAL(sizing.max_open_handles, 10U);
+    BOOST_CHECK_EQUAL(sizing.max_bytes_in_flight,
+                      request_sizing().max_bytes_in_flight);
+}
+
+BOOST_AUTO_TEST_CASE(sizing_leaves_room_for_packet_header)
+{
+    sftp_limits limits;
+    limits.max_packet_length = 64 * 1024;
+    limits.max_read_length = 64 * 1024;
+    limits.max_write_length = 64 * 1024;
+
+    request_sizing sizing = sizing_for(limits);
+
+    BOOST_CHECK_LT(sizing.request_size, 64 * 1024U);
+    BOOST_CHECK_GT(sizing.request_size, 32 * 1024U);
+}
+
+BOOST_AUTO_TEST_CASE(sizing_caps_huge_limits)
+{
+    sftp_limits limits;
+    limits.max_packet_length = 16 * 1024 * 1024;
+    limits.max_read_length = 16 * 1024 * 1024;
+    limits.max_write_length = 16 * 1024 * 1024;
+    limits.max_open_handles = 100000;
+
+    request_sizing sizing = sizing_for(limits);
+
+    BOOST_CHECK_EQUAL(sizing.request_size,
+                      ssh::detail::sftp_protocol::max_request_size);
+    BOOST_CHECK_EQUAL(sizing.max_open_handles,
+                      ssh::detail::sftp_protocol::default_max_outstanding);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
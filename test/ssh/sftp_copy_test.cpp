@@ -0,0 +1,218 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "fake_sftp_server.hpp"
+
+#include <ssh/detail/sftp_copy.hpp> // test subject
+#include <ssh/detail/sftp_protocol.hpp>
+#include <ssh/sftp_error.hpp>
+
+#include <boost/system/system_error.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <cstddef> // size_t
+#include <string>
+
+#include <libssh2_sftp.h>
+
+using ssh::detail::sftp_protocol::copy_file;
+using ssh::detail::sftp_protocol::request_pipeline;
+using ssh::detail::sftp_protocol::request_sizing;
+using ssh::filesystem::sftp_error_category;
+
+using test::ssh::fake_sftp_server;
+
+using boost::system::error_code;
+using boost::system::system_error;
+
+using std::size_t;
+using std::string;
+
+namespace
+{
+
+/**
+ * Data long enough to need many reads, that shows if any land in the wrong
+ * place.
+ */
+string numbered_data(size_t size)
+{
+    string data(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+    {
+        data[i] = static_cast<char>(i % 251);
+    }
+    return data;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(sftp_copy_tests)
+
+BOOST_AUTO_TEST_CASE(copy_streams_without_copy_data)
+{
+    fake_sftp_server server;
+    server.files["/from"] = numbered_data(300 * 1024 + 17);
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    copy_file(pipeline, "/from", "/to");
+
+    BOOST_CHECK(server.files["/to"] == server.files["/from"]);
+    BOOST_CHECK_EQUAL(server.extended_requests.count("copy-data"), 0U);
+    BOOST_CHECK_GT(server.most_unanswered(), 1U);
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(copy_uses_copy_data)
+{
+    fake_sftp_server server;
+    server.extensions["copy-data"] = "";
+    server.files["/from"] = numbered_data(300 * 1024 + 17);
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    copy_file(pipeline, "/from", "/to");
+
+    BOOST_CHECK(server.files["/to"] == server.files["/from"]);
+    BOOST_CHECK_EQUAL(server.extended_requests["copy-data"], 1U);
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(copy_empty_file)
+{
+    fake_sftp_server server;
+    server.files["/from"] = "";
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    copy_file(pipeline, "/from", "/to");
+
+    BOOST_CHECK_EQUAL(server.files.count("/to"), 1U);
+    BOOST_CHECK(server.files["/to"].empty());
+}
+
+BOOST_AUTO_TEST_CASE(copy_completes_short_reads)
+{
+    fake_sftp_server server;
+    server.limit_reads(1000);
+    server.files["/from"] = numbered_data(100 * 1024);
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    copy_file(pipeline, "/from", "/to");
+
+    BOOST_CHECK(server.files["/to"] == server.files["/from"]);
+}
+
+BOOST_AUTO_TEST_CASE(copy_survives_out_of_order_replies)
+{
+    fake_sftp_server server;
+    server.reverse_replies();
+    server.files["/from"] = numbered_data(200 * 1024 + 1);
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    copy_file(pipeline, "/from", "/to");
+
+    BOOST_CHECK(server.files["/to"] == server.files["/from"]);
+}
+
+BOOST_AUTO_TEST_CASE(copy_limits_requests_in_flight)
+{
+    fake_sftp_server server;
+    server.files["/from"] = numbered_data(1024 * 1024);
+
+    request_sizing sizing;
+    sizing.max_outstanding = 4;
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    copy_file(pipeline, "/from", "/to", sizing);
+
+    BOOST_CHECK(server.files["/to"] == server.files["/from"]);
+    BOOST_CHECK_LE(server.most_unanswered(), 4U);
+}
+
+BOOST_AUTO_TEST_CASE(copy_limits_data_in_flight)
+{
+    fake_sftp_server server;
+    server.files["/from"] = numbered_data(1024 * 1024);
+
+    request_sizing sizing;
+    sizing.request_size = 64 * 1024;
+    sizing.max_bytes_in_flight = 128 * 1024;
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    copy_file(pipeline, "/from", "/to", sizing);
+
+    BOOST_CHECK(server.files["/to"] == server.files["/from"]);
+    BOOST_CHECK_EQUAL(server.largest_write(), 64 * 1024U);
+    // Two reads, plus the writes for the data that came back
+    BOOST_CHECK_LE(server.most_unanswered(), 4U);
+}
+
+BOOST_AUTO_TEST_CASE(copy_keeps_permissions)
+{
+    fake_sftp_server server;
+    server.files["/from"] = "#!/bin/sh";
+    server.permissions["/from"] = 0755;
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    copy_file(pipeline, "/from", "/to");
+
+    BOOST_CHECK_EQUAL(server.permissions["/to"], 0755U);
+}
+
+BOOST_AUTO_TEST_CASE(copy_never_overwrites)
+{
+    fake_sftp_server server;
+    server.files["/from"] = "new";
+    server.files["/to"] = "old";
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    BOOST_CHECK_THROW(copy_file(pipeline, "/from", "/to"), system_error);
+
+    BOOST_CHECK_EQUAL(server.files["/to"], "old");
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+    BOOST_CHECK_EQUAL(pipeline.outstanding(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(copy_missing_file)
+{
+    fake_sftp_server server;
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+
+    try
+    {
+        copy_file(pipeline, "/from", "/to");
+        BOOST_FAIL("Expected an error");
+    }
+    catch (const system_error& e)
+    {
+        BOOST_CHECK(e.code() ==
+                    error_code(LIBSSH2_FX_NO_SUCH_FILE, sftp_error_category()));
+    }
+
+    BOOST_CHECK_EQUAL(server.files.count("/to"), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(copy_to_refused_target)
+{
+    fake_sftp_server server;
+    server.files["/from"] = "data";
+    server.refuse("/to");
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    BOOST_CHECK_THROW(copy_file(pipeline, "/from", "/to"), system_error);
+
+    BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,208 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "fake_sftp_server.hpp"
+
+#include <ssh/detail/sftp_protocol.hpp>
+#include <ssh/detail/wire.hpp>
+#include <ssh/sftp_error.hpp>
+#include <ssh/sftp_extensions.hpp> // test subject
+
+#include <boost/system/system_error.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+#include <libssh2_sftp.h>
+
+using ssh::detail::sftp_protocol::request_pipeline;
+using ssh::detail::wire_reader;
+using ssh::detail::wire_writer;
+using ssh::filesystem::sftp_error_category;
+using ssh::filesystem::sftp_extensions;
+using ssh::filesystem::sftp_limits;
+
+using test::ssh::fake_sftp_server;
+
+using boost::system::error_code;
+using boost::system::system_error;
+
+using std::string;
+
+namespace
+{
+
+string path_pair(const string& from, const string& to)
+{
+    wire_writer arguments;
+    arguments.put_string(from).put_string(to);
+    return arguments.buffer();
+}
+}
+
+BOOST_AUTO_TEST_SUITE(sftp_extensions_tests)
+
+BOOST_AUTO_TEST_CASE(nothing_announced)
+{
+    sftp_extensions extensions;
+
+    BOOST_CHECK(extensions.announced().empty());
+    BOOST_CHECK(!extensions.posix_rename());
+    BOOST_CHECK(!extensions.copy_data());
+}
+
+BOOST_AUTO_TEST_CASE(openssh_extensions_need_known_version)
+{
+    sftp_extensions::extension_map announced;
+    announced["posix-rename@openssh.com"] = "1";
+    announced["statvfs@openssh.com"] = "2";
+    announced["hardlink@openssh.com"] = "1";
+    announced["fsync@openssh.com"] = "2";
+    announced["limits@openssh.com"] = "1";
+
+    sftp_extensions extensions(announced);
+
+    BOOST_CHECK(extensions.posix_rename());
+    BOOST_CHECK(extensions.statvfs());
+    BOOST_CHECK(extensions.hardlink());
+    BOOST_CHECK(!extensions.fsync());
+    BOOST_CHECK(extensions.limits());
+    BOOST_CHECK(extensions.has("fsync@openssh.com"));
+}
+
+BOOST_AUTO_TEST_CASE(draft_extensions_need_any_version)
+{
+    sftp_extensions::extension_map announced;
+    announced["copy-data"] = "";
+    announced["check-file"] = "md5,sha1";
+
+    sftp_extensions extensions(announced);
+
+    BOOST_CHECK(extensions.copy_data());
+    BOOST_CHECK(extensions.check_file());
+    BOOST_CHECK(!extensions.hardlink());
+}
+
+BOOST_AUTO_TEST_CASE(pipeline_reports_announced_extensions)
+{
+    fake_sftp_server server;
+    server.extensions["hardlink@openssh.com"] = "1";
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    sftp_extensions extensions(pipeline.extensions());
+
+    BOOST_CHECK(extensions.posix_rename());
+    BOOST_CHECK(extensions.hardlink());
+    BOOST_CHECK(!extensions.statvfs());
+}
+
+BOOST_AUTO_TEST_CASE(extended_request_with_status_reply)
+{
+    fake_sftp_server server;
+    server.files["/a"] = "data";
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    string data = pipeline.transact_extended("posix-rename@openssh.com",
+                                             path_pair("/a", "/b"));
+
+    BOOST_CHECK(data.empty());
+    BOOST_CHECK_EQUAL(server.files.count("/a"), 0U);
+    BOOST_CHECK_EQUAL(server.files["/b"], "data");
+    BOOST_CHECK_EQUAL(server.extended_requests["posix-rename@openssh.com"],
+                      1U);
+}
+
+BOOST_AUTO_TEST_CASE(extended_request_with_data_reply)
+{
+    fake_sftp_server server;
+    server.extensions["limits@openssh.com"] = "1";
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    string data = pipeline.transact_extended("limits@openssh.com", "");
+
+    wire_reader in(data);
+    BOOST_CHECK_EQUAL(in.get_uint64(), 256 * 1024U);
+}
+
+BOOST_AUTO_TEST_CASE(limits_are_asked_for_once)
+{
+    fake_sftp_server server;
+    server.extensions["limits@openssh.com"] = "1";
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    sftp_limits limits = pipeline.limits();
+    pipeline.limits();
+
+    BOOST_CHECK_EQUAL(limits.max_packet_length, 256 * 1024U);
+    BOOST_CHECK_EQUAL(limits.max_read_length, 255 * 1024U);
+    BOOST_CHECK_EQUAL(limits.max_write_length, 255 * 1024U);
+    BOOST_CHECK_EQUAL(limits.max_open_handles, 64U);
+    BOOST_CHECK_EQUAL(server.extended_requests["limits@openssh.com"], 1U);
+}
+
+BOOST_AUTO_TEST_CASE(limits_unknown_if_not_announced)
+{
+    fake_sftp_server server;
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+    sftp_limits limits = pipeline.limits();
+
+    BOOST_CHECK_EQUAL(limits.max_packet_length, 0U);
+    BOOST_CHECK_EQUAL(limits.max_read_length, 0U);
+    BOOST_CHECK_EQUAL(limits.max_write_length, 0U);
+    BOOST_CHECK_EQUAL(limits.max_open_handles, 0U);
+    BOOST_CHECK_EQUAL(server.extended_requests.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(extended_request_failure_throws)
+{
+    fake_sftp_server server;
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+
+    try
+    {
+        pipeline.transact_extended("posix-rename@openssh.com",
+                                   path_pair("/missing", "/b"));
+        BOOST_FAIL("Expected an error");
+    }
+    catch (const system_error& e)
+    {
+        BOOST_CHECK(e.code() ==
+                    error_code(LIBSSH2_FX_NO_SUCH_FILE, sftp_error_category()));
+    }
+
+    BOOST_CHECK_EQUAL(pipeline.outstanding(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(unannounced_extension_is_unsupported)
+{
+    fake_sftp_server server;
+
+    request_pipeline<fake_sftp_server> pipeline(server);
+
+    try
+    {
+        pipeline.transact_extended("copy-data", "");
+        BOOST_FAIL("Expected an error");
+    }
+    catch (const system_error& e)
+    {
+        BOOST_CHECK(e.code() == error_code(LIBSSH2_FX_OP_UNSUPPORTED,
+                                           sftp_error_category()));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,227 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "fake_sftp_server.hpp"
+
+#include <ssh/detail/sftp_batch.hpp> // request_sizing
+#include <ssh/detail/sftp_protocol.hpp>
+#include <ssh/detail/sftp_walk.hpp> // test subject
+#include <ssh/sftp_error.hpp>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <cstddef> // size_t
+#include <map>
+#include <string>
+#include <vector>
+
+#include <libssh2_sftp.h>
+
+using ssh::detail::sftp_protocol::is_directory_entry;
+using ssh::detail::sftp_protocol::request_pipeline;
+using ssh::detail::sftp_protocol::request_sizing;
+using ssh::detail::sftp_protocol::tree_entry;
+using ssh::detail::sftp_protocol::tree_listing;
+using ssh::detail::sftp_protocol::walk_tree;
+using ssh::filesystem::sftp_error_category;
+
+using test::ssh::fake_sftp_server;
+
+using boost::lexical_cast;
+using boost::system::error_code;
+
+using std::map;
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+class walk_fixture
+{
+public:
+    walk_fixture()
+    {
+        server.directories.insert("/root");
+    }
+
+    tree_listing walk(const string& root = "/root",
+                      const request_sizing& sizing = request_sizing())
+    {
+        request_pipeline<fake_sftp_server> pipeline(server);
+        tree_listing listing = walk_tree(pipeline, root, sizing);
+        BOOST_CHECK_EQUAL(pipeline.outstanding(), 0U);
+        BOOST_CHECK_EQUAL(server.open_handles(), 0U);
+        return listing;
+    }
+
+    /**
+     * The listing's entries by name.
+     */
+    map<string, LIBSSH2_SFTP_ATTRIBUTES> by_name(const tree_listing& listing)
+    {
+        map<string, LIBSSH2_SFTP_ATTRIBUTES> entries;
+        for (vector<tree_entry>::const_iterator it = listing.entries.begin();
+             it != listing.entries.end(); ++it)
+        {
+            BOOST_CHECK(entries.insert(std::make_pair(it->name,
+                                                      it->attributes))
+                            .second);
+        }
+        return entries;
+    }
+
+    /**
+     * Make a directory at each level down to `depth`, each with `width`
+     * subdirectories.
+     *
+     * @returns how many directories that is.
+     */
+    size_t make_tree(const string& root, size_t depth, size_t width)
+    {
+        if (depth == 0)
+            return 0;
+
+        size_t count = 0;
+        for (size_t i = 0; i < width; ++i)
+        {
+            string directory = root + "/" + lexical_cast<string>(i);
+            server.directories.insert(directory);
+            server.files[directory + "/file"] = "data";
+            count += 1 + make_tree(directory, depth - 1, width);
+        }
+
+        return count;
+    }
+
+    fake_sftp_server server;
+};
+}
+
+BOOST_FIXTURE_TEST_SUITE(sftp_walk_tests, walk_fixture)
+
+BOOST_AUTO_TEST_CASE(empty_directory)
+{
+    tree_listing listing = walk();
+
+    BOOST_CHECK(listing.entries.empty());
+    BOOST_CHECK(listing.failures.empty());
+}
+
+BOOST_AUTO_TEST_CASE(nested_entries_named_from_root)
+{
+    server.files["/root/a"] = "gobbledy gook";
+    server.directories.insert("/root/dir");
+    server.files["/root/dir/b"] = "";
+    server.directories.insert("/root/dir/nested");
+    server.files["/root/dir/nested/c"] = "c";
+    server.mtimes["/root/a"] = 1000;
+
+    map<string, LIBSSH2_SFTP_ATTRIBUTES> entries = by_name(walk());
+
+    BOOST_REQUIRE_EQUAL(entries.size(), 5U);
+    BOOST_CHECK_EQUAL(entries["a"].filesize, 13U);
+    BOOST_CHECK_EQUAL(entries["a"].mtime, 1000U);
+    BOOST_CHECK(is_directory_entry(entries["dir"]));
+    BOOST_CHECK(!is_directory_entry(entries["dir/b"]));
+    BOOST_CHECK(is_directory_entry(entries["dir/nested"]));
+    BOOST_CHECK_EQUAL(entries["dir/nested/c"].filesize, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(root_with_trailing_slash)
+{
+    server.directories.insert("/");
+    server.files["/a"] = "data";
+
+    map<string, LIBSSH2_SFTP_ATTRIBUTES> entries = by_name(walk("/"));
+
+    BOOST_CHECK_EQUAL(entries.size(), 2U);
+    BOOST_CHECK(entries.count("a"));
+    BOOST_CHECK(entries.count("root"));
+}
+
+BOOST_AUTO_TEST_CASE(missing_root_is_a_failure)
+{
+    tree_listing listing = walk("/missing");
+
+    BOOST_CHECK(listing.entries.empty());
+    BOOST_REQUIRE_EQUAL(listing.failures.size(), 1U);
+    BOOST_CHECK_EQUAL(listing.failures[0].first, "");
+    BOOST_CHECK_EQUAL(listing.failures[0].second,
+                      error_code(LIBSSH2_FX_NO_SUCH_FILE,
+                                 sftp_error_category()));
+}
+
+BOOST_AUTO_TEST_CASE(unreadable_directory_does_not_stop_walk)
+{
+    server.directories.insert("/root/locked");
+    server.files["/root/locked/secret"] = "data";
+    server.directories.insert("/root/open");
+    server.files["/root/open/a"] = "data";
+    server.refuse("/root/locked");
+
+    tree_listing listing = walk();
+    map<string, LIBSSH2_SFTP_ATTRIBUTES> entries = by_name(listing);
+
+    BOOST_CHECK_EQUAL(entries.size(), 3U);
+    BOOST_CHECK(entries.count("locked"));
+    BOOST_CHECK(entries.count("open/a"));
+    BOOST_REQUIRE_EQUAL(listing.failures.size(), 1U);
+    BOOST_CHECK_EQUAL(listing.failures[0].first, "locked");
+    BOOST_CHECK_EQUAL(listing.failures[0].second,
+                      error_code(LIBSSH2_FX_PERMISSION_DENIED,
+                                 sftp_error_category()));
+}
+
+BOOST_AUTO_TEST_CASE(directories_are_read_together)
+{
+    size_t directories = make_tree("/root", 3, 4);
+
+    tree_listing listing = walk();
+
+    BOOST_CHECK_EQUAL(listing.entries.size(), directories * 2);
+    BOOST_CHECK_GT(server.most_open_handles(), 4U);
+}
+
+BOOST_AUTO_TEST_CASE(round_trips_follow_depth_not_size)
+{
+    size_t directories = make_tree("/root", 3, 3);
+    server.reverse_replies();
+
+    walk();
+
+    // The root and each of the three levels below it take an OPENDIR, a
+    // READDIR, the READDIR that finds the end and a CLOSE, which all the
+    // directories in the level share
+    BOOST_CHECK_LE(server.round_trips(), 4U * 4U);
+    BOOST_CHECK_LT(server.round_trips(), directories);
+}
+
+BOOST_AUTO_TEST_CASE(open_directories_limited)
+{
+    make_tree("/root", 2, 10);
+
+    request_sizing sizing;
+    sizing.max_open_handles = 3;
+    tree_listing listing = walk("/root", sizing);
+
+    BOOST_CHECK_EQUAL(listing.entries.size(), 220U);
+    BOOST_CHECK_LE(server.most_open_handles(), 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,254 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <ssh/detail/sync_plan.hpp> // test subject
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+using ssh::detail::plan_sync;
+using ssh::detail::sync_item;
+using ssh::detail::sync_plan;
+using ssh::detail::sync_tree;
+
+using std::string;
+using std::vector;
+
+namespace
+{
+
+sync_item file(unsigned int size, unsigned int mtime)
+{
+    return sync_item(sync_item::file, size, mtime);
+}
+
+sync_item directory()
+{
+    return sync_item(sync_item::directory, 0, 0);
+}
+
+sync_item link()
+{
+    return sync_item(sync_item::other, 0, 0);
+}
+
+bool always_same(const string&)
+{
+    return true;
+}
+
+bool never_same(const string&)
+{
+    return false;
+}
+
+vector<string> names(const char* first, const char* second = NULL,
+                     const char* third = NULL)
+{
+    vector<string> list(1, first);
+    if (second)
+        list.push_back(second);
+    if (third)
+        list.push_back(third);
+    return list;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(sync_plan_tests)
+
+BOOST_AUTO_TEST_CASE(identical_trees_need_nothing)
+{
+    sync_tree tree;
+    tree["a"] = file(10, 1000);
+    tree["dir"] = directory();
+    tree["dir/b"] = file(0, 2000);
+
+    sync_plan plan = plan_sync(tree, tree, true);
+
+    BOOST_CHECK(plan.remove_files.empty());
+    BOOST_CHECK(plan.remove_directories.empty());
+    BOOST_CHECK(plan.create_directories.empty());
+    BOOST_CHECK(plan.uploads.empty());
+    BOOST_CHECK(plan.touches.empty());
+    BOOST_CHECK_EQUAL(plan.unchanged, 2U);
+}
+
+BOOST_AUTO_TEST_CASE(new_tree_created_parents_first)
+{
+    sync_tree local;
+    local["dir"] = directory();
+    local["dir/nested"] = directory();
+    local["dir/nested/a"] = file(1, 1);
+    local["empty"] = directory();
+
+    sync_plan plan = plan_sync(local, sync_tree(), false);
+
+    BOOST_CHECK(plan.create_directories ==
+                names("dir", "dir/nested", "empty"));
+    BOOST_CHECK(plan.uploads == names("dir/nested/a"));
+}
+
+BOOST_AUTO_TEST_CASE(changed_size_or_time_uploads)
+{
+    sync_tree local;
+    local["bigger"] = file(20, 1000);
+    local["newer"] = file(10, 2000);
+    local["same"] = file(10, 1000);
+
+    sync_tree remote;
+    remote["bigger"] = file(10, 1000);
+    remote["newer"] = file(10, 1000);
+    remote["same"] = file(10, 1000);
+
+    sync_plan plan = plan_sync(local, remote, false);
+
+    BOOST_CHECK(plan.uploads == names("bigger", "newer"));
+    BOOST_CHECK_EQUAL(plan.unchanged, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(same_contents_only_touched)
+{
+    sync_tree local;
+    local["a"] = file(10, 2000);
+    local["b"] = file(20, 2000);
+
+    sync_tree remote;
+    remote["a"] = file(10, 1000);
+    remote["b"] = file(10, 1000);
+
+    sync_plan plan = plan_sync(local, remote, false, &always_same);
+
+    // A different size is different contents without asking
+    BOOST_CHECK(plan.touches == names("a"));
+    BOOST_CHECK(plan.uploads == names("b"));
+}
+
+BOOST_AUTO_TEST_CASE(different_contents_uploaded)
+{
+    sync_tree local;
+    local["a"] = file(10, 2000);
+
+    sync_tree remote;
+    remote["a"] = file(10, 1000);
+
+    sync_plan plan = plan_sync(local, remote, false, &never_same);
+
+    BOOST_CHECK(plan.touches.empty());
+    BOOST_CHECK(plan.uploads == names("a"));
+}
+
+BOOST_AUTO_TEST_CASE(extraneous_kept_unless_asked)
+{
+    sync_tree remote;
+    remote["a"] = file(1, 1);
+    remote["dir"] = directory();
+    remote["dir/b"] = file(1, 1);
+
+    sync_plan plan = plan_sync(sync_tree(), remote, false);
+
+    BOOST_CHECK(plan.remove_files.empty());
+    BOOST_CHECK(plan.remove_directories.empty());
+}
+
+BOOST_AUTO_TEST_CASE(extraneous_removed_deepest_first)
+{
+    sync_tree local;
+    local["kept"] = file(1, 1);
+
+    sync_tree remote;
+    remote["a"] = file(1, 1);
+    remote["dir"] = directory();
+    remote["dir/b"] = file(1, 1);
+    remote["dir/nested"] = directory();
+    remote["dir/nested/c"] = link();
+    remote["kept"] = file(1, 1);
+    remote["other"] = directory();
+
+    sync_plan plan = plan_sync(local, remote, true);
+
+    BOOST_CHECK(plan.remove_files == names("a", "dir/b", "dir/nested/c"));
+    BOOST_CHECK(plan.remove_directories ==
+                names("dir/nested", "dir", "other"));
+    BOOST_CHECK_EQUAL(plan.unchanged, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(directory_in_way_of_file_removed)
+{
+    sync_tree local;
+    local["a"] = file(1, 1);
+
+    sync_tree remote;
+    remote["a"] = directory();
+    remote["a/inside"] = file(1, 1);
+
+    sync_plan plan = plan_sync(local, remote, false);
+
+    BOOST_CHECK(plan.remove_files == names("a/inside"));
+    BOOST_CHECK(plan.remove_directories == names("a"));
+    BOOST_CHECK(plan.uploads == names("a"));
+}
+
+BOOST_AUTO_TEST_CASE(file_in_way_of_directory_removed)
+{
+    sync_tree local;
+    local["a"] = directory();
+    local["a/b"] = file(1, 1);
+
+    sync_tree remote;
+    remote["a"] = file(1, 1);
+
+    sync_plan plan = plan_sync(local, remote, false);
+
+    BOOST_CHECK(plan.remove_files == names("a"));
+    BOOST_CHECK(plan.create_directories == names("a"));
+    BOOST_CHECK(plan.uploads == names("a/b"));
+}
+
+BOOST_AUTO_TEST_CASE(link_in_way_of_file_replaced)
+{
+    sync_tree local;
+    local["a"] = file(0, 0);
+
+    sync_tree remote;
+    remote["a"] = link();
+
+    sync_plan plan = plan_sync(local, remote, false);
+
+    BOOST_CHECK(plan.remove_files == names("a"));
+    BOOST_CHECK(plan.uploads == names("a"));
+}
+
+BOOST_AUTO_TEST_CASE(similar_names_not_mistaken_for_children)
+{
+    sync_tree local;
+    local["a"] = file(1, 1);
+    local["a-b"] = file(1, 1);
+    local["ab"] = directory();
+
+    sync_tree remote;
+    remote["a"] = directory();
+    remote["a-b"] = file(1, 1);
+    remote["ab"] = directory();
+
+    sync_plan plan = plan_sync(local, remote, false);
+
+    BOOST_CHECK(plan.remove_directories == names("a"));
+    BOOST_CHECK(plan.uploads == names("a"));
+    BOOST_CHECK_EQUAL(plan.unchanged, 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
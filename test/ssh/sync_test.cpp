@@ -0,0 +1,225 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sftp_fixture.hpp"
+
+#include <ssh/filesystem.hpp>
+#include <ssh/stream.hpp>
+#include <ssh/sync.hpp> // test subject
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <iterator> // istreambuf_iterator
+#include <string>
+
+using ssh::filesystem::create_directory;
+using ssh::filesystem::exists;
+using ssh::filesystem::ifstream;
+using ssh::filesystem::is_directory;
+using ssh::filesystem::is_regular_file;
+using ssh::filesystem::last_write_time;
+using ssh::filesystem::path;
+using ssh::filesystem::sync;
+using ssh::filesystem::sync_policy;
+using ssh::filesystem::sync_statistics;
+
+using test::ssh::sftp_fixture;
+
+using std::istreambuf_iterator;
+using std::string;
+
+namespace
+{
+
+/**
+ * Local directory deleted when the test ends.
+ */
+class sync_fixture : public sftp_fixture
+{
+public:
+    sync_fixture()
+        : local_directory(boost::filesystem::temp_directory_path() /
+                          boost::filesystem::unique_path())
+    {
+        boost::filesystem::create_directories(local_directory);
+    }
+
+    ~sync_fixture()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(local_directory, ec);
+    }
+
+    void make_local_file(const boost::filesystem::path& name,
+                         const string& data)
+    {
+        boost::filesystem::create_directories(
+            (local_directory / name).parent_path());
+        boost::filesystem::ofstream file(local_directory / name,
+                                         std::ios_base::binary);
+        file << data;
+    }
+
+    string remote_data(const path& file)
+    {
+        ifstream stream(filesystem(), file);
+        return string(istreambuf_iterator<char>(stream),
+                      istreambuf_iterator<char>());
+    }
+
+    boost::filesystem::path local_directory;
+};
+
+string same_hash(const boost::filesystem::path&)
+{
+    return "the same";
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(sync_tests, sync_fixture)
+
+BOOST_AUTO_TEST_CASE(first_sync_uploads_everything)
+{
+    make_local_file("a", "gobbledy gook");
+    make_local_file("dir/nested/b", string(2 * 1024 * 1024, 'b'));
+    boost::filesystem::create_directories(local_directory / "empty");
+    boost::filesystem::last_write_time(local_directory / "a", 1000000000);
+
+    path target = absolute_sandbox() / "tree";
+    sync_statistics statistics = sync(local_directory, filesystem(), target);
+
+    BOOST_CHECK_EQUAL(statistics.uploaded, 2U);
+    BOOST_CHECK_EQUAL(statistics.bytes_uploaded, 13U + 2 * 1024 * 1024);
+    BOOST_CHECK_EQUAL(statistics.directories_created, 3U);
+    BOOST_CHECK(statistics.failures.empty());
+
+    BOOST_CHECK_EQUAL(remote_data(target / "a"), "gobbledy gook");
+    BOOST_CHECK_EQUAL(remote_data(target / "dir/nested/b"),
+                      string(2 * 1024 * 1024, 'b'));
+    BOOST_CHECK(is_directory(filesystem(), target / "empty"));
+    BOOST_CHECK_EQUAL(last_write_time(filesystem(), target / "a"),
+                      1000000000);
+}
+
+BOOST_AUTO_TEST_CASE(second_sync_sends_nothing)
+{
+    make_local_file("a", "data");
+    make_local_file("dir/b", "data");
+
+    path target = absolute_sandbox() / "tree";
+    sync(local_directory, filesystem(), target);
+    sync_statistics statistics = sync(local_directory, filesystem(), target);
+
+    BOOST_CHECK_EQUAL(statistics.uploaded, 0U);
+    BOOST_CHECK_EQUAL(statistics.directories_created, 0U);
+    BOOST_CHECK_EQUAL(statistics.unchanged, 2U);
+}
+
+BOOST_AUTO_TEST_CASE(changed_file_resent)
+{
+    make_local_file("a", "old");
+    make_local_file("b", "same");
+
+    path target = absolute_sandbox() / "tree";
+    sync(local_directory, filesystem(), target);
+
+    make_local_file("a", "newer");
+    sync_statistics statistics = sync(local_directory, filesystem(), target);
+
+    BOOST_CHECK_EQUAL(statistics.uploaded, 1U);
+    BOOST_CHECK_EQUAL(statistics.unchanged, 1U);
+    BOOST_CHECK_EQUAL(remote_data(target / "a"), "newer");
+}
+
+BOOST_AUTO_TEST_CASE(different_hash_resends)
+{
+    make_local_file("a", "data");
+    boost::filesystem::last_write_time(local_directory / "a", 1000000000);
+
+    path target = absolute_sandbox() / "tree";
+    sync(local_directory, filesystem(), target);
+    boost::filesystem::last_write_time(local_directory / "a", 1100000000);
+
+    sync_policy policy;
+    policy.local_hash = &same_hash;
+    sync_statistics statistics =
+        sync(local_directory, filesystem(), target, policy);
+
+    // The server's hash can't be "the same", so it is resent
+    BOOST_CHECK_EQUAL(statistics.uploaded, 1U);
+    BOOST_CHECK_EQUAL(last_write_time(filesystem(), target / "a"),
+                      1100000000);
+}
+
+BOOST_AUTO_TEST_CASE(extraneous_removed_when_asked)
+{
+    make_local_file("kept", "data");
+
+    path target = absolute_sandbox() / "tree";
+    create_directory(filesystem(), target);
+    create_directory(filesystem(), target / "old");
+    new_file_in_sandbox_containing_data("tree/old/a", "data");
+    new_file_in_sandbox_containing_data("tree/b", "data");
+
+    sync_statistics statistics = sync(local_directory, filesystem(), target);
+    BOOST_CHECK_EQUAL(statistics.removed, 0U);
+    BOOST_CHECK(exists(filesystem(), target / "b"));
+
+    sync_policy policy;
+    policy.remove_extraneous = true;
+    statistics = sync(local_directory, filesystem(), target, policy);
+
+    BOOST_CHECK_EQUAL(statistics.removed, 3U);
+    BOOST_CHECK(!exists(filesystem(), target / "b"));
+    BOOST_CHECK(!exists(filesystem(), target / "old"));
+    BOOST_CHECK(exists(filesystem(), target / "kept"));
+}
+
+BOOST_AUTO_TEST_CASE(directory_replaced_by_file)
+{
+    make_local_file("a", "data");
+
+    path target = absolute_sandbox() / "tree";
+    create_directory(filesystem(), target);
+    create_directory(filesystem(), target / "a");
+    new_file_in_sandbox_containing_data("tree/a/inside", "data");
+
+    sync_statistics statistics = sync(local_directory, filesystem(), target);
+
+    BOOST_CHECK_EQUAL(statistics.removed, 2U);
+    BOOST_CHECK(is_regular_file(filesystem(), target / "a"));
+}
+
+BOOST_AUTO_TEST_CASE(dry_run_changes_nothing)
+{
+    make_local_file("a", "data");
+    make_local_file("dir/b", "data");
+
+    sync_policy policy;
+    policy.dry_run = true;
+    path target = absolute_sandbox() / "tree";
+    sync_statistics statistics =
+        sync(local_directory, filesystem(), target, policy);
+
+    BOOST_CHECK_EQUAL(statistics.uploaded, 2U);
+    BOOST_CHECK_EQUAL(statistics.bytes_uploaded, 8U);
+    BOOST_CHECK_EQUAL(statistics.directories_created, 1U);
+    BOOST_CHECK(!exists(filesystem(), target));
+}
+
+BOOST_AUTO_TEST_SUITE_END();
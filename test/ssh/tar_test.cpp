@@ -0,0 +1,274 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <ssh/detail/tar.hpp> // test subject
+
+#include <boost/cstdint.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <cstddef> // size_t
+#include <sstream>
+#include <string>
+
+using ssh::detail::tar::block_size;
+using ssh::detail::tar::entry;
+using ssh::detail::tar::reader;
+using ssh::detail::tar::writer;
+namespace entry_type = ssh::detail::tar::entry_type;
+namespace tar_detail = ssh::detail::tar::tar_detail;
+
+using boost::system::system_error;
+using boost::uint64_t;
+
+using std::istringstream;
+using std::ostringstream;
+using std::size_t;
+using std::string;
+
+namespace
+{
+
+entry file_entry(const string& name, const string& contents)
+{
+    entry e;
+    e.name = name;
+    e.size = contents.size();
+    e.mtime = 1234567890;
+    return e;
+}
+
+void add_file(writer& archive, const string& name, const string& contents)
+{
+    istringstream data(contents);
+    archive.add_file(file_entry(name, contents), data);
+}
+
+string read_data(reader& archive)
+{
+    string data;
+    char buffer[100];
+    size_t count;
+    while ((count = archive.read(buffer, sizeof(buffer))) > 0)
+    {
+        data.append(buffer, count);
+    }
+    return data;
+}
+
+string header_with_name(const string& name, char type)
+{
+    entry e;
+    e.type = type;
+    return tar_detail::header_block(name, e, string(), "ustar\0" "00");
+}
+}
+
+BOOST_AUTO_TEST_SUITE(tar_tests)
+
+BOOST_AUTO_TEST_CASE(empty_archive)
+{
+    ostringstream out;
+    writer(out).finish();
+
+    BOOST_CHECK_EQUAL(out.str().size(), 2 * block_size);
+
+    istringstream in(out.str());
+    entry e;
+    BOOST_CHECK(!reader(in).next(e));
+}
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+    ostringstream out;
+    writer archive(out);
+    archive.add_directory("dir", 0755, 1000);
+    add_file(archive, "dir/file", "gobbledy gook");
+    add_file(archive, "empty", "");
+    archive.finish();
+
+    BOOST_CHECK_EQUAL(out.str().size() % block_size, 0U);
+
+    istringstream in(out.str());
+    reader unpacked(in);
+    entry e;
+
+    BOOST_REQUIRE(unpacked.next(e));
+    BOOST_CHECK_EQUAL(e.name, "dir/");
+    BOOST_CHECK_EQUAL(e.type, entry_type::directory);
+    BOOST_CHECK_EQUAL(e.mode, 0755U);
+    BOOST_CHECK_EQUAL(e.mtime, 1000U);
+
+    BOOST_REQUIRE(unpacked.next(e));
+    BOOST_CHECK_EQUAL(e.name, "dir/file");
+    BOOST_CHECK_EQUAL(e.type, entry_type::file);
+    BOOST_CHECK_EQUAL(e.size, 13U);
+    BOOST_CHECK_EQUAL(e.mtime, 1234567890U);
+    BOOST_CHECK_EQUAL(read_data(unpacked), "gobbledy gook");
+
+    BOOST_REQUIRE(unpacked.next(e));
+    BOOST_CHECK_EQUAL(e.name, "empty");
+    BOOST_CHECK_EQUAL(read_data(unpacked), "");
+
+    BOOST_CHECK(!unpacked.next(e));
+}
+
+BOOST_AUTO_TEST_CASE(unread_data_is_skipped)
+{
+    ostringstream out;
+    writer archive(out);
+    add_file(archive, "first", string(1000, 'x'));
+    add_file(archive, "second", "y");
+    archive.finish();
+
+    istringstream in(out.str());
+    reader unpacked(in);
+    entry e;
+
+    BOOST_REQUIRE(unpacked.next(e));
+    char buffer[10];
+    unpacked.read(buffer, sizeof(buffer));
+
+    BOOST_REQUIRE(unpacked.next(e));
+    BOOST_CHECK_EQUAL(e.name, "second");
+    BOOST_CHECK_EQUAL(read_data(unpacked), "y");
+}
+
+BOOST_AUTO_TEST_CASE(long_name_is_split_into_prefix)
+{
+    string name = string(80, 'a') + "/" + string(80, 'b');
+
+    ostringstream out;
+    writer archive(out);
+    add_file(archive, name, "data");
+    archive.finish();
+
+    // No extra long-name entry
+    BOOST_CHECK_EQUAL(out.str().size(), 4 * block_size);
+
+    istringstream in(out.str());
+    reader unpacked(in);
+    entry e;
+    BOOST_REQUIRE(unpacked.next(e));
+    BOOST_CHECK_EQUAL(e.name, name);
+}
+
+BOOST_AUTO_TEST_CASE(very_long_name_uses_gnu_long_name)
+{
+    string name;
+    for (int i = 0; i < 30; ++i)
+    {
+        name += "directory" + string(1, static_cast<char>('a' + i)) + "/";
+    }
+    name += "file";
+
+    ostringstream out;
+    writer archive(out);
+    add_file(archive, name, "data");
+    archive.finish();
+
+    istringstream in(out.str());
+    reader unpacked(in);
+    entry e;
+    BOOST_REQUIRE(unpacked.next(e));
+    BOOST_CHECK_EQUAL(e.name, name);
+    BOOST_CHECK_EQUAL(read_data(unpacked), "data");
+    BOOST_CHECK(!unpacked.next(e));
+}
+
+BOOST_AUTO_TEST_CASE(huge_size_uses_base_256)
+{
+    char field[12];
+    uint64_t huge = 20ULL * 1024 * 1024 * 1024;
+
+    tar_detail::put_number(field, sizeof(field), huge);
+
+    BOOST_CHECK(static_cast<unsigned char>(field[0]) & 0x80);
+    BOOST_CHECK_EQUAL(tar_detail::get_number(field, sizeof(field)), huge);
+}
+
+BOOST_AUTO_TEST_CASE(octal_numbers)
+{
+    char field[8];
+
+    tar_detail::put_number(field, sizeof(field), 0755);
+
+    BOOST_CHECK_EQUAL(string(field, 7), "0000755");
+    BOOST_CHECK_EQUAL(field[7], '\0');
+    BOOST_CHECK_EQUAL(tar_detail::get_number(field, sizeof(field)), 0755U);
+    BOOST_CHECK_EQUAL(tar_detail::get_number("  755 \0\0", 8), 0755U);
+}
+
+BOOST_AUTO_TEST_CASE(pax_header_overrides_name_and_size)
+{
+    string records = "26 path=a/name/from/pax.c\n"
+                     "10 size=3\n"
+                     "19 mtime=1000.5000\n";
+    BOOST_REQUIRE_EQUAL(records.size(), 26U + 10U + 19U);
+
+    entry pax;
+    pax.type = entry_type::pax_header;
+    pax.size = records.size();
+    string archive =
+        tar_detail::header_block("PaxHeader", pax, string(), "ustar\0" "00");
+    archive += records + string(block_size - records.size(), '\0');
+    archive += header_with_name("short", entry_type::file);
+    archive += "abc" + string(block_size - 3, '\0');
+
+    istringstream in(archive);
+    reader unpacked(in);
+    entry e;
+    BOOST_REQUIRE(unpacked.next(e));
+    BOOST_CHECK_EQUAL(e.name, "a/name/from/pax.c");
+    BOOST_CHECK_EQUAL(e.size, 3U);
+    BOOST_CHECK_EQUAL(e.mtime, 1000U);
+    BOOST_CHECK_EQUAL(read_data(unpacked), "abc");
+    BOOST_CHECK(!unpacked.next(e));
+}
+
+BOOST_AUTO_TEST_CASE(bad_checksum)
+{
+    string archive = header_with_name("file", entry_type::file);
+    archive[0] = 'g';
+
+    istringstream in(archive);
+    entry e;
+    BOOST_CHECK_THROW(reader(in).next(e), system_error);
+}
+
+BOOST_AUTO_TEST_CASE(truncated_data)
+{
+    ostringstream out;
+    writer archive(out);
+    add_file(archive, "file", string(1000, 'x'));
+
+    istringstream in(out.str().substr(0, block_size + 100));
+    reader unpacked(in);
+    entry e;
+    BOOST_REQUIRE(unpacked.next(e));
+    BOOST_CHECK_THROW(read_data(unpacked), system_error);
+}
+
+BOOST_AUTO_TEST_CASE(short_file_data)
+{
+    ostringstream out;
+    writer archive(out);
+
+    istringstream data("abc");
+    BOOST_CHECK_THROW(archive.add_file(file_entry("file", "abcdef"), data),
+                      std::exception);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
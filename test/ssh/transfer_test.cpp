@@ -0,0 +1,570 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <ssh/transfer.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/mapped_region.hpp> // get_page_size
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <cstddef> // size_t
+#include <sstream>
+#include <stdexcept> // runtime_error
+#include <string>
+#include <utility> // pair
+#include <vector>
+
+using ssh::filesystem::file_source;
+using ssh::filesystem::mapped_file_source;
+using ssh::filesystem::memory_source;
+using ssh::filesystem::no_bottleneck;
+using ssh::filesystem::sink_bound;
+using ssh::filesystem::source_bound;
+using ssh::filesystem::stream_sink;
+using ssh::filesystem::transfer_engine;
+using ssh::filesystem::transfer_sink;
+using ssh::filesystem::transfer_source;
+using ssh::filesystem::transfer_statistics;
+
+using boost::filesystem::path;
+using boost::posix_time::milliseconds;
+using boost::thread;
+using boost::uintmax_t;
+
+using std::ostringstream;
+using std::pair;
+using std::runtime_error;
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+string test_data(size_t size)
+{
+    string data(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+    {
+        data[i] = static_cast<char>(i * 7 + i / 251);
+    }
+    return data;
+}
+
+/**
+ * Source that takes its time over every read.
+ */
+class slow_source : public transfer_source
+{
+public:
+    slow_source(const string& data, milliseconds delay)
+        : m_inner(data), m_delay(delay)
+    {
+    }
+
+    virtual size_t read(char* buffer, size_t size)
+    {
+        boost::this_thread::sleep(m_delay);
+        return m_inner.read(buffer, size);
+    }
+
+private:
+    memory_source m_inner;
+    milliseconds m_delay;
+};
+
+/**
+ * Sink that takes its time over every write.
+ */
+class slow_sink : public transfer_sink
+{
+public:
+    explicit slow_sink(milliseconds delay) : m_delay(delay)
+    {
+    }
+
+    virtual void write(const char* data, size_t size)
+    {
+        boost::this_thread::sleep(m_delay);
+        written.append(data, size);
+    }
+
+    string written;
+
+private:
+    milliseconds m_delay;
+};
+
+class failing_source : public transfer_source
+{
+public:
+    failing_source() : m_reads(0)
+    {
+    }
+
+    virtual size_t read(char* buffer, size_t size)
+    {
+        if (++m_reads > 3)
+            throw runtime_error("disk on fire");
+
+        std::fill(buffer, buffer + size, 'x');
+        return size;
+    }
+
+private:
+    int m_reads;
+};
+
+/**
+ * Source that records which thread it was used on.
+ */
+class thread_recording_source : public memory_source
+{
+public:
+    explicit thread_recording_source(const string& data)
+        : memory_source(data)
+    {
+    }
+
+    virtual void reading_started()
+    {
+        started_on = boost::this_thread::get_id();
+    }
+
+    virtual void reading_finished()
+    {
+        finished_on = boost::this_thread::get_id();
+    }
+
+    thread::id started_on;
+    thread::id finished_on;
+};
+
+/**
+ * Sink that remembers where each write came from.
+ */
+class address_recording_sink : public transfer_sink
+{
+public:
+    virtual void write(const char* data, size_t size)
+    {
+        addresses.push_back(data);
+        written.append(data, size);
+    }
+
+    vector<const char*> addresses;
+    string written;
+};
+
+/**
+ * Sink that records which thread it was written on.
+ */
+class thread_recording_sink : public transfer_sink
+{
+public:
+    virtual void write(const char* data, size_t size)
+    {
+        written_on = boost::this_thread::get_id();
+        written.append(data, size);
+    }
+
+    virtual void finish()
+    {
+        finished_on = boost::this_thread::get_id();
+    }
+
+    string written;
+    thread::id written_on;
+    thread::id finished_on;
+};
+
+class failing_sink : public transfer_sink
+{
+public:
+    virtual void write(const char*, size_t)
+    {
+        throw runtime_error("network down");
+    }
+};
+
+void cancel_after(uintmax_t limit, uintmax_t so_far)
+{
+    if (so_far >= limit)
+        throw runtime_error("cancelled");
+}
+
+void record_progress(uintmax_t* last, uintmax_t so_far)
+{
+    BOOST_CHECK_GT(so_far, *last);
+    *last = so_far;
+}
+
+/**
+ * Temporary file deleted when the test ends.
+ */
+class temporary_file
+{
+public:
+    explicit temporary_file(const string& contents)
+        : m_path(boost::filesystem::temp_directory_path() /
+                 boost::filesystem::unique_path())
+    {
+        boost::filesystem::ofstream file(m_path, std::ios_base::binary);
+        file.write(contents.data(), contents.size());
+    }
+
+    ~temporary_file()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove(m_path, ec);
+    }
+
+    path file() const
+    {
+        return m_path;
+    }
+
+private:
+    path m_path;
+};
+}
+
+BOOST_AUTO_TEST_SUITE(transfer_tests)
+
+BOOST_AUTO_TEST_CASE(empty_source)
+{
+    transfer_engine engine;
+    memory_source source("", 0);
+    ostringstream output;
+    stream_sink sink(output);
+
+    transfer_statistics statistics = engine.transfer(source, sink);
+
+    BOOST_CHECK_EQUAL(output.str(), "");
+    BOOST_CHECK_EQUAL(statistics.bytes, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(memory_source_is_copied_exactly)
+{
+    // Small buffers so the ring wraps many times, and sizes either side of a
+    // whole number of buffers
+    transfer_engine engine(3, 1000);
+
+    size_t sizes[] = {1, 999, 1000, 1001, 3000, 123457};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        string data = test_data(sizes[i]);
+        memory_source source(data);
+        ostringstream output;
+        stream_sink sink(output);
+
+        transfer_statistics statistics = engine.transfer(source, sink);
+
+        BOOST_CHECK(output.str() == data);
+        BOOST_CHECK_EQUAL(statistics.bytes, sizes[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(file_source_is_copied_exactly)
+{
+    string data = test_data(200 * 1024 + 3);
+    temporary_file file(data);
+
+    transfer_engine engine;
+    file_source source(file.file());
+    ostringstream output;
+    stream_sink sink(output);
+
+    engine.transfer(source, sink);
+
+    BOOST_CHECK(output.str() == data);
+}
+
+BOOST_AUTO_TEST_CASE(mapped_file_source_is_copied_exactly)
+{
+    transfer_engine engine(3, 1000);
+
+    size_t sizes[] = {0, 1, 1000, 123457};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        string data = test_data(sizes[i]);
+        temporary_file file(data);
+
+        mapped_file_source source(file.file());
+        ostringstream output;
+        stream_sink sink(output);
+
+        transfer_statistics statistics = engine.transfer(source, sink);
+
+        BOOST_CHECK(output.str() == data);
+        BOOST_CHECK_EQUAL(statistics.bytes, sizes[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mapped_file_is_written_without_copying)
+{
+    string data = test_data(2500);
+    temporary_file file(data);
+
+    transfer_engine engine(2, 1000);
+    mapped_file_source source(file.file());
+    address_recording_sink sink;
+
+    engine.transfer(source, sink);
+
+    // Consecutive slices of the one mapping, not the engine's buffers
+    BOOST_REQUIRE_EQUAL(sink.addresses.size(), 3U);
+    BOOST_CHECK(sink.addresses[1] == sink.addresses[0] + 1000);
+    BOOST_CHECK(sink.addresses[2] == sink.addresses[0] + 2000);
+    BOOST_CHECK(sink.written == data);
+}
+
+BOOST_AUTO_TEST_CASE(mapped_file_larger_than_window_is_copied_exactly)
+{
+    size_t page = boost::interprocess::mapped_region::get_page_size();
+    string data = test_data(3 * page + 123);
+    temporary_file file(data);
+
+    // Slices that don't divide the window also cross from one to the next
+    transfer_engine engine(2, 1000);
+    mapped_file_source source(file.file(), 1);
+    ostringstream output;
+    stream_sink sink(output);
+
+    transfer_statistics statistics = engine.transfer(source, sink);
+
+    BOOST_CHECK(output.str() == data);
+    BOOST_CHECK_EQUAL(statistics.bytes, data.size());
+}
+
+BOOST_AUTO_TEST_CASE(mapped_file_can_also_be_read)
+{
+    string data = test_data(10);
+    temporary_file file(data);
+
+    mapped_file_source source(file.file());
+
+    char buffer[6];
+    BOOST_CHECK_EQUAL(source.read(buffer, sizeof(buffer)), 6U);
+    BOOST_CHECK_EQUAL(string(buffer, 6), data.substr(0, 6));
+    BOOST_CHECK_EQUAL(source.read(buffer, sizeof(buffer)), 4U);
+    BOOST_CHECK_EQUAL(string(buffer, 4), data.substr(6));
+    BOOST_CHECK_EQUAL(source.read(buffer, sizeof(buffer)), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(missing_file_fails_to_open)
+{
+    BOOST_CHECK_THROW(
+        file_source(boost::filesystem::temp_directory_path() /
+                    boost::filesystem::unique_path()),
+        boost::system::system_error);
+}
+
+BOOST_AUTO_TEST_CASE(reading_and_writing_overlap)
+{
+    // Ten buffers each taking 20ms to read and 20ms to write would take at
+    // least 400ms if done in turns but little over 200ms overlapped
+    transfer_engine engine(4, 100);
+    string data = test_data(1000);
+    slow_source source(data, milliseconds(20));
+    slow_sink sink(milliseconds(20));
+
+    transfer_statistics statistics = engine.transfer(source, sink);
+
+    BOOST_CHECK(sink.written == data);
+    BOOST_CHECK(statistics.elapsed < milliseconds(350));
+}
+
+BOOST_AUTO_TEST_CASE(slow_source_is_reported)
+{
+    transfer_engine engine(4, 100);
+    string data = test_data(1000);
+    slow_source source(data, milliseconds(20));
+    ostringstream output;
+    stream_sink sink(output);
+
+    transfer_statistics statistics = engine.transfer(source, sink);
+
+    BOOST_CHECK_EQUAL(statistics.bottleneck(), source_bound);
+}
+
+BOOST_AUTO_TEST_CASE(slow_sink_is_reported)
+{
+    transfer_engine engine(4, 100);
+    string data = test_data(1000);
+    memory_source source(data);
+    slow_sink sink(milliseconds(20));
+
+    transfer_statistics statistics = engine.transfer(source, sink);
+
+    BOOST_CHECK_EQUAL(statistics.bottleneck(), sink_bound);
+    BOOST_CHECK_GT(statistics.bytes_per_second(), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(source_hooks_run_on_reading_thread)
+{
+    transfer_engine engine;
+    thread_recording_source source(test_data(10));
+    ostringstream output;
+    stream_sink sink(output);
+
+    engine.transfer(source, sink);
+
+    BOOST_CHECK(source.started_on != thread::id());
+    BOOST_CHECK(source.started_on != boost::this_thread::get_id());
+    BOOST_CHECK(source.finished_on == source.started_on);
+}
+
+BOOST_AUTO_TEST_CASE(source_failure_is_rethrown)
+{
+    transfer_engine engine(2, 100);
+    failing_source source;
+    ostringstream output;
+    stream_sink sink(output);
+
+    BOOST_CHECK_THROW(engine.transfer(source, sink), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sink_failure_is_rethrown)
+{
+    transfer_engine engine(2, 100);
+    string data = test_data(100000);
+    memory_source source(data);
+    failing_sink sink;
+
+    BOOST_CHECK_THROW(engine.transfer(source, sink), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(progress_is_reported_after_each_write)
+{
+    transfer_engine engine(2, 100);
+    string data = test_data(1050);
+    memory_source source(data);
+    ostringstream output;
+    stream_sink sink(output);
+
+    uintmax_t last = 0;
+    engine.transfer(source, sink, boost::bind(&record_progress, &last, _1));
+
+    BOOST_CHECK_EQUAL(last, 1050U);
+}
+
+BOOST_AUTO_TEST_CASE(progress_can_cancel)
+{
+    transfer_engine engine(2, 100);
+    string data = test_data(100000);
+    memory_source source(data);
+    ostringstream output;
+    stream_sink sink(output);
+
+    BOOST_CHECK_THROW(
+        engine.transfer(source, sink, boost::bind(&cancel_after, 500, _1)),
+        runtime_error);
+    BOOST_CHECK_EQUAL(output.str().size(), 500U);
+
+    // The engine is still usable after a cancelled transfer
+    memory_source another_source(data);
+    ostringstream another_output;
+    stream_sink another_sink(another_output);
+    engine.transfer(another_source, another_sink);
+    BOOST_CHECK(another_output.str() == data);
+}
+
+BOOST_AUTO_TEST_CASE(reading_here_copies_exactly)
+{
+    transfer_engine engine(3, 1000);
+    string data = test_data(123457);
+    memory_source source(data);
+    ostringstream output;
+    stream_sink sink(output);
+
+    transfer_statistics statistics = engine.transfer_reading_here(source, sink);
+
+    BOOST_CHECK(output.str() == data);
+    BOOST_CHECK_EQUAL(statistics.bytes, data.size());
+}
+
+BOOST_AUTO_TEST_CASE(reading_here_writes_on_another_thread)
+{
+    transfer_engine engine(2, 100);
+    thread_recording_source source(test_data(1000));
+    thread_recording_sink sink;
+
+    engine.transfer_reading_here(source, sink);
+
+    BOOST_CHECK(source.started_on == boost::this_thread::get_id());
+    BOOST_CHECK(source.finished_on == boost::this_thread::get_id());
+    BOOST_CHECK(sink.written_on != thread::id());
+    BOOST_CHECK(sink.written_on != boost::this_thread::get_id());
+    BOOST_CHECK(sink.finished_on == sink.written_on);
+}
+
+BOOST_AUTO_TEST_CASE(reading_here_source_failure_is_rethrown)
+{
+    transfer_engine engine(2, 100);
+    failing_source source;
+    ostringstream output;
+    stream_sink sink(output);
+
+    BOOST_CHECK_THROW(engine.transfer_reading_here(source, sink),
+                      runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(reading_here_sink_failure_is_rethrown)
+{
+    transfer_engine engine(2, 100);
+    string data = test_data(100000);
+    memory_source source(data);
+    failing_sink sink;
+
+    BOOST_CHECK_THROW(engine.transfer_reading_here(source, sink),
+                      runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(reading_here_reports_progress)
+{
+    transfer_engine engine(2, 100);
+    string data = test_data(1050);
+    slow_source source(data, milliseconds(1));
+    ostringstream output;
+    stream_sink sink(output);
+
+    uintmax_t last = 0;
+    engine.transfer_reading_here(source, sink,
+                                 boost::bind(&record_progress, &last, _1));
+
+    BOOST_CHECK_EQUAL(last, 1050U);
+}
+
+BOOST_AUTO_TEST_CASE(reading_here_progress_can_cancel)
+{
+    transfer_engine engine(2, 100);
+    string data = test_data(100000);
+    slow_source source(data, milliseconds(1));
+    ostringstream output;
+    stream_sink sink(output);
+
+    BOOST_CHECK_THROW(engine.transfer_reading_here(
+                          source, sink, boost::bind(&cancel_after, 500, _1)),
+                      runtime_error);
+    BOOST_CHECK_LT(output.str().size(), data.size());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,90 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <ssh/detail/wire.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+using ssh::detail::wire_reader;
+using ssh::detail::wire_writer;
+
+using boost::system::system_error;
+
+using std::string;
+
+BOOST_AUTO_TEST_SUITE(wire_tests)
+
+BOOST_AUTO_TEST_CASE(integers_are_big_endian)
+{
+    wire_writer out;
+    out.put_uint32(0x01020304);
+
+    BOOST_CHECK_EQUAL(out.buffer(), string("\x01\x02\x03\x04", 4));
+}
+
+BOOST_AUTO_TEST_CASE(strings_are_length_prefixed)
+{
+    wire_writer out;
+    out.put_string("abc");
+
+    BOOST_CHECK_EQUAL(out.buffer(), string("\0\0\0\x03" "abc", 7));
+}
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+    wire_writer out;
+    out.put_uint8(0xFE)
+        .put_bool(true)
+        .put_uint32(0xDEADBEEF)
+        .put_uint64(0x0123456789ABCDEFULL)
+        .put_string(string("embedded\0null", 13))
+        .put_string("");
+
+    wire_reader in(out.buffer());
+    BOOST_CHECK_EQUAL(in.get_uint8(), 0xFE);
+    BOOST_CHECK(in.get_bool());
+    BOOST_CHECK_EQUAL(in.get_uint32(), 0xDEADBEEF);
+    BOOST_CHECK_EQUAL(in.get_uint64(), 0x0123456789ABCDEFULL);
+    BOOST_CHECK_EQUAL(in.get_string(), string("embedded\0null", 13));
+    BOOST_CHECK_EQUAL(in.get_string(), "");
+    BOOST_CHECK(in.empty());
+}
+
+BOOST_AUTO_TEST_CASE(truncated_integer)
+{
+    string message("\x01\x02\x03", 3);
+    wire_reader in(message);
+
+    BOOST_CHECK_THROW(in.get_uint32(), system_error);
+}
+
+/**
+ * A length prefix claiming more data than there is must not read beyond
+ * the message.
+ */
+BOOST_AUTO_TEST_CASE(truncated_string)
+{
+    wire_writer out;
+    out.put_uint32(100).put_raw("short", 5);
+
+    wire_reader in(out.buffer());
+    BOOST_CHECK_THROW(in.get_string(), system_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,202 @@
+// Copyright 2016 Alexander Lamaison
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <ssh/detail/write_back.hpp> // test subject
+
+#include <boost/cstdint.hpp> // uint64_t
+#include <boost/test/unit_test.hpp>
+
+#include <cstddef> // size_t
+#include <stdexcept> // runtime_error
+#include <string>
+#include <utility> // make_pair, pair
+#include <vector>
+
+using ssh::detail::dirty_ranges;
+
+using std::pair;
+using std::runtime_error;
+using std::size_t;
+using std::string;
+using std::vector;
+
+namespace
+{
+
+typedef vector<pair<boost::uint64_t, string>> written_ranges;
+
+/**
+ * Records what a flush sends, optionally failing part way through.
+ */
+class recording_writer
+{
+public:
+    explicit recording_writer(written_ranges& written, size_t fail_after = size_t(-1))
+        : m_written(&written), m_fail_after(fail_after)
+    {
+    }
+
+    void operator()(boost::uint64_t offset, const char* data, size_t size)
+    {
+        if (m_written->size() == m_fail_after)
+            throw runtime_error("write failed");
+
+        m_written->push_back(std::make_pair(offset, string(data, size)));
+    }
+
+private:
+    written_ranges* m_written;
+    size_t m_fail_after;
+};
+
+void write(dirty_ranges& dirty, boost::uint64_t offset, const string& data)
+{
+    dirty.write(offset, data.data(), data.size());
+}
+
+written_ranges flush(dirty_ranges& dirty)
+{
+    written_ranges written;
+    dirty.flush(recording_writer(written));
+    return written;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(write_back_tests)
+
+BOOST_AUTO_TEST_CASE(nothing_written_is_empty)
+{
+    dirty_ranges dirty;
+
+    BOOST_CHECK(dirty.empty());
+    BOOST_CHECK_EQUAL(dirty.bytes(), 0U);
+    BOOST_CHECK_EQUAL(dirty.end(), 0U);
+    BOOST_CHECK(flush(dirty).empty());
+}
+
+BOOST_AUTO_TEST_CASE(separate_writes_stay_separate)
+{
+    dirty_ranges dirty;
+    write(dirty, 10, "bbb");
+    write(dirty, 0, "aaa");
+
+    written_ranges written = flush(dirty);
+
+    BOOST_REQUIRE_EQUAL(written.size(), 2U);
+    BOOST_CHECK_EQUAL(written[0].first, 0U);
+    BOOST_CHECK_EQUAL(written[0].second, "aaa");
+    BOOST_CHECK_EQUAL(written[1].first, 10U);
+    BOOST_CHECK_EQUAL(written[1].second, "bbb");
+    BOOST_CHECK(dirty.empty());
+}
+
+BOOST_AUTO_TEST_CASE(adjacent_writes_merge)
+{
+    dirty_ranges dirty;
+    write(dirty, 0, "ab");
+    write(dirty, 2, "cd");
+    write(dirty, 4, "ef");
+
+    written_ranges written = flush(dirty);
+
+    BOOST_REQUIRE_EQUAL(written.size(), 1U);
+    BOOST_CHECK_EQUAL(written[0].first, 0U);
+    BOOST_CHECK_EQUAL(written[0].second, "abcdef");
+}
+
+BOOST_AUTO_TEST_CASE(later_write_wins_where_they_overlap)
+{
+    dirty_ranges dirty;
+    write(dirty, 0, "aaaaaa");
+    write(dirty, 2, "BB");
+
+    written_ranges written = flush(dirty);
+
+    BOOST_REQUIRE_EQUAL(written.size(), 1U);
+    BOOST_CHECK_EQUAL(written[0].second, "aaBBaa");
+}
+
+BOOST_AUTO_TEST_CASE(write_bridging_ranges_merges_them_all)
+{
+    dirty_ranges dirty;
+    write(dirty, 0, "aa");
+    write(dirty, 5, "bb");
+    write(dirty, 10, "cc");
+    write(dirty, 1, "XXXXXXXXXX");
+
+    BOOST_CHECK_EQUAL(dirty.bytes(), 12U);
+
+    written_ranges written = flush(dirty);
+
+    BOOST_REQUIRE_EQUAL(written.size(), 1U);
+    BOOST_CHECK_EQUAL(written[0].first, 0U);
+    BOOST_CHECK_EQUAL(written[0].second, "aXXXXXXXXXXc");
+}
+
+BOOST_AUTO_TEST_CASE(bytes_and_end_follow_merges)
+{
+    dirty_ranges dirty;
+    write(dirty, 100, "abc");
+    write(dirty, 101, "abc");
+
+    BOOST_CHECK_EQUAL(dirty.bytes(), 4U);
+    BOOST_CHECK_EQUAL(dirty.end(), 104U);
+}
+
+BOOST_AUTO_TEST_CASE(covers_only_whole_ranges)
+{
+    dirty_ranges dirty;
+    write(dirty, 10, "abcdef");
+    write(dirty, 20, "x");
+
+    BOOST_CHECK(dirty.covers(10, 6));
+    BOOST_CHECK(dirty.covers(12, 2));
+    BOOST_CHECK(!dirty.covers(9, 2));
+    BOOST_CHECK(!dirty.covers(15, 2));
+    BOOST_CHECK(!dirty.covers(10, 11));
+}
+
+BOOST_AUTO_TEST_CASE(overlay_copies_only_dirty_bytes)
+{
+    dirty_ranges dirty;
+    write(dirty, 2, "AB");
+    write(dirty, 7, "CDE");
+
+    string buffer = "........";
+    dirty.overlay(1, &buffer[0], buffer.size());
+
+    BOOST_CHECK_EQUAL(buffer, ".AB...CD");
+}
+
+BOOST_AUTO_TEST_CASE(failed_flush_keeps_unwritten_ranges)
+{
+    dirty_ranges dirty;
+    write(dirty, 0, "aa");
+    write(dirty, 10, "bb");
+
+    written_ranges written;
+    BOOST_CHECK_THROW(dirty.flush(recording_writer(written, 1)),
+                      runtime_error);
+
+    BOOST_CHECK_EQUAL(written.size(), 1U);
+    BOOST_CHECK_EQUAL(dirty.bytes(), 2U);
+
+    written_ranges retried = flush(dirty);
+    BOOST_REQUIRE_EQUAL(retried.size(), 1U);
+    BOOST_CHECK_EQUAL(retried[0].first, 10U);
+    BOOST_CHECK_EQUAL(retried[0].second, "bb");
+}
+
+BOOST_AUTO_TEST_SUITE_END()